@@ -1,27 +1,618 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <errno.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 
 
 // ====================================
 // Constants and Configurations
 // ====================================
-#define MAX_QUESTIONS 100  // Fixed number of questions in the question bank
+#define MAX_PLAYERS 1000000 // Most players one multiplayer game accepts
 #define TEST_DURATION 360  // Test duration in seconds (6 minutes)
+#ifndef QUESTION_DURATION
+#define QUESTION_DURATION 0 // Seconds allowed per question, 0 for no limit (build with -DQUESTION_DURATION=n)
+#endif
+#define QUIZ_SIZE 10       // Number of questions in one quiz
+#define BANK_FILE "questions.bank"   // Binary question bank opened at startup
+#define BANK_SOURCE "questions.txt"  // Question source the bank is built from
+#define BANK_COPY_NAME "mindmatch-bank" // Name of the memfd a server's copy of the bank is kept in
+#define BANK_VERSION 5               // Version of the binary bank format
+#define MAX_LINE_LENGTH 1024         // Longest line accepted in a question source file
+#define INPUT_BUFFER_SIZE 1024       // Console input held while waiting for the end of a line
+#define CONSOLE_OUTPUT_SIZE 16384    // Console output collected between two waits for input
+#define NAME_LENGTH 50               // Longest player name, including its terminator
+#define ARENA_BLOCK_SIZE 65536       // Size of the blocks an arena hands out memory from
+#define MAX_QUESTION_LENGTH 500      // Longest question text accepted when building a bank
+#define MAX_OPTION_LENGTH 200        // Longest answer option accepted when building a bank
+#define DEFAULT_DIFFICULTY 3         // Difficulty of questions without a "D:" line
+#define DIFFICULTY_LEVELS 5          // Difficulties run from 1 (easy) to 5 (hard)
+#define MAX_TAGS 64                  // Most distinct tags one bank may use
+#define MAX_QUERY_NODES 64           // Most tags and operators in one question query
+#define MAX_SHINGLES 1024            // Most word pairs compared per question (a full question has fewer)
+#define DUPLICATE_HASHES 32          // MinHash values worked out per question to find near duplicates
+#define DUPLICATE_BANDS 8            // LSH bands those values are split into
+#define DUPLICATE_SIMILARITY 60      // Percent of word pairs two questions must share to be near duplicates
+#define DUPLICATE_WINDOW 8           // Earlier questions in the same LSH bucket each question is checked against
+#define DUPLICATE_REPORT_LIMIT 50    // Duplicate groups listed one by one when a bank is built
+#define GENERATED_ID 0x80000000u     // Question ids with this bit set are made up by a generator
+#define GENERATED_SEED_BITS 28       // Low bits of a generated id that seed its generator
+#define GENERATED_TEXT_SIZE 192      // Room for the text of a generated question
+#define GENERATED_OPTION_SIZE 32     // Room for each option of a generated question
+#define PHRASE_CODE 0x80             // First byte of a phrase code in the string arena (bytes below stand for themselves)
+#define PHRASE_LONG 0xF0             // First byte of a two-byte phrase code
+#define PHRASE_LITERAL 0xFF          // Byte before a text byte of 0x80 or more
+#define PHRASE_ONE_BYTE 112          // Phrases with a one-byte code (PHRASE_LONG - PHRASE_CODE)
+#define PHRASE_MAX 3937              // Most phrases one bank may use (all the two-byte codes too)
+#define PHRASE_MIN_LENGTH 3          // Shortest phrase worth a code
+#define PHRASE_MAX_LENGTH 96         // Longest phrase
+#define PHRASE_SAMPLE_SIZE 262144    // Bytes of a bank's text the phrases are picked from
+#define PHRASE_ROUNDS 8              // Passes over that sample, each adding phrases for what is still uncovered
+#define PHRASE_CANDIDATES 1048576    // Most candidate phrases counted in one pass
+#define PHRASE_SLOTS 8192            // Hash slots used to look up phrases while compressing
+#define ADAPTIVE_GUESS 0.25          // Chance of guessing a four-option question right
+#define ADAPTIVE_LEVEL_STEP 1.0      // Ability, in logits, between two neighbouring difficulty levels
+#define ADAPTIVE_MIN_QUESTIONS 5     // Questions an adaptive quiz asks before it may stop early
+#define ADAPTIVE_STOP_ERROR 0.7      // Standard error of the ability estimate at which an adaptive quiz stops
+#define ADAPTIVE_GENERATED_TRIES 8   // Generated questions made up to find one of the wanted level
+#define CATEGORY_COUNT 3             // IQ Test, Math Quiz and English Quiz
+#define JOURNAL_MAGIC 0x314a4d4du    // "MMJ1" at the start of every journal block
+#define JOURNAL_BUFFER_SIZE 65536    // Journal records collected before they are written out as one block
+#define JOURNAL_FLUSH_MS 1000        // Longest the server keeps journal records before writing them
+#define ANALYTICS_MIN_ANSWERS 30     // Answers a question needs before item analysis flags it
+#define ANALYTICS_TOO_EASY 0.95      // Correct rate at or above which a question is flagged too easy
+#define ANALYTICS_TOO_HARD 0.25      // Correct rate at or below which a question is flagged too hard
+#define ANALYTICS_WRONG_KEY -0.05    // Discrimination at or below which a question may have the wrong key
+#define NORMS_FILE "mindmatch.norms" // Past performances that scores are compared with
+#define NORMS_MAGIC 0x314e4d4du      // "MMN1" at the start of a norms file
+#define NORMS_SAVE_MS 10000          // Longest the server keeps new sessions before saving the norms
+#define NORM_POPULATIONS (CATEGORY_COUNT * QUIZ_SIZE) // One population per category and quiz length
+#define NORM_MIN_SESSIONS 100        // Sessions a population needs before scores are compared with it
+#define NORM_TIME_WEIGHT 0.5         // Points a performance gains for finishing with all the time left
+#define SKETCH_COMPRESSION 200       // Quantile sketches keep fewer than twice this many centroids
+#define SKETCH_CENTROIDS (2 * SKETCH_COMPRESSION)
+#define SKETCH_PENDING 200           // Values a sketch collects before merging them into its centroids
+#define EXPOSURE_FILE "mindmatch.seen" // Questions each returning player has already been asked
+#define EXPOSURE_MAGIC 0x31534d4du    // "MMS1" at the start of an exposure file
+#define EXPOSURE_BITS 512            // Bits kept per player: one per question, or a Bloom filter for bigger banks
+#define EXPOSURE_HASHES 5            // Bits each question sets in a Bloom filter
+#define EXPOSURE_CAPACITY 50         // Questions a Bloom filter holds before it starts over (about 1% false positives)
+#define EXPOSURE_MIN_SLOTS 1024      // Player slots a new exposure file starts with
+#define EXPOSURE_DRAW_STEPS 64       // Most shuffle steps a draw takes looking for unseen questions
+#define CHECKPOINT_FILE "mindmatch.checkpoint" // Multiplayer game in progress, kept to pick it up after a crash
+#define CHECKPOINT_MAGIC 0x31434d4du  // "MMC1" at the start of a checkpoint file
+#define CHECKPOINT_SYNC_MS 1000      // Longest answers wait before the checkpoint is synced to disk
+#define CHECKPOINT_CHUNK 256         // Player records read or written at a time
+#define METRICS_SAVE_MS 10000        // How often the server rewrites the metrics file given with --metrics
+#define HISTOGRAM_SUB_BITS 3         // Latency histograms split each power of two into 8 buckets, so values are within 12.5%
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((65 - HISTOGRAM_SUB_BITS) * HISTOGRAM_SUB_BUCKETS) // Enough buckets for any 64-bit value
+#define METRIC_SAMPLE_EVERY 8        // Short pieces of work are timed one time in 8, a power of two
+#define TRACE_BUFFER_SPANS 4096      // Spans collected before they are written to the trace file
+#define IQ_MIN 40                    // Lowest and highest IQ a score is reported as
+#define IQ_MAX 160
+#define SERVER_INPUT_SIZE 256        // Longest command line a server client may send
+#define SERVER_OUTPUT_SIZE 4096      // Output a server client may fall behind by before it is dropped
+#define SERVER_ROOM_BUCKETS 4096     // Hash buckets used to find rooms by name
+#define SERVER_MAX_EVENTS 256        // Events handled per pass of the server loop
+#define SCOREBOARD_SIZE 10           // Players listed on a room's scoreboard
+#define SCOREBOARD_INTERVAL_MS 1000  // How often running rooms get a fresh scoreboard
+#define TIMER_SLOT_BITS 6            // Each timer wheel level has 64 slots
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+#define TIMER_LEVELS 5               // Levels of the timer wheel: 64^5 ms, about 12 days
 
 
 // ====================================
 // Data Structures
 // ====================================
 
-// Structure to store question data including text, options and correct answer
+// Binary bank file layout: a header, a table of sections, then the sections
+// themselves. All integers are stored in the host's byte order. Each field of
+// a question lives in its own dense array so that selecting and grading
+// questions only touches a few bytes per question, while the text sits in one
+// arena where every distinct string is stored once. The arena is compressed
+// with a table of phrases picked from the bank's own text when it is built,
+// and only the question about to be shown is decoded.
 typedef struct {
-    char question[200];         // The question text
-    char options[4][100];       // Array of four possible answer options
+    char magic[4];              // Always "MMQB"
+    uint32_t version;           // BANK_VERSION
+    uint32_t questionCount;     // Number of questions in the bank
+    uint32_t sectionCount;      // Number of entries in the section table
+} BankHeader;
+
+enum {
+    SECTION_TEXT = 1,           // uint32_t per question: offset of the question text
+    SECTION_OPTIONS = 2,        // uint32_t per question: index of its option set
+    SECTION_OPTION_SETS = 3,    // uint32_t[4] per distinct option set: offsets of the options
+    SECTION_CORRECT = 4,        // uint8_t per question: correct option (1-4)
+    SECTION_TAGS = 5,           // BankTag per tag, then one per difficulty level
+    SECTION_DIFFICULTY = 6,     // uint8_t per question: difficulty from 1 to 5
+    SECTION_STRINGS = 7,        // Interned strings as phrase codes and text bytes, NUL-terminated
+    SECTION_POSTINGS = 8,       // The questions of each tag, as id lists or bitsets
+    SECTION_PHRASES = 9,        // uint32_t count, count + 1 offsets, then the phrases back to back
+    SECTION_COUNT = 9
+};
+
+typedef struct {
+    uint32_t id;                // One of the SECTION_ values
+    uint32_t offset;            // Byte offset of the section from the start of the file
+    uint32_t size;              // Size of the section in bytes
+    uint32_t reserved;
+} BankSection;
+
+// Index entry saying which questions carry a tag. A tag few questions carry
+// keeps a sorted list of their ids, any other a bitset with one bit per
+// question (bit i % 64 of word i / 64), whichever is smaller. Queries combine
+// the bitsets a word at a time, so they never look at the questions themselves.
+typedef struct {
+    uint32_t name;              // Offset of the tag's name in the string arena
+    uint32_t kind;              // POSTING_IDS or POSTING_BITS
+    uint32_t offset;            // Byte offset of the ids or words inside the postings section
+    uint32_t count;             // Number of questions carrying the tag
+} BankTag;
+
+enum {
+    POSTING_IDS = 1,            // uint32_t id of each question, ascending
+    POSTING_BITS = 2            // uint64_t words, (questionCount + 63) / 64 of them
+};
+
+// A question bank attached to a mapped file (or any other read-only image)
+typedef struct {
+    const unsigned char *data;  // Start of the bank image
+    size_t size;                // Size of the bank image in bytes
+    int mapped;                 // Set when data came from mmap and must be unmapped
+    uint32_t count;             // Number of questions in the bank
+    uint32_t optionSetCount;    // Number of distinct option sets
+    const uint32_t *text;       // Offset of each question's text in the string arena
+    const uint32_t *optionSet;  // Option set used by each question
+    const uint32_t (*optionSets)[4]; // Offsets of the options of each option set
+    const uint8_t *correctOption;    // Correct option of each question (1-4)
+    const uint8_t *difficulty;       // Difficulty of each question (1-5)
+    const char *strings;        // String arena inside the image
+    uint32_t stringsSize;       // Size of the string arena in bytes
+    const uint32_t *phraseOffsets;   // Where each phrase starts, then where the last one ends
+    const char *phrases;        // The phrases the arena's codes stand for
+    uint32_t phraseCount;
+    const BankTag *tags;        // Tag index, followed by one entry per difficulty level
+    uint32_t tagCount;          // Tags in the index, not counting the difficulty levels
+    const unsigned char *postings;   // Id lists and bitsets the tag index points into
+    uint32_t postingsSize;
+} QuestionBank;
+
+// Structure to store question data including text, options and correct answer.
+// The text is not owned: it points into the QuestionText or GeneratedQuestion
+// the question was decoded or made up in.
+typedef struct {
+    const char *question;       // The question text
+    const char *options[4];     // Array of four possible answer options
     int correctOption;          // Index of the correct option (1-4)
 } Question;
 
+// Kinds of question a generator can make up, in the order of generatorTags
+enum {
+    GENERATOR_SEQUENCE,         // The next pair of numbers in a sequence
+    GENERATOR_RATIO,            // The ratio of two amounts in its simplest form
+    GENERATOR_MENTAL_MATH,      // Sums, products, fractions and percentages
+    GENERATOR_COUNT
+};
+
+// A question made up by a generator. The Question points into the buffers
+// beside it, so it is only valid while this struct stays where it is.
+typedef struct {
+    Question question;
+    int difficulty;             // From 1 (easy) to 5 (hard)
+    char text[GENERATED_TEXT_SIZE];
+    char options[4][GENERATED_OPTION_SIZE];
+} GeneratedQuestion;
+
+// Room a question is decoded from the bank into, or made up in when it is
+// generated. The Question returned points into it, so it must outlive it.
+typedef struct {
+    char question[MAX_QUESTION_LENGTH + 1];
+    char options[4][MAX_OPTION_LENGTH + 1];
+    GeneratedQuestion generated;
+} QuestionText;
+
+// PCG32 random number generator. Every game, session or room owns one and
+// seeds it explicitly, so the same seed always draws the same questions and
+// no state is shared between threads.
+typedef struct {
+    uint64_t state;
+    uint64_t increment;         // Selects the stream; always odd
+} Random;
+
+// The questions of one category or query: ids into the shared, read-only
+// bank. Quizzes are drawn from a view as a short list of ids, so no question
+// is ever copied no matter how many players take part.
+typedef struct {
+    const QuestionBank *bank;   // Bank the ids refer to
+    const uint32_t *ids;        // Ids of the questions in the category
+    int count;                  // Number of ids
+    uint32_t *owned;            // Id list allocated for the view, freed by freeQuestionView
+    int generated;              // Positions past count that stand for generated questions
+    int generatorEnd[GENERATOR_COUNT]; // Where each generator's share of those positions ends
+} QuestionView;
+
+// One version of the question bank with the views of its categories. The
+// server holds the newest version and every running quiz holds the version
+// it started with, each by one reference, so a reloaded bank replaces the
+// old one for new quizzes only. A version is freed once its last reference
+// is let go.
+typedef struct {
+    QuestionBank bank;
+    QuestionView views[CATEGORY_COUNT];
+    int references;
+    int ownsBank;               // Set when the bank was opened for this version and is closed with it
+    uint32_t version;           // 1 for the bank the server started with, counting up with each reload
+} BankSnapshot;
+
+
+// Progress of one player through one quiz. A session does no input or
+// output and uses no globals: the host shows sessionQuestion(), feeds the
+// player's answer and the current time to sessionAnswer(), and reads the
+// score once the state is no longer SESSION_ASKING. One thread can drive any
+// number of sessions, and sessions over the same bank can run on any thread.
+typedef enum {
+    SESSION_NOT_STARTED,        // Zeroed session, not yet started
+    SESSION_ASKING,             // Waiting for the answer to quiz[current]
+    SESSION_FINISHED,           // Every question answered, or ended early by the host
+    SESSION_TIMED_OUT           // The time limit ran out
+} SessionState;
+
+// Append-only record of quiz sessions: a file of blocks, each a JournalBlock
+// header and then fixed-size records. Records are collected in memory and
+// written a block at a time, so recording an answer costs a 16-byte copy.
+// Any number of runs of the game may append to the same file. A block that
+// was cut short or fails its checksum ends the journal when it is replayed.
+typedef struct {
+    uint32_t magic;             // JOURNAL_MAGIC
+    uint32_t run;               // Random number telling apart the runs that appended to the file
+    uint32_t size;              // Bytes of records after the header
+    uint32_t checksum;          // CRC-32 of run, size and the records
+} JournalBlock;
+
+enum {
+    JOURNAL_START = 1,          // option: category, index: questions, id: wall-clock seconds, ms: time limit
+    JOURNAL_QUESTION = 2,       // index: position in the quiz, id: question, ms: when shown, from the start
+    JOURNAL_ANSWER = 3,         // option: choice (0 for none) | JOURNAL_CORRECT, index, id, ms: time since shown
+    JOURNAL_END = 4,            // option: final SessionState, index: score, id: questions answered, ms: time taken
+    JOURNAL_CORRECT = 0x80      // Set in the option of an answer that was graded correct
+};
+
+typedef struct {
+    uint32_t session;           // Numbered from 1 in the order the run started them
+    uint8_t type;               // One of the JOURNAL_ values
+    uint8_t option;
+    uint16_t index;
+    uint32_t id;
+    uint32_t ms;
+} JournalRecord;
+
+typedef struct {
+    int fd;
+    uint32_t run;
+    uint32_t sessions;          // Sessions started so far by this run
+    int failed;                 // Set once a write fails; nothing more is recorded
+    size_t used;                // Bytes of records waiting after the block header
+    _Alignas(8) unsigned char buffer[JOURNAL_BUFFER_SIZE]; // Block header, then the waiting records
+} Journal;
+
+// Recorded answers laid out one array per field, for item analysis
+typedef struct {
+    uint32_t *item;             // Bank id, or bank count + generator kind for generated questions
+    uint8_t *choice;            // Option picked (0 for none), with JOURNAL_CORRECT if it was right
+    uint32_t *latencyMs;        // Time from showing the question to the answer
+    uint32_t *session;          // Index of the answer's session in score
+    size_t count;
+    size_t capacity;
+    int8_t *score;              // Final score of each session, -1 if it never ended
+    size_t sessions;
+    size_t sessionCapacity;
+} AnswerColumns;
+
+// What the answers to one question show about it
+typedef struct {
+    uint32_t answers;
+    uint32_t correct;
+    uint32_t picks[5];          // Times each option was picked, [0] for no answer
+    uint64_t restSum;           // Sum over answers of the rest of the quiz's score
+    uint64_t restSquares;
+    uint64_t restWhenCorrect;   // Sum of rest scores over the correct answers
+    uint64_t latencySum;
+    double correctRate;
+    double discrimination;      // Point-biserial correlation of being right with the rest score
+    double meanLatencyMs;
+} ItemStats;
+
+typedef struct {
+    double mean;
+    double weight;              // Number of values the centroid stands for
+} Centroid;
+
+// Merging t-digest: a summary of a stream of values that answers rank
+// queries in fixed space and merges with others of its kind
+typedef struct {
+    double total;               // Values added
+    double minimum;
+    double maximum;
+    uint32_t merged;            // Centroids in order of their means at the start of centroids
+    uint32_t pending;           // Values added after them since the last merge
+    Centroid centroids[SKETCH_CENTROIDS + SKETCH_PENDING];
+} QuantileSketch;
+
+// Past performances of each category and quiz length
+typedef struct {
+    QuantileSketch population[NORM_POPULATIONS]; // Every session known, including unsaved ones
+    QuantileSketch unsaved[NORM_POPULATIONS];    // Sessions added since the norms were last saved
+    const char *path;
+    int changed;                // Some sessions are not saved yet
+} Norms;
+
+// Start of a norms file, followed by NORM_POPULATIONS sketches
+typedef struct {
+    uint32_t magic;
+    uint32_t populations;
+    uint32_t sketchSize;
+} NormsHeader;
+
+// Questions one player has been asked. While the bank has at most
+// EXPOSURE_BITS questions, bit i stands for question i; for bigger banks the
+// bits are a Bloom filter, which may take an unseen question for a seen one
+// but never the other way round.
+typedef struct {
+    uint64_t player;            // Hash of the player's name, 0 for an empty slot of the file
+    uint32_t seen;              // Questions added since the set last started over
+    uint32_t bankCount;         // Questions in the bank the set was kept for
+    uint64_t bits[EXPOSURE_BITS / 64];
+} SeenSet;
+
+// Start of an exposure file, followed by a hash table of SeenSets found by
+// their player with linear probing
+typedef struct {
+    uint32_t magic;
+    uint32_t recordSize;
+    uint64_t slots;             // A power of two
+    uint64_t players;           // Slots in use
+} ExposureHeader;
+
+// A view's stored questions grouped by difficulty level, so an adaptive
+// quiz can pick a question of the level it wants in constant time
+typedef struct {
+    const QuestionView *view;
+    uint32_t *ids;              // The view's stored ids, level by level
+    uint32_t levelStart[DIFFICULTY_LEVELS + 1]; // Where each level's ids start, level 1 first
+} DifficultyIndex;
+
+// Running estimate of a player's ability, in logits around an average
+// player at 0
+typedef struct {
+    double ability;
+    double information;         // Fisher information so far, the prior's included
+} AbilityEstimate;
+
+// A quiz that picks each question once the previous one is answered
+typedef struct {
+    const DifficultyIndex *index;
+    Random *rng;
+    uint32_t *quiz;             // The session's question ids, filled in as they are picked
+    const SeenSet *seen;        // Questions the player was asked in earlier quizzes, or NULL
+    AbilityEstimate estimate;
+} AdaptiveQuiz;
+
+// How far a player of a multiplayer game got, as kept in the game's
+// checkpoint file after every answer
+typedef struct {
+    int32_t state;              // One of the CHECKPOINT_ states
+    int32_t answered;           // Questions answered so far
+    int32_t score;
+    int32_t timeMs;             // Time used so far, or the whole turn's once it is over
+    uint32_t correctMask;
+} CheckpointProgress;
+
+enum {
+    CHECKPOINT_WAITING,         // The player's turn has not started
+    CHECKPOINT_PLAYING,         // The player is part way through their turn
+    CHECKPOINT_DONE             // The player's turn is over
+};
+
+// Start of a checkpoint file: the game as it was set up. One record per
+// player follows, its progress first and then its name.
+typedef struct {
+    uint32_t magic;             // CHECKPOINT_MAGIC
+    uint32_t recordSize;        // Size of each player's record
+    uint64_t bankSize;          // Size and question count of the bank the quiz ids refer to
+    uint32_t bankCount;
+    int32_t category;
+    int32_t numQuestions;
+    int32_t numPlayers;
+    Random rng;                 // The game's generator once the quiz was drawn
+    uint32_t quiz[QUIZ_SIZE];
+} CheckpointHeader;
+
+// A multiplayer game kept in a checkpoint file while it is played
+typedef struct {
+    int fd;                     // The open file, locked so no other game uses it
+    const char *path;
+    int player;                 // Player whose turn it is
+    CheckpointProgress progress; // How far that player got before the game was cut short
+    long long syncedMs;         // When the file was last synced, on the host's clock
+    int failed;                 // Set once a write failed; nothing more is written after that
+} Checkpoint;
+
+typedef struct {
+    const QuestionBank *bank;   // Bank the quiz ids refer to
+    const uint32_t *quiz;       // Question ids, owned by the host
+    int numQuestions;
+    int current;                // Index of the question being asked (= questions answered)
+    int score;                  // Correct answers so far
+    SessionState state;
+    long long startMs;          // When the session started, on the host's clock
+    long long endMs;            // When the last answer was given or the session ended
+    long long timeLimitMs;      // Time allowed for the whole quiz
+    uint32_t correctMask;       // Bit i set if question i was answered correctly
+    Journal *journal;           // Where the session is recorded, or NULL
+    uint32_t journalSession;    // The session's number in the journal
+    Norms *norms;               // Norms the session counts towards once it ends, or NULL
+    int category;               // Category of the quiz once sessionRecord or sessionNorms is told it, else 0
+    AdaptiveQuiz *adaptive;     // Picks each next question, or NULL if the quiz was drawn up front
+    Checkpoint *checkpoint;     // Where the session's progress is kept after every answer, or NULL
+} QuizSession;
+
+// Memory handed out from large blocks and given back all at once. Used for
+// data that lives exactly as long as one game, such as its roster.
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t used;
+    size_t size;
+    _Alignas(16) unsigned char data[];
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock *blocks;         // Newest block first
+} Arena;
+
+// One player's entry in a multiplayer game
+typedef struct {
+    char name[NAME_LENGTH];
+    int score;
+    int timeTakenMs;
+} RosterEntry;
+
+// Everyone taking part in a multiplayer game, in the order they joined
+typedef struct {
+    Arena arena;                // Holds the entries and anything else sized by the player count
+    RosterEntry *players;
+    int count;
+} Roster;
+
+// A player's place in a ranking: better scores first, then shorter times,
+// then the player who joined first
+typedef struct {
+    int score;
+    int timeMs;
+    int player;                 // Index of the player in the host's own list
+} RankEntry;
+
+// Lines typed at the console. Input is read straight from the file
+// descriptor rather than through stdio so that a wait for the next line can
+// be given a deadline with poll().
+typedef struct {
+    int fd;
+    char buffer[INPUT_BUFFER_SIZE];
+    int length;                 // Bytes waiting in the buffer
+    int skipping;               // Dropping the rest of a line that was too long
+    int eof;                    // Set once the input has ended
+} LineReader;
+
+enum {
+    LINE_EOF = -1,              // readLine(): the input ended
+    LINE_TIMEOUT = -2           // readLine(): no complete line before the deadline
+};
+
+// A deadline kept in a TimerWheel. Timers are embedded in whatever they time,
+// so arming and cancelling one never allocates.
+typedef struct Timer {
+    struct Timer *next;
+    struct Timer *prev;
+    struct Timer **list;        // List the timer is on, or NULL while it is not armed
+    long long expiresMs;        // When the timer fires, on the host's clock
+    void *owner;                // Set by the host to find its way back from a fired timer
+    int kind;                   // One of the TIMER_ values
+} Timer;
+
+enum {
+    TIMER_QUIZ_DEADLINE,        // A quiz's TEST_DURATION ran out
+    TIMER_QUESTION_DEADLINE,    // A question's QUESTION_DURATION ran out
+    TIMER_SCOREBOARD,           // A room is due a fresh scoreboard
+    TIMER_JOURNAL_FLUSH,        // Journal records have waited JOURNAL_FLUSH_MS
+    TIMER_NORMS_SAVE,           // Finished sessions have waited NORMS_SAVE_MS to be saved
+    TIMER_METRICS_SAVE          // The metrics file is METRICS_SAVE_MS old
+};
+
+// Hierarchical timing wheel. Level 0 has a slot for each of the next 64
+// milliseconds and every level above has slots 64 times wider than the one
+// below. A timer sits in the lowest level that reaches its deadline and moves
+// down as the levels below wrap around, so arming, cancelling and firing a
+// timer take constant time however many timers are outstanding.
+typedef struct {
+    long long nowMs;            // Last millisecond the wheel has processed
+    int count;                  // Armed timers, including fired ones not yet collected
+    uint64_t occupied[TIMER_LEVELS]; // One bit for each non-empty slot
+    Timer *slots[TIMER_LEVELS][TIMER_SLOTS];
+    Timer *expired;             // Timers that have fired and wait to be collected
+} TimerWheel;
+
+// Events counted while the game runs, written out with --metrics
+enum {
+    COUNTER_SESSIONS_STARTED,
+    COUNTER_SESSIONS_COMPLETED,     // Every question was answered
+    COUNTER_SESSIONS_TIMED_OUT,     // The quiz ran out of time
+    COUNTER_SESSIONS_ABANDONED,     // The player left or the input ended first
+    COUNTER_ANSWERS_CORRECT,
+    COUNTER_ANSWERS_MISSED,         // A question's time ran out before it was answered
+    COUNTER_CONNECTIONS,            // Clients the server accepted
+    COUNTER_BANK_RELOADS,           // New versions of the bank the server switched to
+    COUNTER_COUNT
+};
+
+// Durations measured while the game runs, written out with --metrics
+enum {
+    HISTOGRAM_BANK_LOAD,            // Nanoseconds to open the question bank
+    HISTOGRAM_QUESTION_RENDER,      // Nanoseconds to look up a question and format it for the player
+    HISTOGRAM_ANSWER_TIME,          // Milliseconds from a question to its answer, one histogram per category
+    HISTOGRAM_SESSION_TIME = HISTOGRAM_ANSWER_TIME + CATEGORY_COUNT, // Milliseconds a session lasted, per category
+    HISTOGRAM_COUNT = HISTOGRAM_SESSION_TIME + CATEGORY_COUNT
+};
+
+// Log-linear histogram in the style of HdrHistogram. Values below
+// HISTOGRAM_SUB_BUCKETS have a bucket each and every power of two above
+// them is split into HISTOGRAM_SUB_BUCKETS equal buckets, so any value is
+// kept to within 12.5% and recording one is a couple of increments.
+typedef struct {
+    uint64_t sum;               // Of every value recorded
+    uint64_t max;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+} Histogram;
+
+typedef struct {
+    uint64_t counters[COUNTER_COUNT];
+    Histogram histograms[HISTOGRAM_COUNT];
+    uint32_t samples;           // Short pieces of work started, for picking the ones that are timed
+} Metrics;
+
+// A piece of work that has finished, kept until the trace is written out
+typedef struct {
+    const char *name;
+    long long startNs;
+    long long durationNs;
+} TraceSpan;
+
+typedef struct {
+    FILE *file;                 // Where the spans go, or NULL while tracing is off
+    long long openedNs;         // When the trace was opened, which its times count from
+    int count;                  // Spans waiting to be written
+    TraceSpan spans[TRACE_BUFFER_SPANS];
+} Trace;
+
 
 // ====================================
 // Function Declarations
@@ -32,60 +623,528 @@ void greet();                                                  // Displays welco
 int getCategory();                                            // Gets user's preferred category (IQ Test/Math Quiz/English Quiz)
 int getGameMode();                                            // Gets user's preferred game mode (Solo/1v1/Multiplayer)
 void getPlayerNames(char player1[], char player2[], int mode); // Gets names of participating players
-void getMultiplePlayerNames(char names[][50], int numPlayers); // Gets names for multiple players
-void playMultiplayer(int numQuestions, Question questions[], int totalQuestions, char names[][50], int numPlayers, int category); // Handles multiplayer gameplay
+void getMultiplePlayerNames(Roster *roster);                   // Gets names for multiple players
+int readLine(LineReader *reader, char line[], int size, int timeoutMs); // Reads one line, waiting at most timeoutMs (-1 = forever)
+int parseChoice(const char *line, int min, int max);           // Parses a line holding just a number in a range
+int readChoice(int min, int max, int fallback);                // Reads a number typed on its own line
+void readName(char name[], int size, const char *fallback);    // Reads a player name
+int renderQuestion(const Question *q, char text[], int size);  // Formats a question, its options and the prompt
+void playMultiplayer(const QuestionView *view, int numQuestions, Roster *roster, int category, Random *rng); // Handles multiplayer gameplay
+void resumeMultiplayer(const QuestionBank *bank, const CheckpointHeader *header, Roster *roster,
+                       Checkpoint *checkpoint);                 // Picks up a multiplayer game that was cut short
+
+// Question Bank Functions
+int buildQuestionBank(const char *sourcePath, const char *bankPath, int collapseDuplicates); // Converts a question source file into a bank file
+int attachQuestionBank(QuestionBank *bank, const unsigned char *data, size_t size); // Validates a bank image and attaches to it
+int openQuestionBank(QuestionBank *bank, const char *path);                     // Maps a bank file read-only
+int copyQuestionBank(QuestionBank *bank, const char *path);                     // Reads a bank file into memory of its own
+void closeQuestionBank(QuestionBank *bank);                                      // Unmaps a bank file
+Question bankQuestion(const QuestionBank *bank, uint32_t id, QuestionText *scratch); // Decodes one question of the bank
+int queryQuestions(const QuestionBank *bank, const char *query, QuestionView *view,
+                   char error[], int errorSize);                                 // Builds the view of the questions a tag query selects
+int queryWithGenerators(const QuestionBank *bank, const char *query, QuestionView *view,
+                        char error[], int errorSize);                            // Same, with generated questions standing in for stored ones
+int generateQuestion(uint32_t id, GeneratedQuestion *out);                       // Makes up the question a generated id stands for
+Question quizQuestion(const QuestionBank *bank, uint32_t id, QuestionText *scratch); // Returns a stored or generated question
+int quizCorrectOption(const QuestionBank *bank, uint32_t id);                    // Correct option of a stored or generated question
+int quizDifficulty(const QuestionBank *bank, uint32_t id);                       // Difficulty of a stored or generated question
+
+// Roster Functions
+void *arenaAlloc(Arena *arena, size_t size);                   // Allocates from an arena, or NULL
+void arenaRelease(Arena *arena);                               // Frees everything allocated from an arena
+int rosterCreate(Roster *roster, int count);                   // Allocates a roster of count unnamed players
+void rosterRelease(Roster *roster);                            // Frees a roster
+
+// Quiz Session Functions
+void sessionStart(QuizSession *session, const QuestionBank *bank, const uint32_t *quiz, int numQuestions,
+                  long long nowMs, long long timeLimitMs);          // Starts a session at the first question
+long sessionQuestion(const QuizSession *session);                   // Id of the question to show, or -1 when over
+int sessionAnswer(QuizSession *session, int answer, long long nowMs); // Grades an answer and moves on
+SessionState sessionCheckTime(QuizSession *session, long long nowMs); // Times the session out once its limit passes
+void sessionEnd(QuizSession *session, long long nowMs);              // Ends a session before every question is answered
+long long sessionTimeTaken(const QuizSession *session);             // Milliseconds the player used
+void sessionRecord(QuizSession *session, Journal *journal, int category); // Records a started session and its events in a journal
+void sessionNorms(QuizSession *session, Norms *norms, int category); // Counts a started session towards the norms once it ends
+void sessionCheckpoint(QuizSession *session, Checkpoint *checkpoint); // Keeps a started session's progress in a checkpoint
+double sessionPerformance(const QuizSession *session);              // Difficulty-weighted score with a bonus for time left
+const char *iqBand(int score, int *iqMin, int *iqMax);               // IQ range and label for a 10-question score
+
+// Adaptive Quiz Functions
+int buildDifficultyIndex(DifficultyIndex *index, const QuestionView *view); // Groups a view's questions by difficulty
+void freeDifficultyIndex(DifficultyIndex *index);                   // Releases a difficulty index
+double levelDifficulty(int level);                                  // Difficulty of a level on the ability scale
+double itemInformation(double ability, double difficulty);          // What an answer tells about a player of that ability
+void abilityStart(AbilityEstimate *estimate);                       // Starts an estimate at the average player
+void abilityUpdate(AbilityEstimate *estimate, double difficulty, int correct); // Moves an estimate after one answer
+double abilityError(const AbilityEstimate *estimate);               // Standard error of an estimate
+int adaptiveStart(AdaptiveQuiz *adaptive, const DifficultyIndex *index, const SeenSet *seen,
+                  uint32_t quiz[], Random *rng);                    // Picks the first question
+void sessionAdapt(QuizSession *session, AdaptiveQuiz *adaptive);    // Lets a started session pick its questions as it goes
+const char *iqLabel(int iq);                                         // Label of the IQ range an IQ falls in
+
+// Journal Functions
+int journalOpen(Journal *journal, const char *path);                // Opens a journal file for appending
+void journalWrite(Journal *journal, const JournalRecord *record);   // Adds a record, writing a block once the buffer fills
+int journalFlush(Journal *journal);                                 // Writes the waiting records as one block
+int journalClose(Journal *journal);                                 // Flushes and closes a journal
+int replayJournal(const QuestionBank *bank, const char *path, FILE *output); // Replays every recorded session through the scoring code
+
+// Item Analytics Functions
+int loadAnswerColumns(const QuestionBank *bank, const char *path, AnswerColumns *columns); // Reads a journal's answers into columns
+void freeAnswerColumns(AnswerColumns *columns);                     // Releases the columns
+int aggregateAnswers(const AnswerColumns *columns, ItemStats stats[], size_t itemCount); // Works out every question's statistics
+void writeItemStats(const QuestionBank *bank, const ItemStats stats[], size_t itemCount, FILE *output); // Writes the statistics as CSV
+int analyzeJournal(const QuestionBank *bank, const char *path, FILE *output); // Reads a journal and writes its item statistics
+
+// Norms Functions
+void sketchAdd(QuantileSketch *sketch, double value, double weight); // Adds a value to a quantile sketch
+void sketchMerge(QuantileSketch *sketch, const QuantileSketch *other); // Adds everything in another sketch
+double sketchRank(QuantileSketch *sketch, double x);               // Fraction of the values below x
+int normsOpen(Norms *norms, const char *path);                      // Loads the norms kept in a file
+void normsAdd(Norms *norms, int category, int numQuestions, double performance); // Counts a finished session
+long normsScore(Norms *norms, int category, int numQuestions, double performance, double *percentile, int *iq); // Percentile and IQ of a performance
+int normsSave(Norms *norms);                                        // Merges the new sessions into the norms file
+int normsMergeFile(Norms *norms, const char *path);                 // Adds the sessions of another norms file
+
+// Exposure Functions
+int seenContains(const SeenSet *set, uint32_t id);                  // Whether the player may have been asked a question
+void seenAdd(SeenSet *set, uint32_t id);                            // Remembers that the player was asked a question
+int drawUnseenQuiz(const QuestionView *view, uint32_t quiz[], int numQuestions, SeenSet *set,
+                   Random *rng);                                    // Picks questions the player has not been asked yet
+int seenLoad(const char *path, const QuestionBank *bank, const char *playerName, SeenSet *set); // Finds a player's questions in an exposure file
+int seenSave(const char *path, const SeenSet *set);                 // Stores a player's questions in an exposure file
+
+// Checkpoint Functions
+int checkpointStart(Checkpoint *checkpoint, const char *path, const QuestionBank *bank, const Roster *roster,
+                    int category, const uint32_t quiz[], int numQuestions, const Random *rng); // Writes the checkpoint of a new game
+int checkpointResume(Checkpoint *checkpoint, const char *path, const QuestionBank *bank, CheckpointHeader *header,
+                     Roster *roster);                               // Reads back a game that was cut short
+void checkpointUpdate(Checkpoint *checkpoint, const QuizSession *session, long long nowMs); // Writes the current player's progress
+void checkpointClose(Checkpoint *checkpoint);                       // Lets go of a checkpoint, keeping its file
+void checkpointFinish(Checkpoint *checkpoint);                      // Removes the checkpoint of a game that is over
+
+// Metrics Functions
+void histogramRecord(Histogram *histogram, uint64_t value, uint64_t weight); // Adds a value to a histogram weight times
+uint64_t histogramCount(const Histogram *histogram);                // Values a histogram holds
+uint64_t histogramQuantile(const Histogram *histogram, double q);   // Value a share q of the values are at or below
+int traceOpen(const char *path);                                    // Starts writing spans to a trace file
+void traceSpan(const char *name, long long startNs);                // Records a span that started at startNs and ends now
+int traceClose();                                                   // Writes the waiting spans and closes the trace file
+int writeMetrics(const char *path);                                 // Writes the metrics as Prometheus text, or JSON for a .json path
+
+// Timer Functions
+void timerWheelInit(TimerWheel *wheel, long long nowMs);            // Starts an empty wheel at the given time
+void timerArm(TimerWheel *wheel, Timer *timer, long long expiresMs); // Sets (or moves) a timer's deadline
+void timerCancel(TimerWheel *wheel, Timer *timer);                  // Disarms a timer if it is armed
+Timer *timerExpire(TimerWheel *wheel, long long nowMs);             // Next timer due by nowMs, or NULL
+long long timerNextExpiry(const TimerWheel *wheel);                 // When the next timer may be due, or -1
 
 // Game Logic Functions
-void loadQuestions(Question questions[], int *totalQuestions, int category); // Loads question bank into memory
-int playSolo(int numQuestions, Question questions[], int totalQuestions, char playerName[], int *timeTaken, int category); // Handles solo gameplay
-void play1v1(int numQuestions, Question questions[], int totalQuestions, char player1[], char player2[], int category); // Manages 1v1 gameplay
-int askQuestion(Question q);                    // Presents question and validates answer
+long long monotonicMs();                                                      // Milliseconds from a clock that never jumps
+long long monotonicNs();                                                      // Nanoseconds from the same clock
+int loadQuestions(const QuestionBank *bank, int category, int generated, QuestionView *view); // Builds the view of a category's questions
+void freeQuestionView(QuestionView *view);                                  // Releases the ids held by a view
+void randomSeed(Random *rng, uint64_t seed, uint64_t stream);               // Starts a generator from a seed
+uint32_t randomNext(Random *rng);                                             // Next 32 random bits
+uint32_t randomBelow(Random *rng, uint32_t bound);                            // Unbiased number from 0 to bound - 1
+int drawQuiz(const QuestionView *view, uint32_t quiz[], int numQuestions, Random *rng); // Picks random question ids for one quiz
+int playSolo(const QuestionBank *bank, const uint32_t quiz[], int numQuestions, AdaptiveQuiz *adaptive,
+             SeenSet *seen, Checkpoint *checkpoint, char playerName[], int *timeTakenMs,
+             int category);                                                   // Handles solo gameplay
+void play1v1(const QuestionView *view, int numQuestions, char player1[], char player2[], int category, Random *rng); // Manages 1v1 gameplay
+int askQuestion(QuizSession *session, TimerWheel *timers); // Presents the session's question and waits for the answer until a timer fires
 
 // Results and Scoring Functions
-void declareWinner(char player1[], char player2[], int score1, int score2, int timeTaken1, int timeTaken2); // Determines winner in 1v1 mode
-void displayIQScore(char playerName[], int score, int totalQuestions); // Calculates and shows IQ score
+int findWinner(const int scores[], const int times[], int numPlayers, int useTime); // Index of the winner, or -1 for a tie
+void rankAll(RankEntry entries[], int count);                  // Sorts a whole ranking
+int rankTop(RankEntry entries[], int count, int k);            // Puts just the best k in order at the front
+int rankedWinner(const RankEntry ranked[], int count, int useTime); // 0 if the first of a ranking won outright, else -1
+void declareWinner(char player1[], char player2[], int score1, int score2, int timeTakenMs1, int timeTakenMs2); // Determines winner in 1v1 mode
+void displayIQScore(char playerName[], const QuizSession *session); // Calculates and shows IQ score
+
+// Batch Mode Functions
+int runBatch(const QuestionBank *bank, const char *scriptPath, int generated, Journal *journal, Norms *norms,
+             FILE *output);                                     // Plays every session of a script without prompts
+
+// Bank Version Functions
+BankSnapshot *snapshotCreate(const QuestionBank *bank, int generated); // Makes a bank the first version, with its category views
+BankSnapshot *snapshotOpen(const char *path, int generated);   // Opens a bank file as a new version
+BankSnapshot *snapshotAcquire(BankSnapshot *snapshot);         // Takes one more reference to a version
+void snapshotRelease(BankSnapshot *snapshot);                  // Lets go of a reference, freeing the version after the last
+
+// Server Functions
+int runServer(const QuestionBank *bank, const char *bankPath, const char *address, int generated, Journal *journal,
+              Norms *norms, uint64_t seed);                     // Hosts multiplayer rooms over the network
+
+
+// Journal the games are recorded in, set with --journal
+static Journal *gameJournal = NULL;
+
+// Norms the scores are compared with, unless started with --no-norms
+static Norms *gameNorms = NULL;
+
+// File the questions each solo player was asked are kept in, unless
+// started with --no-exposures
+static const char *gameExposures = NULL;
+
+// File a multiplayer game is kept in while it is played, unless started
+// with --no-checkpoint
+static const char *gameCheckpoint = NULL;
+
+// Counters and histograms of everything the game has done so far, and the
+// file they are written to, set with --metrics
+static Metrics gameMetrics;
+static const char *gameMetricsPath = NULL;
+
+// Spans of work written to the file given with --trace
+static Trace gameTrace;
+
+// Instrumentation used throughout the game. Building with
+// -DMINDMATCH_NO_METRICS compiles all of it out, clock reads included.
+// Work too short to afford two clock reads each time is timed with
+// METRIC_SAMPLE and METRIC_SAMPLED: one time in METRIC_SAMPLE_EVERY, counted
+// that many times over.
+#ifndef MINDMATCH_NO_METRICS
+#define METRIC_COUNT(counter) (gameMetrics.counters[counter]++)
+#define METRIC_RECORD(histogram, value) histogramRecord(&gameMetrics.histograms[histogram], (uint64_t)(value), 1)
+#define METRIC_CLOCK() monotonicNs()
+#define METRIC_SAMPLE() ((++gameMetrics.samples & (METRIC_SAMPLE_EVERY - 1)) == 0 ? monotonicNs() : 0LL)
+#define METRIC_SAMPLED(histogram, startNs) ((startNs) != 0 ? histogramRecord(&gameMetrics.histograms[histogram], \
+    (uint64_t)(monotonicNs() - (startNs)), METRIC_SAMPLE_EVERY) : (void)0)
+#define TRACE_START() (gameTrace.file != NULL ? monotonicNs() : 0LL)
+#define TRACE_SPAN(name, startNs) (gameTrace.file != NULL ? traceSpan(name, startNs) : (void)0)
+#else
+#define METRIC_COUNT(counter) ((void)0)
+#define METRIC_RECORD(histogram, value) ((void)(histogram), (void)(value))
+#define METRIC_CLOCK() 0LL
+#define METRIC_SAMPLE() 0LL
+#define METRIC_SAMPLED(histogram, startNs) ((void)(histogram), (void)(startNs))
+#define TRACE_START() 0LL
+#define TRACE_SPAN(name, startNs) ((void)(startNs))
+#endif
+
+// Bank image generated from questions.txt by bankgen (see README.md)
+#ifdef MINDMATCH_BAKED_BANK
+#include "bank_table.h"
+#endif
 
 
 // ====================================
 // Main Program Entry Point
 // ====================================
-int main() {
+#ifndef MINDMATCH_NO_MAIN
+int main(int argc, char *argv[]) {
+    // Build a bank file from a question source and exit
+    if ((argc == 4 || (argc == 5 && strcmp(argv[4], "--collapse-duplicates") == 0))
+        && strcmp(argv[1], "--build-bank") == 0) {
+        if (buildQuestionBank(argv[2], argv[3], argc == 5) != 0) {
+            return 1;
+        }
+        printf("Question bank written to %s\n", argv[3]);
+        return 0;
+    }
+
+    // Other options: a bank file to play with, or a script to run in batch mode
+    const char *bankPath = NULL;
+    const char *batchScript = NULL;
+    const char *serverAddress = NULL;
+    const char *seedText = NULL;
+    const char *questionQuery = NULL;
+    const char *journalPath = NULL;
+    const char *replayPath = NULL;
+    const char *analyzePath = NULL;
+    const char *normsPath = NORMS_FILE;
+    const char *mergeNormsPath = NULL;
+    const char *exposuresPath = EXPOSURE_FILE;
+    const char *checkpointPath = CHECKPOINT_FILE;
+    const char *metricsPath = NULL;
+    const char *tracePath = NULL;
+    int generated = 0;
+    int adaptive = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batchScript = argv[++i];
+        } else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc) {
+            serverAddress = argv[++i];
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seedText = argv[++i];
+        } else if (strcmp(argv[i], "--questions") == 0 && i + 1 < argc) {
+            questionQuery = argv[++i];
+        } else if (strcmp(argv[i], "--generated") == 0) {
+            generated = 1;
+        } else if (strcmp(argv[i], "--adaptive") == 0) {
+            adaptive = 1;
+        } else if (strcmp(argv[i], "--journal") == 0 && i + 1 < argc) {
+            journalPath = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayPath = argv[++i];
+        } else if (strcmp(argv[i], "--analyze") == 0 && i + 1 < argc) {
+            analyzePath = argv[++i];
+        } else if (strcmp(argv[i], "--norms") == 0 && i + 1 < argc) {
+            normsPath = argv[++i];
+        } else if (strcmp(argv[i], "--no-norms") == 0) {
+            normsPath = NULL;
+        } else if (strcmp(argv[i], "--merge-norms") == 0 && i + 1 < argc) {
+            mergeNormsPath = argv[++i];
+        } else if (strcmp(argv[i], "--exposures") == 0 && i + 1 < argc) {
+            exposuresPath = argv[++i];
+        } else if (strcmp(argv[i], "--no-exposures") == 0) {
+            exposuresPath = NULL;
+        } else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+            checkpointPath = argv[++i];
+        } else if (strcmp(argv[i], "--no-checkpoint") == 0) {
+            checkpointPath = NULL;
+        } else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+            metricsPath = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else if (argv[i][0] != '-' && bankPath == NULL) {
+            bankPath = argv[i];
+        } else {
+            fprintf(stderr, "Usage: %s [bank file] [--seed n] [--questions query] [--generated] [--adaptive]\n"
+                            "                  [--journal file] [--norms file | --no-norms]\n"
+                            "                  [--exposures file | --no-exposures]\n"
+                            "                  [--checkpoint file | --no-checkpoint]\n"
+                            "                  [--metrics file] [--trace file]\n"
+                            "                  [--batch script | --server port|unix:path]\n"
+                            "       %s [bank file] --replay <journal>\n"
+                            "       %s [bank file] --analyze <journal>\n"
+                            "       %s [--norms file] --merge-norms <norms file>\n"
+                            "       %s --build-bank <source> <bank file> [--collapse-duplicates]\n",
+                    argv[0], argv[0], argv[0], argv[0], argv[0]);
+            return 2;
+        }
+    }
+
+    // What the game does is counted and timed, and written to the file
+    // given with --metrics when it ends, or every METRICS_SAVE_MS by a server
+#ifdef MINDMATCH_NO_METRICS
+    if (metricsPath != NULL || tracePath != NULL) {
+        fprintf(stderr, "This build has no metrics (it was built with -DMINDMATCH_NO_METRICS).\n");
+        metricsPath = tracePath = NULL;
+    }
+#endif
+    gameMetricsPath = metricsPath;
+
+    // Scores are compared with the sessions in the norms file given with
+    // --norms, or NORMS_FILE. Those kept elsewhere can be merged into it.
+    static Norms norms;
+    if (normsPath != NULL && replayPath == NULL && analyzePath == NULL) {
+        if (normsOpen(&norms, normsPath) == 0) {
+            gameNorms = &norms;
+        } else if (mergeNormsPath == NULL) {
+            fprintf(stderr, "Scores will not be compared with earlier games.\n");
+        }
+    }
+    if (mergeNormsPath != NULL) {
+        if (gameNorms == NULL || normsMergeFile(gameNorms, mergeNormsPath) != 0 || normsSave(gameNorms) != 0) {
+            return 1;
+        }
+        printf("Norms from %s merged into %s\n", mergeNormsPath, normsPath);
+        return 0;
+    }
+
+    // Open the question bank, building it from the source file on first run
+    long long loading = METRIC_CLOCK();
+    QuestionBank bank;
+    int loaded = 0;
+#ifdef MINDMATCH_BAKED_BANK
+    // The bank compiled into the program is used unless a bank file is given
+    loaded = bankPath == NULL && attachQuestionBank(&bank, bakedBank, sizeof(bakedBank)) == 0;
+#endif
+    if (!loaded && openQuestionBank(&bank, bankPath ? bankPath : BANK_FILE) != 0) {
+        if (bankPath != NULL || buildQuestionBank(BANK_SOURCE, BANK_FILE, 0) != 0
+            || openQuestionBank(&bank, BANK_FILE) != 0) {
+            fprintf(stderr, "Could not load the question bank '%s'.\n", bankPath ? bankPath : BANK_FILE);
+            return 1;
+        }
+    }
+    METRIC_RECORD(HISTOGRAM_BANK_LOAD, METRIC_CLOCK() - loading);
+
+    // A journal given with --replay is played again and checked, then the program exits
+    if (replayPath != NULL) {
+        int status = replayJournal(&bank, replayPath, stdout);
+        closeQuestionBank(&bank);
+        return status < 0 ? 1 : status;
+    }
+
+    // A journal given with --analyze has its answers summed up per question, then the program exits
+    if (analyzePath != NULL) {
+        int status = analyzeJournal(&bank, analyzePath, stdout);
+        closeQuestionBank(&bank);
+        return status < 0 ? 1 : status;
+    }
+
+    // Every session played from here on is recorded in the journal given with --journal
+    static Journal journal;
+    if (journalPath != NULL) {
+        if (journalOpen(&journal, journalPath) != 0) {
+            closeQuestionBank(&bank);
+            return 1;
+        }
+        gameJournal = &journal;
+    }
+
+    // Batch mode plays a whole script without asking anything
+    if (batchScript != NULL) {
+        int status = runBatch(&bank, batchScript, generated, gameJournal, gameNorms, stdout);
+        if (gameJournal != NULL && journalClose(gameJournal) != 0 && status == 0) {
+            status = 1;
+        }
+        if (gameNorms != NULL && normsSave(gameNorms) != 0 && status == 0) {
+            status = 1;
+        }
+        if (gameMetricsPath != NULL && writeMetrics(gameMetricsPath) != 0 && status == 0) {
+            status = 1;
+        }
+        closeQuestionBank(&bank);
+        return status < 0 ? 1 : status;
+    }
+
+    // Solo players' questions are remembered in the exposure file given
+    // with --exposures, or EXPOSURE_FILE
+    gameExposures = exposuresPath;
+
+    // Solo games and each question asked in them are traced to the file
+    // given with --trace
+    if (tracePath != NULL && traceOpen(tracePath) != 0) {
+        closeQuestionBank(&bank);
+        return 1;
+    }
+
+    // Seed for question shuffling: given with --seed to replay a game,
+    // otherwise taken from the clock
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t seed = seedText ? strtoull(seedText, NULL, 10)
+                             : (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+
+    // Server mode hosts multiplayer rooms until it is stopped
+    if (serverAddress != NULL) {
+        runServer(&bank, loaded ? NULL : bankPath ? bankPath : BANK_FILE, serverAddress, generated, gameJournal,
+                  gameNorms, seed);
+        closeQuestionBank(&bank);
+        return 1;
+    }
+
+    // A tag query given with --questions replaces the category's questions
+    QuestionView view;
+    if (questionQuery != NULL) {
+        char error[128];
+        int failed = generated ? queryWithGenerators(&bank, questionQuery, &view, error, sizeof(error))
+                               : queryQuestions(&bank, questionQuery, &view, error, sizeof(error));
+        if (failed != 0 || view.count + view.generated == 0) {
+            fprintf(stderr, "No questions for '%s': %s\n", questionQuery,
+                    view.ids ? "no question matches" : error);
+            freeQuestionView(&view);
+            closeQuestionBank(&bank);
+            return 2;
+        }
+    }
+
     // Initialize random number generator for question shuffling
-    srand(time(0)); 
+    Random rng;
+    randomSeed(&rng, seed, 0);
+
+    // Output is flushed each time the game waits for input, so everything
+    // shown between two answers reaches the terminal in one write
+    static char consoleOutput[CONSOLE_OUTPUT_SIZE];
+    setvbuf(stdout, consoleOutput, _IOFBF, sizeof(consoleOutput));
 
     // Display welcome screen
     greet(); 
+    printf("Game seed: %llu (start with --seed %llu to get the same questions again)\n\n",
+           (unsigned long long)seed, (unsigned long long)seed);
+
+    // A multiplayer game is kept in the checkpoint file given with
+    // --checkpoint, or CHECKPOINT_FILE, while it is played. One that was cut
+    // short can be picked up again, and is otherwise replaced by the next.
+    gameCheckpoint = checkpointPath;
+    Checkpoint checkpoint;
+    CheckpointHeader setup;
+    Roster players;
+    if (gameCheckpoint != NULL && checkpointResume(&checkpoint, gameCheckpoint, &bank, &setup, &players) == 0) {
+        printf("A multiplayer game of %d players was cut short during %s's turn.\n", setup.numPlayers,
+               checkpoint.player < players.count ? players.players[checkpoint.player].name : "the results");
+        printf("Pick it up where it stopped? (1 - Yes, 2 - No): ");
+        if (readChoice(1, 2, 2) == 1) {
+            resumeMultiplayer(&bank, &setup, &players, &checkpoint);
+            rosterRelease(&players);
+            if (gameJournal != NULL) {
+                journalClose(gameJournal);
+            }
+            if (gameNorms != NULL) {
+                normsSave(gameNorms);
+            }
+            if (gameMetricsPath != NULL) {
+                writeMetrics(gameMetricsPath);
+            }
+            traceClose();
+            closeQuestionBank(&bank);
+            return 0;
+        }
+        checkpointClose(&checkpoint);
+        rosterRelease(&players);
+    }
 
     // Get game configuration
     int category = getCategory();
     int mode = getGameMode();
-    int quizSize = 10;             // Set fixed quiz length
+    int quizSize = QUIZ_SIZE;      // Set fixed quiz length
 
-    // Initialize question bank
-    Question questions[MAX_QUESTIONS];
-    int totalQuestions = 0;
-    loadQuestions(questions, &totalQuestions, category);
+    // Select the category's questions from the bank
+    if (questionQuery == NULL && loadQuestions(&bank, category, generated, &view) != 0) {
+        fprintf(stderr, "Could not load the questions.\n");
+        closeQuestionBank(&bank);
+        return 1;
+    }
 
     // Handle different game modes
     if (mode == 1) { // Solo Play
-        char player1[50];
+        char player1[NAME_LENGTH];
         printf("\nEnter your name: ");
-        scanf(" %[^\n]", player1);
+        readName(player1, sizeof(player1), "Player 1");
         int timeTaken;
-        playSolo(quizSize, questions, totalQuestions, player1, &timeTaken, category);
+        uint32_t quiz[QUIZ_SIZE];
+
+        // A returning player is given questions they have not been asked yet
+        SeenSet seen;
+        SeenSet *tracked = NULL;
+        if (gameExposures != NULL) {
+            if (seenLoad(gameExposures, &bank, player1, &seen) == 0) {
+                tracked = &seen;
+            } else {
+                fprintf(stderr, "Questions from earlier games may come up again.\n");
+            }
+        }
+        if (adaptive) {
+            // With --adaptive each question is picked to suit the answers so far
+            DifficultyIndex index;
+            AdaptiveQuiz adaptiveQuiz;
+            if (buildDifficultyIndex(&index, &view) != 0) {
+                fprintf(stderr, "Not enough memory for an adaptive quiz.\n");
+            } else {
+                int numQuestions = adaptiveStart(&adaptiveQuiz, &index, tracked, quiz, &rng);
+                playSolo(&bank, quiz, numQuestions, &adaptiveQuiz, tracked, NULL, player1, &timeTaken, category);
+                freeDifficultyIndex(&index);
+            }
+        } else {
+            int numQuestions = tracked ? drawUnseenQuiz(&view, quiz, quizSize, tracked, &rng)
+                                       : drawQuiz(&view, quiz, quizSize, &rng);
+            playSolo(&bank, quiz, numQuestions, NULL, tracked, NULL, player1, &timeTaken, category);
+        }
     } 
     else if (mode == 2) { // Challenge a Friend
-        char player1[50], player2[50];
+        char player1[NAME_LENGTH], player2[NAME_LENGTH];
         printf("\nEnter Player 1's name: ");
-        scanf(" %[^\n]", player1);
+        readName(player1, sizeof(player1), "Player 1");
         printf("Enter Player 2's name: ");
-        scanf(" %[^\n]", player2);
-        play1v1(quizSize, questions, totalQuestions, player1, player2, category);
+        readName(player2, sizeof(player2), "Player 2");
+        play1v1(&view, quizSize, player1, player2, category, &rng);
     }
     else { // Challenge Multiple Friends
-        int numPlayers;
         printf("\nHow many players will participate? ");
-        scanf("%d", &numPlayers);
+        int numPlayers = readChoice(2, MAX_PLAYERS, 0);
         
         // Validate number of players
         if (numPlayers < 2) {
@@ -93,13 +1152,31 @@ int main() {
             numPlayers = 2;
         }
         
-        char playerNames[numPlayers][50];
-        getMultiplePlayerNames(playerNames, numPlayers);
-        playMultiplayer(quizSize, questions, totalQuestions, playerNames, numPlayers, category);
+        Roster roster;
+        if (rosterCreate(&roster, numPlayers) != 0) {
+            fprintf(stderr, "Not enough memory for %d players.\n", numPlayers);
+        } else {
+            getMultiplePlayerNames(&roster);
+            playMultiplayer(&view, quizSize, &roster, category, &rng);
+            rosterRelease(&roster);
+        }
     }
 
+    freeQuestionView(&view);
+    if (gameJournal != NULL) {
+        journalClose(gameJournal);
+    }
+    if (gameNorms != NULL) {
+        normsSave(gameNorms);
+    }
+    if (gameMetricsPath != NULL) {
+        writeMetrics(gameMetricsPath);
+    }
+    traceClose();
+    closeQuestionBank(&bank);
     return 0;
 }
+#endif
 
 
 // ====================================
@@ -115,664 +1192,6693 @@ void greet() {
 
 // Gets and validates user's category selection
 int getCategory() {
-    int category;
-
     printf("Select Category:\n");
     printf("1 - IQ Test\n");
     printf("2 - Math Quiz\n");
     printf("3 - English Quiz\n");
     printf("Enter your choice: ");
-    scanf("%d", &category);
 
     // Input validation - defaults to IQ if invalid
-    return (category >= 1 && category <= 3) ? category : 1;
+    return readChoice(1, 3, 1);
 }
 
 // Gets and validates user's game mode selection
 int getGameMode() {
-    int mode;
-
     printf("\nSelect Game Mode:\n");
     printf("1 - Solo Play\n");
     printf("2 - Challenge a Friend\n");
     printf("3 - Challenge Multiple Friends\n");
     printf("Enter your choice: ");
-    scanf("%d", &mode);
 
     // Input validation - defaults to Solo mode if invalid
-    return (mode >= 1 && mode <= 3) ? mode : 1;
+    return readChoice(1, 3, 1);
 }
 
 // Collects player names with input validation
 void getPlayerNames(char player1[], char player2[], int mode) {
     if (mode == 1) {
         printf("\nEnter your name: ");
-        scanf(" %[^\n]", player1);
+        readName(player1, NAME_LENGTH, "Player 1");
     } else {
         printf("\nEnter Player 1's name: ");
-        scanf(" %[^\n]", player1);
+        readName(player1, NAME_LENGTH, "Player 1");
         printf("Enter Player 2's name: ");
-        scanf(" %[^\n]", player2);
+        readName(player2, NAME_LENGTH, "Player 2");
     }
 }
 
 // Gets names for multiple players
-void getMultiplePlayerNames(char names[][50], int numPlayers) {
-    for (int i = 0; i < numPlayers; i++) {
+void getMultiplePlayerNames(Roster *roster) {
+    for (int i = 0; i < roster->count; i++) {
+        char fallback[24];
+        snprintf(fallback, sizeof(fallback), "Player %d", i + 1);
         printf("Enter Player %d's name: ", i + 1);
-        scanf(" %[^\n]", names[i]);
+        readName(roster->players[i].name, NAME_LENGTH, fallback);
     }
 }
 
+// Console input shared by every prompt
+static LineReader console = {STDIN_FILENO};
 
-void loadQuestions(Question questions[], int *totalQuestions, int category) {
-    // First, load all questions into the array
-    *totalQuestions = 100;
-    
-    // ====================================
-    // Vocabulary & Word Meaning Questions
-    // ====================================
-    Question q1 = {"Which word does not have a similar meaning to 'imaginary'?", {"inconsistent", "fictional", "illusive", "apocryphal"}, 1};
-    Question q2 = {"Which word does not have a similar meaning to 'fatigued'?", {"enervated", "strength", "tired","exhaustion" }, 2};
-    Question q3 = {"Which word does not have a similar meaning to 'beautiful'?", {"elegant", "stunning","grotesque" , "exquisite"}, 3};
-    Question q4 = {"Find two words, one from each group, that are closest in meaning: Group A: Confused, enraged, terrified Group B: Calm, trance, incensed",
-     {"confused and calm", "terrified and trance", "enraged and calm" ,"enraged and incensed"}, 4};
-
-    Question q5 = {"Which word means 'having been deserted or left'?", {"abandoned", "deluded", "truant", "mindful"}, 1};
-    Question q6 = {"Which word can be used to describe the part of the body that contains all structures between the chest and pelvis?",
-     { "pleural","abdominal", "articular", "wreathed"}, 2};
-    Question q7 = {"Which word is most similar in meaning to 'betraying'?", {"faithful", "loyal","treacherous" , "steadfast"}, 3};
-    Question q8 = {"Which word means 'a lack of generosity or willingness to share'?", {"altruistic", "bountiful", "charitable","miserly" }, 4};
-
-    Question q9 = {"Which word means 'to damage or destroy secretly'?", {"sabotaged", "repaired", "enhanced", "constructed"}, 1};
-    Question q10 = {"Which word means 'the act of thinking deeply or carefully about something'?", { "dismissal","deliberation", "ignorance", "neglect"}, 2};
-    Question q11 = {"Which word means 'the act of giving up or surrendering something'?", {"persistence", "resistance","abandonment" , "defiance"}, 3};
-    Question q12 = {"Which word does not have a similar meaning to 'honorable'?", {"ethical", "principled", "moral", "deceitful"}, 4};
-
-    Question q13 = {"What is the opposite of 'believable'?", {"incredulous", "plausible", "credible", "trustworthy"}, 1};
-    Question q14 = {"Which word means 'a person who gives disapproval'?", {"admirer", "critic", "supporter", "advocate"}, 2};
-    Question q15 = {"Which word does not belong with the others?", {"spaghetti", "macaroni", "pancake", "pasta"}, 3};
-    Question q16 = {"Which word means 'acceptable, fair, or good enough'?", {"unacceptable", "inadequate", "insufficient", "satisfactory"}, 4};
-
-    Question q17 = {"What is the opposite of 'respectful'?", {"disrespectful", "considerate", "polite", "courteous"}, 1};
-    Question q18 = {"Which word means 'a sense of pride or pleasure'?", {"disappointment", "satisfaction", "frustration", "dissatisfaction"}, 2};
-    Question q19 = {"Which word does not mean 'something that can be questioned'?", {"disputable", "debatable", "certainty", "questionable"}, 3};
-    Question q20 = {"Which word means 'ethical, fair, and principled'?", {"dishonest", "corrupt", "unethical", "honourable"}, 4};
-
-    Question q21 = {"Which word means 'the process of carefully considering something before making a decision'?",
-     {"contemplation", "impulsiveness", "recklessness", "haste"}, 1};
-    Question q22 = {"Which word means 'the act of giving freely without expecting anything in return'?", {"stinginess", "generosity", "selfishness", "greed"}, 2};
-    Question q23 = {"Which word does not have a similar meaning to 'belittle'?", {"criticise", "downgrade", "overrate", "discredit"}, 3};
-    Question q24 = {"Which word means 'a sense of pride or pleasure derived from achievement'?", {"disappointment", "frustration", "dissatisfaction", "satisfaction"}, 4};
-    
-    Question q25 = {"Which word does not have a similar meaning to 'important'?", {"miniature", "significant", "imperative", "of substance"}, 1};
-
-    // ====================================
-    // Grammar Questions
-    // ====================================
-    Question q26 = {"Which sentence is grammatically correct?", 
-     {"We regret to be in contact with you shortly.", "We will be in contact with you shortly.",
-      "Shortly, we will be in contract with you.", "Will be in contract with you shortley."}, 2};
-    Question q27 = {"Which sentence is grammatically correct?", 
-     {"I wishes you the very best of luck.", "Our holiday as been postponed.", 
-     "It is difficult to understand my teacher.", "The Government are implementing a new law today."}, 3};
-    Question q28 = {"Which sentence is grammatically correct?", 
-    {"Every days he bring me flowers.","Every days he brings me flower.",
-     "Every day he bringing me flowers.",  "Every day he brings me flowers."}, 4};
-
-    Question q29 = {"Choose the grammatically correct option:", 
-    {"Prior to the airplane taking off, the pilot informs about safety procedures.", "The pilot the helicopter back to basecamp due terrential winds.",
-     "Prior to the airplane taking off, the informs about safety.", "The pilot navigate the plane through stormy weather."}, 1};
-    Question q30 = {"Which sentence is grammatically correct?", 
-    {"The firefighter service are more than just putting out fires.", "The firefighter service is more than just putting out fires.", 
-    "Firefighters service is more than just putting out fire.", "The firefighters service is more than just putting out fires."}, 2};
-    Question q31 = {"Which sentence is grammatically correct?", 
-     {"The queen are bout to give a speech.", "The queen was about too give a speech.", "The queen is about to give a speech.", "The queen will giving a speech."}, 3};
-    Question q32 = {"Identify the grammatically correct sentence:", 
-    {"Every day he bring me flowers.", "Every days he brings me flower.", "Every day he bringing me flowers.", "Every day he brings me flowers."}, 4};
-
-    Question q33 = {"Which combination of words can be inserted into the sentence? 'We regret to inform you that your application was ____________.'", 
-     {"unsuccessful", "success", "succeeding", "succeed"}, 1};
-    Question q34 = {"Which sentence is grammatically correct?", 
-     {"The fire departments provides emergency services.", "The fire department provides emergency services.", 
-     "Fire departments provide emergency services.", "The fire department are providing emergency services."}, 2};
-    Question q35 = {"Which sentence is grammatically correct?", 
-     {"The police has new suspect.", "The police as a new lead.", "The police have a new suspect.", "The police not have any leads to go on."}, 3};
-    Question q36 = {"Insert the correct combination of words into the sentence: 'Law is the system of rules, guidelines, and conducts established by the ______ government that maintains a safe and stable society.'",
-     {"generous", "friendly", "vulgar", "sovereign"}, 4};
-
-    Question q37 = {"Which combination of words completes the sentence correctly? 'A lawyer is a person that is learned in law; whether that be as an ______, counsel, or solicitor.'",
-     {"attorney", "generous", "friendly", "vulgar"}, 1};
-    Question q38 = {"Which combination of words can be inserted into the sentence? 'We are pleased to inform you that your application has been ____________.'",
-     {"rejected", "accepted", "pending", "reviewed"}, 2};
-    Question q39 = {"Which sentence is grammatically correct?",
-     {"She always bring me coffee in the morning.", "She always bringing me coffee in the morning.",
-      "She always brings me coffee in the morning.", "She always brings me coffee in the mornings."}, 3};
-    Question q40 = {"Which sentence is grammatically correct?", 
-     {"The police departments maintains public safety.", "Police departments maintain public safety.",
-      "The police department are maintaining public safety.", "The police department maintains public safety."}, 4};
-
-    // ====================================
-    // Number Sequence Questions
-    // ====================================
-    Question q41 = {"Look carefully for the pattern, and then choose which pair of numbers comes next: 1, 4, 9, 16, 25, 36, 49", {"64, 81", "63, 74", "51, 80", "54, 63"}, 1};
-    Question q42 = {"What comes next in this sequence? 0, 1, 1, 2, 3, 5, 8", {"12, 18", "13, 21", "15, 25", "15, 23"}, 2};
-    Question q43 = {"What is the next pair in the sequence? 27, 25, 87, 23, 21, 87, 19", {"16, 87", "87, 17" , "17, 87", "16, 13"}, 3};
-    Question q44 = {"Complete the sequence: 1, 3, 7, 15, 31, 63, 127", {"220, 440", "136, 210", "187, 316", "255, 511"}, 4};
-
-    Question q45 = {"What comes next? 1, 3, 6, 10, 15, 21, 28", {"36, 45", "42, 56", "42, 48", "30, 36"}, 1};
-    Question q46 = {"Look carefully for the pattern, and then choose which pair of numbers comes next: 2, 4, 8, 16, 32, 64", {"120, 240", "128, 256", "130, 260", "140, 280"}, 2};
-    Question q47 = {"Look carefully for the pattern, and then choose which pair of numbers comes next: 1, 4, 9, 16, 25, 36", {"45, 60", "50, 65", "49, 64", "55, 70"}, 3};
-    Question q48 = {"Look carefully for the pattern, and then choose which pair of numbers comes next: 1, 3, 6, 10, 15, 21", {"25, 30", "30, 40", "35, 45", "28, 36"}, 4};
-
-    Question q49 = {"Look carefully for the pattern, and then choose which pair of numbers comes next: 2, 5, 10, 17, 26, 37", {"50, 65", "45, 60", "55, 70", "60, 75"}, 1};
-    Question q50 = {"Look carefully for the pattern, and then choose which pair of numbers comes next: 1, 2, 4, 7, 11, 16", {"20, 25", "22, 29", "25, 30", "30, 35"}, 2};
-    Question q51 = {"Look carefully for the pattern, and then choose which pair of numbers comes next: 3, 6, 12, 24, 48, 96", {"180, 360", "200, 400", "192, 384", "220, 440"}, 3};
-    Question q52 = {"Look carefully for the pattern, and then choose which pair of numbers comes next: 1, 5, 13, 29, 61, 125", {"250, 500", "260, 520", "270, 540", "253, 509"}, 4};
-
-    Question q53 = {"Look carefully for the pattern, and then choose which pair of numbers comes next: 1, 4, 9, 16, 25, 36", {"49, 64", "45, 60", "50, 65", "55, 70"}, 1};
-    Question q54 = {"Look carefully for the pattern, and then choose which pair of numbers comes next: 2, 6, 12, 20, 30, 42", {"50, 60", "56, 72", "60, 70", "70, 80"}, 2};
-    Question q55 = {"Look carefully for the pattern, and then choose which pair of numbers comes next: 1, 3, 7, 15, 31, 63", {"120, 240", "130, 260", "127, 255", "140, 280"}, 3};
-
-    // ====================================
-    // Ratio Questions
-    // ====================================
-  Question q56 = {"Peter has £15.20, and Jim has £20.80. What is the ratio of Peter's money to Jim's money in its simplest form?", {"15:20", "38:52", "10:13", "19:26"}, 4};
-
-Question q57 = {"A newspaper includes 16 pages of sport and 8 pages of TV. What is the ratio of sport to TV?", {"2:1", "1:2", "4:1", "3:1"}, 1};  
-Question q58 = {"A magazine includes 24 pages of fashion and 8 pages of lifestyle. What is the ratio of fashion to lifestyle?", {"2:1", "3:1", "1:3", "4:1"}, 2};  
-Question q59 = {"A book contains 240 pages for its novel and 24 pages for introductions and summaries. What is the ratio of novel pages to introductions and summaries?", 
-{"5:1", "20:1", "10:1", "1:10"}, 3}; 
-Question q60 = {"A school has to mark 180 English papers and 170 Maths papers. What is the ratio of English papers to Maths papers?", {"17:18", "9:8", "10:9", "18:17"}, 4};
-
-Question q61 = {"A class has 12 boys and 18 girls. What is the ratio of boys to girls in its simplest form?", {"2:3", "3:2", "4:6", "6:9"}, 1};  
-Question q62 = {"A bag contains 8 red marbles and 12 blue marbles. What is the ratio of red to blue marbles in its simplest form?", {"2:3", "3:2", "4:6", "6:9"}, 2};  
-Question q63 = {"A recipe uses 2 cups of flour and 3 cups of sugar. What is the ratio of flour to sugar in its simplest form?", {"4:6", "3:2", "2:3", "6:9"}, 3}; 
-Question q64 = {"A garden has 15 roses and 25 tulips. What is the ratio of roses to tulips in its simplest form?", {"9:15", "5:3", "6:10", "3:5"}, 4}; 
-
-Question q65 = {"A box contains 20 apples and 30 oranges. What is the ratio of apples to oranges in its simplest form?", {"2:3", "3:2", "4:6", "6:9"}, 1};  
-Question q66 = {"A school has 24 teachers and 36 students. What is the ratio of teachers to students in its simplest form?", {"2:3", "3:2", "4:6", "6:9"}, 2};  
-Question q67 = {"A store has 16 shirts and 24 pants. What is the ratio of shirts to pants in its simplest form?", {"4:6", "3:2", "2:3", "6:9"}, 3}; 
-Question q68 = {"A park has 18 trees and 27 bushes. What is the ratio of trees to bushes in its simplest form?", {"6:9", "3:2", "4:6", "2:3"}, 4};  
-
-Question q69 = {"A zoo has 20 lions and 30 tigers. What is the ratio of lions to tigers in its simplest form?", {"2:3", "3:2", "4:6", "6:9"}, 1}; 
-Question q70 = {"A farm has 14 cows and 21 sheep. What is the ratio of cows to sheep in its simplest form?", {"2:3", "3:2", "4:6", "6:9"}, 2};  
-    // ====================================
-    // General Knowledge Questions
-    // ====================================
-Question q71 = {"What is the capital of France?", {"Lyon", "Marseille", "Paris", "Bordeaux"}, 3};
-Question q72 = {"Which planet is known as the Red Planet?", {"Venus", "Jupiter", "Saturn", "Mars"}, 4};
-
-Question q73 = {"Who wrote 'Hamlet'?", {"William Shakespeare", "Charles Dickens", "Mark Twain", "Jane Austen"}, 1};
-Question q74 = {"What is the chemical symbol for water?", {"CO₂", "H₂O", "O₂", "NaCl"}, 2};
-Question q75 = {"Which element has the atomic number 1?", {"Helium", "Oxygen", "Hydrogen", "Carbon"}, 3};
-
-    // ====================================
-    // Mental Math Questions
-    // ====================================
-Question q76 = {"What is 8 multiplied by 6?", {"42", "54", "60", "48"}, 4};
-
-Question q77 = {"What is 4 multiplied by 7?", {"28", "24", "32", "36"}, 1};
-Question q78 = {"What is 6 multiplied by 9?", {"48", "54", "52", "60"}, 2};
-Question q79 = {"What is 9 multiplied by 9?", {"72", "84", "81", "90"}, 3};
-Question q80 = {"What is 8 multiplied by 7?", {"54", "63", "64", "56"}, 4};
-
-Question q81 = {"What is 12 multiplied by 6?", {"72", "66", "60", "78"}, 1};
-Question q82 = {"What is 13 multiplied by 7?", {"84", "91", "81", "96"}, 2};
-Question q83 = {"What is 3/4 of 80 plus 1/5 of 75?", {"65", "85", "75", "95"}, 3};
-Question q84 = {"Subtract 1/3 of 90 from 2/5 of 150.", {"20","50", "40",  "30"}, 4};
-
-Question q85 = {"Multiply 1/2 of 48 by 3/4 of 20.", {"360", "420", "480", "540"}, 1};
-Question q86 = {"What is 25% of 240 minus 15% of 120?", {"36",  "42","48", "54"}, 2};
-Question q87 = {"Add 3/8 of 64 to 5/6 of 36.", {"48", "60", "54", "66"}, 3};
-Question q88 = {"What is 7/10 of 120 minus 2/5 of 50?", {"56", "80", "72", "64"}, 4};
-
-Question q89 = {"Divide 3/4 of 144 by 2/3 of 36.", {"5", "3", "4", "6"}, 1};
-Question q90 = {"Multiply 5/6 of 72 by 2/3 of 45.", {"1350", "1800", "1500", "1650"}, 2};
-Question q91 = {"What is 40% of 180 plus 60% of 120?", {"120", "168", "144", "192"}, 3};
-Question q92 = {"Subtract 1/4 of 200 from 3/5 of 250.", {"80", "140", "120", "100"}, 4};
-
-Question q93 = {"What is 5/8 of 160 plus 3/10 of 100?", {"130", "120", "140", "150"}, 1};
-Question q94 = {"Add 2/3 of 90 to 4/5 of 75.", {"110", "120", "130", "140"}, 2};
-Question q95 = {"Multiply 3/4 of 80 by 5/6 of 36.", {"600", "540", "1800", "660"}, 3};
-Question q96 = {"What is 15% of 300 minus 10% of 150?", {"25", "30", "35", "40"}, 4};
-
-Question q97 = {"Divide 7/10 of 200 by 1/2 of 40.", {"7", "6", "8", "9"}, 1};
-Question q98 = {"What is 3/4 of 108 plus 2/5 of 65?", {"105", "100", "110", "107"}, 2};
-Question q99 = {"Add 3/7 of 63 to 2/3 of 45.", {"60", "55", "65", "57"}, 3};
-Question q100 = {"Subtract 1/4 of 140 from 2/3 of 450.", {"250", "270", "280", "265"}, 4};
-
-    // Assign all questions to the array
-    questions[0] = q1;
-    questions[1] = q2;
-    questions[2] = q3;
-    questions[3] = q4;
-    questions[4] = q5;
-    questions[5] = q6;
-    questions[6] = q7;
-    questions[7] = q8;
-    questions[8] = q9;
-    questions[9] = q10;
-    questions[10] = q11;
-    questions[11] = q12;
-    questions[12] = q13;
-    questions[13] = q14;
-    questions[14] = q15;
-    questions[15] = q16;
-    questions[16] = q17;
-    questions[17] = q18;
-    questions[18] = q19;
-    questions[19] = q20;
-    questions[20] = q21;
-    questions[21] = q22;
-    questions[22] = q23;
-    questions[23] = q24;
-    questions[24] = q25;
-    questions[25] = q26;
-    questions[26] = q27;
-    questions[27] = q28;
-    questions[28] = q29;
-    questions[29] = q30;
-    questions[30] = q31;
-    questions[31] = q32;
-    questions[32] = q33;
-    questions[33] = q34;
-    questions[34] = q35;
-    questions[35] = q36;
-    questions[36] = q37;
-    questions[37] = q38;
-    questions[38] = q39;
-    questions[39] = q40;
-    questions[40] = q41;
-    questions[41] = q42;
-    questions[42] = q43;
-    questions[43] = q44;
-    questions[44] = q45;
-    questions[45] = q46;
-    questions[46] = q47;
-    questions[47] = q48;
-    questions[48] = q49;
-    questions[49] = q50;
-    questions[50] = q51;
-    questions[51] = q52;
-    questions[52] = q53;
-    questions[53] = q54;
-    questions[54] = q55;
-    questions[55] = q56;
-    questions[56] = q57;
-    questions[57] = q58;
-    questions[58] = q59;
-    questions[59] = q60;
-    questions[60] = q61;
-    questions[61] = q62;
-    questions[62] = q63;
-    questions[63] = q64;
-    questions[64] = q65;
-    questions[65] = q66;
-    questions[66] = q67;
-    questions[67] = q68;
-    questions[68] = q69;
-    questions[69] = q70;
-    questions[70] = q71;
-    questions[71] = q72;
-    questions[72] = q73;
-    questions[73] = q74;
-    questions[74] = q75;
-    questions[75] = q76;
-    questions[76] = q77;
-    questions[77] = q78;
-    questions[78] = q79;
-    questions[79] = q80;
-    questions[80] = q81;
-    questions[81] = q82;
-    questions[82] = q83;
-    questions[83] = q84;
-    questions[84] = q85;
-    questions[85] = q86;
-    questions[86] = q87;
-    questions[87] = q88;
-    questions[88] = q89;
-    questions[89] = q90;
-    questions[90] = q91;
-    questions[91] = q92;
-    questions[92] = q93;
-    questions[93] = q94;
-    questions[94] = q95;
-    questions[95] = q96;
-    questions[96] = q97;
-    questions[97] = q98;
-    questions[98] = q99;
-    questions[99] = q100;
-
-    // Now, based on category, adjust which questions are available
-    switch(category) {
-        case 1: // IQ Test - uses all questions (1-100)
-            *totalQuestions = 100;
-            break;
-            
-        case 2: // Math Quiz - uses questions 56-70 and 76-100
-            *totalQuestions = 40; // 15 from 56-70 + 25 from 76-100
-            // Copy math questions to the beginning of the array
-            for (int i = 0; i < 15; i++) {
-                questions[i] = questions[55 + i]; // Questions 56-70
+// Reads one line from the reader into line, without its line ending. Lines
+// longer than the buffer are cut short and the rest is dropped. Waits at
+// most timeoutMs for the line to be complete, or forever if it is negative.
+// Returns the length of the line, LINE_TIMEOUT or LINE_EOF.
+int readLine(LineReader *reader, char line[], int size, int timeoutMs) {
+    long long deadline = timeoutMs >= 0 ? monotonicMs() + timeoutMs : -1;
+    fflush(stdout);
+
+    for (;;) {
+        char *newline = memchr(reader->buffer, '\n', reader->length);
+        if (reader->skipping && (newline != NULL || reader->length > 0)) {
+            // Throw away what is left of a line that was already returned
+            int consumed = newline ? (int)(newline - reader->buffer) + 1 : reader->length;
+            memmove(reader->buffer, reader->buffer + consumed, reader->length - consumed);
+            reader->length -= consumed;
+            reader->skipping = newline == NULL;
+            continue;
+        }
+        if (newline != NULL || (reader->eof && reader->length > 0)
+            || reader->length == (int)sizeof(reader->buffer)) {
+            int lineLength = newline ? (int)(newline - reader->buffer) : reader->length;
+            int consumed = newline ? lineLength + 1 : lineLength;
+            int copied = lineLength < size - 1 ? lineLength : size - 1;
+            memcpy(line, reader->buffer, copied);
+            if (copied > 0 && line[copied - 1] == '\r') {
+                copied--;
             }
-            for (int i = 15; i < 40; i++) {
-                questions[i] = questions[75 + (i-15)]; // Questions 76-100
+            line[copied] = '\0';
+            memmove(reader->buffer, reader->buffer + consumed, reader->length - consumed);
+            reader->length -= consumed;
+            reader->skipping = newline == NULL;
+            return copied;
+        }
+        if (reader->eof) {
+            return LINE_EOF;
+        }
+
+        int waitMs = -1;
+        if (deadline >= 0) {
+            long long left = deadline - monotonicMs();
+            if (left <= 0) {
+                return LINE_TIMEOUT;
             }
-            break;
-            
-        case 3: // English Quiz - uses questions 1-40
-            *totalQuestions = 40;
-            // No need to copy, first 40 questions are already in place
-            break;
+            waitMs = (int)left;
+        }
+        struct pollfd ready = {reader->fd, POLLIN, 0};
+        int count = poll(&ready, 1, waitMs);
+        if (count < 0 && errno != EINTR) {
+            reader->eof = 1;
+        } else if (count > 0) {
+            ssize_t got = read(reader->fd, reader->buffer + reader->length,
+                               sizeof(reader->buffer) - reader->length);
+            if (got > 0) {
+                reader->length += (int)got;
+            } else if (got == 0 || (errno != EINTR && errno != EAGAIN)) {
+                reader->eof = 1;
+            }
+        }
     }
 }
 
-
-// ====================================
-// Function Implementations - Game Logic
-// ====================================
-
-// Conducts a solo IQ test with timer functionality
-int playSolo(int numQuestions, Question questions[], int totalQuestions, char playerName[], int *timeTaken, int category) {
-    printf("\nStarting Solo Quiz...\n");
-    printf("You have 6 minutes to complete the quiz!\n");
-
-    int score = 0;
-    time_t startTime = time(NULL);
-
-    // Load category-specific questions
-    Question categoryQuestions[MAX_QUESTIONS];
-    int categoryTotalQuestions;
-    loadQuestions(categoryQuestions, &categoryTotalQuestions, category);
-
-    // Shuffle questions
-    int indices[MAX_QUESTIONS];
-    for (int i = 0; i < categoryTotalQuestions; i++) {
-        indices[i] = i;
+// Reads a line that holds nothing but a number from min to max, with
+// optional spaces around it. Returns -1 for anything else, so a stray word
+// never turns into an answer.
+int parseChoice(const char *line, int min, int max) {
+    const char *p = line + strspn(line, " \t");
+    int value = 0, digits = 0;
+    for (; *p >= '0' && *p <= '9'; p++, digits++) {
+        if (digits < 9) {
+            value = value * 10 + (*p - '0');
+        }
     }
-    for (int i = categoryTotalQuestions - 1; i > 0; i--) {
-        int j = rand() % (i + 1);
-        int temp = indices[i];
-        indices[i] = indices[j];
-        indices[j] = temp;
+    p += strspn(p, " \t");
+    if (digits == 0 || digits > 9 || *p != '\0' || value < min || value > max) {
+        return -1;
     }
+    return value;
+}
 
-    // Ask questions
-    for (int i = 0; i < numQuestions; i++) {
-        int randIndex = indices[i];
-        printf("\n%s, it's your turn!\n", playerName);
-        
-        score += askQuestion(categoryQuestions[randIndex]);
-        
-        if (difftime(time(NULL), startTime) > TEST_DURATION) {
-            printf("\nTime's up! The test has ended.\n");
-            break;
-        }
+// Reads a number from min to max typed on its own line, or returns fallback
+// if the line holds anything else or the input ended
+int readChoice(int min, int max, int fallback) {
+    char line[64];
+    int value = readLine(&console, line, sizeof(line), -1) >= 0 ? parseChoice(line, min, max) : -1;
+    return value < 0 ? fallback : value;
+}
 
-        int timeLeft = TEST_DURATION - difftime(time(NULL), startTime);
-        int minutes = timeLeft / 60;
-        int seconds = timeLeft % 60;
-        printf("Time remaining: %02d:%02d\n", minutes, seconds);
+// Reads a player name, skipping blank lines and the spaces around it. Names
+// longer than size - 1 bytes are cut short. Falls back to the given name if
+// the input ends first.
+void readName(char name[], int size, const char *fallback) {
+    char line[INPUT_BUFFER_SIZE];
+    int length;
+    while ((length = readLine(&console, line, sizeof(line), -1)) >= 0) {
+        while (length > 0 && (line[length - 1] == ' ' || line[length - 1] == '\t')) {
+            line[--length] = '\0';
+        }
+        const char *start = line + strspn(line, " \t");
+        if (*start != '\0') {
+            snprintf(name, size, "%s", start);
+            return;
+        }
     }
+    snprintf(name, size, "%s", fallback);
+}
 
-    *timeTaken = (int)difftime(time(NULL), startTime);
+// Formats a question, its numbered options and the answer prompt as one
+// block of text, so showing a question is a single write to the console.
+// Returns the length of the text.
+int renderQuestion(const Question *q, char text[], int size) {
+    int length = snprintf(text, size, "\n%s\n1) %s\n2) %s\n3) %s\n4) %s\nEnter your answer (1-4): ",
+                          q->question, q->options[0], q->options[1], q->options[2], q->options[3]);
+    return length < size ? length : size - 1;
+}
 
-    // Display results based on category
-    if (category == 1) {
-        displayIQScore(playerName, score, numQuestions);
-    } else {
-        printf("\n%s, your Final Score: %d/%d\n", playerName, score, numQuestions);
-    }
 
-    return score;
-}
+// ====================================
+// Function Implementations - Question Bank
+// ====================================
 
+// Growable buffer used to collect the string arena while building a bank
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+} StringBlob;
 
-// Manages the 1v1 gameplay mode between two players
-void play1v1(int numQuestions, Question questions[], int totalQuestions, char player1[], char player2[], int category) {
-    printf("\nStarting Multiplayer Quiz!\n");
+// Open-addressing hash table used to intern strings and option sets.
+// Slots hold an offset or index plus one, so zero marks an empty slot.
+typedef struct {
+    uint32_t *slots;
+    size_t capacity;            // Always a power of two
+    size_t used;
+} InternTable;
 
-    int timeTaken1, timeTaken2;
+// Everything collected from a question source before it is written out
+typedef struct {
+    StringBlob blob;
+    InternTable strings;        // Interned strings in the blob
+    InternTable sets;           // Interned option sets
+    uint32_t (*optionSets)[4];
+    size_t setCount, setCapacity;
+    uint32_t *text;
+    uint32_t *optionSet;
+    uint8_t *correctOption;
+    uint64_t *tags;             // Bit t set when a question carries tag t
+    uint8_t *difficulty;
+    size_t count, capacity;
+    uint32_t tagName[MAX_TAGS]; // Arena offset of each tag's name
+    int tagCount;
+    uint32_t *sourceLine;       // Line of the source file each question starts on
+    uint32_t *duplicateOf;      // First question of each question's duplicate group, once looked for
+    uint8_t *exactDuplicate;    // Set when a question is an exact copy of an earlier one
+    int collapseDuplicates;     // Leave every duplicate but the first out of the tag index
+} BankBuilder;
 
-    printf("\n%s's turn!\n", player1);
-    int score1 = playSolo(numQuestions, questions, totalQuestions, player1, &timeTaken1, category);
+long findDuplicates(BankBuilder *builder);                   // Groups exact and near duplicate questions
+void printDuplicates(const BankBuilder *builder, const char *sourcePath, long repeats); // Lists those groups
 
-    printf("\n%s's turn!\n", player2);
-    int score2 = playSolo(numQuestions, questions, totalQuestions, player2, &timeTaken2, category);
+// FNV-1a hash over a block of bytes
+static uint32_t hashBytes(const void *data, size_t length) {
+    const unsigned char *bytes = data;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
 
-    // Display results based on category
-    if (category == 1) {
-        declareWinner(player1, player2, score1, score2, timeTaken1, timeTaken2);
-    } else {
-        printf("\n=================================\n");
-        printf("        FINAL SCORES\n");
-        printf("=================================\n");
-        printf("%s: %d/%d\n", player1, score1, numQuestions);
-        printf("%s: %d/%d\n", player2, score2, numQuestions);
-        
-        if (score1 > score2) {
-            printf("%s wins!\n", player1);
-        } else if (score2 > score1) {
-            printf("%s wins!\n", player2);
-        } else {
-            printf("It's a tie!\n");
+// Makes sure the table has room for one more entry, rehashing with the
+// given function when it grows past half full
+static int reserveIntern(InternTable *table, const BankBuilder *builder,
+                         uint32_t (*hashEntry)(const BankBuilder *, uint32_t)) {
+    if ((table->used + 1) * 2 <= table->capacity) {
+        return 0;
+    }
+    size_t capacity = table->capacity ? table->capacity * 2 : 1024;
+    uint32_t *slots = calloc(capacity, sizeof(uint32_t));
+    if (slots == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->slots[i] != 0) {
+            size_t slot = hashEntry(builder, table->slots[i] - 1) & (capacity - 1);
+            while (slots[slot] != 0) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            slots[slot] = table->slots[i];
         }
     }
+    free(table->slots);
+    table->slots = slots;
+    table->capacity = capacity;
+    return 0;
 }
 
+static uint32_t hashStringEntry(const BankBuilder *builder, uint32_t offset) {
+    const char *text = builder->blob.data + offset;
+    return hashBytes(text, strlen(text));
+}
 
-// Presents a question to the user and validates their answer
-int askQuestion(Question q) {
-    int answer;
-    printf("\n%s\n", q.question);
-    for (int i = 0; i < 4; i++) {
-        printf("%d) %s\n", i + 1, q.options[i]);
+static uint32_t hashSetEntry(const BankBuilder *builder, uint32_t index) {
+    return hashBytes(builder->optionSets[index], sizeof(builder->optionSets[index]));
+}
+
+// Returns the arena offset of the string, adding it only if it is new
+static long internString(BankBuilder *builder, const char *text) {
+    size_t length = strlen(text);
+    if (reserveIntern(&builder->strings, builder, hashStringEntry) != 0) {
+        return -1;
+    }
+    InternTable *table = &builder->strings;
+    size_t slot = hashBytes(text, length) & (table->capacity - 1);
+    while (table->slots[slot] != 0) {
+        const char *existing = builder->blob.data + table->slots[slot] - 1;
+        if (strcmp(existing, text) == 0) {
+            return table->slots[slot] - 1;
+        }
+        slot = (slot + 1) & (table->capacity - 1);
     }
-    printf("Enter your answer (1-4): ");
-    scanf("%d", &answer);
 
-    // Check if the answer is correct
-    if (answer == q.correctOption) {
-        printf("Correct!\n");
+    StringBlob *blob = &builder->blob;
+    if (blob->size + length + 1 >= UINT32_MAX) {
+        return -1;
+    }
+    if (blob->size + length + 1 > blob->capacity) {
+        size_t capacity = blob->capacity ? blob->capacity * 2 : 4096;
+        while (capacity < blob->size + length + 1) {
+            capacity *= 2;
+        }
+        char *data = realloc(blob->data, capacity);
+        if (data == NULL) {
+            return -1;
+        }
+        blob->data = data;
+        blob->capacity = capacity;
+    }
+    uint32_t offset = (uint32_t)blob->size;
+    memcpy(blob->data + offset, text, length + 1);
+    blob->size += length + 1;
+    table->slots[slot] = offset + 1;
+    table->used++;
+    return offset;
+}
+
+// Returns the index of the option set, adding it only if it is new
+static long internOptionSet(BankBuilder *builder, const uint32_t options[4]) {
+    if (reserveIntern(&builder->sets, builder, hashSetEntry) != 0) {
+        return -1;
+    }
+    InternTable *table = &builder->sets;
+    size_t slot = hashBytes(options, 4 * sizeof(uint32_t)) & (table->capacity - 1);
+    while (table->slots[slot] != 0) {
+        if (memcmp(builder->optionSets[table->slots[slot] - 1], options, 4 * sizeof(uint32_t)) == 0) {
+            return table->slots[slot] - 1;
+        }
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+
+    if (builder->setCount == builder->setCapacity) {
+        size_t capacity = builder->setCapacity ? builder->setCapacity * 2 : 128;
+        uint32_t (*grown)[4] = realloc(builder->optionSets, capacity * sizeof(*grown));
+        if (grown == NULL) {
+            return -1;
+        }
+        builder->optionSets = grown;
+        builder->setCapacity = capacity;
+    }
+    memcpy(builder->optionSets[builder->setCount], options, 4 * sizeof(uint32_t));
+    table->slots[slot] = (uint32_t)builder->setCount + 1;
+    table->used++;
+    return (long)builder->setCount++;
+}
+
+// Appends one question to the builder's dense arrays
+static int addBuiltQuestion(BankBuilder *builder, const char *text, char options[4][MAX_LINE_LENGTH],
+                            int correctOption, uint64_t tags, int difficulty) {
+    if (builder->count == builder->capacity) {
+        size_t capacity = builder->capacity ? builder->capacity * 2 : 128;
+        uint32_t *newText = realloc(builder->text, capacity * sizeof(uint32_t));
+        if (newText != NULL) builder->text = newText;
+        uint32_t *newSets = realloc(builder->optionSet, capacity * sizeof(uint32_t));
+        if (newSets != NULL) builder->optionSet = newSets;
+        uint8_t *newCorrect = realloc(builder->correctOption, capacity);
+        if (newCorrect != NULL) builder->correctOption = newCorrect;
+        uint64_t *newTags = realloc(builder->tags, capacity * sizeof(uint64_t));
+        if (newTags != NULL) builder->tags = newTags;
+        uint8_t *newDifficulty = realloc(builder->difficulty, capacity);
+        if (newDifficulty != NULL) builder->difficulty = newDifficulty;
+        uint32_t *newLines = realloc(builder->sourceLine, capacity * sizeof(uint32_t));
+        if (newLines != NULL) builder->sourceLine = newLines;
+        if (!newText || !newSets || !newCorrect || !newTags || !newDifficulty || !newLines) {
+            return -1;
+        }
+        builder->capacity = capacity;
+    }
+
+    uint32_t optionOffsets[4];
+    long textOffset = internString(builder, text);
+    if (textOffset < 0) {
+        return -1;
+    }
+    for (int i = 0; i < 4; i++) {
+        long offset = internString(builder, options[i]);
+        if (offset < 0) {
+            return -1;
+        }
+        optionOffsets[i] = (uint32_t)offset;
+    }
+    long set = internOptionSet(builder, optionOffsets);
+    if (set < 0) {
+        return -1;
+    }
+
+    size_t n = builder->count++;
+    builder->text[n] = (uint32_t)textOffset;
+    builder->optionSet[n] = (uint32_t)set;
+    builder->correctOption[n] = (uint8_t)correctOption;
+    builder->tags[n] = tags;
+    builder->difficulty[n] = (uint8_t)difficulty;
+    builder->sourceLine[n] = 0;
+    return 0;
+}
+
+static void freeBankBuilder(BankBuilder *builder) {
+    free(builder->blob.data);
+    free(builder->strings.slots);
+    free(builder->sets.slots);
+    free(builder->optionSets);
+    free(builder->text);
+    free(builder->optionSet);
+    free(builder->correctOption);
+    free(builder->tags);
+    free(builder->difficulty);
+    free(builder->sourceLine);
+    free(builder->duplicateOf);
+    free(builder->exactDuplicate);
+}
+
+// Words with a meaning of their own in question queries, so never tag names
+static const char *queryKeywords[] = {"and", "or", "not", "all", "difficulty"};
+
+// Adds the space-separated tags in a "@section" or "T:" line to the mask,
+// registering tags seen for the first time. Returns NULL on success, or why
+// the list was refused.
+static const char *parseTagList(BankBuilder *builder, const char *list, uint64_t *mask) {
+    while (*list != '\0') {
+        if (*list == ' ') {
+            list++;
+            continue;
+        }
+        char name[MAX_LINE_LENGTH];
+        int length = 0;
+        while (list[length] != ' ' && list[length] != '\0') {
+            char c = list[length];
+            int letter = c >= 'a' && c <= 'z';
+            int other = (c >= '0' && c <= '9') || c == '_';
+            if (!letter && !(other && length > 0)) {
+                return "tags are lowercase letters, digits and '_', starting with a letter";
+            }
+            name[length++] = c;
+        }
+        name[length] = '\0';
+        list += length;
+        for (size_t k = 0; k < sizeof(queryKeywords) / sizeof(queryKeywords[0]); k++) {
+            if (strcmp(name, queryKeywords[k]) == 0) {
+                return "tag name is a query keyword";
+            }
+        }
+
+        int tag = 0;
+        while (tag < builder->tagCount && strcmp(builder->blob.data + builder->tagName[tag], name) != 0) {
+            tag++;
+        }
+        if (tag == builder->tagCount) {
+            if (builder->tagCount == MAX_TAGS) {
+                return "too many different tags";
+            }
+            long offset = internString(builder, name);
+            if (offset < 0) {
+                return "not enough memory";
+            }
+            builder->tagName[builder->tagCount++] = (uint32_t)offset;
+        }
+        *mask |= 1ULL << tag;
+    }
+    return NULL;
+}
+
+// Phrases the string arena is compressed with. A phrase is a run of whole
+// words that comes up often in the bank's text, and the arena stores a one-
+// or two-byte code in its place.
+typedef struct {
+    char *bytes;                // The phrases back to back
+    size_t size, capacity;
+    uint32_t offsets[PHRASE_MAX + 1];  // Where each phrase starts, then where the last one ends
+    uint32_t uses[PHRASE_MAX];  // Times each phrase was picked while compressing
+    int count;
+    uint16_t slots[PHRASE_SLOTS];      // Phrase index plus one by hash, zero when empty
+} PhraseTable;
+
+// A run of words counted while picking phrases, by where it first came up in the sample
+typedef struct {
+    uint32_t hash;
+    uint32_t start;
+    uint32_t length;
+    uint32_t count;             // Zero marks an empty slot
+} PhraseCandidate;
+
+// Tells whether a phrase starting at text may end before text[end]: at the
+// end of a word, with or without the space after it
+static int phraseEnds(const char *text, size_t end) {
+    return text[end] == ' ' || text[end] == '\0' || text[end - 1] == ' ';
+}
+
+// Returns the index of a phrase, or -1 when the table does not have it
+static int findPhrase(const PhraseTable *table, const char *text, size_t length, uint32_t hash) {
+    for (size_t slot = hash & (PHRASE_SLOTS - 1); table->slots[slot] != 0; slot = (slot + 1) & (PHRASE_SLOTS - 1)) {
+        int p = table->slots[slot] - 1;
+        if (table->offsets[p + 1] - table->offsets[p] == length
+            && memcmp(table->bytes + table->offsets[p], text, length) == 0) {
+            return p;
+        }
+    }
+    return -1;
+}
+
+static int addPhrase(PhraseTable *table, const char *text, size_t length) {
+    if (table->count == PHRASE_MAX) {
+        return -1;
+    }
+    if (table->size + length > table->capacity) {
+        size_t capacity = table->capacity ? table->capacity * 2 : 4096;
+        char *bytes = realloc(table->bytes, capacity);
+        if (bytes == NULL) {
+            return -1;
+        }
+        table->bytes = bytes;
+        table->capacity = capacity;
+    }
+    memcpy(table->bytes + table->size, text, length);
+    table->size += length;
+    table->offsets[table->count + 1] = (uint32_t)table->size;
+    size_t slot = hashBytes(text, length) & (PHRASE_SLOTS - 1);
+    while (table->slots[slot] != 0) {
+        slot = (slot + 1) & (PHRASE_SLOTS - 1);
+    }
+    table->slots[slot] = (uint16_t)(++table->count);
+    return 0;
+}
+
+static void freePhrases(PhraseTable *table) {
+    if (table != NULL) {
+        free(table->bytes);
+        free(table);
+    }
+}
+
+// Finds the longest phrase at a word start. Returns its index and sets
+// *length, or returns -1.
+static int matchPhrase(const PhraseTable *table, const char *text, size_t *length) {
+    uint32_t hash = 2166136261u;
+    int found = -1;
+    for (size_t end = 1; end <= PHRASE_MAX_LENGTH && text[end - 1] != '\0' && table->count > 0; end++) {
+        hash = (hash ^ (unsigned char)text[end - 1]) * 16777619u;
+        if (end >= PHRASE_MIN_LENGTH && phraseEnds(text, end)) {
+            int p = findPhrase(table, text, end, hash);
+            if (p >= 0) {
+                found = p;
+                *length = end;
+            }
+        }
+    }
+    return found;
+}
+
+// Compresses one string: the longest phrase at each word start, and every
+// other byte as itself. Writes the codes and a terminator to out (when not
+// NULL), which needs room for twice the string's length plus one, and
+// returns how many bytes that takes. Marks the bytes phrases stand for in
+// covered (when not NULL) and counts the phrases used.
+static size_t compressString(PhraseTable *table, const char *text, unsigned char *out, unsigned char *covered) {
+    size_t written = 0;
+    for (size_t i = 0; text[i] != '\0';) {
+        size_t length = 0;
+        int p = i == 0 || text[i - 1] == ' ' ? matchPhrase(table, text + i, &length) : -1;
+        if (p < 0) {
+            unsigned char c = (unsigned char)text[i++];
+            if (out != NULL && c >= PHRASE_CODE) {
+                out[written] = PHRASE_LITERAL;
+            }
+            written += 1 + (c >= PHRASE_CODE);
+            if (out != NULL) {
+                out[written - 1] = c;
+            }
+            continue;
+        }
+        table->uses[p]++;
+        if (out != NULL && p < PHRASE_ONE_BYTE) {
+            out[written] = (unsigned char)(PHRASE_CODE + p);
+        } else if (out != NULL) {
+            out[written] = (unsigned char)(PHRASE_LONG + (p - PHRASE_ONE_BYTE) / 255);
+            out[written + 1] = (unsigned char)(1 + (p - PHRASE_ONE_BYTE) % 255);
+        }
+        written += p < PHRASE_ONE_BYTE ? 1 : 2;
+        if (covered != NULL) {
+            memset(covered + i, 1, length);
+        }
+        i += length;
+    }
+    if (out != NULL) {
+        out[written] = '\0';
+    }
+    return written + 1;
+}
+
+// Orders packed (bytes saved << 32 | index) values from the most saved down
+static int comparePhraseRanks(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+// Picks the phrases a bank's text is compressed with. An even sample of the
+// builder's strings is taken, then each round counts the runs of whole
+// words in what the phrases so far leave uncovered and adds the ones that
+// would save the most bytes. The phrases that end up used are put in order
+// of the bytes they save, so the most useful get the one-byte codes.
+// Returns the table, or NULL when out of memory.
+static PhraseTable *trainPhrases(const BankBuilder *builder) {
+    const StringBlob *blob = &builder->blob;
+    size_t stride = blob->size / PHRASE_SAMPLE_SIZE + 1;
+    size_t sampleCapacity = (blob->size < PHRASE_SAMPLE_SIZE ? blob->size : PHRASE_SAMPLE_SIZE) + 1;
+    size_t slots = 1024;
+    while (slots < sampleCapacity * 4 && slots < PHRASE_CANDIDATES) {
+        slots *= 2;
+    }
+    PhraseTable *table = calloc(1, sizeof(PhraseTable));
+    char *sample = malloc(sampleCapacity);
+    unsigned char *covered = calloc(1, sampleCapacity);
+    PhraseCandidate *candidates = malloc(slots * sizeof(PhraseCandidate));
+    uint64_t *ranked = malloc(slots * sizeof(uint64_t));
+    int failed = table == NULL || sample == NULL || covered == NULL || candidates == NULL || ranked == NULL;
+
+    size_t sampleSize = 0, nth = 0;
+    for (size_t offset = 0; !failed && offset < blob->size; nth++) {
+        size_t length = strlen(blob->data + offset) + 1;
+        if (nth % stride == 0 && sampleSize + length <= sampleCapacity) {
+            memcpy(sample + sampleSize, blob->data + offset, length);
+            sampleSize += length;
+        }
+        offset += length;
+    }
+
+    for (int round = 0; !failed && round < PHRASE_ROUNDS && table->count < PHRASE_MAX; round++) {
+        memset(candidates, 0, slots * sizeof(PhraseCandidate));
+        size_t used = 0;
+        for (size_t i = 0; i < sampleSize; i++) {
+            if (covered[i] || sample[i] == '\0' || (i > 0 && sample[i - 1] != ' ' && sample[i - 1] != '\0')) {
+                continue;
+            }
+            uint32_t hash = 2166136261u;
+            for (size_t end = 1; end <= PHRASE_MAX_LENGTH && sample[i + end - 1] != '\0' && !covered[i + end - 1]; end++) {
+                hash = (hash ^ (unsigned char)sample[i + end - 1]) * 16777619u;
+                if (end < PHRASE_MIN_LENGTH || !phraseEnds(sample + i, end)) {
+                    continue;
+                }
+                size_t slot = hash & (slots - 1);
+                PhraseCandidate *c = &candidates[slot];
+                while (c->count != 0 && !(c->hash == hash && c->length == end
+                                          && memcmp(sample + c->start, sample + i, end) == 0)) {
+                    slot = (slot + 1) & (slots - 1);
+                    c = &candidates[slot];
+                }
+                if (c->count != 0) {
+                    c->count++;
+                } else if (used * 4 < slots * 3) {
+                    c->hash = hash;
+                    c->start = (uint32_t)i;
+                    c->length = (uint32_t)end;
+                    c->count = 1;
+                    used++;
+                }
+            }
+        }
+
+        // A phrase costs its bytes and an offset once, and saves all but its code each time it is used
+        size_t rankedCount = 0;
+        for (size_t slot = 0; slot < slots; slot++) {
+            const PhraseCandidate *c = &candidates[slot];
+            int64_t saved = (int64_t)c->count * (c->length - 2) - c->length - 4;
+            if (c->count > 1 && saved > 0) {
+                ranked[rankedCount++] = (uint64_t)(saved < UINT32_MAX ? saved : UINT32_MAX) << 32 | slot;
+            }
+        }
+        qsort(ranked, rankedCount, sizeof(uint64_t), comparePhraseRanks);
+
+        // Runs inside a phrase picked this round wait for the next round, which
+        // only counts them where that phrase did not cover them
+        int first = table->count;
+        int room = (PHRASE_MAX - first + PHRASE_ROUNDS - round - 1) / (PHRASE_ROUNDS - round);
+        for (size_t r = 0; r < rankedCount && table->count - first < room && !failed; r++) {
+            const PhraseCandidate *c = &candidates[(uint32_t)ranked[r]];
+            const char *text = sample + c->start;
+            int inside = findPhrase(table, text, c->length, c->hash) >= 0;
+            for (int p = first; p < table->count && !inside; p++) {
+                inside = memmem(table->bytes + table->offsets[p], table->offsets[p + 1] - table->offsets[p],
+                                text, c->length) != NULL;
+            }
+            failed = !inside && addPhrase(table, text, c->length) != 0;
+        }
+        if (table->count == first) {
+            break;
+        }
+        memset(covered, 0, sampleSize);
+        for (size_t i = 0; i < sampleSize; i += strlen(sample + i) + 1) {
+            compressString(table, sample + i, NULL, covered);
+        }
+    }
+
+    // Keep the phrases the sample used, the ones saving the most bytes first
+    PhraseTable *ordered = failed ? NULL : calloc(1, sizeof(PhraseTable));
+    if (ordered != NULL) {
+        memset(table->uses, 0, sizeof(table->uses));
+        for (size_t i = 0; i < sampleSize; i += strlen(sample + i) + 1) {
+            compressString(table, sample + i, NULL, NULL);
+        }
+        size_t rankedCount = 0;
+        for (int p = 0; p < table->count; p++) {
+            uint64_t saved = (uint64_t)table->uses[p] * (table->offsets[p + 1] - table->offsets[p] - 1);
+            if (table->uses[p] > 0) {
+                ranked[rankedCount++] = (saved < UINT32_MAX ? saved : UINT32_MAX) << 32 | (uint64_t)p;
+            }
+        }
+        qsort(ranked, rankedCount, sizeof(uint64_t), comparePhraseRanks);
+        for (size_t r = 0; r < rankedCount && ordered != NULL; r++) {
+            uint32_t p = (uint32_t)ranked[r];
+            if (addPhrase(ordered, table->bytes + table->offsets[p], table->offsets[p + 1] - table->offsets[p]) != 0) {
+                freePhrases(ordered);
+                ordered = NULL;
+            }
+        }
+    }
+    freePhrases(table);
+    free(sample);
+    free(covered);
+    free(candidates);
+    free(ranked);
+    return ordered;
+}
+
+// Finds where the string at an old arena offset went, given the old and new
+// start of every string in arena order
+static uint32_t movedString(const uint32_t *oldStart, const uint32_t *newStart, size_t count, uint32_t offset) {
+    size_t low = 0, high = count;
+    while (high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+        if (oldStart[middle] <= offset) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return newStart[low];
+}
+
+// Tells whether built question i belongs in entry e of the tag index: one of
+// the tags, or for the entries after them, one of the difficulty levels.
+// Collapsed duplicates belong in none, so no query can select them.
+static int builtQuestionHasEntry(const BankBuilder *builder, size_t i, int entry) {
+    if (builder->collapseDuplicates && builder->duplicateOf != NULL && builder->duplicateOf[i] != i) {
+        return 0;
+    }
+    if (entry < builder->tagCount) {
+        return (builder->tags[i] >> entry) & 1;
+    }
+    return builder->difficulty[i] == entry - builder->tagCount + 1;
+}
+
+// Lays the builder's arrays out as a bank image: header, section table and
+// sections, each starting on an 8-byte boundary so the arrays can be used in
+// place once mapped. The tag index is computed here so that a query at run
+// time only combines the ready-made id lists and bitsets, and the string
+// arena is compressed string by string with phrases picked from its text.
+// Tag names are added to the end of the arena as they are, so they can be
+// read without decoding.
+unsigned char *serializeBank(const BankBuilder *builder, size_t *imageSize) {
+    uint32_t count = (uint32_t)builder->count;
+    int entries = builder->tagCount + DIFFICULTY_LEVELS;
+    size_t words = ((size_t)count + 63) / 64;
+
+    // Size each posting first: an id list when that is smaller than a bitset
+    BankTag tags[MAX_TAGS + DIFFICULTY_LEVELS];
+    size_t postingsSize = 0;
+    for (int e = 0; e < entries; e++) {
+        uint32_t carried = 0;
+        for (size_t i = 0; i < count; i++) {
+            carried += builtQuestionHasEntry(builder, i, e);
+        }
+        tags[e].name = e < builder->tagCount ? builder->tagName[e] : 0;
+        tags[e].kind = (size_t)carried * 4 <= words * 8 ? POSTING_IDS : POSTING_BITS;
+        tags[e].offset = (uint32_t)postingsSize;
+        tags[e].count = carried;
+        postingsSize += tags[e].kind == POSTING_IDS ? ((size_t)carried * 4 + 7) & ~(size_t)7 : words * 8;
+        if (postingsSize > UINT32_MAX) {
+            return NULL;
+        }
+    }
+    unsigned char *postings = calloc(1, postingsSize ? postingsSize : 1);
+    PhraseTable *phrases = postings != NULL ? trainPhrases(builder) : NULL;
+    size_t stringCount = builder->strings.used;
+    uint32_t *oldStart = malloc((stringCount + 1) * sizeof(uint32_t));
+    uint32_t *newStart = malloc((stringCount + 1) * sizeof(uint32_t));
+    uint32_t *text = malloc(((size_t)count + 1) * sizeof(uint32_t));
+    uint32_t (*optionSets)[4] = malloc((builder->setCount + 1) * sizeof(optionSets[0]));
+    // At worst every byte is escaped, and the tag names are copied once more
+    unsigned char *arena = malloc(3 * builder->blob.size + 1);
+    unsigned char *phraseSection = phrases != NULL ? malloc(8 + 4 * (size_t)phrases->count + phrases->size) : NULL;
+    if (phraseSection == NULL || oldStart == NULL || newStart == NULL || text == NULL
+        || optionSets == NULL || arena == NULL) {
+        free(postings);
+        freePhrases(phrases);
+        free(oldStart);
+        free(newStart);
+        free(text);
+        free(optionSets);
+        free(arena);
+        free(phraseSection);
+        return NULL;
+    }
+    for (int e = 0; e < entries; e++) {
+        uint32_t *ids = (uint32_t *)(postings + tags[e].offset);
+        uint64_t *bits = (uint64_t *)(postings + tags[e].offset);
+        uint32_t next = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            if (!builtQuestionHasEntry(builder, i, e)) {
+                continue;
+            }
+            if (tags[e].kind == POSTING_IDS) {
+                ids[next++] = i;
+            } else {
+                bits[i / 64] |= 1ULL << (i % 64);
+            }
+        }
+    }
+
+    // Compress the arena, then point the text, options and tag names at where their strings went
+    size_t arenaSize = 0, nth = 0;
+    for (size_t offset = 0; offset < builder->blob.size; nth++) {
+        const char *string = builder->blob.data + offset;
+        oldStart[nth] = (uint32_t)offset;
+        newStart[nth] = (uint32_t)arenaSize;
+        arenaSize += compressString(phrases, string, arena + arenaSize, NULL);
+        offset += strlen(string) + 1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        text[i] = movedString(oldStart, newStart, nth, builder->text[i]);
+    }
+    for (size_t set = 0; set < builder->setCount; set++) {
+        for (int k = 0; k < 4; k++) {
+            optionSets[set][k] = movedString(oldStart, newStart, nth, builder->optionSets[set][k]);
+        }
+    }
+    for (int t = 0; t < builder->tagCount; t++) {
+        const char *name = builder->blob.data + builder->tagName[t];
+        tags[t].name = (uint32_t)arenaSize;
+        memcpy(arena + arenaSize, name, strlen(name) + 1);
+        arenaSize += strlen(name) + 1;
+    }
+
+    uint32_t *phraseHeader = (uint32_t *)phraseSection;
+    phraseHeader[0] = (uint32_t)phrases->count;
+    memcpy(phraseHeader + 1, phrases->offsets, 4 * ((size_t)phrases->count + 1));
+    memcpy(phraseSection + 8 + 4 * (size_t)phrases->count, phrases->bytes, phrases->size);
+
+    const void *contents[SECTION_COUNT] = {
+        text, builder->optionSet, optionSets, builder->correctOption,
+        tags, builder->difficulty, arena, postings, phraseSection
+    };
+    uint32_t sizes[SECTION_COUNT] = {
+        count * 4, count * 4, (uint32_t)builder->setCount * 16, count,
+        (uint32_t)(entries * sizeof(BankTag)), count, (uint32_t)arenaSize, (uint32_t)postingsSize,
+        (uint32_t)(8 + 4 * (size_t)phrases->count + phrases->size)
+    };
+
+    BankHeader header = {{'M', 'M', 'Q', 'B'}, BANK_VERSION, count, SECTION_COUNT};
+    BankSection sections[SECTION_COUNT];
+    size_t offset = sizeof(BankHeader) + sizeof(sections);
+    for (int i = 0; i < SECTION_COUNT; i++) {
+        sections[i].id = i + 1;
+        sections[i].offset = (uint32_t)offset;
+        sections[i].size = sizes[i];
+        sections[i].reserved = 0;
+        offset = (offset + sizes[i] + 7) & ~(size_t)7;
+    }
+
+    unsigned char *image = offset <= UINT32_MAX ? calloc(1, offset) : NULL;
+    if (image != NULL) {
+        memcpy(image, &header, sizeof(header));
+        memcpy(image + sizeof(header), sections, sizeof(sections));
+        for (int i = 0; i < SECTION_COUNT; i++) {
+            memcpy(image + sections[i].offset, contents[i], sizes[i]);
+        }
+        *imageSize = offset;
+    }
+    free(postings);
+    freePhrases(phrases);
+    free(oldStart);
+    free(newStart);
+    free(text);
+    free(optionSets);
+    free(arena);
+    free(phraseSection);
+    return image;
+}
+
+// Writes a bank image to disk. The file is written under a temporary name
+// and renamed into place so a reader never maps a half-written bank.
+static int writeBankFile(const char *bankPath, const unsigned char *image, size_t imageSize) {
+    char tempPath[512];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", bankPath);
+    FILE *out = fopen(tempPath, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "Cannot create bank file '%s'\n", tempPath);
+        return -1;
+    }
+
+    int failed = fwrite(image, 1, imageSize, out) != imageSize;
+    if (fclose(out) != 0) {
+        failed = 1;
+    }
+    if (failed || rename(tempPath, bankPath) != 0) {
+        fprintf(stderr, "Cannot write bank file '%s'\n", bankPath);
+        remove(tempPath);
+        return -1;
+    }
+    return 0;
+}
+
+// Reads a question source file into the builder, checking every question.
+// The builder must start zeroed and be released with freeBankBuilder.
+int parseQuestionSource(const char *sourcePath, BankBuilder *builder) {
+    FILE *source = fopen(sourcePath, "r");
+    if (source == NULL) {
+        fprintf(stderr, "Cannot open question source '%s'\n", sourcePath);
+        return -1;
+    }
+
+    static char text[MAX_LINE_LENGTH];
+    static char options[4][MAX_LINE_LENGTH];
+    uint64_t sectionTags = 0;   // Tags of the current section, 0 before the first one
+    uint64_t questionTags = 0;  // Tags of the pending question from its "T:" line
+    int tagged = 0;             // Set once the pending question has had a "T:" line
+    int optionsSeen = 0;        // Bit mask of the option lines read for the pending question
+    int pending = 0;            // Set while a question has been started but not stored
+    int correctOption = 0;      // Answer of the pending question, 0 until its "A:" line
+    int difficulty = DEFAULT_DIFFICULTY;
+    int lineNumber = 0;
+    int questionLine = 0;       // Line the pending question started on
+    int failed = 0;
+    char line[MAX_LINE_LENGTH];
+
+    while (!failed) {
+        int atEnd = fgets(line, sizeof(line), source) == NULL;
+        size_t length = 0;
+        if (!atEnd) {
+            lineNumber++;
+            length = strlen(line);
+            if (length == sizeof(line) - 1 && line[length - 1] != '\n') {
+                fprintf(stderr, "%s:%d: line is too long\n", sourcePath, lineNumber);
+                failed = 1;
+                break;
+            }
+            while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+                line[--length] = '\0';
+            }
+            if (length == 0 || line[0] == '#') {
+                continue;
+            }
+        }
+
+        // A new question, a new section or the end of the file stores the pending question
+        if (pending && (atEnd || line[0] == '@' || strncmp(line, "Q: ", 3) == 0)) {
+            if (correctOption == 0) {
+                fprintf(stderr, "%s:%d: question has no answer line\n", sourcePath, lineNumber);
+                failed = 1;
+                break;
+            }
+            if (addBuiltQuestion(builder, text, options, correctOption, sectionTags | questionTags, difficulty) != 0) {
+                fprintf(stderr, "Not enough memory to build the question bank\n");
+                failed = 1;
+                break;
+            }
+            builder->sourceLine[builder->count - 1] = (uint32_t)questionLine;
+            pending = 0;
+        }
+        if (atEnd) {
+            break;
+        }
+
+        if (strncmp(line, "@section ", 9) == 0) {
+            sectionTags = 0;
+            const char *problem = parseTagList(builder, line + 9, &sectionTags);
+            if (problem == NULL && sectionTags == 0) {
+                problem = "section has no tags";
+            }
+            if (problem != NULL) {
+                fprintf(stderr, "%s:%d: %s\n", sourcePath, lineNumber, problem);
+                failed = 1;
+            }
+        } else if (strncmp(line, "Q: ", 3) == 0) {
+            if (sectionTags == 0) {
+                fprintf(stderr, "%s:%d: question outside of a section\n", sourcePath, lineNumber);
+                failed = 1;
+            } else if (length - 3 > MAX_QUESTION_LENGTH) {
+                fprintf(stderr, "%s:%d: question is longer than %d characters\n", sourcePath, lineNumber, MAX_QUESTION_LENGTH);
+                failed = 1;
+            }
+            strcpy(text, line + 3);
+            optionsSeen = 0;
+            correctOption = 0;
+            difficulty = DEFAULT_DIFFICULTY;
+            questionTags = 0;
+            tagged = 0;
+            questionLine = lineNumber;
+            pending = 1;
+        } else if (line[0] >= '1' && line[0] <= '4' && line[1] == ':' && line[2] == ' ') {
+            int option = line[0] - '1';
+            if (!pending || correctOption != 0 || (optionsSeen & (1 << option))) {
+                fprintf(stderr, "%s:%d: unexpected option line\n", sourcePath, lineNumber);
+                failed = 1;
+            } else if (length - 3 > MAX_OPTION_LENGTH) {
+                fprintf(stderr, "%s:%d: option is longer than %d characters\n", sourcePath, lineNumber, MAX_OPTION_LENGTH);
+                failed = 1;
+            } else {
+                strcpy(options[option], line + 3);
+                optionsSeen |= 1 << option;
+            }
+        } else if (strncmp(line, "A: ", 3) == 0) {
+            int answer = atoi(line + 3);
+            if (!pending || optionsSeen != 0xF || correctOption != 0) {
+                fprintf(stderr, "%s:%d: answer line must follow all four options\n", sourcePath, lineNumber);
+                failed = 1;
+            } else if (answer < 1 || answer > 4) {
+                fprintf(stderr, "%s:%d: correct option must be 1-4\n", sourcePath, lineNumber);
+                failed = 1;
+            } else {
+                correctOption = answer;
+            }
+        } else if (strncmp(line, "D: ", 3) == 0) {
+            int rating = atoi(line + 3);
+            if (!pending || correctOption == 0) {
+                fprintf(stderr, "%s:%d: difficulty line must follow the answer line\n", sourcePath, lineNumber);
+                failed = 1;
+            } else if (rating < 1 || rating > 5) {
+                fprintf(stderr, "%s:%d: difficulty must be 1-5\n", sourcePath, lineNumber);
+                failed = 1;
+            } else {
+                difficulty = rating;
+            }
+        } else if (strncmp(line, "T: ", 3) == 0) {
+            const char *problem = NULL;
+            if (!pending || correctOption == 0) {
+                problem = "tag line must follow the answer line";
+            } else if (tagged) {
+                problem = "question has more than one tag line";
+            } else {
+                problem = parseTagList(builder, line + 3, &questionTags);
+                tagged = 1;
+            }
+            if (problem != NULL) {
+                fprintf(stderr, "%s:%d: %s\n", sourcePath, lineNumber, problem);
+                failed = 1;
+            }
+        } else {
+            fprintf(stderr, "%s:%d: unrecognised line\n", sourcePath, lineNumber);
+            failed = 1;
+        }
+    }
+    fclose(source);
+
+    if (!failed && builder->count == 0) {
+        fprintf(stderr, "%s: no questions found\n", sourcePath);
+        failed = 1;
+    }
+    return failed ? -1 : 0;
+}
+
+// Reads a question source file and writes it out as a binary bank file,
+// reporting duplicate questions and optionally leaving them out of the index
+int buildQuestionBank(const char *sourcePath, const char *bankPath, int collapseDuplicates) {
+    BankBuilder builder;
+    memset(&builder, 0, sizeof(builder));
+    builder.collapseDuplicates = collapseDuplicates;
+    size_t imageSize = 0;
+    unsigned char *image = NULL;
+
+    int failed = parseQuestionSource(sourcePath, &builder) != 0;
+    if (!failed) {
+        long repeats = findDuplicates(&builder);
+        failed = repeats < 0;
+        printDuplicates(&builder, sourcePath, repeats);
+    }
+    if (!failed) {
+        image = serializeBank(&builder, &imageSize);
+        failed = image == NULL || writeBankFile(bankPath, image, imageSize) != 0;
+    }
+    QuestionBank bank;
+    if (!failed && attachQuestionBank(&bank, image, imageSize) == 0) {
+        printf("%zu questions, %zu distinct strings, %zu option sets, %zu bytes (%.1f bytes per question)\n",
+               builder.count, builder.strings.used, builder.setCount, imageSize,
+               (double)imageSize / builder.count);
+        size_t packed = bank.stringsSize + 8 + 4 * (size_t)bank.phraseCount + bank.phraseOffsets[bank.phraseCount];
+        printf("text compressed from %zu to %zu bytes (%.2fx) with a table of %u phrases\n",
+               builder.blob.size, packed, (double)builder.blob.size / packed, bank.phraseCount);
+    }
+
+    free(image);
+    freeBankBuilder(&builder);
+    return failed ? -1 : 0;
+}
+
+// Checks the header and section table of a bank image and points the bank
+// at the arrays inside it. Nothing is copied: the only per-question work is
+// a range check of the answer keys and difficulties, a byte each.
+int attachQuestionBank(QuestionBank *bank, const unsigned char *data, size_t size) {
+    memset(bank, 0, sizeof(*bank));
+
+    if (size < sizeof(BankHeader)) {
+        return -1;
+    }
+    const BankHeader *header = (const BankHeader *)data;
+    if (memcmp(header->magic, "MMQB", 4) != 0 || header->version != BANK_VERSION
+        || header->questionCount >= GENERATED_ID) {
+        return -1;
+    }
+    if (header->sectionCount > (size - sizeof(BankHeader)) / sizeof(BankSection)) {
+        return -1;
+    }
+
+    uint64_t count = header->questionCount;
+    const BankSection *sections = (const BankSection *)(data + sizeof(BankHeader));
+    for (uint32_t i = 0; i < header->sectionCount; i++) {
+        uint32_t sectionSize = sections[i].size;
+        if (sections[i].offset > size || sectionSize > size - sections[i].offset
+            || sections[i].offset % 4 != 0) {
+            return -1;
+        }
+        const unsigned char *start = data + sections[i].offset;
+        switch (sections[i].id) {
+            case SECTION_TEXT:
+                if (sectionSize != count * 4) return -1;
+                bank->text = (const uint32_t *)start;
+                break;
+            case SECTION_OPTIONS:
+                if (sectionSize != count * 4) return -1;
+                bank->optionSet = (const uint32_t *)start;
+                break;
+            case SECTION_OPTION_SETS:
+                if (sectionSize % 16 != 0) return -1;
+                bank->optionSets = (const uint32_t (*)[4])start;
+                bank->optionSetCount = sectionSize / 16;
+                break;
+            case SECTION_CORRECT:
+                if (sectionSize != count) return -1;
+                bank->correctOption = start;
+                break;
+            case SECTION_TAGS:
+                if (sectionSize % sizeof(BankTag) != 0) return -1;
+                bank->tags = (const BankTag *)start;
+                bank->tagCount = sectionSize / sizeof(BankTag);
+                break;
+            case SECTION_DIFFICULTY:
+                if (sectionSize != count) return -1;
+                bank->difficulty = start;
+                break;
+            case SECTION_STRINGS:
+                // The arena must end with a terminator so every offset inside it is a valid string
+                if (sectionSize == 0 || start[sectionSize - 1] != '\0') return -1;
+                bank->strings = (const char *)start;
+                bank->stringsSize = sectionSize;
+                break;
+            case SECTION_POSTINGS:
+                if (sections[i].offset % 8 != 0) return -1;
+                bank->postings = start;
+                bank->postingsSize = sectionSize;
+                break;
+            case SECTION_PHRASES: {
+                // The offsets must rise and stay inside the phrases that follow them
+                const uint32_t *counted = (const uint32_t *)start;
+                if (sectionSize < 8 || counted[0] > PHRASE_MAX || sectionSize < 8 + 4 * (uint64_t)counted[0]) return -1;
+                uint32_t bytes = sectionSize - 8 - 4 * counted[0];
+                for (uint32_t p = 0; p < counted[0]; p++) {
+                    if (counted[p + 1] > counted[p + 2]) return -1;
+                }
+                if (counted[1] != 0 || counted[counted[0] + 1] > bytes) return -1;
+                bank->phraseCount = counted[0];
+                bank->phraseOffsets = counted + 1;
+                bank->phrases = (const char *)(counted + 2 + counted[0]);
+                break;
+            }
+        }
+    }
+    if (!bank->text || !bank->optionSet || !bank->optionSets || !bank->correctOption
+        || !bank->tags || !bank->difficulty || !bank->strings || !bank->postings || !bank->phraseOffsets
+        || bank->tagCount < DIFFICULTY_LEVELS || bank->tagCount > MAX_TAGS + DIFFICULTY_LEVELS) {
+        memset(bank, 0, sizeof(*bank));
+        return -1;
+    }
+
+    // Answer keys and difficulties are used as indexes, so each must be in range
+    for (uint64_t i = 0; i < count; i++) {
+        if (bank->correctOption[i] < 1 || bank->correctOption[i] > 4
+            || bank->difficulty[i] < 1 || bank->difficulty[i] > DIFFICULTY_LEVELS) {
+            memset(bank, 0, sizeof(*bank));
+            return -1;
+        }
+    }
+
+    // Every index entry must point at a whole, aligned posting inside the section
+    bank->tagCount -= DIFFICULTY_LEVELS;
+    uint64_t words = (count + 63) / 64;
+    for (uint32_t t = 0; t < bank->tagCount + DIFFICULTY_LEVELS; t++) {
+        const BankTag *tag = &bank->tags[t];
+        uint64_t extent = tag->kind == POSTING_IDS ? (uint64_t)tag->count * 4
+                        : tag->kind == POSTING_BITS ? words * 8 : UINT64_MAX;
+        if (tag->offset % 8 != 0 || tag->offset > bank->postingsSize
+            || extent > bank->postingsSize - tag->offset || tag->count > count
+            || tag->name >= bank->stringsSize) {
+            memset(bank, 0, sizeof(*bank));
+            return -1;
+        }
+    }
+
+    bank->data = data;
+    bank->size = size;
+    bank->count = header->questionCount;
+    return 0;
+}
+
+// Maps a bank file into memory read-only and attaches to it in place
+int openQuestionBank(QuestionBank *bank, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        close(fd);
+        return -1;
+    }
+    void *data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+    if (attachQuestionBank(bank, data, (size_t)info.st_size) != 0) {
+        fprintf(stderr, "'%s' is not a valid question bank (expected version %d)\n", path, BANK_VERSION);
+        munmap(data, (size_t)info.st_size);
+        return -1;
+    }
+    bank->mapped = 1;
+    return 0;
+}
+
+// Reads a bank file into a memfd of its own and attaches to it, so writing
+// over the file later cannot change the bank under its readers. Returns -1
+// if the file cannot be read whole or is not a valid bank.
+int copyQuestionBank(QuestionBank *bank, const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat info;
+    size_t size = 0, done = 0;
+    int copy = -1;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        size = (size_t)info.st_size;
+        copy = memfd_create(BANK_COPY_NAME, MFD_CLOEXEC);
+    }
+    if (copy >= 0 && ftruncate(copy, (off_t)size) == 0) {
+        data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, copy, 0);
+    }
+    ssize_t got;
+    while (data != MAP_FAILED && done < size && (got = read(fd, (char *)data + done, size - done)) > 0) {
+        done += (size_t)got;
+    }
+    close(fd);
+    if (copy >= 0) close(copy);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+    // A file cut short while it was read is refused along with one that is not a bank
+    if (done != size || mprotect(data, size, PROT_READ) != 0 || attachQuestionBank(bank, data, size) != 0) {
+        fprintf(stderr, "'%s' is not a valid question bank (expected version %d)\n", path, BANK_VERSION);
+        munmap(data, size);
+        return -1;
+    }
+    bank->mapped = 1;
+    return 0;
+}
+
+// Releases the mapping behind a bank opened with openQuestionBank or copyQuestionBank
+void closeQuestionBank(QuestionBank *bank) {
+    if (bank->mapped) {
+        munmap((void *)bank->data, bank->size);
+    }
+    memset(bank, 0, sizeof(*bank));
+}
+
+// Resolves a string offset, falling back to an empty string if it is out of range
+static const char *bankString(const QuestionBank *bank, uint32_t offset) {
+    return offset < bank->stringsSize ? bank->strings + offset : "";
+}
+
+// Decodes a string of the arena into out, which has room for size bytes
+// with the terminator; anything past that is cut off. A byte below
+// PHRASE_CODE stands for itself, as does the byte after PHRASE_LITERAL, and
+// any other byte starts the code of a phrase.
+static const char *bankText(const QuestionBank *bank, uint32_t offset, char out[], size_t size) {
+    const unsigned char *in = (const unsigned char *)bankString(bank, offset);
+    size_t length = 0;
+    for (unsigned c = *in++; c != '\0'; c = *in++) {
+        uint32_t p;
+        if (c < PHRASE_CODE) {
+            if (length + 1 < size) {
+                out[length++] = (char)c;
+            }
+            continue;
+        } else if (c < PHRASE_LONG) {
+            p = c - PHRASE_CODE;
+        } else if (*in == '\0') {
+            break;              // A code cut short by the end of the string
+        } else if (c == PHRASE_LITERAL) {
+            if (length + 1 < size) {
+                out[length++] = (char)*in;
+            }
+            in++;
+            continue;
+        } else {
+            p = PHRASE_ONE_BYTE + (c - PHRASE_LONG) * 255 + *in++ - 1;
+        }
+        if (p < bank->phraseCount) {
+            size_t start = bank->phraseOffsets[p], phraseLength = bank->phraseOffsets[p + 1] - start;
+            if (phraseLength > size - 1 - length) {
+                phraseLength = size - 1 - length;
+            }
+            memcpy(out + length, bank->phrases + start, phraseLength);
+            length += phraseLength;
+        }
+    }
+    out[length] = '\0';
+    return out;
+}
+
+// Decodes one question of the bank into scratch. Only its own strings are
+// decoded, so the cost does not depend on the size of the bank.
+Question bankQuestion(const QuestionBank *bank, uint32_t id, QuestionText *scratch) {
+    Question q;
+    if (id >= bank->count) {
+        memset(&q, 0, sizeof(q));
+        q.question = q.options[0] = q.options[1] = q.options[2] = q.options[3] = "";
+        return q;
+    }
+    uint32_t set = bank->optionSet[id];
+    q.question = bankText(bank, bank->text[id], scratch->question, sizeof(scratch->question));
+    for (int i = 0; i < 4; i++) {
+        q.options[i] = set < bank->optionSetCount
+                     ? bankText(bank, bank->optionSets[set][i], scratch->options[i], sizeof(scratch->options[i])) : "";
+    }
+    q.correctOption = bank->correctOption[id];
+    return q;
+}
+
+// Questions each category draws its quizzes from, as tag queries
+static const char *categoryQueries[CATEGORY_COUNT] = {
+    "all",                      // IQ Test - every question in the bank
+    "math",                     // Math Quiz - ratio and mental math questions
+    "english"                   // English Quiz - vocabulary and grammar questions
+};
+
+// Builds the view of a category's questions by running its tag query. With
+// generated set, generators stand in for the stored questions they can make.
+int loadQuestions(const QuestionBank *bank, int category, int generated, QuestionView *view) {
+    if (category < 1 || category > CATEGORY_COUNT) {
+        category = 1;
+    }
+    char error[128];
+    const char *query = categoryQueries[category - 1];
+    if ((generated ? queryWithGenerators(bank, query, view, error, sizeof(error))
+                   : queryQuestions(bank, query, view, error, sizeof(error))) != 0) {
+        fprintf(stderr, "Category %d (%s): %s\n", category, categoryQueries[category - 1], error);
+        return -1;
+    }
+    return 0;
+}
+
+// Releases the id list a query allocated for the view
+void freeQuestionView(QuestionView *view) {
+    free(view->owned);
+    view->owned = NULL;
+    view->ids = NULL;
+    view->count = 0;
+    view->generated = 0;
+}
+
+// Starts a generator. Generators with the same seed but different streams
+// give unrelated sequences.
+void randomSeed(Random *rng, uint64_t seed, uint64_t stream) {
+    rng->state = 0;
+    rng->increment = (stream << 1) | 1;
+    randomNext(rng);
+    rng->state += seed;
+    randomNext(rng);
+}
+
+// Returns the next 32 random bits (PCG-XSH-RR)
+uint32_t randomNext(Random *rng) {
+    uint64_t old = rng->state;
+    rng->state = old * 6364136223846793005ULL + rng->increment;
+    uint32_t shifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+    uint32_t rotation = (uint32_t)(old >> 59);
+    return (shifted >> rotation) | (shifted << ((-rotation) & 31));
+}
+
+// Returns a number from 0 to bound - 1 with every value equally likely.
+// Multiplying instead of taking a remainder avoids a division in almost
+// every call; the rare draws that would favour some values are redone.
+uint32_t randomBelow(Random *rng, uint32_t bound) {
+    uint64_t product = (uint64_t)randomNext(rng) * bound;
+    uint32_t low = (uint32_t)product;
+    if (low < bound) {
+        uint32_t threshold = -bound % bound;
+        while (low < threshold) {
+            product = (uint64_t)randomNext(rng) * bound;
+            low = (uint32_t)product;
+        }
+    }
+    return (uint32_t)(product >> 32);
+}
+
+// Returns the question at a position of a view. Positions past the stored
+// ids stand for generated questions, and each one drawn gets a fresh seed.
+static uint32_t viewQuestion(const QuestionView *view, uint32_t position, Random *rng) {
+    if (position < (uint32_t)view->count) {
+        return view->ids[position];
+    }
+    uint32_t kind = 0;
+    while (position - (uint32_t)view->count >= (uint32_t)view->generatorEnd[kind]) {
+        kind++;
+    }
+    return GENERATED_ID | kind << GENERATED_SEED_BITS | randomNext(rng) >> (32 - GENERATED_SEED_BITS);
+}
+
+// Picks up to QUIZ_SIZE different questions from the view in random order.
+// This is a Fisher-Yates shuffle stopped after numQuestions steps, run over
+// a virtual array of positions: only the few positions that have been
+// swapped are remembered, so the cost does not depend on the size of the
+// view and the view itself is left untouched for other players to share.
+int drawQuiz(const QuestionView *view, uint32_t quiz[], int numQuestions, Random *rng) {
+    int available = view->count + view->generated;
+    if (numQuestions > QUIZ_SIZE) {
+        numQuestions = QUIZ_SIZE;
+    }
+    if (numQuestions > available) {
+        numQuestions = available;
+    }
+
+    uint32_t movedFrom[QUIZ_SIZE];  // Positions past the current step that were swapped...
+    uint32_t movedValue[QUIZ_SIZE]; // ...and the position each one now holds
+    int moved = 0;
+    for (int i = 0; i < numQuestions; i++) {
+        uint32_t j = (uint32_t)i + randomBelow(rng, (uint32_t)(available - i));
+        uint32_t valueI = (uint32_t)i, valueJ = j;
+        int slotJ = -1;
+        for (int m = 0; m < moved; m++) {
+            if (movedFrom[m] == (uint32_t)i) {
+                valueI = movedValue[m];
+            }
+            if (movedFrom[m] == j) {
+                valueJ = movedValue[m];
+                slotJ = m;
+            }
+        }
+        // Position i is never looked at again, so only j needs remembering
+        if (slotJ < 0) {
+            slotJ = moved++;
+            movedFrom[slotJ] = j;
+        }
+        movedValue[slotJ] = valueI;
+        quiz[i] = viewQuestion(view, valueJ, rng);
+    }
+    return numQuestions;
+}
+
+// ====================================
+// Function Implementations - Duplicate Detection
+// ====================================
+//
+// Run over a built bank before it is written out. Questions are compared
+// by the words of their text and options, lowercased and without
+// punctuation. Two questions with the same words and the same set of options
+// are exact duplicates. Near duplicates share most of their word pairs: each
+// question gets a MinHash signature, split into LSH bands, and only questions
+// landing in the same bucket of some band are compared, by counting the word
+// pairs they really share. Duplicate groups are joined with union-find and
+// headed by their first question.
+
+// 64-bit FNV-1a hash, continuing from an earlier hash
+static uint64_t hashBytes64(const void *data, size_t length, uint64_t hash) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Spreads the bits of a hash over the whole word (MurmurHash3's finalizer)
+static uint64_t mixHash(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static int isDuplicateWordChar(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c >= 0x80;
+}
+
+// Appends hashes of the word pairs of one field (a lone word counts as a
+// pair on its own) and returns the new count. *key is set to a hash of the
+// field's words in order.
+static int fieldShingles(const char *text, uint64_t shingles[], int count, uint64_t *key) {
+    uint64_t previous = 0;
+    int words = 0;
+    *key = 14695981039346656037ULL;
+    while (*text != '\0') {
+        if (!isDuplicateWordChar((unsigned char)*text)) {
+            text++;
+            continue;
+        }
+        uint64_t word = 14695981039346656037ULL;
+        for (; isDuplicateWordChar((unsigned char)*text); text++) {
+            unsigned char c = (unsigned char)*text;
+            c = c >= 'A' && c <= 'Z' ? c | 0x20 : c;
+            word = (word ^ c) * 1099511628211ULL;
+        }
+        *key = mixHash(*key ^ word);
+        if (words++ > 0 && count < MAX_SHINGLES) {
+            shingles[count++] = mixHash(previous * 31 + word);
+        }
+        previous = word;
+    }
+    if (words == 1 && count < MAX_SHINGLES) {
+        shingles[count++] = mixHash(previous * 31);
+    }
+    return count;
+}
+
+// Collects the word pairs of a built question and its options, and a key
+// that is the same for exact duplicates whatever order their options are in
+static int questionShingles(const BankBuilder *builder, size_t i, uint64_t shingles[], uint64_t *exactKey) {
+    uint64_t keys[5];
+    const uint32_t *options = builder->optionSets[builder->optionSet[i]];
+    int count = fieldShingles(builder->blob.data + builder->text[i], shingles, 0, &keys[0]);
+    for (int k = 0; k < 4; k++) {
+        count = fieldShingles(builder->blob.data + options[k], shingles, count, &keys[k + 1]);
+    }
+    for (int k = 2; k < 5; k++) {
+        for (int j = k; j > 1 && keys[j - 1] > keys[j]; j--) {
+            uint64_t swap = keys[j];
+            keys[j] = keys[j - 1];
+            keys[j - 1] = swap;
+        }
+    }
+    *exactKey = hashBytes64(keys, sizeof(keys), 14695981039346656037ULL);
+    return count;
+}
+
+static int compareHashes(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Orders key and question pairs by key, then question
+static int compareKeyedQuestions(const void *a, const void *b) {
+    const uint64_t *x = a, *y = b;
+    return x[0] != y[0] ? (x[0] > y[0]) - (x[0] < y[0]) : (x[1] > y[1]) - (x[1] < y[1]);
+}
+
+// Sorts a shingle list and drops repeats, returning the new count
+static int uniqueShingles(uint64_t shingles[], int count) {
+    qsort(shingles, count, sizeof(uint64_t), compareHashes);
+    int unique = 0;
+    for (int i = 0; i < count; i++) {
+        if (unique == 0 || shingles[unique - 1] != shingles[i]) {
+            shingles[unique++] = shingles[i];
+        }
+    }
+    return unique;
+}
+
+// Percentage of word pairs two questions share out of all they have between them
+static int questionSimilarity(const BankBuilder *builder, size_t a, size_t b) {
+    static uint64_t first[MAX_SHINGLES], second[MAX_SHINGLES];
+    uint64_t key;
+    int na = uniqueShingles(first, questionShingles(builder, a, first, &key));
+    int nb = uniqueShingles(second, questionShingles(builder, b, second, &key));
+    int shared = 0;
+    for (int i = 0, j = 0; i < na && j < nb; ) {
+        if (first[i] == second[j]) {
+            shared++;
+            i++;
+            j++;
+        } else if (first[i] < second[j]) {
+            i++;
+        } else {
+            j++;
+        }
+    }
+    int all = na + nb - shared;
+    return all > 0 ? shared * 100 / all : 100;
+}
+
+// Union-find root of a question, halving the path on the way
+static uint32_t duplicateRoot(uint32_t parent[], uint32_t i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+// Puts two groups together under whichever question comes first
+static void joinDuplicates(uint32_t parent[], uint32_t a, uint32_t b) {
+    a = duplicateRoot(parent, a);
+    b = duplicateRoot(parent, b);
+    if (a < b) {
+        parent[b] = a;
+    } else if (b < a) {
+        parent[a] = b;
+    }
+}
+
+// Fills builder->duplicateOf with the first question of every question's
+// group (the question itself when it has no duplicate) and marks exact
+// copies. Returns the number of questions that repeat an earlier one, or -1
+// when memory runs out.
+long findDuplicates(BankBuilder *builder) {
+    size_t n = builder->count;
+    uint32_t *parent = malloc((n ? n : 1) * sizeof(uint32_t));
+    uint8_t *exact = calloc(n ? n : 1, 1);
+    uint64_t *exactKeys = malloc((n ? n : 1) * 2 * sizeof(uint64_t));
+    uint64_t *buckets = malloc((n ? n : 1) * DUPLICATE_BANDS * sizeof(uint64_t));
+    if (parent == NULL || exact == NULL || exactKeys == NULL || buckets == NULL || n > UINT32_MAX) {
+        free(parent);
+        free(exact);
+        free(exactKeys);
+        free(buckets);
+        return -1;
+    }
+
+    // Signatures: each band's bucket goes in the top half of a word, the
+    // question in the bottom half, so sorting a band lines buckets up
+    static uint64_t shingles[MAX_SHINGLES];
+    const int rows = DUPLICATE_HASHES / DUPLICATE_BANDS;
+    for (size_t i = 0; i < n; i++) {
+        parent[i] = (uint32_t)i;
+        int count = questionShingles(builder, i, shingles, &exactKeys[2 * i]);
+        exactKeys[2 * i + 1] = i;
+        uint32_t minimum[DUPLICATE_HASHES];
+        memset(minimum, 0xff, sizeof(minimum));
+        for (int s = 0; s < count; s++) {
+            // The hash functions are h1 + k * h2 for two hashes of the
+            // pair, scrambled so that they order pairs independently
+            uint64_t step = mixHash(shingles[s]) | 1;
+            uint64_t value = shingles[s];
+            for (int h = 0; h < DUPLICATE_HASHES; h++, value += step) {
+                uint64_t mixed = (value ^ (value >> 31)) * 0x9e3779b97f4a7c15ULL;
+                uint32_t hash = (uint32_t)(mixed >> 32);
+                minimum[h] = hash < minimum[h] ? hash : minimum[h];
+            }
+        }
+        for (int band = 0; band < DUPLICATE_BANDS; band++) {
+            uint64_t bucket = hashBytes(&minimum[band * rows], rows * sizeof(uint32_t));
+            buckets[band * n + i] = bucket << 32 | i;
+        }
+    }
+
+    // Exact duplicates share their key
+    qsort(exactKeys, n, 2 * sizeof(uint64_t), compareKeyedQuestions);
+    for (size_t i = 1; i < n; i++) {
+        if (exactKeys[2 * i] == exactKeys[2 * (i - 1)]) {
+            uint32_t later = (uint32_t)exactKeys[2 * i + 1];
+            joinDuplicates(parent, (uint32_t)exactKeys[2 * (i - 1) + 1], later);
+            exact[later] = 1;
+        }
+    }
+
+    // Near duplicates: questions sharing a bucket in any band are compared
+    // with a few of the questions before them in that bucket
+    for (int band = 0; band < DUPLICATE_BANDS; band++) {
+        uint64_t *sorted = buckets + band * n;
+        qsort(sorted, n, sizeof(uint64_t), compareHashes);
+        for (size_t i = 1; i < n; i++) {
+            uint32_t question = (uint32_t)sorted[i];
+            for (size_t j = i; j > 0 && i - j < DUPLICATE_WINDOW && (sorted[j - 1] >> 32) == (sorted[i] >> 32); j--) {
+                uint32_t other = (uint32_t)sorted[j - 1];
+                if (duplicateRoot(parent, question) != duplicateRoot(parent, other)
+                    && questionSimilarity(builder, question, other) >= DUPLICATE_SIMILARITY) {
+                    joinDuplicates(parent, question, other);
+                }
+            }
+        }
+    }
+
+    long repeats = 0;
+    for (size_t i = 0; i < n; i++) {
+        parent[i] = duplicateRoot(parent, (uint32_t)i);
+        repeats += parent[i] != i;
+    }
+    free(exactKeys);
+    free(buckets);
+    free(builder->duplicateOf);
+    free(builder->exactDuplicate);
+    builder->duplicateOf = parent;
+    builder->exactDuplicate = exact;
+    return repeats;
+}
+
+// Lists the duplicate groups findDuplicates found, by source line
+void printDuplicates(const BankBuilder *builder, const char *sourcePath, long repeats) {
+    size_t n = builder->count;
+    uint8_t *listed = repeats > 0 ? calloc(n, 1) : NULL;
+    if (listed == NULL) {
+        return;
+    }
+    long groups = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t first = builder->duplicateOf[i];
+        if (first == i || listed[first]) {
+            continue;
+        }
+
+        // The first repeat of a group lists the whole group
+        listed[first] = 1;
+        if (++groups > DUPLICATE_REPORT_LIMIT) {
+            continue;
+        }
+        printf("  line %u is repeated at line", builder->sourceLine[first]);
+        const char *separator = " ";
+        for (size_t j = i; j < n; j++) {
+            if (builder->duplicateOf[j] == first) {
+                printf("%s%u (%s)", separator, builder->sourceLine[j], builder->exactDuplicate[j] ? "exact" : "near");
+                separator = ", ";
+            }
+        }
+        printf("\n");
+    }
+    if (groups > DUPLICATE_REPORT_LIMIT) {
+        printf("  ... and %ld more groups\n", groups - DUPLICATE_REPORT_LIMIT);
+    }
+    printf("%s: %ld duplicate groups, %ld questions repeat an earlier one%s\n", sourcePath, groups, repeats,
+           builder->collapseDuplicates ? " and were left out of every category" : "");
+    free(listed);
+}
+
+
+// ====================================
+// Function Implementations - Tag Queries
+// ====================================
+//
+// A query picks questions by their tags:
+//
+//     math AND NOT ratio
+//     grammar OR vocabulary, difficulty >= 3
+//
+// NOT binds tightest, then AND, then OR, and a comma is an AND that binds
+// loosest of all. Parentheses group, "all" is every question and
+// "difficulty" compares with =, !=, <, <=, > or >= (also written ≤ and ≥).
+// Keywords and tags may be written in any case. The query is parsed into a
+// handful of nodes, then evaluated a 64-bit word at a time over the bitsets
+// of the tag index, so its cost depends on the size of the bank divided by
+// 64 and not on the questions themselves.
+
+enum {
+    QUERY_ALL,                  // Every question
+    QUERY_TAG,                  // The questions of one tag
+    QUERY_LEVELS,               // The questions with a difficulty from minLevel to maxLevel
+    QUERY_NOT,
+    QUERY_AND,
+    QUERY_OR
+};
+
+typedef struct {
+    int kind;                   // One of the QUERY_ values
+    int left, right;            // Operands, as indexes of other nodes (NOT only uses left)
+    const BankTag *tag;         // Index entry of a QUERY_TAG node
+    int minLevel, maxLevel;     // Range of a QUERY_LEVELS node
+} QueryNode;
+
+typedef struct {
+    const QuestionBank *bank;
+    const char *next;           // Rest of the query text
+    int depth;                  // Nesting of the part being parsed
+    QueryNode nodes[MAX_QUERY_NODES];
+    int count;
+    char *error;                // First error found, for the caller
+    int errorSize;
+    int failed;
+} QueryParser;
+
+static int parseQueryList(QueryParser *parser);
+
+// Records the first error in a query and returns -1
+static int queryError(QueryParser *parser, const char *format, ...) {
+    if (!parser->failed && parser->errorSize > 0) {
+        va_list args;
+        va_start(args, format);
+        vsnprintf(parser->error, parser->errorSize, format, args);
+        va_end(args);
+    }
+    parser->failed = 1;
+    return -1;
+}
+
+static int addQueryNode(QueryParser *parser, int kind, int left, int right) {
+    if (parser->count == MAX_QUERY_NODES) {
+        return queryError(parser, "query is too long");
+    }
+    QueryNode *node = &parser->nodes[parser->count];
+    memset(node, 0, sizeof(*node));
+    node->kind = kind;
+    node->left = left;
+    node->right = right;
+    return parser->count++;
+}
+
+static int isQueryWordChar(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// Length of the word at the start of the rest of the query, after blanks
+static int queryWordLength(QueryParser *parser) {
+    while (*parser->next == ' ' || *parser->next == '\t') {
+        parser->next++;
+    }
+    int length = 0;
+    while (isQueryWordChar(parser->next[length])) {
+        length++;
+    }
+    return length;
+}
+
+// Consumes the keyword if it comes next
+static int acceptKeyword(QueryParser *parser, const char *keyword) {
+    int length = queryWordLength(parser);
+    if (length == (int)strlen(keyword) && strncasecmp(parser->next, keyword, length) == 0) {
+        parser->next += length;
+        return 1;
+    }
+    return 0;
+}
+
+// Consumes the symbol if it comes next
+static int acceptSymbol(QueryParser *parser, const char *symbol) {
+    queryWordLength(parser);
+    size_t length = strlen(symbol);
+    if (strncmp(parser->next, symbol, length) == 0) {
+        parser->next += length;
+        return 1;
+    }
+    return 0;
+}
+
+// "difficulty" followed by a comparison with a level
+static int parseDifficulty(QueryParser *parser) {
+    static const struct { const char *symbol; int below, equal, above; } comparisons[] = {
+        {">=", 0, 1, 1}, {"\xe2\x89\xa5", 0, 1, 1}, {"<=", 1, 1, 0}, {"\xe2\x89\xa4", 1, 1, 0},
+        {"!=", 1, 0, 1}, {"==", 0, 1, 0}, {"=", 0, 1, 0}, {">", 0, 0, 1}, {"<", 1, 0, 0}
+    };
+    int c = 0;
+    int count = (int)(sizeof(comparisons) / sizeof(comparisons[0]));
+    while (c < count && !acceptSymbol(parser, comparisons[c].symbol)) {
+        c++;
+    }
+    int length = queryWordLength(parser);
+    int level = length == 1 ? parser->next[0] - '0' : -1;
+    if (c == count || level < 1 || level > DIFFICULTY_LEVELS) {
+        return queryError(parser, "difficulty must be compared with a level from 1 to %d, as in difficulty>=3",
+                          DIFFICULTY_LEVELS);
+    }
+    parser->next += length;
+
+    // != is the only comparison that is not one range of levels
+    if (comparisons[c].below && comparisons[c].above && !comparisons[c].equal) {
+        int node = addQueryNode(parser, QUERY_LEVELS, 0, 0);
+        if (node < 0) {
+            return -1;
+        }
+        parser->nodes[node].minLevel = parser->nodes[node].maxLevel = level;
+        return addQueryNode(parser, QUERY_NOT, node, 0);
+    }
+    int node = addQueryNode(parser, QUERY_LEVELS, 0, 0);
+    if (node >= 0) {
+        parser->nodes[node].minLevel = comparisons[c].below ? 1 : comparisons[c].equal ? level : level + 1;
+        parser->nodes[node].maxLevel = comparisons[c].above ? DIFFICULTY_LEVELS : comparisons[c].equal ? level : level - 1;
+    }
+    return node;
+}
+
+// NOT factor | ( list ) | all | difficulty comparison | tag
+static int parseQueryFactor(QueryParser *parser) {
+    if (++parser->depth > MAX_QUERY_NODES) {
+        return queryError(parser, "query is nested too deeply");
+    }
+    int node;
+    if (acceptKeyword(parser, "not")) {
+        node = parseQueryFactor(parser);
+        node = node < 0 ? -1 : addQueryNode(parser, QUERY_NOT, node, 0);
+    } else if (acceptSymbol(parser, "(")) {
+        node = parseQueryList(parser);
+        if (node >= 0 && !acceptSymbol(parser, ")")) {
+            node = queryError(parser, "missing ')'");
+        }
+    } else if (acceptKeyword(parser, "all")) {
+        node = addQueryNode(parser, QUERY_ALL, 0, 0);
+    } else if (acceptKeyword(parser, "difficulty")) {
+        node = parseDifficulty(parser);
+    } else {
+        int length = queryWordLength(parser);
+        if (length == 0) {
+            node = *parser->next ? queryError(parser, "expected a tag at '%s'", parser->next)
+                                 : queryError(parser, "expected a tag at the end of the query");
+        } else {
+            const QuestionBank *bank = parser->bank;
+            uint32_t t = 0;
+            while (t < bank->tagCount) {
+                const char *name = bankString(bank, bank->tags[t].name);
+                if (strncasecmp(name, parser->next, length) == 0 && name[length] == '\0') {
+                    break;
+                }
+                t++;
+            }
+            if (t == bank->tagCount) {
+                node = queryError(parser, "unknown tag '%.*s'", length, parser->next);
+            } else {
+                parser->next += length;
+                node = addQueryNode(parser, QUERY_TAG, 0, 0);
+                if (node >= 0) {
+                    parser->nodes[node].tag = &bank->tags[t];
+                }
+            }
+        }
+    }
+    parser->depth--;
+    return node;
+}
+
+// factor { AND factor }
+static int parseQueryAnd(QueryParser *parser) {
+    int node = parseQueryFactor(parser);
+    while (node >= 0 && acceptKeyword(parser, "and")) {
+        int right = parseQueryFactor(parser);
+        node = right < 0 ? -1 : addQueryNode(parser, QUERY_AND, node, right);
+    }
+    return node;
+}
+
+// and-expression { OR and-expression }
+static int parseQueryOr(QueryParser *parser) {
+    int node = parseQueryAnd(parser);
+    while (node >= 0 && acceptKeyword(parser, "or")) {
+        int right = parseQueryAnd(parser);
+        node = right < 0 ? -1 : addQueryNode(parser, QUERY_OR, node, right);
+    }
+    return node;
+}
+
+// or-expression { , or-expression }
+static int parseQueryList(QueryParser *parser) {
+    int node = parseQueryOr(parser);
+    while (node >= 0 && acceptSymbol(parser, ",")) {
+        int right = parseQueryOr(parser);
+        node = right < 0 ? -1 : addQueryNode(parser, QUERY_AND, node, right);
+    }
+    return node;
+}
+
+// ORs the questions of one index entry into a bitset
+static void orPosting(const QuestionBank *bank, const BankTag *tag, uint64_t *bits, size_t words) {
+    if (tag->kind == POSTING_BITS) {
+        const uint64_t *posting = (const uint64_t *)(bank->postings + tag->offset);
+        for (size_t w = 0; w < words; w++) {
+            bits[w] |= posting[w];
+        }
+    } else {
+        const uint32_t *ids = (const uint32_t *)(bank->postings + tag->offset);
+        for (uint32_t i = 0; i < tag->count; i++) {
+            if (ids[i] < bank->count) {
+                bits[ids[i] / 64] |= 1ULL << (ids[i] % 64);
+            }
+        }
+    }
+}
+
+// The bitset a right-hand operand can be combined straight from: a tag
+// stored as a bitset, or NOT of one (then *flip inverts it). NULL if the
+// operand has to be evaluated into scratch space first.
+static const uint64_t *directOperand(const QuestionBank *bank, const QueryNode *nodes, int index, uint64_t *flip) {
+    const QueryNode *node = &nodes[index];
+    *flip = 0;
+    if (node->kind == QUERY_NOT) {
+        node = &nodes[node->left];
+        *flip = ~0ULL;
+    }
+    if (node->kind == QUERY_TAG && node->tag->kind == POSTING_BITS) {
+        return (const uint64_t *)(bank->postings + node->tag->offset);
+    }
+    return NULL;
+}
+
+// Scratch bitsets evaluating a node needs besides the one it writes to
+static int queryScratchNeeded(const QuestionBank *bank, const QueryNode *nodes, int index) {
+    const QueryNode *node = &nodes[index];
+    uint64_t flip;
+    switch (node->kind) {
+        case QUERY_NOT:
+            return queryScratchNeeded(bank, nodes, node->left);
+        case QUERY_AND:
+        case QUERY_OR: {
+            int left = queryScratchNeeded(bank, nodes, node->left);
+            if (directOperand(bank, nodes, node->right, &flip) != NULL) {
+                return left;
+            }
+            int right = 1 + queryScratchNeeded(bank, nodes, node->right);
+            return left > right ? left : right;
+        }
+        default:
+            return 0;
+    }
+}
+
+// Evaluates a query node into a bitset, using the bitsets after scratch for
+// right-hand operands. Bits past the last question may be left set and are
+// cleared by the caller.
+static void evalQueryNode(const QuestionBank *bank, const QueryNode *nodes, int index,
+                          uint64_t *bits, uint64_t *scratch, size_t words) {
+    const QueryNode *node = &nodes[index];
+    switch (node->kind) {
+        case QUERY_ALL:
+            memset(bits, 0xff, words * sizeof(uint64_t));
+            return;
+        case QUERY_TAG:
+            memset(bits, 0, words * sizeof(uint64_t));
+            orPosting(bank, node->tag, bits, words);
+            return;
+        case QUERY_LEVELS:
+            memset(bits, 0, words * sizeof(uint64_t));
+            for (int level = node->minLevel; level <= node->maxLevel; level++) {
+                orPosting(bank, &bank->tags[bank->tagCount + level - 1], bits, words);
+            }
+            return;
+        case QUERY_NOT:
+            evalQueryNode(bank, nodes, node->left, bits, scratch, words);
+            for (size_t w = 0; w < words; w++) {
+                bits[w] = ~bits[w];
+            }
+            return;
+    }
+
+    evalQueryNode(bank, nodes, node->left, bits, scratch, words);
+    uint64_t flip;
+    const uint64_t *operand = directOperand(bank, nodes, node->right, &flip);
+    if (operand == NULL) {
+        evalQueryNode(bank, nodes, node->right, scratch, scratch + words, words);
+        operand = scratch;
+    }
+    if (node->kind == QUERY_AND) {
+        for (size_t w = 0; w < words; w++) {
+            bits[w] &= operand[w] ^ flip;
+        }
+    } else {
+        for (size_t w = 0; w < words; w++) {
+            bits[w] |= operand[w] ^ flip;
+        }
+    }
+}
+
+// Runs a tag query over the bank and points the view at the ids it selects,
+// in bank order. Returns -1 with a message in error if the query is not
+// valid for this bank or memory runs out. The view must be released with
+// freeQuestionView.
+int queryQuestions(const QuestionBank *bank, const char *query, QuestionView *view,
+                   char error[], int errorSize) {
+    memset(view, 0, sizeof(*view));
+    view->bank = bank;
+    QueryParser parser;
+    memset(&parser, 0, sizeof(parser));
+    parser.bank = bank;
+    parser.next = query;
+    parser.error = error;
+    parser.errorSize = errorSize;
+
+    int root = parseQueryList(&parser);
+    if (root >= 0 && queryWordLength(&parser) == 0 && *parser.next != '\0') {
+        root = queryError(&parser, "unexpected '%s'", parser.next);
+    } else if (root >= 0 && *parser.next != '\0') {
+        root = queryError(&parser, "expected AND, OR or ',' before '%s'", parser.next);
+    }
+    if (root < 0) {
+        return -1;
+    }
+
+    // One block holds the result and every scratch bitset the query needs,
+    // with at least one scratch bitset for the questions left to select from
+    size_t words = ((size_t)bank->count + 63) / 64;
+    int needed = queryScratchNeeded(bank, parser.nodes, root);
+    size_t bitsets = 1 + (size_t)(needed > 0 ? needed : 1);
+    uint64_t *bits = malloc(words ? bitsets * words * sizeof(uint64_t) : 1);
+    size_t capacity = 1024;
+    uint32_t *ids = malloc(capacity * sizeof(uint32_t));
+    if (bits == NULL || ids == NULL) {
+        free(bits);
+        free(ids);
+        snprintf(error, errorSize, "not enough memory");
+        return -1;
+    }
+    evalQueryNode(bank, parser.nodes, root, bits, bits + words, words);
+    if (bank->count % 64 != 0) {
+        bits[words - 1] &= (1ULL << (bank->count % 64)) - 1;
+    }
+
+    // Duplicates collapsed when the bank was built have no difficulty level,
+    // so "all" and NOT must not bring them back
+    uint64_t listed = 0;
+    for (int level = 0; level < DIFFICULTY_LEVELS; level++) {
+        listed += bank->tags[bank->tagCount + level].count;
+    }
+    if (listed < bank->count) {
+        uint64_t *selectable = bits + words;
+        memset(selectable, 0, words * sizeof(uint64_t));
+        for (int level = 0; level < DIFFICULTY_LEVELS; level++) {
+            orPosting(bank, &bank->tags[bank->tagCount + level], selectable, words);
+        }
+        for (size_t w = 0; w < words; w++) {
+            bits[w] &= selectable[w];
+        }
+    }
+
+    // Ids are collected in one pass, growing the list as it fills
+    size_t selected = 0;
+    for (size_t w = 0; w < words; w++) {
+        for (uint64_t word = bits[w]; word != 0; word &= word - 1) {
+            if (selected == capacity) {
+                uint32_t *grown = realloc(ids, 2 * capacity * sizeof(uint32_t));
+                if (grown == NULL) {
+                    free(bits);
+                    free(ids);
+                    snprintf(error, errorSize, "not enough memory");
+                    return -1;
+                }
+                ids = grown;
+                capacity *= 2;
+            }
+            ids[selected++] = (uint32_t)(w * 64 + (size_t)__builtin_ctzll(word));
+        }
+    }
+    free(bits);
+
+    view->ids = view->owned = ids;
+    view->count = (int)selected;
+    return 0;
+}
+
+
+// ====================================
+// Function Implementations - Question Generators
+// ====================================
+//
+// Sequence, ratio and mental math questions follow a few fixed patterns, so
+// besides the stored ones the game can make up as many as it needs. A
+// generated question is named by an id with GENERATED_ID set, the generator
+// in the next three bits and a seed in the low GENERATED_SEED_BITS: the same
+// id always gives the same question, so a quiz is still a short list of ids
+// and nothing has to be stored. Each generator works out the answer itself
+// and takes its distractors from the slips people make with that kind of
+// question.
+
+// Tags of the stored questions each generator can stand in for
+static const char *generatorTags[GENERATOR_COUNT] = {"sequence", "ratio", "mental_math"};
+
+enum {
+    OPTION_NUMBER,              // "48"
+    OPTION_PAIR,                // "64, 81"
+    OPTION_RATIO                // "2:1"
+};
+
+// Writers for generated text. Every template and number a generator uses
+// is short enough for the buffers, so they need no bounds checks.
+static char *putText(char *at, const char *text) {
+    while (*text != '\0') {
+        *at++ = *text++;
+    }
+    *at = '\0';
+    return at;
+}
+
+static char *putNumber(char *at, long value) {
+    char digits[24];
+    int length = 0;
+    unsigned long magnitude = value < 0 ? 0UL - (unsigned long)value : (unsigned long)value;
+    do {
+        digits[length++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (value < 0) {
+        *at++ = '-';
+    }
+    while (length > 0) {
+        *at++ = digits[--length];
+    }
+    *at = '\0';
+    return at;
+}
+
+static long greatestCommonDivisor(long a, long b) {
+    while (b != 0) {
+        long rest = a % b;
+        a = b;
+        b = rest;
+    }
+    return a;
+}
+
+// Fills in the options from a list of candidates, the first of them the
+// right answer, and shuffles them. Candidates that repeat an earlier one or
+// make no sense (negative, or a zero in a ratio) are skipped; if too few are
+// left, the answer shifted by one, two and so on makes up the rest.
+static void placeOptions(GeneratedQuestion *out, Random *rng, const long candidates[][2], int count, int format) {
+    long chosen[4][2];
+    int picked = 0;
+    for (int i = 0; picked < 4; i++) {
+        long first = candidates[0][0], second = candidates[0][1];
+        if (i < count) {
+            first = candidates[i][0];
+            second = candidates[i][1];
+        } else {
+            long shift = (i - count) / 2 + 1;
+            shift = (i - count) % 2 ? -shift : shift;
+            first += shift;
+            second += format == OPTION_NUMBER ? 0 : shift;
+        }
+        int usable = first >= (format == OPTION_RATIO) && second >= (format == OPTION_RATIO);
+        for (int j = 0; j < picked && usable; j++) {
+            usable = chosen[j][0] != first || chosen[j][1] != second;
+        }
+        if (usable) {
+            chosen[picked][0] = first;
+            chosen[picked][1] = second;
+            picked++;
+        }
+    }
+
+    int order[4] = {0, 1, 2, 3};
+    for (int i = 3; i > 0; i--) {
+        int j = (int)randomBelow(rng, (uint32_t)i + 1);
+        int swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+    }
+    for (int slot = 0; slot < 4; slot++) {
+        const long *option = chosen[order[slot]];
+        char *at = putNumber(out->options[slot], option[0]);
+        if (format == OPTION_PAIR) {
+            putNumber(putText(at, ", "), option[1]);
+        } else if (format == OPTION_RATIO) {
+            putNumber(putText(at, ":"), option[1]);
+        }
+        out->question.options[slot] = out->options[slot];
+        if (order[slot] == 0) {
+            out->question.correctOption = slot + 1;
+        }
+    }
+}
+
+// Six terms of a sequence, asking for the two that come next
+static void generateSequence(GeneratedQuestion *out, Random *rng) {
+    static const char *prompts[] = {
+        "Look carefully for the pattern, and then choose which pair of numbers comes next: ",
+        "What is the next pair in the sequence? ",
+        "Which two numbers continue the sequence? "
+    };
+    long terms[8];
+    long start = 1 + randomBelow(rng, 9);
+    long step = 2 + randomBelow(rng, 8);
+    switch (randomBelow(rng, 6)) {
+        case 0: // Adding the same number each time
+            for (int i = 0; i < 8; i++) {
+                terms[i] = start + i * step;
+            }
+            out->difficulty = 1;
+            break;
+        case 1: // Multiplying by 2 or 3
+            terms[0] = start;
+            for (int i = 1; i < 8; i++) {
+                terms[i] = terms[i - 1] * (2 + step % 2);
+            }
+            out->difficulty = 2;
+            break;
+        case 2: // Squares, possibly moved up
+            for (int i = 0; i < 8; i++) {
+                terms[i] = (i + start % 4 + 1) * (i + start % 4 + 1) + step % 6;
+            }
+            out->difficulty = 2;
+            break;
+        case 3: // The difference grows by one each time
+            terms[0] = start;
+            for (int i = 1; i < 8; i++) {
+                terms[i] = terms[i - 1] + step % 4 + i;
+            }
+            out->difficulty = 3;
+            break;
+        case 4: // Doubling and adding
+            terms[0] = start;
+            for (int i = 1; i < 8; i++) {
+                terms[i] = 2 * terms[i - 1] + step % 3 + 1;
+            }
+            out->difficulty = 4;
+            break;
+        default: // Each number is the sum of the two before it
+            terms[0] = start % 5 + 1;
+            terms[1] = terms[0] + step % 4;
+            for (int i = 2; i < 8; i++) {
+                terms[i] = terms[i - 2] + terms[i - 1];
+            }
+            out->difficulty = 4;
+            break;
+    }
+
+    char *at = putText(out->text, prompts[randomBelow(rng, 3)]);
+    for (int i = 0; i < 6; i++) {
+        at = putNumber(at, terms[i]);
+        at = i < 5 ? putText(at, ", ") : at;
+    }
+
+    // Wrong answers: keeping the last difference, getting only the first
+    // number right, and doubling the last number shown
+    long difference = terms[5] - terms[4];
+    const long candidates[][2] = {
+        {terms[6], terms[7]},
+        {terms[5] + difference, terms[5] + 2 * difference},
+        {terms[6], terms[6] + terms[6] - terms[5]},
+        {terms[5] * 2, terms[5] * 4}
+    };
+    placeOptions(out, rng, candidates, 4, OPTION_PAIR);
+}
+
+// Two amounts in a ratio of small coprime numbers, asking for the ratio
+static void generateRatio(GeneratedQuestion *out, Random *rng) {
+    static const char *contexts[][5] = {
+        {"A newspaper includes ", "pages of sport", "pages of TV", "sport", "TV"},
+        {"A magazine includes ", "pages of fashion", "pages of lifestyle", "fashion", "lifestyle"},
+        {"A class has ", "boys", "girls", "boys", "girls"},
+        {"A recipe uses ", "grams of flour", "grams of sugar", "flour", "sugar"},
+        {"A bag holds ", "red marbles", "blue marbles", "red marbles", "blue marbles"},
+        {"A car park has ", "cars", "vans", "cars", "vans"},
+        {"A library shelf holds ", "novels", "atlases", "novels", "atlases"},
+        {"A fruit bowl has ", "apples", "pears", "apples", "pears"}
+    };
+    long p, q;
+    do {
+        p = 1 + randomBelow(rng, 9);
+        q = 1 + randomBelow(rng, 9);
+    } while (p == q || greatestCommonDivisor(p, q) != 1);
+    long times = 2 + randomBelow(rng, 11);
+    const char **context = contexts[randomBelow(rng, 8)];
+
+    char *at = putText(out->text, context[0]);
+    at = putText(putText(putNumber(at, p * times), " "), context[1]);
+    at = putText(putText(putNumber(putText(at, " and "), q * times), " "), context[2]);
+    at = putText(putText(putText(at, ". What is the ratio of "), context[3]), " to ");
+    putText(putText(at, context[4]), " in its simplest form?");
+    out->difficulty = 1 + (times > 6) + (p > 4 || q > 4);
+
+    // Wrong answers: the ratio the wrong way round, one amount to the
+    // total, and a ratio that is not fully simplified
+    const long candidates[][2] = {{p, q}, {q, p}, {p, p + q}, {2 * p, 2 * q}};
+    placeOptions(out, rng, candidates, 4, OPTION_RATIO);
+}
+
+// Times tables, sums and differences, or fractions and percentages of amounts
+static void generateMentalMath(GeneratedQuestion *out, Random *rng) {
+    static const long percents[] = {5, 10, 15, 20, 25, 50, 75};
+    long a, b, answer;
+    long candidates[5][2] = {{0, 0}};
+    char *at = putText(out->text, "What is ");
+    switch (randomBelow(rng, 6)) {
+        case 0: // Neighbouring results of the times tables
+            a = 2 + randomBelow(rng, 11);
+            b = 2 + randomBelow(rng, 11);
+            answer = a * b;
+            putText(putNumber(putText(putNumber(at, a), " multiplied by "), b), "?");
+            candidates[1][0] = a * (b + 1);
+            candidates[2][0] = a * (b - 1);
+            candidates[3][0] = (a + 1) * b;
+            candidates[4][0] = answer + 10;
+            out->difficulty = 1 + (a > 9 && b > 9);
+            break;
+        case 1: // A result one or two away
+            b = 2 + randomBelow(rng, 11);
+            answer = 2 + randomBelow(rng, 11);
+            putText(putNumber(putText(putNumber(at, answer * b), " divided by "), b), "?");
+            candidates[1][0] = answer + 1;
+            candidates[2][0] = answer - 1;
+            candidates[3][0] = answer + 2;
+            candidates[4][0] = answer - 2;
+            out->difficulty = 2;
+            break;
+        case 2: // A carry missed or added
+            a = 10 + randomBelow(rng, 190);
+            b = 10 + randomBelow(rng, 190);
+            answer = a + b;
+            putText(putNumber(putText(putNumber(at, a), " plus "), b), "?");
+            candidates[1][0] = answer + 10;
+            candidates[2][0] = answer - 10;
+            candidates[3][0] = answer + 1;
+            candidates[4][0] = answer - 1;
+            out->difficulty = 1;
+            break;
+        case 3: // A borrow missed or added
+            a = 50 + randomBelow(rng, 450);
+            b = 10 + randomBelow(rng, (uint32_t)a - 20);
+            answer = a - b;
+            putText(putNumber(putText(putNumber(at, a), " minus "), b), "?");
+            candidates[1][0] = answer + 10;
+            candidates[2][0] = answer - 10;
+            candidates[3][0] = answer + 1;
+            candidates[4][0] = answer - 1;
+            out->difficulty = 2;
+            break;
+        case 4: { // Fractions of amounts that divide exactly
+            long top[2], bottom[2], part[2];
+            for (int i = 0; i < 2; i++) {
+                bottom[i] = 2 + randomBelow(rng, 9);
+                do {
+                    top[i] = 1 + randomBelow(rng, (uint32_t)bottom[i] - 1);
+                } while (greatestCommonDivisor(top[i], bottom[i]) != 1);
+                part[i] = bottom[i] * (2 + randomBelow(rng, 14));
+            }
+            int minus = part[0] * top[0] / bottom[0] > part[1] * top[1] / bottom[1] && randomBelow(rng, 2);
+            for (int i = 0; i < 2; i++) {
+                at = putNumber(putText(putNumber(at, top[i]), "/"), bottom[i]);
+                at = putNumber(putText(at, " of "), part[i]);
+                at = putText(at, i == 0 ? (minus ? " minus " : " plus ") : "?");
+            }
+            long sign = minus ? -1 : 1;
+            answer = part[0] * top[0] / bottom[0] + sign * part[1] * top[1] / bottom[1];
+            candidates[1][0] = part[0] / bottom[0] + sign * part[1] / bottom[1];
+            candidates[2][0] = answer + 5;
+            candidates[3][0] = answer - 5;
+            candidates[4][0] = answer + 10;
+            out->difficulty = 4;
+            break;
+        }
+        default: { // Percentages of multiples of 20, so every part is whole
+            long percent[2], amount[2];
+            for (int i = 0; i < 2; i++) {
+                percent[i] = percents[randomBelow(rng, 7)];
+                amount[i] = 20 * (1 + randomBelow(rng, 20));
+            }
+            int minus = percent[0] * amount[0] > percent[1] * amount[1] && randomBelow(rng, 2);
+            for (int i = 0; i < 2; i++) {
+                at = putNumber(putText(putNumber(at, percent[i]), "% of "), amount[i]);
+                at = putText(at, i == 0 ? (minus ? " minus " : " plus ") : "?");
+            }
+            long sign = minus ? -1 : 1;
+            answer = (percent[0] * amount[0] + sign * percent[1] * amount[1]) / 100;
+            candidates[1][0] = answer + 5;
+            candidates[2][0] = answer - 5;
+            candidates[3][0] = answer + 10;
+            candidates[4][0] = (percent[0] * amount[0] - sign * percent[1] * amount[1]) / 100;
+            out->difficulty = 3;
+            break;
+        }
+    }
+    candidates[0][0] = answer;
+    placeOptions(out, rng, (const long (*)[2])candidates, 5, OPTION_NUMBER);
+}
+
+// Makes up the question a generated id stands for. Returns -1 if the id
+// does not name a generator.
+int generateQuestion(uint32_t id, GeneratedQuestion *out) {
+    uint32_t kind = (id & ~GENERATED_ID) >> GENERATED_SEED_BITS;
+    if (!(id & GENERATED_ID) || kind >= GENERATOR_COUNT) {
+        return -1;
+    }
+    Random rng;
+    randomSeed(&rng, id & ((1u << GENERATED_SEED_BITS) - 1), kind + 1);
+    out->question.question = out->text;
+    if (kind == GENERATOR_SEQUENCE) {
+        generateSequence(out, &rng);
+    } else if (kind == GENERATOR_RATIO) {
+        generateRatio(out, &rng);
+    } else {
+        generateMentalMath(out, &rng);
+    }
+    return 0;
+}
+
+// Returns a question of a quiz, whether it is stored in the bank or
+// generated. Either way it is decoded or made up in scratch, which must
+// outlive the Question returned.
+Question quizQuestion(const QuestionBank *bank, uint32_t id, QuestionText *scratch) {
+    if (!(id & GENERATED_ID)) {
+        return bankQuestion(bank, id, scratch);
+    }
+    if (generateQuestion(id, &scratch->generated) != 0) {
+        Question empty = {"", {"", "", "", ""}, 0};
+        return empty;
+    }
+    return scratch->generated.question;
+}
+
+// Text of a question's correct option, or an empty string when it has none
+// (quizQuestion returns correct option 0 for an id it cannot resolve)
+static const char *correctOptionText(const Question *q) {
+    return q->correctOption >= 1 && q->correctOption <= 4 ? q->options[q->correctOption - 1] : "";
+}
+
+// Returns the correct option of a stored or generated question
+int quizCorrectOption(const QuestionBank *bank, uint32_t id) {
+    if (!(id & GENERATED_ID)) {
+        return bank->correctOption[id];
+    }
+    GeneratedQuestion scratch;
+    return generateQuestion(id, &scratch) == 0 ? scratch.question.correctOption : 0;
+}
+
+// Difficulty of a stored or generated question, from 1 to 5 (a bank with
+// any other difficulty does not attach). An id no generator can make up
+// counts as DEFAULT_DIFFICULTY.
+int quizDifficulty(const QuestionBank *bank, uint32_t id) {
+    if (!(id & GENERATED_ID)) {
+        return bank->difficulty[id];
+    }
+    GeneratedQuestion scratch;
+    return generateQuestion(id, &scratch) == 0 ? scratch.difficulty : DEFAULT_DIFFICULTY;
+}
+
+// Runs a tag query like queryQuestions, but leaves out the stored questions
+// a generator can stand in for and puts as many generated positions in the
+// view instead, so quizzes keep the same mix of questions while the
+// generated part never runs out. Tags the bank does not use are skipped.
+int queryWithGenerators(const QuestionBank *bank, const char *query, QuestionView *view,
+                        char error[], int errorSize) {
+    if (queryQuestions(bank, query, view, error, errorSize) != 0) {
+        return -1;
+    }
+    freeQuestionView(view);
+
+    char narrowed[MAX_LINE_LENGTH];
+    int length = snprintf(narrowed, sizeof(narrowed), "(%s)", query);
+    int ends[GENERATOR_COUNT];
+    int generated = 0;
+    for (int kind = 0; kind < GENERATOR_COUNT && length < (int)sizeof(narrowed); kind++) {
+        char tagged[MAX_LINE_LENGTH];
+        QuestionView stored;
+        snprintf(tagged, sizeof(tagged), "(%s), %s", query, generatorTags[kind]);
+        if (queryQuestions(bank, tagged, &stored, error, errorSize) == 0 && stored.count > 0) {
+            generated += stored.count;
+            length += snprintf(narrowed + length, sizeof(narrowed) - length, ", not %s", generatorTags[kind]);
+        }
+        freeQuestionView(&stored);
+        ends[kind] = generated;
+    }
+    if (length >= (int)sizeof(narrowed)) {
+        snprintf(error, errorSize, "query is too long");
+        return -1;
+    }
+    if (queryQuestions(bank, narrowed, view, error, errorSize) != 0) {
+        return -1;
+    }
+    view->generated = generated;
+    memcpy(view->generatorEnd, ends, sizeof(ends));
+    return 0;
+}
+
+
+// ====================================
+// Function Implementations - Maths
+// ====================================
+//
+// The few functions of the maths library the game needs, so it builds
+// without linking it
+
+// Square root by Newton's method. Halving the exponent of x gives a first
+// guess within a few percent, which four steps take to full precision.
+static double squareRoot(double x) {
+    if (x <= 0) {
+        return 0;
+    }
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    bits = (bits >> 1) + ((uint64_t)0x3ff << 51);
+    double root;
+    memcpy(&root, &bits, sizeof(root));
+    for (int i = 0; i < 4; i++) {
+        root = (root + x / root) / 2;
+    }
+    return root;
+}
+
+// Natural logarithm of a positive number, from the series of atanh after
+// scaling it into [1, 2)
+static double naturalLog(double x) {
+    int exponent = 0;
+    while (x >= 2) {
+        x /= 2;
+        exponent++;
+    }
+    while (x < 1) {
+        x *= 2;
+        exponent--;
+    }
+    double t = (x - 1) / (x + 1), term = t, sum = 0;
+    for (int k = 1; k < 40; k += 2) {
+        sum += term / k;
+        term *= t * t;
+    }
+    return 2 * sum + exponent * 0.69314718055994530942;
+}
+
+// e to the power x, from its series after taking out the powers of two
+static double exponential(double x) {
+    if (x < -700) {
+        return 0;
+    }
+    if (x > 700) {
+        x = 700;
+    }
+    int k = (int)(x / 0.69314718055994530942 + (x >= 0 ? 0.5 : -0.5));
+    double r = x - k * 0.69314718055994530942, term = 1, sum = 1;
+    for (int n = 1; n < 14; n++) {
+        term *= r / n;
+        sum += term;
+    }
+    uint64_t bits = (uint64_t)(k + 1023) << 52;
+    double scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return sum * scale;
+}
+
+// 1 / (1 + e^-x)
+static double logistic(double x) {
+    return 1 / (1 + exponential(-x));
+}
+
+
+// ====================================
+// Function Implementations - Adaptive Quizzes
+// ====================================
+//
+// Instead of drawing every question up front, an adaptive quiz keeps an
+// estimate of the player's ability and picks each next question from the
+// difficulty level whose answer says the most about a player of that
+// ability. A player gets a question right with chance
+//
+//     p = g + (1 - g) / (1 + e^-(ability - difficulty))
+//
+// where g is the chance of guessing. Strong players soon get hard questions
+// and weak ones easy questions, so the estimate settles in fewer questions
+// than a quiz drawn at random, and the quiz stops once it has.
+
+// Groups the stored questions of a view by difficulty, in one counting pass.
+// Every stored difficulty is a level from 1 to 5, as attachQuestionBank checks.
+int buildDifficultyIndex(DifficultyIndex *index, const QuestionView *view) {
+    memset(index, 0, sizeof(*index));
+    index->view = view;
+    index->ids = malloc((view->count ? view->count : 1) * sizeof(uint32_t));
+    if (index->ids == NULL) {
+        return -1;
+    }
+    const uint8_t *difficulty = view->bank->difficulty;
+    uint32_t counts[DIFFICULTY_LEVELS + 1] = {0};
+    for (int i = 0; i < view->count; i++) {
+        counts[difficulty[view->ids[i]]]++;
+    }
+    for (int level = 1; level <= DIFFICULTY_LEVELS; level++) {
+        index->levelStart[level] = index->levelStart[level - 1] + counts[level];
+    }
+    uint32_t next[DIFFICULTY_LEVELS];
+    memcpy(next, index->levelStart, sizeof(next));
+    for (int i = 0; i < view->count; i++) {
+        index->ids[next[difficulty[view->ids[i]] - 1]++] = view->ids[i];
+    }
+    return 0;
+}
+
+// Releases a difficulty index
+void freeDifficultyIndex(DifficultyIndex *index) {
+    free(index->ids);
+    memset(index, 0, sizeof(*index));
+}
+
+// Difficulty of a level on the ability scale, the middle level at 0
+double levelDifficulty(int level) {
+    return (level - (DIFFICULTY_LEVELS + 1) / 2.0) * ADAPTIVE_LEVEL_STEP;
+}
+
+// Fisher information of one answer to a question of the given difficulty
+// for a player of the given ability: how sharply the chance of getting it
+// right changes with the ability, against how uncertain the answer is
+double itemInformation(double ability, double difficulty) {
+    double s = logistic(ability - difficulty);
+    double p = ADAPTIVE_GUESS + (1 - ADAPTIVE_GUESS) * s;
+    double slope = (1 - ADAPTIVE_GUESS) * s * (1 - s);
+    return slope * slope / (p * (1 - p));
+}
+
+// Starts an estimate at the average player, with the spread of all players
+// (a standard normal) as what is known so far
+void abilityStart(AbilityEstimate *estimate) {
+    estimate->ability = 0;
+    estimate->information = 1;
+}
+
+// Moves the estimate after one answer by a Newton step on the likelihood,
+// scaled by all the information gathered so far, so it moves less as it
+// becomes surer
+void abilityUpdate(AbilityEstimate *estimate, double difficulty, int correct) {
+    double s = logistic(estimate->ability - difficulty);
+    double p = ADAPTIVE_GUESS + (1 - ADAPTIVE_GUESS) * s;
+    double slope = (1 - ADAPTIVE_GUESS) * s * (1 - s);
+    estimate->information += slope * slope / (p * (1 - p));
+    estimate->ability += (correct - p) * slope / (p * (1 - p)) / estimate->information;
+}
+
+// Standard error of an estimate
+double abilityError(const AbilityEstimate *estimate) {
+    return 1 / squareRoot(estimate->information);
+}
+
+// Whether a question is already in the first asked questions of a quiz
+static int alreadyAsked(const uint32_t quiz[], int asked, uint32_t id) {
+    for (int i = 0; i < asked; i++) {
+        if (quiz[i] == id) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Makes up a few generated questions of the view and keeps the one whose
+// level is closest to the one wanted
+static uint32_t generatedAtLevel(AdaptiveQuiz *adaptive, int level) {
+    const QuestionView *view = adaptive->index->view;
+    uint32_t best = 0;
+    int bestDistance = DIFFICULTY_LEVELS;
+    for (int i = 0; i < ADAPTIVE_GENERATED_TRIES && bestDistance > 0; i++) {
+        uint32_t id = viewQuestion(view, view->count + randomBelow(adaptive->rng, view->generated), adaptive->rng);
+        int distance = abs(quizDifficulty(view->bank, id) - level);
+        if (distance < bestDistance) {
+            best = id;
+            bestDistance = distance;
+        }
+    }
+    return best;
+}
+
+// Picks a question of a level that the quiz has not asked yet, trying a few
+// at random before going through the whole level. Questions the player saw
+// in earlier quizzes are passed over while the level has others. Returns 0
+// if there is none.
+static int storedAtLevel(AdaptiveQuiz *adaptive, int level, int asked, uint32_t *id) {
+    const DifficultyIndex *index = adaptive->index;
+    const SeenSet *seen = adaptive->seen;
+    uint32_t start = index->levelStart[level - 1], count = index->levelStart[level] - start;
+    if (count == 0) {
+        return 0;
+    }
+    for (int attempt = 0; attempt < 3; attempt++) {
+        uint32_t candidate = index->ids[start + randomBelow(adaptive->rng, count)];
+        if (!alreadyAsked(adaptive->quiz, asked, candidate) && (seen == NULL || !seenContains(seen, candidate))) {
+            *id = candidate;
+            return 1;
+        }
+    }
+    for (int pass = seen == NULL; pass < 2; pass++) {
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t candidate = index->ids[start + i];
+            if (!alreadyAsked(adaptive->quiz, asked, candidate) && (pass == 1 || !seenContains(seen, candidate))) {
+                *id = candidate;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Decides whether the quiz goes on after asked questions and, if it does,
+// puts the question that tells the most about the current estimate in
+// quiz[asked]. Generated questions are picked as often as their share of
+// the view. Returns 0 once the estimate is sure enough or the view has no
+// question left to ask.
+static int adaptiveNext(AdaptiveQuiz *adaptive, int asked) {
+    if (asked >= ADAPTIVE_MIN_QUESTIONS && abilityError(&adaptive->estimate) <= ADAPTIVE_STOP_ERROR) {
+        return 0;
+    }
+    const QuestionView *view = adaptive->index->view;
+    double information[DIFFICULTY_LEVELS + 1];
+    for (int level = 1; level <= DIFFICULTY_LEVELS; level++) {
+        information[level] = itemInformation(adaptive->estimate.ability, levelDifficulty(level));
+    }
+    int generated = view->generated > 0
+                 && randomBelow(adaptive->rng, (uint32_t)(view->count + view->generated)) >= (uint32_t)view->count;
+
+    // Levels are tried from the most informative down, so a level that has
+    // run out of questions gives way to the next best
+    int tried = 0;
+    for (int round = 0; round < DIFFICULTY_LEVELS; round++) {
+        int best = 0;
+        for (int level = 1; level <= DIFFICULTY_LEVELS; level++) {
+            if (!(tried & 1 << level) && (best == 0 || information[level] > information[best])) {
+                best = level;
+            }
+        }
+        tried |= 1 << best;
+        if (generated) {
+            adaptive->quiz[asked] = generatedAtLevel(adaptive, best);
+            return 1;
+        }
+        if (storedAtLevel(adaptive, best, asked, &adaptive->quiz[asked])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Starts an adaptive quiz over the indexed view and picks its first
+// question, for an average player. Questions in seen, if given, are only
+// asked once a level has no others. Returns the most questions it may ask.
+int adaptiveStart(AdaptiveQuiz *adaptive, const DifficultyIndex *index, const SeenSet *seen,
+                  uint32_t quiz[], Random *rng) {
+    adaptive->index = index;
+    adaptive->rng = rng;
+    adaptive->quiz = quiz;
+    adaptive->seen = seen;
+    abilityStart(&adaptive->estimate);
+    int available = index->view->count + index->view->generated;
+    if (available == 0 || !adaptiveNext(adaptive, 0)) {
+        return 0;
+    }
+    return available < QUIZ_SIZE ? available : QUIZ_SIZE;
+}
+
+// Hands the choice of each next question of a session that was just
+// started to an adaptive quiz, which already picked its first
+void sessionAdapt(QuizSession *session, AdaptiveQuiz *adaptive) {
+    if (adaptive != NULL && session->state == SESSION_ASKING) {
+        session->adaptive = adaptive;
+    }
+}
+
+
+// ====================================
+// Function Implementations - Quiz Sessions
+// ====================================
+
+// Starts a session at its first question. Times are on whatever clock the
+// host uses, as long as it uses the same one for every call.
+void sessionStart(QuizSession *session, const QuestionBank *bank, const uint32_t *quiz, int numQuestions,
+                  long long nowMs, long long timeLimitMs) {
+    session->bank = bank;
+    session->quiz = quiz;
+    session->numQuestions = numQuestions;
+    session->current = 0;
+    session->score = 0;
+    session->state = numQuestions > 0 ? SESSION_ASKING : SESSION_FINISHED;
+    session->startMs = nowMs;
+    session->endMs = nowMs;
+    session->timeLimitMs = timeLimitMs;
+    session->correctMask = 0;
+    session->journal = NULL;
+    session->norms = NULL;
+    session->category = 0;
+    session->adaptive = NULL;
+    session->checkpoint = NULL;
+    METRIC_COUNT(COUNTER_SESSIONS_STARTED);
+}
+
+// Adds a time in milliseconds to the session's category in one of the
+// per-category histograms
+static void sessionMetric(const QuizSession *session, int histogram, long long ms) {
+    if (session->category >= 1 && session->category <= CATEGORY_COUNT) {
+        METRIC_RECORD(histogram + session->category - 1, ms > 0 ? ms : 0);
+    }
+}
+
+// Adds one of the session's events to its journal, if it has one
+static void sessionLog(const QuizSession *session, int type, int option, int index, uint32_t id, long long ms) {
+    if (session->journal != NULL) {
+        JournalRecord record = {session->journalSession, (uint8_t)type, (uint8_t)option, (uint16_t)index,
+                                id, (uint32_t)ms};
+        journalWrite(session->journal, &record);
+    }
+}
+
+// Records the end of a session that has just stopped asking. Sessions the
+// player left before the end do not count towards the norms, and neither do
+// adaptive ones, whose scores are not comparable.
+static void sessionLogEnd(const QuizSession *session) {
+    sessionLog(session, JOURNAL_END, session->state, session->score, (uint32_t)session->current,
+               session->endMs - session->startMs);
+    METRIC_COUNT(session->state == SESSION_TIMED_OUT ? COUNTER_SESSIONS_TIMED_OUT
+                 : session->current == session->numQuestions ? COUNTER_SESSIONS_COMPLETED
+                 : COUNTER_SESSIONS_ABANDONED);
+    sessionMetric(session, HISTOGRAM_SESSION_TIME, session->endMs - session->startMs);
+    if (session->checkpoint != NULL) {
+        checkpointUpdate(session->checkpoint, session, session->endMs);
+    }
+    if (session->norms != NULL && session->adaptive == NULL
+        && (session->current == session->numQuestions || session->state == SESSION_TIMED_OUT)) {
+        normsAdd(session->norms, session->category, session->numQuestions, sessionPerformance(session));
+    }
+}
+
+// Starts recording a session that was just started: its start and first
+// question now, and each answer and its end as they happen
+void sessionRecord(QuizSession *session, Journal *journal, int category) {
+    session->category = category;
+    if (journal == NULL || journal->failed) {
+        return;
+    }
+    session->journal = journal;
+    session->journalSession = ++journal->sessions;
+    sessionLog(session, JOURNAL_START, category, session->numQuestions, (uint32_t)time(NULL), session->timeLimitMs);
+    if (session->state == SESSION_ASKING) {
+        sessionLog(session, JOURNAL_QUESTION, 0, 0, session->quiz[0], 0);
+    } else {
+        sessionLogEnd(session);
+    }
+}
+
+// Makes a session that was just started count towards the norms of its
+// category and length once it ends
+void sessionNorms(QuizSession *session, Norms *norms, int category) {
+    session->category = category;
+    if (norms != NULL && session->state == SESSION_ASKING) {
+        session->norms = norms;
+    }
+}
+
+// Keeps the progress of a session that was just started in the checkpoint,
+// as the checkpoint's current player, after every answer. If that player's
+// turn was cut short the session first carries on from where it stopped,
+// with the time they had used already gone.
+void sessionCheckpoint(QuizSession *session, Checkpoint *checkpoint) {
+    const CheckpointProgress *progress = &checkpoint->progress;
+    if (progress->state == CHECKPOINT_PLAYING && progress->answered < session->numQuestions
+        && session->state == SESSION_ASKING) {
+        session->current = progress->answered;
+        session->score = progress->score;
+        session->correctMask = progress->correctMask;
+        session->startMs -= progress->timeMs;
+    }
+    session->checkpoint = checkpoint;
+}
+
+// How well a session went, for comparing it with others of the same
+// category and length: the score with each question counted by its
+// difficulty, scaled back to the number of questions, plus up to
+// NORM_TIME_WEIGHT for the share of the time limit left over
+double sessionPerformance(const QuizSession *session) {
+    double earned = 0, available = 0;
+    for (int i = 0; i < session->numQuestions; i++) {
+        int difficulty = quizDifficulty(session->bank, session->quiz[i]);
+        available += difficulty;
+        earned += i < 32 && (session->correctMask >> i & 1) ? difficulty : 0;
+    }
+    double timeLeft = 1 - (double)sessionTimeTaken(session) / session->timeLimitMs;
+    return (available > 0 ? session->numQuestions * earned / available : 0)
+         + NORM_TIME_WEIGHT * (timeLeft > 0 ? timeLeft : 0);
+}
+
+// Returns the id of the question the player should see, or -1 once the session is over
+long sessionQuestion(const QuizSession *session) {
+    return session->state == SESSION_ASKING ? (long)session->quiz[session->current] : -1;
+}
+
+// Grades the answer to the current question and moves to the next one.
+// Returns 1 if it was correct, 0 if not, and -1 if no question was pending.
+// An answer that arrives once the time limit is reached is not graded: the
+// session times out at exactly its limit instead.
+int sessionAnswer(QuizSession *session, int answer, long long nowMs) {
+    if (sessionCheckTime(session, nowMs) != SESSION_ASKING) {
+        return -1;
+    }
+    uint32_t id = session->quiz[session->current];
+    int correct = answer == quizCorrectOption(session->bank, id);
+    sessionLog(session, JOURNAL_ANSWER, (answer >= 1 && answer <= 4 ? answer : 0) | (correct ? JOURNAL_CORRECT : 0),
+               session->current, id, nowMs - session->endMs);
+    sessionMetric(session, HISTOGRAM_ANSWER_TIME, nowMs - session->endMs);
+    if (correct || answer == 0) {
+        METRIC_COUNT(correct ? COUNTER_ANSWERS_CORRECT : COUNTER_ANSWERS_MISSED);
+    }
+    session->score += correct;
+    session->correctMask |= session->current < 32 ? (uint32_t)correct << session->current : 0;
+    session->current++;
+    session->endMs = nowMs;
+
+    // An adaptive quiz learns from the answer, then picks the next question
+    // or stops once it knows the player's ability well enough
+    if (session->adaptive != NULL) {
+        abilityUpdate(&session->adaptive->estimate, levelDifficulty(quizDifficulty(session->bank, id)), correct);
+        if (session->current < session->numQuestions && !adaptiveNext(session->adaptive, session->current)) {
+            session->numQuestions = session->current;
+        }
+    }
+
+    if (session->current == session->numQuestions) {
+        session->state = SESSION_FINISHED;
+        sessionLogEnd(session);
+    } else {
+        sessionLog(session, JOURNAL_QUESTION, 0, session->current, session->quiz[session->current],
+                   nowMs - session->startMs);
+        if (session->checkpoint != NULL) {
+            checkpointUpdate(session->checkpoint, session, nowMs);
+        }
+    }
+    return correct;
+}
+
+// Times the session out if its limit has passed without an answer
+SessionState sessionCheckTime(QuizSession *session, long long nowMs) {
+    if (session->state == SESSION_ASKING && nowMs - session->startMs >= session->timeLimitMs) {
+        session->state = SESSION_TIMED_OUT;
+        session->endMs = session->startMs + session->timeLimitMs;
+        sessionLogEnd(session);
+    }
+    return session->state;
+}
+
+// Ends a session that still has questions left, e.g. when the player leaves
+void sessionEnd(QuizSession *session, long long nowMs) {
+    if (sessionCheckTime(session, nowMs) == SESSION_ASKING) {
+        session->state = SESSION_FINISHED;
+        session->endMs = nowMs;
+        sessionLogEnd(session);
+    }
+}
+
+// Milliseconds from the start of the session to its last answer or its end
+long long sessionTimeTaken(const QuizSession *session) {
+    return session->endMs - session->startMs;
+}
+
+
+// ====================================
+// Function Implementations - Timers
+// ====================================
+
+// Starts an empty wheel. Deadlines are on the host's clock, like sessions.
+void timerWheelInit(TimerWheel *wheel, long long nowMs) {
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->nowMs = nowMs;
+}
+
+static void timerLink(Timer **list, Timer *timer) {
+    timer->prev = NULL;
+    timer->next = *list;
+    if (*list != NULL) {
+        (*list)->prev = timer;
+    }
+    *list = timer;
+    timer->list = list;
+}
+
+static void timerUnlink(TimerWheel *wheel, Timer *timer) {
+    if (timer->prev != NULL) {
+        timer->prev->next = timer->next;
+    } else {
+        *timer->list = timer->next;
+    }
+    if (timer->next != NULL) {
+        timer->next->prev = timer->prev;
+    }
+    if (*timer->list == NULL && timer->list != &wheel->expired) {
+        size_t index = (size_t)(timer->list - &wheel->slots[0][0]);
+        wheel->occupied[index / TIMER_SLOTS] &= ~(1ULL << (index % TIMER_SLOTS));
+    }
+    timer->list = NULL;
+    timer->next = timer->prev = NULL;
+}
+
+// Puts a timer in the lowest level whose slots reach its deadline. A slot of
+// level n is emptied into the levels below when the wheel reaches its start,
+// which is never later than the deadline of any timer in it.
+static void timerPlace(TimerWheel *wheel, Timer *timer) {
+    long long delta = timer->expiresMs - wheel->nowMs;
+    if (delta <= 0) {
+        timerLink(&wheel->expired, timer);
+        return;
+    }
+    long long when = timer->expiresMs;
+    long long reach = 1LL << (TIMER_SLOT_BITS * TIMER_LEVELS);
+    if (delta >= reach) {
+        when = wheel->nowMs + reach - 1;    // Park it as far out as the wheel reaches
+        delta = reach - 1;
+    }
+    int level = 0;
+    while (delta >= 1LL << (TIMER_SLOT_BITS * (level + 1))) {
+        level++;
+    }
+    int slot = (int)((when >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1));
+    timerLink(&wheel->slots[level][slot], timer);
+    wheel->occupied[level] |= 1ULL << slot;
+}
+
+// Arms a timer, moving it if it is already armed
+void timerArm(TimerWheel *wheel, Timer *timer, long long expiresMs) {
+    if (timer->list != NULL) {
+        timerUnlink(wheel, timer);
+    } else {
+        wheel->count++;
+    }
+    timer->expiresMs = expiresMs;
+    timerPlace(wheel, timer);
+}
+
+// Disarms a timer, whether it is still waiting or has fired and not been collected
+void timerCancel(TimerWheel *wheel, Timer *timer) {
+    if (timer->list != NULL) {
+        timerUnlink(wheel, timer);
+        wheel->count--;
+    }
+}
+
+// Processes one millisecond: brings down the higher-level slots that start
+// at it, from the top so timers can fall several levels, then fires the
+// level 0 slot
+static void timerTick(TimerWheel *wheel, long long tick) {
+    wheel->nowMs = tick;
+    int top = 0;
+    while (top < TIMER_LEVELS - 1 && (tick & ((1LL << (TIMER_SLOT_BITS * (top + 1))) - 1)) == 0) {
+        top++;
+    }
+    for (int level = top; level >= 0; level--) {
+        int slot = (int)((tick >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1));
+        Timer *timer = wheel->slots[level][slot];
+        wheel->slots[level][slot] = NULL;
+        wheel->occupied[level] &= ~(1ULL << slot);
+        while (timer != NULL) {
+            Timer *next = timer->next;
+            timerPlace(wheel, timer);
+            timer = next;
+        }
+    }
+}
+
+// Returns a timer that is due by nowMs, disarmed, or NULL once there are no
+// more. Milliseconds with nothing to do are skipped, so catching up after a
+// long wait costs at most one step per 64 ms.
+Timer *timerExpire(TimerWheel *wheel, long long nowMs) {
+    while (wheel->expired == NULL && wheel->nowMs < nowMs) {
+        if (wheel->count == 0) {
+            wheel->nowMs = nowMs;
+            break;
+        }
+        long long next = wheel->nowMs + 1;
+        int index = (int)(next & (TIMER_SLOTS - 1));
+        if (index != 0) {
+            uint64_t ahead = wheel->occupied[0] >> index;
+            next = ahead != 0 ? next + __builtin_ctzll(ahead) : (next | (TIMER_SLOTS - 1)) + 1;
+        }
+        if (next > nowMs) {
+            wheel->nowMs = nowMs;
+            break;
+        }
+        timerTick(wheel, next);
+    }
+
+    Timer *timer = wheel->expired;
+    if (timer != NULL) {
+        timerUnlink(wheel, timer);
+        wheel->count--;
+    }
+    return timer;
+}
+
+// Returns the earliest time timerExpire() may have a timer to return, for
+// use as a poll timeout. It is exact for deadlines under 64 ms away and is
+// otherwise when the wheel next has to move timers down a level, which is
+// never after their deadline. Returns -1 if no timer is armed.
+long long timerNextExpiry(const TimerWheel *wheel) {
+    if (wheel->expired != NULL) {
+        return wheel->nowMs;
+    }
+    long long earliest = -1;
+    for (int level = 0; level < TIMER_LEVELS; level++) {
+        uint64_t bits = wheel->occupied[level];
+        if (bits == 0) {
+            continue;
+        }
+        int shift = TIMER_SLOT_BITS * level;
+        long long nextSlot = (wheel->nowMs >> shift) + 1;
+        int index = (int)(nextSlot & (TIMER_SLOTS - 1));
+        uint64_t ahead = index ? (bits >> index) | (bits << (TIMER_SLOTS - index)) : bits;
+        long long when = (nextSlot + __builtin_ctzll(ahead)) << shift;
+        if (earliest < 0 || when < earliest) {
+            earliest = when;
+        }
+    }
+    return earliest;
+}
+
+
+// ====================================
+// Function Implementations - Game Logic
+// ====================================
+
+// Milliseconds from a clock that never jumps, for measuring durations
+long long monotonicMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Nanoseconds from the same clock, for timing short pieces of work
+long long monotonicNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Conducts a solo IQ test with timer functionality. The turn ends as soon as
+// the time limit is reached, even while waiting for an answer. With an
+// adaptive quiz, quiz holds only the first question and the rest are
+// picked as the player answers. The questions shown are added to seen, if
+// given, and saved for the player's next quiz. With a checkpoint, each
+// answer is kept in it, and a turn that was cut short carries on where it
+// stopped.
+int playSolo(const QuestionBank *bank, const uint32_t quiz[], int numQuestions, AdaptiveQuiz *adaptive,
+             SeenSet *seen, Checkpoint *checkpoint, char playerName[], int *timeTakenMs, int category) {
+    long long started = TRACE_START();
+    printf("\nStarting Solo Quiz...\n");
+    printf("You have 6 minutes to complete the quiz!\n");
+
+    QuizSession session;
+    sessionStart(&session, bank, quiz, numQuestions, monotonicMs(), TEST_DURATION * 1000LL);
+    if (checkpoint != NULL) {
+        sessionCheckpoint(&session, checkpoint);
+    }
+    // A turn picked up part way through is not journaled, as its first
+    // answers were given in the run that was cut short
+    if (session.current == 0) {
+        sessionRecord(&session, gameJournal, category);
+    } else {
+        printf("Carrying on from question %d, with your score of %d.\n", session.current + 1, session.score);
+    }
+    sessionNorms(&session, gameNorms, category);
+    sessionAdapt(&session, adaptive);
+
+    // The quiz deadline, and a deadline for each question if they are limited
+    TimerWheel timers;
+    Timer quizDeadline = {0}, questionDeadline = {0};
+    timerWheelInit(&timers, session.startMs);
+    quizDeadline.kind = TIMER_QUIZ_DEADLINE;
+    questionDeadline.kind = TIMER_QUESTION_DEADLINE;
+    timerArm(&timers, &quizDeadline, session.startMs + session.timeLimitMs);
+
+    // Ask the questions picked for this quiz
+    while (session.state == SESSION_ASKING) {
+        printf("\n%s, it's your turn!\n", playerName);
+        if (QUESTION_DURATION > 0) {
+            timerArm(&timers, &questionDeadline, monotonicMs() + QUESTION_DURATION * 1000LL);
+        }
+
+        long long asked = TRACE_START();
+        askQuestion(&session, &timers);
+        TRACE_SPAN("askQuestion", asked);
+
+        if (session.state == SESSION_TIMED_OUT) {
+            printf("\nTime's up! The test has ended.\n");
+            break;
+        }
+
+        int timeLeft = (int)((session.timeLimitMs - (monotonicMs() - session.startMs)) / 1000);
+        int minutes = timeLeft / 60;
+        int seconds = timeLeft % 60;
+        printf("Time remaining: %02d:%02d\n", minutes, seconds);
+    }
+
+    int score = session.score;
+    *timeTakenMs = (int)sessionTimeTaken(&session);
+    if (gameJournal != NULL) {
+        journalFlush(gameJournal);
+    }
+    if (seen != NULL) {
+        int shown = session.current + (session.state == SESSION_TIMED_OUT && session.current < session.numQuestions);
+        for (int i = 0; i < shown; i++) {
+            seenAdd(seen, quiz[i]);
+        }
+        seenSave(gameExposures, seen);
+    }
+
+    // Display results based on category
+    if (category == 1) {
+        displayIQScore(playerName, &session);
+    } else {
+        printf("\n%s, your Final Score: %d/%d\n", playerName, score, session.numQuestions);
+    }
+
+    TRACE_SPAN("playSolo", started);
+    return score;
+}
+
+
+// Manages the 1v1 gameplay mode between two players
+void play1v1(const QuestionView *view, int numQuestions, char player1[], char player2[], int category, Random *rng) {
+    printf("\nStarting Multiplayer Quiz!\n");
+
+    int timeTaken1, timeTaken2;
+    uint32_t quiz[QUIZ_SIZE];
+    if (numQuestions > QUIZ_SIZE) {
+        numQuestions = QUIZ_SIZE;
+    }
+
+    // Each player gets their own random draw from the category
+    printf("\n%s's turn!\n", player1);
+    numQuestions = drawQuiz(view, quiz, numQuestions, rng);
+    int score1 = playSolo(view->bank, quiz, numQuestions, NULL, NULL, NULL, player1, &timeTaken1, category);
+
+    printf("\n%s's turn!\n", player2);
+    numQuestions = drawQuiz(view, quiz, numQuestions, rng);
+    int score2 = playSolo(view->bank, quiz, numQuestions, NULL, NULL, NULL, player2, &timeTaken2, category);
+
+    // Display results based on category
+    if (category == 1) {
+        declareWinner(player1, player2, score1, score2, timeTaken1, timeTaken2);
+    } else {
+        printf("\n=================================\n");
+        printf("        FINAL SCORES\n");
+        printf("=================================\n");
+        printf("%s: %d/%d\n", player1, score1, numQuestions);
+        printf("%s: %d/%d\n", player2, score2, numQuestions);
+        
+        int scores[2] = {score1, score2};
+        int winner = findWinner(scores, scores, 2, 0);
+        if (winner < 0) {
+            printf("It's a tie!\n");
+        } else {
+            printf("%s wins!\n", winner == 0 ? player1 : player2);
+        }
+    }
+}
+
+
+// Presents the session's current question to the user and validates their answer.
+// Waits for the answer only until the next timer fires: the quiz deadline
+// times the session out, and a question deadline counts the question as
+// wrong. Anything but a number from 1 to 4 is asked for again rather than
+// graded. Returns 1 or 0 for a graded answer, and -1 if the quiz ran out of
+// time or the input ended first.
+int askQuestion(QuizSession *session, TimerWheel *timers) {
+    long long rendering = METRIC_SAMPLE();
+    QuestionText scratch;
+    Question q = quizQuestion(session->bank, (uint32_t)sessionQuestion(session), &scratch);
+    char text[MAX_QUESTION_LENGTH + 4 * MAX_OPTION_LENGTH + 64];
+    int textLength = renderQuestion(&q, text, sizeof(text));
+    METRIC_SAMPLED(HISTOGRAM_QUESTION_RENDER, rendering);
+    fwrite(text, 1, textLength, stdout);
+
+    char line[64];
+    for (;;) {
+        long long now = monotonicMs();
+        long long due = timerNextExpiry(timers);
+        int length = readLine(&console, line, sizeof(line), due < 0 ? -1 : due > now ? (int)(due - now) : 0);
+        if (length == LINE_EOF) {
+            sessionEnd(session, monotonicMs());
+            return -1;
+        }
+        if (length == LINE_TIMEOUT) {
+            now = monotonicMs();
+            Timer *timer;
+            while ((timer = timerExpire(timers, now)) != NULL) {
+                if (timer->kind == TIMER_QUIZ_DEADLINE) {
+                    sessionCheckTime(session, now);
+                } else if (sessionAnswer(session, 0, now) == 0) {
+                    printf("\nToo slow! The correct answer was: %s\n", correctOptionText(&q));
+                    return 0;
+                }
+            }
+            if (session->state != SESSION_ASKING) {
+                return -1;
+            }
+            continue;
+        }
+
+        int answer = parseChoice(line, 1, 4);
+        if (answer < 0) {
+            printf("Please enter a number from 1 to 4: ");
+            continue;
+        }
+
+        // Check if the answer is correct
+        int result = sessionAnswer(session, answer, monotonicMs());
+        if (result == 1) {
+            printf("Correct!\n");
+        } 
+        else if (result == 0) {
+            printf("Wrong! The correct answer was: %s\n", correctOptionText(&q));
+        }
+        return result;
+    }
+}
+
+
+// ====================================
+// Function Implementations - Rosters
+// ====================================
+
+// Hands out memory from the newest block, starting a new one when it is
+// full. Requests bigger than a block get a block of their own.
+void *arenaAlloc(Arena *arena, size_t size) {
+    size = (size + 15) & ~(size_t)15;
+    ArenaBlock *block = arena->blocks;
+    if (block == NULL || block->size - block->used < size) {
+        size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(ArenaBlock) + blockSize);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->used = 0;
+        block->size = blockSize;
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+    void *memory = block->data + block->used;
+    block->used += size;
+    return memory;
+}
+
+void arenaRelease(Arena *arena) {
+    while (arena->blocks != NULL) {
+        ArenaBlock *next = arena->blocks->next;
+        free(arena->blocks);
+        arena->blocks = next;
+    }
+}
+
+// Sets up a roster for count players with empty names and no results
+int rosterCreate(Roster *roster, int count) {
+    roster->arena.blocks = NULL;
+    roster->count = count;
+    roster->players = arenaAlloc(&roster->arena, (size_t)count * sizeof(RosterEntry));
+    if (roster->players == NULL) {
+        return -1;
+    }
+    memset(roster->players, 0, (size_t)count * sizeof(RosterEntry));
+    return 0;
+}
+
+void rosterRelease(Roster *roster) {
+    arenaRelease(&roster->arena);
+    roster->players = NULL;
+    roster->count = 0;
+}
+
+
+// ====================================
+// Function Implementations - Results
+// ====================================
+
+// Finds the player with the highest score. When several players share the
+// top score the fastest of them wins if useTime is set; otherwise, or if
+// their times are equal too, it is a tie and -1 is returned.
+int findWinner(const int scores[], const int times[], int numPlayers, int useTime) {
+    int winner = 0;
+    int tied = 0;
+    for (int i = 1; i < numPlayers; i++) {
+        if (scores[i] > scores[winner]) {
+            winner = i;
+            tied = 0;
+        } else if (scores[i] == scores[winner]) {
+            if (useTime && times[i] < times[winner]) {
+                winner = i;
+                tied = 0;
+            } else if (!useTime || times[i] == times[winner]) {
+                tied = 1;
+            }
+        }
+    }
+    return tied ? -1 : winner;
+}
+
+// Orders ranking entries: higher score, then less time, then joined first
+static int compareRank(const void *a, const void *b) {
+    const RankEntry *x = a, *y = b;
+    if (x->score != y->score) {
+        return y->score - x->score;
+    }
+    if (x->timeMs != y->timeMs) {
+        return (x->timeMs > y->timeMs) - (x->timeMs < y->timeMs);
+    }
+    return x->player - y->player;
+}
+
+// Sorts every entry into ranking order
+void rankAll(RankEntry entries[], int count) {
+    qsort(entries, count, sizeof(RankEntry), compareRank);
+}
+
+// Moves the best k entries to the front in ranking order and leaves the rest
+// in no particular order behind them. Quickselect finds the k best in linear
+// time on average, so only those k are sorted. Returns how many are ranked.
+int rankTop(RankEntry entries[], int count, int k) {
+    if (k >= count) {
+        rankAll(entries, count);
+        return count;
+    }
+    if (k <= 0) {
+        return 0;
+    }
+    int low = 0, high = count - 1;
+    while (low < high) {
+        // Partition around the median of three so sorted input stays linear
+        int mid = low + (high - low) / 2;
+        if (compareRank(&entries[mid], &entries[low]) < 0) {
+            RankEntry t = entries[mid]; entries[mid] = entries[low]; entries[low] = t;
+        }
+        if (compareRank(&entries[high], &entries[low]) < 0) {
+            RankEntry t = entries[high]; entries[high] = entries[low]; entries[low] = t;
+        }
+        if (compareRank(&entries[high], &entries[mid]) < 0) {
+            RankEntry t = entries[high]; entries[high] = entries[mid]; entries[mid] = t;
+        }
+        RankEntry pivot = entries[mid];
+        int i = low, j = high;
+        while (i <= j) {
+            while (compareRank(&entries[i], &pivot) < 0) {
+                i++;
+            }
+            while (compareRank(&entries[j], &pivot) > 0) {
+                j--;
+            }
+            if (i <= j) {
+                RankEntry t = entries[i]; entries[i] = entries[j]; entries[j] = t;
+                i++;
+                j--;
+            }
+        }
+        // Keep narrowing only the side that holds position k - 1
+        if (k - 1 <= j) {
+            high = j;
+        } else if (k - 1 >= i) {
+            low = i;
+        } else {
+            break;
+        }
+    }
+    rankAll(entries, k);
+    return k;
+}
+
+// Tells whether the first entry of a ranking won outright: 0 if it did, -1
+// if the next one has the same score and, when time counts, the same time
+int rankedWinner(const RankEntry ranked[], int count, int useTime) {
+    if (count > 1 && ranked[1].score == ranked[0].score
+        && (!useTime || ranked[1].timeMs == ranked[0].timeMs)) {
+        return -1;
+    }
+    return count > 0 ? 0 : -1;
+}
+
+// Determines and announces the winner in 1v1 mode
+void declareWinner(char player1[], char player2[], int score1, int score2, int timeTakenMs1, int timeTakenMs2) {
+    printf("\n=================================\n");
+    printf("        FINAL SCORES\n");
+    printf("=================================\n");
+    printf("%s: %d (Time: %d.%03d seconds)\n", player1, score1, timeTakenMs1 / 1000, timeTakenMs1 % 1000);
+    printf("%s: %d (Time: %d.%03d seconds)\n", player2, score2, timeTakenMs2 / 1000, timeTakenMs2 % 1000);
+
+    // Determine and display the winner, using time taken (to the millisecond) if scores are tied
+    int scores[2] = {score1, score2};
+    int times[2] = {timeTakenMs1, timeTakenMs2};
+    int winner = findWinner(scores, times, 2, 1);
+    if (winner < 0) {
+        printf("U R both smart it is a tie.\n");
+    } 
+    else if (score1 != score2) {
+        printf("%s is the smartest here !!!!!!!!!!!!\n", winner == 0 ? player1 : player2);
+    } 
+    else {
+        printf("%s wins by time taken!\n", winner == 0 ? player1 : player2);
+    }
+}
+
+
+// IQ ranges and their labels, one for each score out of 10
+static const struct {
+    int iqMin;
+    int iqMax;
+    const char *label;
+} iqBands[] = {
+    {40, 50, "Severe Intellectual Disability!"},
+    {50, 60, "Moderate Intellectual Disability!"},
+    {60, 70, "Mild Intellectual Disability!"},
+    {70, 80, "Borderline Intelligence!"},
+    {80, 90, "Below Average Intelligence!"},
+    {90, 100, "Low Average Intelligence!"},
+    {100, 110, "Average Intelligence!"},
+    {110, 120, "High Average Intelligence!"},
+    {120, 130, "Superior Intelligence!"},
+    {130, 140, "Very Superior Intelligence!"},
+    {140, 160, "Exceptional Genius!"}
+};
+
+// Maps a score out of 10 to its IQ range and label. Used until enough
+// sessions have been played to compare a score with them.
+const char *iqBand(int score, int *iqMin, int *iqMax) {
+    if (score < 0 || score > 10) {
+        *iqMin = 0;
+        *iqMax = 0;
+        return "Invalid Score!";
+    }
+    *iqMin = iqBands[score].iqMin;
+    *iqMax = iqBands[score].iqMax;
+    return iqBands[score].label;
+}
+
+// Label of the IQ range an IQ falls in
+const char *iqLabel(int iq) {
+    int band = 0;
+    while (band < 10 && iq >= iqBands[band + 1].iqMin) {
+        band++;
+    }
+    return iqBands[band].label;
+}
+
+// Calculates and displays the player's IQ score and category. Once enough
+// IQ tests of the same length were played, the score is placed among
+// theirs; before that it is read off the fixed ranges.
+void displayIQScore(char playerName[], const QuizSession *session) {
+    // An adaptive quiz measures the ability itself, on a scale where the
+    // players' spread is one unit
+    if (session->adaptive != NULL) {
+        const AbilityEstimate *estimate = &session->adaptive->estimate;
+        double value = 100 + 15 * estimate->ability;
+        int iq = value < IQ_MIN ? IQ_MIN : value > IQ_MAX ? IQ_MAX : (int)(value + 0.5);
+        printf("\n%s, your Final Score: %d/%d | IQ: %d (give or take %.0f) | Category: %s\n",
+               playerName, session->score, session->numQuestions, iq, 15 * abilityError(estimate), iqLabel(iq));
+        return;
+    }
+
+    double percentile;
+    int iq;
+    long compared = gameNorms ? normsScore(gameNorms, 1, session->numQuestions, sessionPerformance(session),
+                                           &percentile, &iq) : 0;
+    if (compared > 0) {
+        printf("\n%s, your Final Score: %d/%d | Percentile: %.1f | IQ: %d | Category: %s\n"
+               "(compared with %ld IQ tests of %d questions)\n",
+               playerName, session->score, session->numQuestions, percentile, iq, iqLabel(iq),
+               compared, session->numQuestions);
+        return;
+    }
+
+    int iqMin, iqMax;
+    int outOfTen = session->numQuestions > 0 ? (session->score * 10 + session->numQuestions / 2) / session->numQuestions : 0;
+    const char *category = iqBand(outOfTen, &iqMin, &iqMax);
+
+    // Display the final result
+    printf("\n%s, your Final Score: %d/%d | IQ Range: %d-%d | Category: %s\n",
+           playerName, session->score, session->numQuestions, iqMin, iqMax, category);
+}
+
+// Plays the turns of a multiplayer game from the checkpoint's current
+// player on (or from the first without one), then shows the results. The
+// checkpoint is removed once every player has had their turn.
+static void playTurns(const QuestionBank *bank, const uint32_t quiz[], int numQuestions, Roster *roster, int category,
+                      Checkpoint *checkpoint) {
+    // Each player takes their turn
+    for (int i = checkpoint ? checkpoint->player : 0; i < roster->count; i++) {
+        RosterEntry *player = &roster->players[i];
+        if (checkpoint != NULL && i > checkpoint->player) {
+            checkpoint->player = i;
+            checkpoint->progress.state = CHECKPOINT_WAITING;
+        }
+        printf("\n%s's turn!\n", player->name);
+        player->score = playSolo(bank, quiz, numQuestions, NULL, NULL, checkpoint, player->name,
+                                 &player->timeTakenMs, category);
+    }
+    if (checkpoint != NULL) {
+        checkpointFinish(checkpoint);
+    }
+    
+    // Display results
+    printf("\n=================================\n");
+    printf("        FINAL SCORES\n");
+    printf("=================================\n");
+    
+    // Display scores based on category
+    for (int i = 0; i < roster->count; i++) {
+        const RosterEntry *player = &roster->players[i];
+        if (category == 1) {
+            printf("%s: %d (Time: %d.%03d seconds)\n", player->name, player->score,
+                   player->timeTakenMs / 1000, player->timeTakenMs % 1000);
+        } else {
+            printf("%s: %d/%d\n", player->name, player->score, numQuestions);
+        }
+    }
+    
+    // Rank everyone by score, then by time taken
+    RankEntry *ranked = arenaAlloc(&roster->arena, (size_t)roster->count * sizeof(RankEntry));
+    if (ranked == NULL) {
+        return;
+    }
+    for (int i = 0; i < roster->count; i++) {
+        ranked[i].score = roster->players[i].score;
+        ranked[i].timeMs = roster->players[i].timeTakenMs;
+        ranked[i].player = i;
+    }
+    rankAll(ranked, roster->count);
+    
+    printf("\n=================================\n");
+    printf("        LEADERBOARD\n");
+    printf("=================================\n");
+    for (int i = 0; i < roster->count; i++) {
+        printf("%d. %s - %d/%d (%d.%03d seconds)\n", i + 1, roster->players[ranked[i].player].name,
+               ranked[i].score, numQuestions, ranked[i].timeMs / 1000, ranked[i].timeMs % 1000);
+    }
+    
+    // Handle ties: time only breaks them in the IQ Test
+    int useTime = category == 1;
+    if (rankedWinner(ranked, roster->count, useTime) < 0) {
+        printf("\nIt's a tie between: ");
+        for (int i = 0; i < roster->count && ranked[i].score == ranked[0].score
+                        && (!useTime || ranked[i].timeMs == ranked[0].timeMs); i++) {
+            printf("%s ", roster->players[ranked[i].player].name);
+        }
+        printf("\n");
+    } else {
+        printf("\n%s wins!\n", roster->players[ranked[0].player].name);
+    }
+}
+
+// Handles multiplayer gameplay with unlimited players
+void playMultiplayer(const QuestionView *view, int numQuestions, Roster *roster, int category, Random *rng) {
+    printf("\nStarting Multiplayer Quiz!\n");
+    
+    // Validate the number of available questions
+    if (numQuestions > QUIZ_SIZE) {
+        numQuestions = QUIZ_SIZE;
+    }
+    if (view->count + view->generated < numQuestions) {
+        printf("Warning: Not enough questions available. Using all available questions.\n");
+        numQuestions = view->count + view->generated;
+    }
+    
+    // Draw one quiz that every player answers
+    uint32_t quiz[QUIZ_SIZE];
+    numQuestions = drawQuiz(view, quiz, numQuestions, rng);
+
+    // Every answer is kept in the checkpoint file, so a game that is cut
+    // short can be picked up again where it stopped
+    Checkpoint checkpoint;
+    int kept = gameCheckpoint != NULL
+            && checkpointStart(&checkpoint, gameCheckpoint, view->bank, roster, category, quiz, numQuestions, rng) == 0;
+    playTurns(view->bank, quiz, numQuestions, roster, category, kept ? &checkpoint : NULL);
+}
+
+// Picks up a multiplayer game from the checkpoint it left when it was cut
+// short: the players who had their turn keep their results, and the one
+// whose turn it was carries on from their last answer
+void resumeMultiplayer(const QuestionBank *bank, const CheckpointHeader *header, Roster *roster,
+                       Checkpoint *checkpoint) {
+    printf("\nResuming Multiplayer Quiz!\n");
+    playTurns(bank, header->quiz, header->numQuestions, roster, header->category, checkpoint);
+}
+
+// ====================================
+// Function Implementations - Batch Mode
+// ====================================
+
+// Output collected in memory and written out in large blocks
+typedef struct {
+    FILE *file;
+    char data[1 << 16];
+    size_t size;
+} OutputBuffer;
+
+static void flushOutput(OutputBuffer *out) {
+    fwrite(out->data, 1, out->size, out->file);
+    out->size = 0;
+}
+
+static void appendBytes(OutputBuffer *out, const char *text, size_t length) {
+    if (out->size + length > sizeof(out->data)) {
+        flushOutput(out);
+        if (length > sizeof(out->data)) {
+            fwrite(text, 1, length, out->file);
+            return;
+        }
+    }
+    memcpy(out->data + out->size, text, length);
+    out->size += length;
+}
+
+static void appendNumber(OutputBuffer *out, long value) {
+    char digits[24];
+    int length = 0;
+    unsigned long magnitude = value < 0 ? 0UL - (unsigned long)value : (unsigned long)value;
+    do {
+        digits[sizeof(digits) - 1 - length++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (value < 0) {
+        digits[sizeof(digits) - 1 - length++] = '-';
+    }
+    appendBytes(out, digits + sizeof(digits) - length, (size_t)length);
+}
+
+// One player of a scripted session. Names and answers point into the script.
+typedef struct {
+    const char *name;
+    int nameLength;
+    const char *answers;        // Digits 1-4, or '-' for a question left unanswered
+    int answerCount;
+    int seconds;                // Time the player is recorded as taking
+    int score;
+} BatchPlayer;
+
+// Reads an unsigned number from the script, leaving *text after it
+static int readNumber(const char **text, const char *end, long *value) {
+    const char *p = *text;
+    long result = 0;
+    if (p == end || *p < '0' || *p > '9') {
+        return -1;
+    }
+    while (p < end && *p >= '0' && *p <= '9') {
+        result = result * 10 + (*p - '0');
+        if (result > 0x7fffffff) {
+            return -1;
+        }
+        p++;
+    }
+    *value = result;
+    *text = p;
+    return 0;
+}
+
+// Feeds a scripted player's answers to a session, spreading them evenly
+// over the time the player is recorded as taking
+static void playScriptedAnswers(QuizSession *session, const BatchPlayer *player) {
+    long long totalMs = player->seconds * 1000LL;
+    for (int i = 0; i < player->answerCount && session->state == SESSION_ASKING; i++) {
+        int answer = player->answers[i] == '-' ? 0 : player->answers[i] - '0';
+        sessionAnswer(session, answer, totalMs * (i + 1) / player->answerCount);
+    }
+    sessionEnd(session, totalMs);
+}
+
+// Plays every session of a script without prompts and writes one CSV row per
+// player. Each line of the script is one session:
+//
+//     <category> <mode> <seed> <name>:<answers>[@<seconds>] ...
+//
+// The seed fixes the questions that are drawn, generated ones included, so a
+// script always produces the same results.
+int runBatch(const QuestionBank *bank, const char *scriptPath, int generated, Journal *journal, Norms *norms,
+             FILE *output) {
+    int fd = open(scriptPath, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        fprintf(stderr, "Cannot open batch script '%s'\n", scriptPath);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    const char *script = "";
+    if (info.st_size > 0) {
+        script = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (script == MAP_FAILED) {
+        fprintf(stderr, "Cannot read batch script '%s'\n", scriptPath);
+        return -1;
+    }
+
+    QuestionView views[CATEGORY_COUNT];
+    for (int c = 0; c < CATEGORY_COUNT; c++) {
+        if (loadQuestions(bank, c + 1, generated, &views[c]) != 0) {
+            while (c-- > 0) {
+                freeQuestionView(&views[c]);
+            }
+            if (info.st_size > 0) {
+                munmap((void *)script, (size_t)info.st_size);
+            }
+            return -1;
+        }
+    }
+
+    static OutputBuffer out;
+    out.file = output;
+    out.size = 0;
+    static const char header[] = "session,player,name,category,mode,score,questions,seconds,result\n";
+    appendBytes(&out, header, sizeof(header) - 1);
+
+    BatchPlayer *players = NULL;
+    int *scores = NULL, *times = NULL;
+    int playerCapacity = 0;
+    long sessions = 0, quizzes = 0, errors = 0;
+    int lineNumber = 0;
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    const char *end = script + info.st_size;
+    for (const char *line = script; line < end; ) {
+        const char *lineEnd = memchr(line, '\n', (size_t)(end - line));
+        if (lineEnd == NULL) {
+            lineEnd = end;
+        }
+        const char *p = line;
+        line = lineEnd + 1;
+        lineNumber++;
+
+        while (p < lineEnd && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+        if (p == lineEnd || *p == '#') {
+            continue;
+        }
+
+        // Session settings
+        long category, mode, seed;
+        int valid = readNumber(&p, lineEnd, &category) == 0 && p < lineEnd && *p++ == ' '
+                 && readNumber(&p, lineEnd, &mode) == 0 && p < lineEnd && *p++ == ' '
+                 && readNumber(&p, lineEnd, &seed) == 0
+                 && category >= 1 && category <= CATEGORY_COUNT && mode >= 1 && mode <= 3;
+
+        // Players
+        int numPlayers = 0;
+        while (valid) {
+            while (p < lineEnd && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+            if (p == lineEnd) {
+                break;
+            }
+            if (numPlayers == playerCapacity) {
+                int capacity = playerCapacity ? playerCapacity * 2 : 16;
+                BatchPlayer *grownPlayers = realloc(players, capacity * sizeof(BatchPlayer));
+                if (grownPlayers != NULL) players = grownPlayers;
+                int *grownScores = realloc(scores, capacity * sizeof(int));
+                if (grownScores != NULL) scores = grownScores;
+                int *grownTimes = realloc(times, capacity * sizeof(int));
+                if (grownTimes != NULL) times = grownTimes;
+                if (grownPlayers == NULL || grownScores == NULL || grownTimes == NULL) {
+                    fprintf(stderr, "%s:%d: not enough memory for the players\n", scriptPath, lineNumber);
+                    valid = 0;
+                    break;
+                }
+                playerCapacity = capacity;
+            }
+            BatchPlayer *player = &players[numPlayers];
+            player->name = p;
+            while (p < lineEnd && *p != ':' && *p != ' ') p++;
+            player->nameLength = (int)(p - player->name);
+            if (p == lineEnd || *p != ':' || player->nameLength == 0) {
+                valid = 0;
+                break;
+            }
+            player->answers = ++p;
+            while (p < lineEnd && ((*p >= '1' && *p <= '4') || *p == '-')) p++;
+            player->answerCount = (int)(p - player->answers);
+            long seconds = 0;
+            if (p < lineEnd && *p == '@') {
+                p++;
+                valid = readNumber(&p, lineEnd, &seconds) == 0;
+            }
+            player->seconds = (int)seconds;
+            if (p < lineEnd && *p != ' ' && *p != '\t' && *p != '\r') {
+                valid = 0;
+            }
+            numPlayers++;
+        }
+        if (valid) {
+            valid = (mode == 1) ? numPlayers == 1 : (mode == 2) ? numPlayers == 2 : numPlayers >= 2;
+        }
+        if (!valid) {
+            fprintf(stderr, "%s:%d: invalid session\n", scriptPath, lineNumber);
+            errors++;
+            continue;
+        }
+
+        // Draw the questions the same way the interactive modes do: one quiz
+        // per player in 1v1, one shared quiz otherwise
+        const QuestionView *view = &views[category - 1];
+        uint32_t quiz[QUIZ_SIZE];
+        int numQuestions = 0;
+        Random rng;
+        randomSeed(&rng, (uint64_t)seed, 0);
+        for (int i = 0; i < numPlayers; i++) {
+            if (i == 0 || mode == 2) {
+                numQuestions = drawQuiz(view, quiz, QUIZ_SIZE, &rng);
+                quizzes++;
+            }
+            QuizSession session;
+            sessionStart(&session, bank, quiz, numQuestions, 0, TEST_DURATION * 1000LL);
+            sessionRecord(&session, journal, (int)category);
+            sessionNorms(&session, norms, (int)category);
+            playScriptedAnswers(&session, &players[i]);
+            players[i].score = session.score;
+            scores[i] = players[i].score;
+            times[i] = players[i].seconds;
+        }
+
+        // Same winner rules as the interactive modes and the server: time only breaks ties in an IQ test
+        int winner = findWinner(scores, times, numPlayers, category == 1);
+        int topScore = scores[0];
+        for (int i = 1; i < numPlayers; i++) {
+            if (scores[i] > topScore) {
+                topScore = scores[i];
+            }
+        }
+
+        sessions++;
+        for (int i = 0; i < numPlayers; i++) {
+            const char *result = "solo";
+            if (mode != 1) {
+                result = (winner == i) ? "win" : (winner < 0 && scores[i] == topScore) ? "tie" : "lose";
+            }
+            appendNumber(&out, sessions);
+            appendBytes(&out, ",", 1);
+            appendNumber(&out, i + 1);
+            appendBytes(&out, ",", 1);
+            appendBytes(&out, players[i].name, (size_t)players[i].nameLength);
+            appendBytes(&out, ",", 1);
+            appendNumber(&out, category);
+            appendBytes(&out, ",", 1);
+            appendNumber(&out, mode);
+            appendBytes(&out, ",", 1);
+            appendNumber(&out, players[i].score);
+            appendBytes(&out, ",", 1);
+            appendNumber(&out, numQuestions);
+            appendBytes(&out, ",", 1);
+            appendNumber(&out, players[i].seconds);
+            appendBytes(&out, ",", 1);
+            appendBytes(&out, result, strlen(result));
+            appendBytes(&out, "\n", 1);
+        }
+    }
+    flushOutput(&out);
+    fflush(output);
+
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    double elapsed = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+    fprintf(stderr, "%ld sessions, %ld quizzes in %.3f s (%.0f quizzes per second), %ld invalid lines\n",
+            sessions, quizzes, elapsed, elapsed > 0 ? quizzes / elapsed : 0.0, errors);
+
+    free(players);
+    free(scores);
+    free(times);
+    for (int c = 0; c < CATEGORY_COUNT; c++) {
+        freeQuestionView(&views[c]);
+    }
+    if (info.st_size > 0) {
+        munmap((void *)script, (size_t)info.st_size);
+    }
+    return errors ? 1 : 0;
+}
+
+
+// ====================================
+// Function Implementations - Journal
+// ====================================
+
+// CRC-32 (the zlib polynomial), eight bytes at a time (slicing-by-8) from
+// tables built on first use
+static uint32_t crc32Update(uint32_t crc, const void *data, size_t length) {
+    static uint32_t table[8][256];
+    if (table[0][1] == 0) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; bit++) {
+                value = value & 1 ? 0xedb88320u ^ (value >> 1) : value >> 1;
+            }
+            table[0][i] = value;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int k = 1; k < 8; k++) {
+                table[k][i] = table[0][table[k - 1][i] & 0xff] ^ (table[k - 1][i] >> 8);
+            }
+        }
+    }
+    const unsigned char *bytes = data;
+    crc = ~crc;
+    for (; length >= 8; bytes += 8, length -= 8) {
+        uint32_t low = crc ^ ((uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24);
+        crc = table[7][low & 0xff] ^ table[6][(low >> 8) & 0xff] ^ table[5][(low >> 16) & 0xff] ^ table[4][low >> 24]
+            ^ table[3][bytes[4]] ^ table[2][bytes[5]] ^ table[1][bytes[6]] ^ table[0][bytes[7]];
+    }
+    for (; length > 0; bytes++, length--) {
+        crc = table[0][(crc ^ *bytes) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// Checksum of a block: its run, its size and its records
+static uint32_t journalChecksum(const JournalBlock *block, const void *records) {
+    return crc32Update(crc32Update(0, &block->run, 2 * sizeof(uint32_t)), records, block->size);
+}
+
+// Opens a journal file for appending, creating it if needed. The run number
+// comes from the clock and the process id, so runs that share a file keep
+// their sessions apart.
+int journalOpen(Journal *journal, const char *path) {
+    memset(journal, 0, sizeof(*journal) - sizeof(journal->buffer));
+    journal->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (journal->fd < 0) {
+        fprintf(stderr, "Cannot open journal '%s'\n", path);
+        return -1;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t clock = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+    journal->run = (uint32_t)mixHash(clock ^ (uint64_t)getpid() << 40);
+    return 0;
+}
+
+// Adds a record to the buffer, writing the buffer out as a block once it is full
+void journalWrite(Journal *journal, const JournalRecord *record) {
+    if (journal->failed) {
+        return;
+    }
+    if (sizeof(JournalBlock) + journal->used + sizeof(JournalRecord) > sizeof(journal->buffer)) {
+        journalFlush(journal);
+    }
+    memcpy(journal->buffer + sizeof(JournalBlock) + journal->used, record, sizeof(JournalRecord));
+    journal->used += sizeof(JournalRecord);
+}
+
+// Writes the waiting records as one block with a single write, so a block
+// from another run appending to the same file never lands inside it. A
+// journal that fails to write stops recording rather than leave a gap.
+int journalFlush(Journal *journal) {
+    if (journal->used == 0 || journal->failed) {
+        return journal->failed ? -1 : 0;
+    }
+    JournalBlock *block = (JournalBlock *)journal->buffer;
+    block->magic = JOURNAL_MAGIC;
+    block->run = journal->run;
+    block->size = (uint32_t)journal->used;
+    block->checksum = journalChecksum(block, journal->buffer + sizeof(JournalBlock));
+    size_t length = sizeof(JournalBlock) + journal->used;
+    ssize_t written;
+    do {
+        written = write(journal->fd, journal->buffer, length);
+    } while (written < 0 && errno == EINTR);
+    journal->used = 0;
+    if (written != (ssize_t)length) {
+        fprintf(stderr, "Cannot write the journal, recording stopped\n");
+        journal->failed = 1;
+        return -1;
+    }
+    return 0;
+}
+
+// Writes what is left and closes the file
+int journalClose(Journal *journal) {
+    int status = journalFlush(journal);
+    if (close(journal->fd) != 0) {
+        status = -1;
+    }
+    journal->fd = -1;
+    return status;
+}
+
+// Sessions that have started but not yet ended, found by their run and
+// number (run << 32 | session). Slots can be of any size as long as they
+// start with that key; a key of 0 marks a free slot. Open addressing with
+// linear probing, grown at half full.
+typedef struct {
+    unsigned char *slots;
+    size_t slotSize;
+    size_t capacity;            // A power of two, or 0 before the first insert
+    size_t count;
+} SessionTable;
+
+static uint64_t *sessionTableSlot(const SessionTable *table, size_t i) {
+    return (uint64_t *)(table->slots + i * table->slotSize);
+}
+
+static size_t sessionTableHome(const SessionTable *table, uint64_t key) {
+    return (size_t)mixHash(key) & (table->capacity - 1);
+}
+
+static void *sessionTableFind(const SessionTable *table, uint64_t key) {
+    if (table->capacity == 0) {
+        return NULL;
+    }
+    for (size_t i = sessionTableHome(table, key); *sessionTableSlot(table, i) != 0; i = (i + 1) & (table->capacity - 1)) {
+        if (*sessionTableSlot(table, i) == key) {
+            return sessionTableSlot(table, i);
+        }
+    }
+    return NULL;
+}
+
+// Returns a zeroed slot holding the key, or NULL if memory runs out
+static void *sessionTableInsert(SessionTable *table, uint64_t key) {
+    if (2 * (table->count + 1) > table->capacity) {
+        SessionTable grown = *table;
+        grown.capacity = table->capacity ? 2 * table->capacity : 1024;
+        grown.slots = calloc(grown.capacity, table->slotSize);
+        if (grown.slots == NULL) {
+            return NULL;
+        }
+        for (size_t i = 0; i < table->capacity; i++) {
+            uint64_t *slot = sessionTableSlot(table, i);
+            if (*slot != 0) {
+                size_t j = sessionTableHome(&grown, *slot);
+                while (*sessionTableSlot(&grown, j) != 0) {
+                    j = (j + 1) & (grown.capacity - 1);
+                }
+                memcpy(sessionTableSlot(&grown, j), slot, table->slotSize);
+            }
+        }
+        free(table->slots);
+        *table = grown;
+    }
+    size_t i = sessionTableHome(table, key);
+    while (*sessionTableSlot(table, i) != 0 && *sessionTableSlot(table, i) != key) {
+        i = (i + 1) & (table->capacity - 1);
+    }
+    uint64_t *slot = sessionTableSlot(table, i);
+    table->count += *slot == 0;
+    memset(slot, 0, table->slotSize);
+    *slot = key;
+    return slot;
+}
+
+// Frees a slot, moving back any later slot of the same probe run that
+// could not sit in its home slot, so lookups never need tombstones
+static void sessionTableRemove(SessionTable *table, void *slot) {
+    size_t mask = table->capacity - 1;
+    size_t hole = (size_t)((unsigned char *)slot - table->slots) / table->slotSize;
+    for (size_t i = (hole + 1) & mask; *sessionTableSlot(table, i) != 0; i = (i + 1) & mask) {
+        size_t home = sessionTableHome(table, *sessionTableSlot(table, i));
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            memcpy(sessionTableSlot(table, hole), sessionTableSlot(table, i), table->slotSize);
+            hole = i;
+        }
+    }
+    *sessionTableSlot(table, hole) = 0;
+    table->count--;
+}
+
+// Called for each record of a journal. Returning non-zero stops the scan.
+typedef int (*JournalVisitor)(void *context, uint32_t run, const JournalRecord *record);
+
+// What a scan of a journal found
+typedef struct {
+    long events;                // Records visited
+    size_t size;                // Size of the file
+    size_t intact;              // Bytes up to the first damaged block
+    int stopped;                // The visitor stopped the scan
+} JournalScan;
+
+// Maps a journal and calls visit for every record of every intact block in
+// file order. The journal ends at the first block that is cut short or
+// fails its checksum; scan->intact says where. Returns -1 if the file
+// cannot be read.
+static int scanJournal(const char *path, JournalVisitor visit, void *context, JournalScan *scan) {
+    memset(scan, 0, sizeof(*scan));
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        fprintf(stderr, "Cannot open journal '%s'\n", path);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    const unsigned char *data = (const unsigned char *)"";
+    if (info.st_size > 0) {
+        data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Cannot read journal '%s'\n", path);
+        return -1;
+    }
+    if (info.st_size > 0) {
+        madvise((void *)data, (size_t)info.st_size, MADV_SEQUENTIAL);
+    }
+
+    scan->size = (size_t)info.st_size;
+    size_t offset = 0;
+    while (offset < scan->size && !scan->stopped) {
+        JournalBlock block;
+        if (scan->size - offset < sizeof(block)) {
+            break;
+        }
+        memcpy(&block, data + offset, sizeof(block));
+        const unsigned char *records = data + offset + sizeof(block);
+        if (block.magic != JOURNAL_MAGIC || block.size % sizeof(JournalRecord) != 0
+            || block.size > scan->size - offset - sizeof(block) || journalChecksum(&block, records) != block.checksum) {
+            break;
+        }
+        for (size_t r = 0; r < block.size && !scan->stopped; r += sizeof(JournalRecord)) {
+            JournalRecord record;
+            memcpy(&record, records + r, sizeof(record));
+            scan->events++;
+            scan->stopped = visit(context, block.run, &record) != 0;
+        }
+        offset += sizeof(block) + block.size;
+    }
+    scan->intact = offset;
+
+    if (info.st_size > 0) {
+        munmap((void *)data, scan->size);
+    }
+    return 0;
+}
+
+// Tells how far a scan got, if the journal was damaged
+static void reportJournalDamage(const char *path, const JournalScan *scan) {
+    if (!scan->stopped && scan->intact < scan->size) {
+        fprintf(stderr, "%s: journal is damaged at byte %zu, the %zu bytes after it were not read\n",
+                path, scan->intact, scan->size - scan->intact);
+    }
+}
+
+// A session being replayed
+typedef struct {
+    uint64_t key;               // run << 32 | session
+    int category;
+    int mismatched;             // The replay and the record disagree
+    long long shownMs;          // When the current question was shown
+    QuizSession session;
+    uint32_t quiz[QUIZ_SIZE];   // Filled in as the questions are shown
+} ReplaySlot;
+
+typedef struct {
+    const QuestionBank *bank;
+    SessionTable open;
+    OutputBuffer *out;
+    long sessions;
+    long mismatches;
+    long strays;                // Records of sessions whose start was never seen
+} ReplayContext;
+
+// Item a question id is counted under: its bank id, or one item per
+// generator after the bank's questions. Returns -1 for ids the bank does
+// not have.
+static long answerItem(const QuestionBank *bank, uint32_t id) {
+    if (id < bank->count) {
+        return id;
+    }
+    uint32_t kind = (id & ~GENERATED_ID) >> GENERATED_SEED_BITS;
+    return (id & GENERATED_ID) && kind < GENERATOR_COUNT ? (long)bank->count + kind : -1;
+}
+
+// Plays one record of a journal through the recorded session
+static int replayRecord(void *context, uint32_t run, const JournalRecord *record) {
+    static const char *stateNames[] = {"not_started", "asking", "finished", "timed_out"};
+    ReplayContext *replay = context;
+    uint64_t key = (uint64_t)run << 32 | record->session;
+    if (record->type == JOURNAL_START) {
+        ReplaySlot *slot = sessionTableInsert(&replay->open, key);
+        if (slot == NULL) {
+            fprintf(stderr, "Not enough memory to replay the journal\n");
+            return -1;
+        }
+        slot->category = record->option;
+        slot->mismatched = record->index > QUIZ_SIZE;
+        sessionStart(&slot->session, replay->bank, slot->quiz, record->index <= QUIZ_SIZE ? record->index : 0,
+                     0, record->ms);
+        return 0;
+    }
+    ReplaySlot *slot = sessionTableFind(&replay->open, key);
+    if (slot == NULL) {
+        replay->strays++;
+        return 0;
+    }
+    if (slot->mismatched && record->type != JOURNAL_END) {
+        return 0;
+    }
+
+    // The slot may have moved since the session was started
+    QuizSession *session = &slot->session;
+    session->quiz = slot->quiz;
+    if (record->type == JOURNAL_QUESTION) {
+        // A question the bank being replayed against does not have (the
+        // journal may span reloads of a bigger bank) cannot be graded
+        if (record->index != session->current || session->state != SESSION_ASKING
+            || answerItem(replay->bank, record->id) < 0) {
+            slot->mismatched = 1;
+            return 0;
+        }
+        slot->quiz[record->index] = record->id;
+        slot->shownMs = record->ms;
+    } else if (record->type == JOURNAL_ANSWER) {
+        int result = session->state == SESSION_ASKING && record->index == session->current
+                  && record->id == slot->quiz[session->current]
+                   ? sessionAnswer(session, record->option & ~JOURNAL_CORRECT, slot->shownMs + record->ms) : -1;
+        slot->mismatched |= result != ((record->option & JOURNAL_CORRECT) != 0);
+    } else if (record->type == JOURNAL_END) {
+        if (!slot->mismatched && session->state == SESSION_ASKING) {
+            if (record->option == SESSION_TIMED_OUT) {
+                sessionCheckTime(session, session->timeLimitMs);
+            } else {
+                sessionEnd(session, record->ms);
+            }
+        }
+        int matches = !slot->mismatched && session->state == record->option && session->score == record->index
+                   && (uint32_t)session->current == record->id && sessionTimeTaken(session) == record->ms;
+        replay->mismatches += !matches;
+        replay->sessions++;
+
+        OutputBuffer *out = replay->out;
+        appendNumber(out, run);
+        appendBytes(out, ",", 1);
+        appendNumber(out, record->session);
+        appendBytes(out, ",", 1);
+        appendNumber(out, slot->category);
+        appendBytes(out, ",", 1);
+        appendNumber(out, session->numQuestions);
+        appendBytes(out, ",", 1);
+        appendNumber(out, record->id);
+        appendBytes(out, ",", 1);
+        appendNumber(out, record->index);
+        appendBytes(out, ",", 1);
+        appendNumber(out, record->ms);
+        appendBytes(out, ",", 1);
+        const char *state = record->option < 4 ? stateNames[record->option] : "unknown";
+        appendBytes(out, state, strlen(state));
+        appendBytes(out, matches ? ",ok\n" : ",mismatch\n", matches ? 4 : 10);
+        sessionTableRemove(&replay->open, slot);
+    } else {
+        slot->mismatched = 1;
+    }
+    return 0;
+}
+
+// Reads a journal and plays every recorded session again through the same
+// session code that scored it, with the recorded answers at the recorded
+// times. Writes one CSV row per session that ended, saying whether the
+// replayed score, state and time match the recorded ones. Returns 1 if
+// anything failed to match or the journal was damaged, -1 if it could not
+// be read.
+int replayJournal(const QuestionBank *bank, const char *path, FILE *output) {
+    static OutputBuffer out;
+    out.file = output;
+    out.size = 0;
+    static const char header[] = "run,session,category,questions,answered,score,milliseconds,state,replay\n";
+    appendBytes(&out, header, sizeof(header) - 1);
+
+    ReplayContext replay;
+    memset(&replay, 0, sizeof(replay));
+    replay.bank = bank;
+    replay.open.slotSize = sizeof(ReplaySlot);
+    replay.out = &out;
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    JournalScan scan;
+    int status = scanJournal(path, replayRecord, &replay, &scan);
+    flushOutput(&out);
+    fflush(output);
+    if (status == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &finished);
+        double elapsed = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+        fprintf(stderr, "%ld events, %ld sessions in %.3f s (%.1f million events per second), "
+                        "%ld mismatched, %zu never ended, %ld stray events\n",
+                scan.events, replay.sessions, elapsed, elapsed > 0 ? scan.events / elapsed / 1e6 : 0.0,
+                replay.mismatches, replay.open.count, replay.strays);
+        reportJournalDamage(path, &scan);
+        status = scan.stopped || scan.intact < scan.size || replay.mismatches ? 1 : 0;
+    }
+    free(replay.open.slots);
+    return status;
+}
+
+
+// ====================================
+// Function Implementations - Item Analytics
+// ====================================
+//
+// Works out from a journal how each question does: how often it is
+// answered correctly, whether the players who get it right are the ones who
+// do well on the rest of their quiz (point-biserial discrimination), how
+// often each option is picked and how long players take over it. The
+// answers are first pulled out of the journal into columns, one array per
+// field, then aggregated in straight passes over those arrays.
+
+// Flags a question as too easy, too hard or wrongly keyed. A wrong key
+// shows as a distractor picked more often than the key, mostly by the
+// players who do well on the rest of the quiz.
+static const char *itemFlag(const ItemStats *stats, int key) {
+    if (stats->answers < ANALYTICS_MIN_ANSWERS) {
+        return "";
+    }
+    int keyBeaten = 0;
+    for (int option = 1; option <= 4 && key > 0; option++) {
+        keyBeaten |= option != key && stats->picks[option] > stats->picks[key];
+    }
+    if (keyBeaten && stats->discrimination <= ANALYTICS_WRONG_KEY) {
+        return "check_key";
+    }
+    if (stats->correctRate >= ANALYTICS_TOO_EASY) {
+        return "too_easy";
+    }
+    return stats->correctRate <= ANALYTICS_TOO_HARD ? "too_hard" : "";
+}
+
+// Makes room for one more answer and one more session in the columns
+static int growAnswerColumns(AnswerColumns *columns) {
+    if (columns->count == columns->capacity) {
+        size_t capacity = columns->capacity ? 2 * columns->capacity : 1 << 16;
+        uint32_t *item = realloc(columns->item, capacity * sizeof(uint32_t));
+        if (item != NULL) columns->item = item;
+        uint8_t *choice = realloc(columns->choice, capacity);
+        if (choice != NULL) columns->choice = choice;
+        uint32_t *latency = realloc(columns->latencyMs, capacity * sizeof(uint32_t));
+        if (latency != NULL) columns->latencyMs = latency;
+        uint32_t *session = realloc(columns->session, capacity * sizeof(uint32_t));
+        if (session != NULL) columns->session = session;
+        if (item == NULL || choice == NULL || latency == NULL || session == NULL) {
+            return -1;
+        }
+        columns->capacity = capacity;
+    }
+    if (columns->sessions == columns->sessionCapacity) {
+        size_t capacity = columns->sessionCapacity ? 2 * columns->sessionCapacity : 1 << 12;
+        int8_t *score = realloc(columns->score, capacity);
+        if (score == NULL) {
+            return -1;
+        }
+        columns->score = score;
+        columns->sessionCapacity = capacity;
+    }
+    return 0;
+}
+
+// Releases the columns
+void freeAnswerColumns(AnswerColumns *columns) {
+    free(columns->item);
+    free(columns->choice);
+    free(columns->latencyMs);
+    free(columns->session);
+    free(columns->score);
+    memset(columns, 0, sizeof(*columns));
+}
+
+// A session whose answers are being collected
+typedef struct {
+    uint64_t key;               // run << 32 | session
+    uint32_t index;             // Index of the session in the score column
+} CollectSlot;
+
+typedef struct {
+    const QuestionBank *bank;
+    AnswerColumns *columns;
+    SessionTable open;
+} CollectContext;
+
+// Adds the answers of a journal to the columns and fills in each session's
+// score once it ends
+static int collectAnswer(void *context, uint32_t run, const JournalRecord *record) {
+    CollectContext *collect = context;
+    AnswerColumns *columns = collect->columns;
+    uint64_t key = (uint64_t)run << 32 | record->session;
+    if (record->type == JOURNAL_START) {
+        CollectSlot *slot = growAnswerColumns(columns) == 0 ? sessionTableInsert(&collect->open, key) : NULL;
+        if (slot == NULL || columns->sessions > UINT32_MAX) {
+            fprintf(stderr, "Not enough memory for the answers in the journal\n");
+            return -1;
+        }
+        slot->index = (uint32_t)columns->sessions;
+        columns->score[columns->sessions++] = -1;
+        return 0;
+    }
+    CollectSlot *slot = sessionTableFind(&collect->open, key);
+    if (slot == NULL) {
+        return 0;
+    }
+    if (record->type == JOURNAL_ANSWER) {
+        long item = answerItem(collect->bank, record->id);
+        if (item < 0 || (record->option & ~JOURNAL_CORRECT) > 4) {
+            return 0;
+        }
+        if (growAnswerColumns(columns) != 0) {
+            fprintf(stderr, "Not enough memory for the answers in the journal\n");
+            return -1;
+        }
+        columns->item[columns->count] = (uint32_t)item;
+        columns->choice[columns->count] = record->option;
+        columns->latencyMs[columns->count] = record->ms;
+        columns->session[columns->count] = slot->index;
+        columns->count++;
+    } else if (record->type == JOURNAL_END) {
+        columns->score[slot->index] = (int8_t)(record->index <= QUIZ_SIZE ? record->index : -1);
+        sessionTableRemove(&collect->open, slot);
+    }
+    return 0;
+}
+
+// Reads every answer of a journal into columns. Returns -1 if the journal
+// cannot be read or memory runs out, and 1 if it was damaged.
+int loadAnswerColumns(const QuestionBank *bank, const char *path, AnswerColumns *columns) {
+    memset(columns, 0, sizeof(*columns));
+    CollectContext collect;
+    memset(&collect, 0, sizeof(collect));
+    collect.bank = bank;
+    collect.columns = columns;
+    collect.open.slotSize = sizeof(CollectSlot);
+
+    JournalScan scan;
+    int status = scanJournal(path, collectAnswer, &collect, &scan);
+    free(collect.open.slots);
+    if (status != 0 || scan.stopped) {
+        freeAnswerColumns(columns);
+        return -1;
+    }
+    reportJournalDamage(path, &scan);
+    return scan.intact < scan.size ? 1 : 0;
+}
+
+// Aggregates the columns into one ItemStats per item (itemCount of them).
+// Answers of sessions that never ended are left out, as the rest of their
+// quiz is unknown. The rest score of each answer is worked out first in a
+// pass of its own, so the main pass is straight loads and adds.
+int aggregateAnswers(const AnswerColumns *columns, ItemStats stats[], size_t itemCount) {
+    memset(stats, 0, itemCount * sizeof(ItemStats));
+    uint8_t *rest = malloc(columns->count ? columns->count : 1);
+    if (rest == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < columns->count; i++) {
+        int score = columns->score[columns->session[i]];
+        rest[i] = score < 0 ? 0xff : (uint8_t)(score - (columns->choice[i] >> 7));
+    }
+
+    for (size_t i = 0; i < columns->count; i++) {
+        if (rest[i] == 0xff || columns->item[i] >= itemCount) {
+            continue;
+        }
+        ItemStats *item = &stats[columns->item[i]];
+        uint32_t correct = columns->choice[i] >> 7;
+        uint32_t restScore = rest[i];
+        item->answers++;
+        item->correct += correct;
+        item->picks[columns->choice[i] & 7]++;
+        item->restSum += restScore;
+        item->restSquares += restScore * restScore;
+        item->restWhenCorrect += restScore * correct;
+        item->latencySum += columns->latencyMs[i];
+    }
+    free(rest);
+
+    for (size_t i = 0; i < itemCount; i++) {
+        ItemStats *item = &stats[i];
+        if (item->answers == 0) {
+            continue;
+        }
+        double n = item->answers;
+        double p = item->correct / n;
+        double mean = item->restSum / n;
+        double variance = item->restSquares / n - mean * mean;
+        item->correctRate = p;
+        item->meanLatencyMs = item->latencySum / n;
+        if (item->correct > 0 && item->correct < item->answers && variance > 0) {
+            double meanCorrect = (double)item->restWhenCorrect / item->correct;
+            double meanWrong = (double)(item->restSum - item->restWhenCorrect) / (item->answers - item->correct);
+            item->discrimination = (meanCorrect - meanWrong) * squareRoot(p * (1 - p) / variance);
+        }
+    }
+    return 0;
+}
+
+// Writes the statistics of every question that was answered as CSV, in
+// bank order and then one row per generator
+void writeItemStats(const QuestionBank *bank, const ItemStats stats[], size_t itemCount, FILE *output) {
+    fprintf(output, "question,key,answers,correct_rate,discrimination,none,option1,option2,option3,option4,"
+                    "mean_latency_ms,flag\n");
+    for (size_t i = 0; i < itemCount; i++) {
+        const ItemStats *item = &stats[i];
+        if (item->answers == 0) {
+            continue;
+        }
+        int key = i < bank->count ? bank->correctOption[i] : 0;
+        if (i < bank->count) {
+            fprintf(output, "%zu,%d,", i, key);
+        } else {
+            fprintf(output, "generated:%s,,", generatorTags[i - bank->count]);
+        }
+        fprintf(output, "%u,%.4f,%.4f,%u,%u,%u,%u,%u,%.0f,%s\n", item->answers, item->correctRate,
+                item->discrimination, item->picks[0], item->picks[1], item->picks[2], item->picks[3],
+                item->picks[4], item->meanLatencyMs, itemFlag(item, key));
+    }
+}
+
+// Reads the answers in a journal and writes the statistics of each question
+// as CSV. Returns 1 if the journal was damaged, -1 if it could not be read.
+int analyzeJournal(const QuestionBank *bank, const char *path, FILE *output) {
+    struct timespec started, loaded, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    AnswerColumns columns;
+    int status = loadAnswerColumns(bank, path, &columns);
+    if (status < 0) {
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &loaded);
+
+    size_t itemCount = (size_t)bank->count + GENERATOR_COUNT;
+    ItemStats *stats = malloc(itemCount * sizeof(ItemStats));
+    if (stats == NULL || aggregateAnswers(&columns, stats, itemCount) != 0) {
+        fprintf(stderr, "Not enough memory to analyze the journal\n");
+        free(stats);
+        freeAnswerColumns(&columns);
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    writeItemStats(bank, stats, itemCount, output);
+    fflush(output);
+
+    long flagged = 0;
+    for (size_t i = 0; i < itemCount; i++) {
+        flagged += itemFlag(&stats[i], i < bank->count ? bank->correctOption[i] : 0)[0] != '\0';
+    }
+    double reading = (loaded.tv_sec - started.tv_sec) + (loaded.tv_nsec - started.tv_nsec) / 1e9;
+    double aggregating = (finished.tv_sec - loaded.tv_sec) + (finished.tv_nsec - loaded.tv_nsec) / 1e9;
+    fprintf(stderr, "%zu answers from %zu sessions, read in %.3f s and aggregated in %.3f s "
+                    "(%.0f million answers per second), %ld questions flagged\n",
+            columns.count, columns.sessions, reading, aggregating,
+            aggregating > 0 ? columns.count / aggregating / 1e6 : 0.0, flagged);
+    free(stats);
+    freeAnswerColumns(&columns);
+    return status;
+}
+
+
+// ====================================
+// Function Implementations - Norms
+// ====================================
+//
+// Scores are compared with those of everyone who took a quiz of the same
+// category and length before. Past performances are kept in a merging
+// t-digest per population: a fixed number of centroids, small near the
+// ends of the distribution and large in the middle, so a percentile costs
+// the same however many sessions were seen and two sketches merge by
+// pooling their centroids.
+
+// Largest fraction of the values a centroid starting at fraction q may
+// reach. Centroids may span one unit of the scale
+//
+//     k(q) = c/2 * sqrt(2q)             for q <= 1/2
+//     k(q) = c/2 * (2 - sqrt(2(1 - q)))  above,
+//
+// with c = SKETCH_COMPRESSION. It rises steeply near both ends, so the
+// tails keep small centroids, and runs from 0 to c, which keeps the number
+// of centroids below 2c.
+static double sketchLimit(double q) {
+    double k = (q <= 0.5 ? squareRoot(2 * q) : 2 - squareRoot(2 * (1 - q))) + 2.0 / SKETCH_COMPRESSION;
+    return k <= 1 ? k * k / 2 : k < 2 ? 1 - (2 - k) * (2 - k) / 2 : 1;
+}
+
+static int compareCentroids(const void *a, const void *b) {
+    double x = ((const Centroid *)a)->mean, y = ((const Centroid *)b)->mean;
+    return (x > y) - (x < y);
+}
+
+// Sorts the pending values, merges them into the centroids (which are in
+// order already) and then joins neighbours for as long as the joined
+// centroid stays within its limit
+static void sketchCompress(QuantileSketch *sketch) {
+    if (sketch->pending == 0) {
+        return;
+    }
+    Centroid *c = sketch->centroids;
+    Centroid sorted[SKETCH_CENTROIDS + SKETCH_PENDING];
+    uint32_t count = sketch->merged + sketch->pending;
+    qsort(c + sketch->merged, sketch->pending, sizeof(Centroid), compareCentroids);
+    for (uint32_t n = 0, i = 0, j = sketch->merged; n < count; n++) {
+        sorted[n] = j == count || (i < sketch->merged && c[i].mean <= c[j].mean) ? c[i++] : c[j++];
+    }
+
+    uint32_t out = 0;
+    double before = 0;          // Weight of the centroids before c[out - 1]
+    double limit = 0;           // Weight c[out - 1] may grow to, counting those before it
+    for (uint32_t n = 0; n < count; n++) {
+        if (out > 0 && before + c[out - 1].weight + sorted[n].weight <= limit) {
+            Centroid *last = &c[out - 1];
+            last->weight += sorted[n].weight;
+            last->mean += (sorted[n].mean - last->mean) * sorted[n].weight / last->weight;
+        } else {
+            before += out > 0 ? c[out - 1].weight : 0;
+            limit = sketchLimit(before / sketch->total) * sketch->total;
+            c[out++] = sorted[n];
+        }
+    }
+    sketch->merged = out;
+    sketch->pending = 0;
+}
+
+// Adds a value seen weight times
+void sketchAdd(QuantileSketch *sketch, double value, double weight) {
+    if (sketch->total == 0 || value < sketch->minimum) sketch->minimum = value;
+    if (sketch->total == 0 || value > sketch->maximum) sketch->maximum = value;
+    sketch->centroids[sketch->merged + sketch->pending].mean = value;
+    sketch->centroids[sketch->merged + sketch->pending].weight = weight;
+    sketch->pending++;
+    sketch->total += weight;
+    if (sketch->merged + sketch->pending == SKETCH_CENTROIDS + SKETCH_PENDING) {
+        sketchCompress(sketch);
+    }
+}
+
+// Adds everything in another sketch
+void sketchMerge(QuantileSketch *sketch, const QuantileSketch *other) {
+    if (other->total == 0) {
+        return;
+    }
+    double minimum = other->minimum, maximum = other->maximum;
+    if (sketch->total > 0 && sketch->minimum < minimum) minimum = sketch->minimum;
+    if (sketch->total > 0 && sketch->maximum > maximum) maximum = sketch->maximum;
+    for (uint32_t i = 0; i < other->merged + other->pending; i++) {
+        sketchAdd(sketch, other->centroids[i].mean, other->centroids[i].weight);
+    }
+    sketch->minimum = minimum;
+    sketch->maximum = maximum;
+}
+
+// Fraction of the values below x, counting values equal to it as half
+// below. Between centroids the fraction is interpolated, taking half of
+// each centroid's weight to lie on either side of its mean.
+double sketchRank(QuantileSketch *sketch, double x) {
+    sketchCompress(sketch);
+    if (sketch->total == 0 || x < sketch->minimum) {
+        return 0;
+    }
+    if (x > sketch->maximum) {
         return 1;
-    } 
-    else {
-        printf("Wrong! The correct answer was: %s\n", q.options[q.correctOption - 1]);
+    }
+    const Centroid *c = sketch->centroids;
+    double before = 0;          // Weight of the centroids left of c[i]
+    double lastMean = sketch->minimum, lastRank = 0;
+    for (uint32_t i = 0; i < sketch->merged; i++) {
+        if (x == c[i].mean) {
+            double equal = 0;
+            for (uint32_t j = i; j < sketch->merged && c[j].mean == x; j++) {
+                equal += c[j].weight;
+            }
+            return (before + equal / 2) / sketch->total;
+        }
+        double rank = before + c[i].weight / 2;
+        if (x < c[i].mean) {
+            return (lastRank + (rank - lastRank) * (x - lastMean) / (c[i].mean - lastMean)) / sketch->total;
+        }
+        before += c[i].weight;
+        lastMean = c[i].mean;
+        lastRank = rank;
+    }
+    if (sketch->maximum == lastMean) {
+        return 1;
+    }
+    return (lastRank + (sketch->total - lastRank) * (x - lastMean) / (sketch->maximum - lastMean)) / sketch->total;
+}
+
+// Number of standard deviations below which a fraction p of a normal
+// distribution lies (Acklam's rational approximation, good to about 1e-9)
+static double inverseNormal(double p) {
+    static const double a[] = {-3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+                               1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00};
+    static const double b[] = {-5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+                               6.680131188771972e+01, -1.328068155288572e+01};
+    static const double c[] = {-7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+                               -2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00};
+    static const double d[] = {7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00,
+                               3.754408661907416e+00};
+    if (p < 0.02425 || p > 1 - 0.02425) {
+        double q = squareRoot(-2 * naturalLog(p < 0.5 ? p : 1 - p));
+        double z = (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5])
+                 / ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+        return p < 0.5 ? z : -z;
+    }
+    double q = p - 0.5, r = q * q;
+    return (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q
+         / (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1);
+}
+
+// Index of the sketch of a category and quiz length, or -1
+static int normsPopulation(int category, int numQuestions) {
+    if (category < 1 || category > CATEGORY_COUNT || numQuestions < 1 || numQuestions > QUIZ_SIZE) {
+        return -1;
+    }
+    return (category - 1) * QUIZ_SIZE + numQuestions - 1;
+}
+
+// Adds a finished session's performance to its population
+void normsAdd(Norms *norms, int category, int numQuestions, double performance) {
+    int population = normsPopulation(category, numQuestions);
+    if (population >= 0) {
+        sketchAdd(&norms->population[population], performance, 1);
+        sketchAdd(&norms->unsaved[population], performance, 1);
+        norms->changed = 1;
+    }
+}
+
+// Percentile of a performance among the sessions of the same category and
+// length, and the IQ it stands for: 100 plus 15 for each standard
+// deviation above the middle. Returns the number of sessions it was
+// compared with, or 0 if there were fewer than NORM_MIN_SESSIONS.
+long normsScore(Norms *norms, int category, int numQuestions, double performance, double *percentile, int *iq) {
+    int population = normsPopulation(category, numQuestions);
+    if (population < 0 || norms->population[population].total < NORM_MIN_SESSIONS) {
+        return 0;
+    }
+    QuantileSketch *sketch = &norms->population[population];
+    double rank = sketchRank(sketch, performance);
+    *percentile = 100 * rank;
+    // Kept clear of 0 and 1, which have no place on the normal curve
+    double p = (rank * sketch->total + 0.5) / (sketch->total + 1);
+    double value = 100 + 15 * inverseNormal(p);
+    *iq = value < IQ_MIN ? IQ_MIN : value > IQ_MAX ? IQ_MAX : (int)(value + 0.5);
+    return (long)sketch->total;
+}
+
+// Reads the sketches of a norms file. A file that does not exist yet holds
+// no sessions.
+static int readNormsFile(const char *path, QuantileSketch sketches[]) {
+    memset(sketches, 0, NORM_POPULATIONS * sizeof(QuantileSketch));
+    FILE *in = fopen(path, "rb");
+    if (in == NULL) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    NormsHeader header;
+    int failed = fread(&header, sizeof(header), 1, in) != 1 || header.magic != NORMS_MAGIC
+              || header.populations != NORM_POPULATIONS || header.sketchSize != sizeof(QuantileSketch)
+              || fread(sketches, sizeof(QuantileSketch), NORM_POPULATIONS, in) != NORM_POPULATIONS;
+    fclose(in);
+    for (int i = 0; i < NORM_POPULATIONS && !failed; i++) {
+        failed = sketches[i].merged + sketches[i].pending >= SKETCH_CENTROIDS + SKETCH_PENDING
+              || !(sketches[i].total >= 0);
+    }
+    if (failed) {
+        fprintf(stderr, "'%s' is not a valid norms file\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// Loads the norms kept in a file. Sessions added afterwards are counted
+// straight away and written out by normsSave.
+int normsOpen(Norms *norms, const char *path) {
+    memset(norms, 0, sizeof(*norms));
+    norms->path = path;
+    return readNormsFile(path, norms->population);
+}
+
+// Merges the sessions added since the last save into the norms file. The
+// file is read again under a lock, so the sessions other processes saved
+// in the meantime are kept and from now on counted here too, and replaced
+// in one rename so a reader never sees half of it.
+int normsSave(Norms *norms) {
+    if (!norms->changed) {
+        return 0;
+    }
+    char lockPath[512], tempPath[512];
+    snprintf(lockPath, sizeof(lockPath), "%s.lock", norms->path);
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", norms->path);
+    int lock = open(lockPath, O_RDWR | O_CREAT, 0644);
+    if (lock < 0 || flock(lock, LOCK_EX) != 0) {
+        fprintf(stderr, "Cannot lock norms file '%s'\n", lockPath);
+        if (lock >= 0) close(lock);
+        return -1;
+    }
+
+    QuantileSketch *sketches = malloc(NORM_POPULATIONS * sizeof(QuantileSketch));
+    int failed = sketches == NULL || readNormsFile(norms->path, sketches) != 0;
+    if (!failed) {
+        for (int i = 0; i < NORM_POPULATIONS; i++) {
+            sketchMerge(&sketches[i], &norms->unsaved[i]);
+            sketchCompress(&sketches[i]);
+        }
+        NormsHeader header = {NORMS_MAGIC, NORM_POPULATIONS, sizeof(QuantileSketch)};
+        FILE *out = fopen(tempPath, "wb");
+        failed = out == NULL || fwrite(&header, sizeof(header), 1, out) != 1
+              || fwrite(sketches, sizeof(QuantileSketch), NORM_POPULATIONS, out) != NORM_POPULATIONS;
+        if (out != NULL && fclose(out) != 0) {
+            failed = 1;
+        }
+        if (failed || rename(tempPath, norms->path) != 0) {
+            fprintf(stderr, "Cannot write norms file '%s'\n", norms->path);
+            remove(tempPath);
+            failed = 1;
+        }
+    }
+    if (!failed) {
+        memcpy(norms->population, sketches, sizeof(norms->population));
+        memset(norms->unsaved, 0, sizeof(norms->unsaved));
+        norms->changed = 0;
+    }
+    free(sketches);
+    close(lock);
+    return failed ? -1 : 0;
+}
+
+// Adds the sessions of another norms file, e.g. one kept on another
+// machine, to these norms
+int normsMergeFile(Norms *norms, const char *path) {
+    if (access(path, R_OK) != 0) {
+        fprintf(stderr, "Cannot open norms file '%s'\n", path);
+        return -1;
+    }
+    QuantileSketch *sketches = malloc(NORM_POPULATIONS * sizeof(QuantileSketch));
+    int failed = sketches == NULL || readNormsFile(path, sketches) != 0;
+    for (int i = 0; i < NORM_POPULATIONS && !failed; i++) {
+        sketchMerge(&norms->population[i], &sketches[i]);
+        sketchMerge(&norms->unsaved[i], &sketches[i]);
+        norms->changed |= sketches[i].total > 0;
+    }
+    free(sketches);
+    return failed ? -1 : 0;
+}
+
+
+// ====================================
+// Function Implementations - Exposure
+// ====================================
+//
+// Each solo player's questions are kept between games so a returning player
+// is given ones they have not seen. A player's set is a fixed EXPOSURE_BITS
+// bits whatever the bank's size, and the exposure file is a hash table of
+// sets on disk, so finding a player reads a few slots however many players
+// the file holds.
+
+// Key a player's set is filed under. 0 marks an empty slot.
+static uint64_t playerKey(const char *playerName) {
+    uint64_t key = mixHash(hashBytes64(playerName, strlen(playerName), 14695981039346656037ULL));
+    return key != 0 ? key : 1;
+}
+
+// Bits a question stands for in a set: its own bit while the bank fits,
+// otherwise EXPOSURE_HASHES bits picked by double hashing
+static int seenBits(const SeenSet *set, uint32_t id, uint32_t bits[]) {
+    if (set->bankCount <= EXPOSURE_BITS) {
+        bits[0] = id;
+        return 1;
+    }
+    uint64_t hash = mixHash(id + 0x9e3779b97f4a7c15ULL);
+    uint32_t first = (uint32_t)hash, step = (uint32_t)(hash >> 32) | 1;
+    for (int i = 0; i < EXPOSURE_HASHES; i++) {
+        bits[i] = (first + (uint32_t)i * step) % EXPOSURE_BITS;
+    }
+    return EXPOSURE_HASHES;
+}
+
+// Whether the player may have been asked a question. Generated questions
+// are made up afresh each time, so they are never counted as seen.
+int seenContains(const SeenSet *set, uint32_t id) {
+    uint32_t bits[EXPOSURE_HASHES];
+    if (id & GENERATED_ID) {
+        return 0;
+    }
+    int count = seenBits(set, id, bits);
+    for (int i = 0; i < count; i++) {
+        if (!(set->bits[bits[i] / 64] >> (bits[i] % 64) & 1)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Remembers that the player was asked a question. A Bloom filter that holds
+// EXPOSURE_CAPACITY questions starts over, since beyond that it would take
+// too many unseen questions for seen ones.
+void seenAdd(SeenSet *set, uint32_t id) {
+    uint32_t bits[EXPOSURE_HASHES];
+    if ((id & GENERATED_ID) || seenContains(set, id)) {
+        return;
+    }
+    if (set->bankCount > EXPOSURE_BITS && set->seen >= EXPOSURE_CAPACITY) {
+        memset(set->bits, 0, sizeof(set->bits));
+        set->seen = 0;
+    }
+    int count = seenBits(set, id, bits);
+    for (int i = 0; i < count; i++) {
+        set->bits[bits[i] / 64] |= 1ULL << (bits[i] % 64);
+    }
+    set->seen++;
+}
+
+// Forgets the view's questions once the player has seen nearly all of them,
+// so a new round through them starts. A Bloom filter cannot forget single
+// questions and starts over.
+static void seenForgetView(SeenSet *set, const QuestionView *view) {
+    if (set->bankCount > EXPOSURE_BITS) {
+        memset(set->bits, 0, sizeof(set->bits));
+        set->seen = 0;
+        return;
+    }
+    for (int i = 0; i < view->count; i++) {
+        uint32_t id = view->ids[i];
+        if (set->bits[id / 64] >> (id % 64) & 1) {
+            set->bits[id / 64] &= ~(1ULL << (id % 64));
+            set->seen--;
+        }
+    }
+}
+
+// Picks up to QUIZ_SIZE different questions the player has not been asked.
+// This is drawQuiz's shuffle carried on past numQuestions steps, passing
+// over seen questions, for at most EXPOSURE_DRAW_STEPS steps; while most of
+// the view is unseen it stops after about numQuestions. If it cannot find
+// enough, the player has seen nearly the whole view: the quiz is made up
+// with seen questions and the view starts a new round.
+int drawUnseenQuiz(const QuestionView *view, uint32_t quiz[], int numQuestions, SeenSet *set, Random *rng) {
+    int available = view->count + view->generated;
+    if (numQuestions > QUIZ_SIZE) {
+        numQuestions = QUIZ_SIZE;
+    }
+    if (numQuestions > available) {
+        numQuestions = available;
+    }
+    int steps = available < EXPOSURE_DRAW_STEPS ? available : EXPOSURE_DRAW_STEPS;
+
+    uint32_t movedFrom[EXPOSURE_DRAW_STEPS];  // Positions past the current step that were swapped...
+    uint32_t movedValue[EXPOSURE_DRAW_STEPS]; // ...and the position each one now holds
+    uint32_t repeats[QUIZ_SIZE];              // Seen questions, in case there are not enough others
+    int moved = 0, drawn = 0, repeated = 0;
+    for (int i = 0; i < steps && drawn < numQuestions; i++) {
+        uint32_t j = (uint32_t)i + randomBelow(rng, (uint32_t)(available - i));
+        uint32_t valueI = (uint32_t)i, valueJ = j;
+        int slotJ = -1;
+        for (int m = 0; m < moved; m++) {
+            if (movedFrom[m] == (uint32_t)i) {
+                valueI = movedValue[m];
+            }
+            if (movedFrom[m] == j) {
+                valueJ = movedValue[m];
+                slotJ = m;
+            }
+        }
+        if (slotJ < 0) {
+            slotJ = moved++;
+            movedFrom[slotJ] = j;
+        }
+        movedValue[slotJ] = valueI;
+
+        uint32_t id = viewQuestion(view, valueJ, rng);
+        if (!seenContains(set, id)) {
+            quiz[drawn++] = id;
+        } else if (repeated < numQuestions) {
+            repeats[repeated++] = id;
+        }
+    }
+    if (drawn < numQuestions) {
+        seenForgetView(set, view);
+        while (drawn < numQuestions) {
+            quiz[drawn++] = repeats[--repeated];
+        }
+    }
+    return drawn;
+}
+
+// Takes the lock that guards an exposure file. The file itself is replaced
+// when it grows, so the lock is kept on a file beside it.
+static int lockExposures(const char *path, int operation) {
+    char lockPath[512];
+    snprintf(lockPath, sizeof(lockPath), "%s.lock", path);
+    int lock = open(lockPath, O_RDWR | O_CREAT, 0644);
+    if (lock < 0 || flock(lock, operation) != 0) {
+        fprintf(stderr, "Cannot lock exposure file '%s'\n", lockPath);
+        if (lock >= 0) close(lock);
+        return -1;
+    }
+    return lock;
+}
+
+// Reads the header of an exposure file and checks the file holds its table
+static int readExposureHeader(int fd, ExposureHeader *header) {
+    struct stat info;
+    if (pread(fd, header, sizeof(*header), 0) != (ssize_t)sizeof(*header) || header->magic != EXPOSURE_MAGIC
+        || header->recordSize != sizeof(SeenSet) || header->slots == 0 || (header->slots & (header->slots - 1)) != 0
+        || header->slots > (UINT64_MAX - sizeof(*header)) / sizeof(SeenSet) || fstat(fd, &info) != 0
+        || (uint64_t)info.st_size < sizeof(*header) + header->slots * sizeof(SeenSet)) {
+        return -1;
+    }
+    return 0;
+}
+
+// Finds the slot holding a player's set, or the empty slot it would go in,
+// and reads it into record. Returns -1 if the file cannot be read.
+static long long findSeenSlot(int fd, const ExposureHeader *header, uint64_t player, SeenSet *record) {
+    uint64_t slot = player & (header->slots - 1);
+    for (uint64_t probe = 0; probe < header->slots; probe++) {
+        off_t offset = (off_t)(sizeof(*header) + slot * sizeof(SeenSet));
+        if (pread(fd, record, sizeof(*record), offset) != (ssize_t)sizeof(*record)) {
+            return -1;
+        }
+        if (record->player == player || record->player == 0) {
+            return (long long)slot;
+        }
+        slot = (slot + 1) & (header->slots - 1);
+    }
+    return -1;
+}
+
+// Writes a set into its slot
+static int writeSeenSlot(int fd, const ExposureHeader *header, long long slot, const SeenSet *set) {
+    off_t offset = (off_t)(sizeof(*header) + (uint64_t)slot * sizeof(SeenSet));
+    return pwrite(fd, set, sizeof(*set), offset) == (ssize_t)sizeof(*set) ? 0 : -1;
+}
+
+// Creates an empty table of the given number of slots under the temporary
+// name of an exposure file. Empty slots are zeros, so the file is made the
+// right length without writing them. Returns the open file, or -1.
+static int createExposureTable(const char *tempPath, uint64_t slots, ExposureHeader *header) {
+    header->magic = EXPOSURE_MAGIC;
+    header->recordSize = sizeof(SeenSet);
+    header->slots = slots;
+    header->players = 0;
+    int fd = open(tempPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    if (pwrite(fd, header, sizeof(*header), 0) != (ssize_t)sizeof(*header)
+        || ftruncate(fd, (off_t)(sizeof(*header) + slots * sizeof(SeenSet))) != 0) {
+        close(fd);
+        remove(tempPath);
+        return -1;
+    }
+    return fd;
+}
+
+// Moves every set of an exposure file into a table with twice the slots,
+// which replaces the file in one rename. Both tables are mapped, so moving
+// a set costs no system call. Returns the new file, or -1.
+static int growExposureFile(const char *path, int fd, ExposureHeader *header) {
+    char tempPath[512];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+    ExposureHeader grown;
+    int out = createExposureTable(tempPath, header->slots * 2, &grown);
+    if (out < 0) {
+        return -1;
+    }
+    size_t oldSize = sizeof(*header) + header->slots * sizeof(SeenSet);
+    size_t newSize = sizeof(grown) + grown.slots * sizeof(SeenSet);
+    void *oldData = mmap(NULL, oldSize, PROT_READ, MAP_SHARED, fd, 0);
+    void *newData = mmap(NULL, newSize, PROT_READ | PROT_WRITE, MAP_SHARED, out, 0);
+    int failed = oldData == MAP_FAILED || newData == MAP_FAILED;
+    if (!failed) {
+        const SeenSet *from = (const SeenSet *)((const unsigned char *)oldData + sizeof(*header));
+        SeenSet *to = (SeenSet *)((unsigned char *)newData + sizeof(grown));
+        for (uint64_t i = 0; i < header->slots; i++) {
+            if (from[i].player != 0) {
+                uint64_t slot = from[i].player & (grown.slots - 1);
+                while (to[slot].player != 0) {
+                    slot = (slot + 1) & (grown.slots - 1);
+                }
+                to[slot] = from[i];
+                grown.players++;
+            }
+        }
+        memcpy(newData, &grown, sizeof(grown));
+    }
+    if (oldData != MAP_FAILED) {
+        munmap(oldData, oldSize);
+    }
+    if (newData != MAP_FAILED) {
+        munmap(newData, newSize);
+    }
+    if (failed || rename(tempPath, path) != 0) {
+        close(out);
+        remove(tempPath);
+        return -1;
+    }
+    *header = grown;
+    return out;
+}
+
+// Finds a player's set in an exposure file. A player the file does not
+// know, or one whose set was kept for a different bank, starts with an
+// empty set, as does everyone while the file does not exist yet.
+int seenLoad(const char *path, const QuestionBank *bank, const char *playerName, SeenSet *set) {
+    memset(set, 0, sizeof(*set));
+    set->player = playerKey(playerName);
+    set->bankCount = bank->count;
+    int lock = lockExposures(path, LOCK_SH);
+    if (lock < 0) {
+        return -1;
+    }
+    int fd = open(path, O_RDONLY);
+    int failed = fd < 0 && errno != ENOENT;
+    if (fd >= 0) {
+        ExposureHeader header;
+        SeenSet record;
+        failed = readExposureHeader(fd, &header) != 0 || findSeenSlot(fd, &header, set->player, &record) < 0;
+        if (!failed && record.player == set->player && record.bankCount == bank->count
+            && record.seen <= bank->count) {
+            *set = record;
+        }
+        close(fd);
+    }
+    close(lock);
+    if (failed) {
+        fprintf(stderr, "'%s' is not a valid exposure file\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// Stores a player's set in an exposure file, creating the file on first use
+// and doubling its table once three quarters of the slots are in use
+int seenSave(const char *path, const SeenSet *set) {
+    char tempPath[512];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+    int lock = lockExposures(path, LOCK_EX);
+    if (lock < 0) {
+        return -1;
+    }
+    ExposureHeader header;
+    int fd = open(path, O_RDWR);
+    if (fd < 0 && errno == ENOENT) {
+        fd = createExposureTable(tempPath, EXPOSURE_MIN_SLOTS, &header);
+        if (fd >= 0 && rename(tempPath, path) != 0) {
+            close(fd);
+            remove(tempPath);
+            fd = -1;
+        }
+    }
+    SeenSet record;
+    int failed = fd < 0 || readExposureHeader(fd, &header) != 0;
+    long long slot = failed ? -1 : findSeenSlot(fd, &header, set->player, &record);
+    if (slot >= 0 && record.player == 0 && (header.players + 1) * 4 > header.slots * 3) {
+        int grown = growExposureFile(path, fd, &header);
+        close(fd);
+        fd = grown;
+        slot = fd < 0 ? -1 : findSeenSlot(fd, &header, set->player, &record);
+    }
+    failed = slot < 0 || writeSeenSlot(fd, &header, slot, set) != 0;
+    if (!failed && record.player == 0) {
+        header.players++;
+        failed = pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    close(lock);
+    if (failed) {
+        fprintf(stderr, "Cannot write exposure file '%s'\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+
+// ====================================
+// Function Implementations - Metrics
+// ====================================
+//
+// The game counts what it does and times the parts players wait on in
+// gameMetrics, which costs a few nanoseconds an event and nothing at all in
+// a build with -DMINDMATCH_NO_METRICS. --metrics writes them out in the
+// Prometheus text format, which node_exporter's textfile collector picks up
+// as it is, or as JSON for a path ending in .json. --trace writes a span for
+// each solo game and each question asked in the Chrome trace event format,
+// for chrome://tracing or Perfetto.
+
+// How a counter or histogram is named when the metrics are written out.
+// Metrics that share a name follow each other and differ in their label.
+typedef struct {
+    const char *name;
+    const char *help;
+    const char *label;          // Label telling apart the metrics of one name, or NULL
+    const char *labelValue;
+    double scale;               // Seconds in one unit of a histogram's values
+} MetricInfo;
+
+static const MetricInfo counterInfo[COUNTER_COUNT] = {
+    {"mindmatch_sessions_started_total", "Quiz sessions started", NULL, NULL, 0},
+    {"mindmatch_sessions_ended_total", "Quiz sessions ended, by how they ended", "outcome", "completed", 0},
+    {"mindmatch_sessions_ended_total", "Quiz sessions ended, by how they ended", "outcome", "timed_out", 0},
+    {"mindmatch_sessions_ended_total", "Quiz sessions ended, by how they ended", "outcome", "abandoned", 0},
+    {"mindmatch_answers_correct_total", "Answers that were correct", NULL, NULL, 0},
+    {"mindmatch_answers_missed_total", "Questions whose time ran out before they were answered", NULL, NULL, 0},
+    {"mindmatch_connections_total", "Clients the server accepted", NULL, NULL, 0},
+    {"mindmatch_bank_reloads_total", "New versions of the question bank the server switched to", NULL, NULL, 0}
+};
+
+static const MetricInfo histogramInfo[HISTOGRAM_COUNT] = {
+    {"mindmatch_bank_load_seconds", "Time taken to open the question bank", NULL, NULL, 1e-9},
+    {"mindmatch_question_render_seconds", "Time taken to look up and format a question, one in 8 timed",
+     NULL, NULL, 1e-9},
+    {"mindmatch_answer_seconds", "Time from showing a question to its answer", "category", "iq", 1e-3},
+    {"mindmatch_answer_seconds", "Time from showing a question to its answer", "category", "math", 1e-3},
+    {"mindmatch_answer_seconds", "Time from showing a question to its answer", "category", "english", 1e-3},
+    {"mindmatch_session_seconds", "Time from the start of a quiz session to its end", "category", "iq", 1e-3},
+    {"mindmatch_session_seconds", "Time from the start of a quiz session to its end", "category", "math", 1e-3},
+    {"mindmatch_session_seconds", "Time from the start of a quiz session to its end", "category", "english", 1e-3}
+};
+
+// Bucket a value falls in: the value itself while it is small, otherwise
+// its power of two and the HISTOGRAM_SUB_BITS bits below its top bit
+static int histogramBucket(uint64_t value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return (int)value;
+    }
+    int shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+    return shift * HISTOGRAM_SUB_BUCKETS + (int)(value >> shift);
+}
+
+// Highest value that falls in a bucket
+static uint64_t histogramBucketTop(int bucket) {
+    if (bucket + 1 >= HISTOGRAM_BUCKETS) {
+        return UINT64_MAX;
+    }
+    int next = bucket + 1;
+    if (next < 2 * HISTOGRAM_SUB_BUCKETS) {
+        return (uint64_t)bucket;
+    }
+    int shift = next / HISTOGRAM_SUB_BUCKETS - 1;
+    return ((uint64_t)(next % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS) << shift) - 1;
+}
+
+void histogramRecord(Histogram *histogram, uint64_t value, uint64_t weight) {
+    histogram->buckets[histogramBucket(value)] += weight;
+    histogram->sum += value * weight;
+    histogram->max = value > histogram->max ? value : histogram->max;
+}
+
+uint64_t histogramCount(const Histogram *histogram) {
+    uint64_t count = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        count += histogram->buckets[i];
+    }
+    return count;
+}
+
+// The value a share q of the recorded values are at or below, given as the
+// top of its bucket (but never above the largest value), or 0 if empty
+uint64_t histogramQuantile(const Histogram *histogram, double q) {
+    uint64_t count = histogramCount(histogram);
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(q * count);
+    rank += rank < q * count || rank == 0;
+    uint64_t seen = 0;
+    int bucket = 0;
+    while (bucket < HISTOGRAM_BUCKETS - 1 && (seen += histogram->buckets[bucket]) < rank) {
+        bucket++;
+    }
+    uint64_t top = histogramBucketTop(bucket);
+    return top < histogram->max ? top : histogram->max;
+}
+
+// Starts a trace file, whose times count from now. The spans go into a
+// JSON array that is never closed, which the trace viewers accept, so the
+// file stays readable if the game stops without writing the rest.
+int traceOpen(const char *path) {
+    gameTrace.file = fopen(path, "w");
+    if (gameTrace.file == NULL) {
+        fprintf(stderr, "Cannot create trace file '%s'\n", path);
+        return -1;
+    }
+    gameTrace.count = 0;
+    gameTrace.openedNs = monotonicNs();
+    fprintf(gameTrace.file, "[\n");
+    return 0;
+}
+
+// Writes a time in nanoseconds as microseconds, the unit of trace files,
+// so that it ends just before end. Returns where the text starts.
+static char *formatMicros(char *end, long long ns) {
+    static const char pairs[] = "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+                                "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+                                "8081828384858687888990919293949596979899";
+    uint64_t value = ns > 0 ? (uint64_t)ns : 0;
+    uint64_t fraction = value % 1000;
+    value /= 1000;
+    end -= 4;
+    end[0] = '.';
+    end[1] = (char)('0' + fraction / 100);
+    memcpy(end + 2, pairs + 2 * (fraction % 100), 2);
+    while (value >= 10) {
+        end -= 2;
+        memcpy(end, pairs + 2 * (value % 100), 2);
+        value /= 100;
+    }
+    if (value != 0 || *end == '.') {
+        *--end = (char)('0' + value);
+    }
+    return end;
+}
+
+// Copies text so that it ends just before end. Returns where it starts.
+static char *formatBefore(char *end, const char *text, size_t length) {
+    return memcpy(end - length, text, length);
+}
+
+// Writes out the spans waiting in the buffer. Each line is put together
+// from its end backwards, which is how the numbers come out digit by digit.
+static void traceFlush() {
+    static OutputBuffer out;
+    static const char start[] = "{\"name\": \"", middle[] = "\", \"ph\": \"X\", \"ts\": ", duration[] = ", \"dur\": ";
+    char ending[48];
+    int endingLength = snprintf(ending, sizeof(ending), ", \"pid\": %d, \"tid\": 1},\n", (int)getpid());
+    out.file = gameTrace.file;
+    out.size = 0;
+    for (int i = 0; i < gameTrace.count; i++) {
+        const TraceSpan *span = &gameTrace.spans[i];
+        char line[256];
+        char *end = line + sizeof(line);
+        char *text = formatBefore(end, ending, (size_t)endingLength);
+        text = formatMicros(text, span->durationNs);
+        text = formatBefore(text, duration, sizeof(duration) - 1);
+        text = formatMicros(text, span->startNs - gameTrace.openedNs);
+        text = formatBefore(text, middle, sizeof(middle) - 1);
+        size_t nameLength = strnlen(span->name, 64);
+        text = formatBefore(text, span->name, nameLength);
+        text = formatBefore(text, start, sizeof(start) - 1);
+        appendBytes(&out, text, (size_t)(end - text));
+    }
+    flushOutput(&out);
+    gameTrace.count = 0;
+    fflush(gameTrace.file);
+}
+
+// Keeps a span that started at startNs and ends now. Spans are only
+// formatted once the buffer is full, or when the trace is closed.
+void traceSpan(const char *name, long long startNs) {
+    TraceSpan *span = &gameTrace.spans[gameTrace.count++];
+    span->name = name;
+    span->startNs = startNs;
+    span->durationNs = monotonicNs() - startNs;
+    if (gameTrace.count == TRACE_BUFFER_SPANS) {
+        traceFlush();
+    }
+}
+
+int traceClose() {
+    if (gameTrace.file == NULL) {
         return 0;
     }
+    traceFlush();
+    int failed = ferror(gameTrace.file);
+    if (fclose(gameTrace.file) != 0) {
+        failed = 1;
+    }
+    gameTrace.file = NULL;
+    return failed ? -1 : 0;
+}
+
+// Writes the HELP and TYPE lines of a metric unless the one before it
+// had the same name
+static void writeMetricHeader(FILE *out, const MetricInfo *info, const MetricInfo *previous, const char *type) {
+    if (previous == NULL || strcmp(previous->name, info->name) != 0) {
+        fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", info->name, info->help, info->name, type);
+    }
+}
+
+// Writes every metric in the Prometheus text format. Only the buckets that
+// hold values are listed, each with the count of values up to its top.
+static void writePrometheus(FILE *out, const Metrics *metrics) {
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        const MetricInfo *info = &counterInfo[i];
+        writeMetricHeader(out, info, i > 0 ? &counterInfo[i - 1] : NULL, "counter");
+        if (info->label != NULL) {
+            fprintf(out, "%s{%s=\"%s\"} %llu\n", info->name, info->label, info->labelValue,
+                    (unsigned long long)metrics->counters[i]);
+        } else {
+            fprintf(out, "%s %llu\n", info->name, (unsigned long long)metrics->counters[i]);
+        }
+    }
+    for (int i = 0; i < HISTOGRAM_COUNT; i++) {
+        const MetricInfo *info = &histogramInfo[i];
+        const Histogram *histogram = &metrics->histograms[i];
+        writeMetricHeader(out, info, i > 0 ? &histogramInfo[i - 1] : NULL, "histogram");
+        char label[64] = "", labels[64] = "";
+        if (info->label != NULL) {
+            snprintf(label, sizeof(label), "%s=\"%s\",", info->label, info->labelValue);
+            snprintf(labels, sizeof(labels), "{%s=\"%s\"}", info->label, info->labelValue);
+        }
+        uint64_t count = 0;
+        for (int b = 0; b < HISTOGRAM_BUCKETS - 1; b++) {
+            if (histogram->buckets[b] != 0) {
+                count += histogram->buckets[b];
+                fprintf(out, "%s_bucket{%sle=\"%.9g\"} %llu\n", info->name, label,
+                        histogramBucketTop(b) * info->scale, (unsigned long long)count);
+            }
+        }
+        count += histogram->buckets[HISTOGRAM_BUCKETS - 1];
+        fprintf(out, "%s_bucket{%sle=\"+Inf\"} %llu\n", info->name, label, (unsigned long long)count);
+        fprintf(out, "%s_sum%s %.9g\n", info->name, labels, histogram->sum * info->scale);
+        fprintf(out, "%s_count%s %llu\n", info->name, labels, (unsigned long long)count);
+    }
+}
+
+// Writes every metric as JSON, one per line, with the main quantiles of
+// each histogram in place of its buckets
+static void writeMetricsJson(FILE *out, const Metrics *metrics) {
+    fprintf(out, "{\"metrics\": [\n");
+    for (int i = 0; i < COUNTER_COUNT + HISTOGRAM_COUNT; i++) {
+        const MetricInfo *info = i < COUNTER_COUNT ? &counterInfo[i] : &histogramInfo[i - COUNTER_COUNT];
+        fprintf(out, "{\"name\": \"%s\", \"type\": \"%s\"", info->name, i < COUNTER_COUNT ? "counter" : "histogram");
+        if (info->label != NULL) {
+            fprintf(out, ", \"%s\": \"%s\"", info->label, info->labelValue);
+        }
+        if (i < COUNTER_COUNT) {
+            fprintf(out, ", \"value\": %llu", (unsigned long long)metrics->counters[i]);
+        } else {
+            const Histogram *histogram = &metrics->histograms[i - COUNTER_COUNT];
+            fprintf(out, ", \"count\": %llu, \"sum\": %.9g, \"p50\": %.9g, \"p90\": %.9g, \"p99\": %.9g, \"max\": %.9g",
+                    (unsigned long long)histogramCount(histogram), histogram->sum * info->scale,
+                    histogramQuantile(histogram, 0.5) * info->scale, histogramQuantile(histogram, 0.9) * info->scale,
+                    histogramQuantile(histogram, 0.99) * info->scale, histogram->max * info->scale);
+        }
+        fprintf(out, "}%s\n", i + 1 < COUNTER_COUNT + HISTOGRAM_COUNT ? "," : "");
+    }
+    fprintf(out, "]}\n");
+}
+
+// Writes the game's metrics to a file, replacing it in one rename so a
+// collector never reads half of it
+int writeMetrics(const char *path) {
+    char tempPath[512];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+    FILE *out = fopen(tempPath, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Cannot create metrics file '%s'\n", tempPath);
+        return -1;
+    }
+    size_t length = strlen(path);
+    if (length >= 5 && strcmp(path + length - 5, ".json") == 0) {
+        writeMetricsJson(out, &gameMetrics);
+    } else {
+        writePrometheus(out, &gameMetrics);
+    }
+    int failed = ferror(out);
+    if (fclose(out) != 0) {
+        failed = 1;
+    }
+    if (failed || rename(tempPath, path) != 0) {
+        fprintf(stderr, "Cannot write metrics file '%s'\n", path);
+        remove(tempPath);
+        return -1;
+    }
+    return 0;
+}
+
+
+// ====================================
+// Function Implementations - Checkpoints
+// ====================================
+//
+// A multiplayer game is kept in a checkpoint file while it is played, so a
+// game cut short by a crash or a closed terminal can be picked up where it
+// stopped. The file is written whole when the game starts; after that each
+// answer rewrites only the current player's progress, in place.
+
+// One player's record in a checkpoint file
+typedef struct {
+    CheckpointProgress progress;
+    char name[NAME_LENGTH];
+} CheckpointPlayer;
+
+// Where a player's record starts in a checkpoint file
+static off_t checkpointOffset(int player) {
+    return (off_t)(sizeof(CheckpointHeader) + (uint64_t)player * sizeof(CheckpointPlayer));
+}
+
+// Writes the checkpoint of a game that is about to start, with every player
+// still waiting for their turn. The file is written under a temporary name
+// and renamed into place, and stays open and locked until the game is over.
+// A checkpoint another running game holds is left alone, and the game is
+// then played without one.
+int checkpointStart(Checkpoint *checkpoint, const char *path, const QuestionBank *bank, const Roster *roster,
+                    int category, const uint32_t quiz[], int numQuestions, const Random *rng) {
+    checkpoint->fd = -1;
+    int old = open(path, O_RDONLY);
+    if (old >= 0) {
+        int busy = flock(old, LOCK_EX | LOCK_NB) != 0;
+        close(old);
+        if (busy) {
+            fprintf(stderr, "Another game is using the checkpoint '%s'; this one will not be kept.\n", path);
+            return -1;
+        }
+    }
+
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = CHECKPOINT_MAGIC;
+    header.recordSize = sizeof(CheckpointPlayer);
+    header.bankSize = bank->size;
+    header.bankCount = bank->count;
+    header.category = category;
+    header.numQuestions = numQuestions;
+    header.numPlayers = roster->count;
+    header.rng = *rng;
+    memcpy(header.quiz, quiz, (size_t)numQuestions * sizeof(uint32_t));
+
+    char tempPath[512];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+    int fd = open(tempPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    int failed = fd < 0 || write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header);
+    CheckpointPlayer records[CHECKPOINT_CHUNK];
+    for (int i = 0; !failed && i < roster->count; i += CHECKPOINT_CHUNK) {
+        int count = roster->count - i < CHECKPOINT_CHUNK ? roster->count - i : CHECKPOINT_CHUNK;
+        memset(records, 0, (size_t)count * sizeof(CheckpointPlayer));
+        for (int j = 0; j < count; j++) {
+            memcpy(records[j].name, roster->players[i + j].name, NAME_LENGTH);
+        }
+        size_t size = (size_t)count * sizeof(CheckpointPlayer);
+        failed = write(fd, records, size) != (ssize_t)size;
+    }
+    failed = failed || fdatasync(fd) != 0 || flock(fd, LOCK_EX | LOCK_NB) != 0 || rename(tempPath, path) != 0;
+    if (failed) {
+        fprintf(stderr, "Cannot write checkpoint '%s'; this game will not be kept.\n", path);
+        if (fd >= 0) close(fd);
+        remove(tempPath);
+        return -1;
+    }
+
+    checkpoint->fd = fd;
+    checkpoint->path = path;
+    checkpoint->player = 0;
+    memset(&checkpoint->progress, 0, sizeof(checkpoint->progress));
+    checkpoint->syncedMs = 0;
+    checkpoint->failed = 0;
+    return 0;
+}
+
+// Writes how far the current player has got over their record. The write
+// reaches the page cache at once, which is enough to survive the game
+// being killed; the file is synced to disk when a turn ends and otherwise
+// at most every CHECKPOINT_SYNC_MS, so answering stays quick.
+void checkpointUpdate(Checkpoint *checkpoint, const QuizSession *session, long long nowMs) {
+    if (checkpoint->failed) {
+        return;
+    }
+    CheckpointProgress *progress = &checkpoint->progress;
+    int asking = session->state == SESSION_ASKING;
+    progress->state = asking ? CHECKPOINT_PLAYING : CHECKPOINT_DONE;
+    progress->answered = session->current;
+    progress->score = session->score;
+    progress->timeMs = (int32_t)(asking ? nowMs - session->startMs : sessionTimeTaken(session));
+    progress->correctMask = session->correctMask;
+
+    int failed = pwrite(checkpoint->fd, progress, sizeof(*progress), checkpointOffset(checkpoint->player))
+                 != (ssize_t)sizeof(*progress);
+    if (!failed && (!asking || nowMs - checkpoint->syncedMs >= CHECKPOINT_SYNC_MS)) {
+        failed = fdatasync(checkpoint->fd) != 0;
+        checkpoint->syncedMs = nowMs;
+    }
+    if (failed) {
+        fprintf(stderr, "Cannot write checkpoint '%s'; the rest of this game will not be kept.\n", checkpoint->path);
+        checkpoint->failed = 1;
+    }
+}
+
+// Reads back a game that was cut short: its setup into header, and its
+// players with the results of those whose turn is over into roster. The
+// checkpoint is left open and locked, at the player whose turn it was.
+// Returns -1 if there is no such game, if another running game holds it,
+// or if it was kept for a different bank or does not hold together.
+int checkpointResume(Checkpoint *checkpoint, const char *path, const QuestionBank *bank, CheckpointHeader *header,
+                     Roster *roster) {
+    checkpoint->fd = -1;
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        return -1;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    struct stat info;
+    int valid = pread(fd, header, sizeof(*header), 0) == (ssize_t)sizeof(*header)
+             && header->magic == CHECKPOINT_MAGIC && header->recordSize == sizeof(CheckpointPlayer)
+             && header->bankSize == bank->size && header->bankCount == bank->count
+             && header->category >= 1 && header->category <= CATEGORY_COUNT
+             && header->numQuestions >= 1 && header->numQuestions <= QUIZ_SIZE
+             && header->numPlayers >= 1 && header->numPlayers <= MAX_PLAYERS
+             && fstat(fd, &info) == 0 && info.st_size == checkpointOffset(header->numPlayers);
+    for (int i = 0; valid && i < header->numQuestions; i++) {
+        valid = answerItem(bank, header->quiz[i]) >= 0;
+    }
+    int players = valid ? header->numPlayers : 0;
+    if (valid && rosterCreate(roster, players) != 0) {
+        fprintf(stderr, "Not enough memory for %d players.\n", players);
+        close(fd);
+        return -1;
+    }
+
+    // Turns are taken in order, so the players whose turn is over come
+    // first, then at most one part way through, then those still waiting
+    int player = players, last = CHECKPOINT_DONE;
+    CheckpointProgress progress;
+    memset(&progress, 0, sizeof(progress));
+    CheckpointPlayer records[CHECKPOINT_CHUNK];
+    for (int i = 0; valid && i < players; i += CHECKPOINT_CHUNK) {
+        int count = players - i < CHECKPOINT_CHUNK ? players - i : CHECKPOINT_CHUNK;
+        size_t size = (size_t)count * sizeof(CheckpointPlayer);
+        valid = pread(fd, records, size, checkpointOffset(i)) == (ssize_t)size;
+        for (int j = 0; valid && j < count; j++) {
+            const CheckpointProgress *kept = &records[j].progress;
+            valid = kept->state >= CHECKPOINT_WAITING && kept->state <= last
+                 && !(last == CHECKPOINT_PLAYING && kept->state == CHECKPOINT_PLAYING)
+                 && kept->answered >= 0 && kept->answered <= header->numQuestions
+                 && kept->score >= 0 && kept->score <= kept->answered && kept->timeMs >= 0;
+            last = kept->state;
+
+            RosterEntry *entry = &roster->players[i + j];
+            memcpy(entry->name, records[j].name, NAME_LENGTH);
+            entry->name[NAME_LENGTH - 1] = '\0';
+            if (kept->state == CHECKPOINT_DONE) {
+                entry->score = kept->score;
+                entry->timeTakenMs = kept->timeMs;
+            } else if (player == players) {
+                player = i + j;
+                progress = *kept;
+            }
+        }
+    }
+    if (!valid) {
+        fprintf(stderr, "'%s' is not a valid checkpoint for this question bank\n", path);
+        if (players > 0) rosterRelease(roster);
+        close(fd);
+        return -1;
+    }
+
+    checkpoint->fd = fd;
+    checkpoint->path = path;
+    checkpoint->player = player;
+    checkpoint->progress = progress;
+    checkpoint->syncedMs = 0;
+    checkpoint->failed = 0;
+    return 0;
+}
+
+// Lets go of a checkpoint, leaving its file to be picked up later
+void checkpointClose(Checkpoint *checkpoint) {
+    if (checkpoint->fd >= 0) {
+        close(checkpoint->fd);
+        checkpoint->fd = -1;
+    }
+}
+
+// Removes the checkpoint of a game every player has had their turn in
+void checkpointFinish(Checkpoint *checkpoint) {
+    if (checkpoint->fd >= 0) {
+        remove(checkpoint->path);
+    }
+    checkpointClose(checkpoint);
 }
 
 
 // ====================================
-// Function Implementations - Results
+// Function Implementations - Bank Versions
 // ====================================
+//
+// A server keeps running while its bank file is replaced. Each time, the new
+// file is read as a new version beside the old one: quizzes that are
+// running keep reading the version they were drawn from and new quizzes use
+// the new one. Every version read from a file is a private copy, so writing
+// over the file in place cannot change a version in use, and no quiz waits
+// for the swap. The server is one thread, so a version's references are a
+// plain count.
 
-// Determines and announces the winner in 1v1 mode
-void declareWinner(char player1[], char player2[], int score1, int score2, int timeTaken1, int timeTaken2) {
-    printf("\n=================================\n");
-    printf("        FINAL SCORES\n");
-    printf("=================================\n");
-    printf("%s: %d (Time: %d seconds)\n", player1, score1, timeTaken1);
-    printf("%s: %d (Time: %d seconds)\n", player2, score2, timeTaken2);
-
-    // Determine and display the winner
-    if (score1 > score2) {
-        printf("%s is the smartest here !!!!!!!!!!!!\n", player1);
-    } 
-    else if (score2 > score1) {
-        printf("%s is the smartest here !!!!!!!!!!!!\n", player2);
-    } 
-    else {
-        // If scores are tied, check time taken
-        if (timeTaken1 < timeTaken2) {
-            printf("%s wins by time taken!\n", player1);
-        } 
-        else if (timeTaken2 < timeTaken1) {
-            printf("%s wins by time taken!\n", player2);
-        } 
-        else {
-            printf("U R both smart it is a tie.\n");
+// Makes a bank the first version, building the view of each category.
+// The bank stays the caller's to close. Returns NULL if a category cannot
+// be loaded.
+BankSnapshot *snapshotCreate(const QuestionBank *bank, int generated) {
+    BankSnapshot *snapshot = calloc(1, sizeof(BankSnapshot));
+    if (snapshot == NULL) {
+        return NULL;
+    }
+    snapshot->bank = *bank;
+    snapshot->references = 1;
+    snapshot->version = 1;
+    for (int c = 0; c < CATEGORY_COUNT; c++) {
+        if (loadQuestions(&snapshot->bank, c + 1, generated, &snapshot->views[c]) != 0) {
+            snapshotRelease(snapshot);
+            return NULL;
         }
     }
+    return snapshot;
 }
 
+// Copies a bank file as a new version, which releases the copy when it is
+// freed. Returns NULL if the file is not a bank this game can read.
+BankSnapshot *snapshotOpen(const char *path, int generated) {
+    QuestionBank bank;
+    if (copyQuestionBank(&bank, path) != 0) {
+        return NULL;
+    }
+    BankSnapshot *snapshot = snapshotCreate(&bank, generated);
+    if (snapshot == NULL) {
+        closeQuestionBank(&bank);
+        return NULL;
+    }
+    snapshot->ownsBank = 1;
+    return snapshot;
+}
 
-// Calculates and displays the player's IQ score and category
-void displayIQScore(char playerName[], int score, int totalQuestions) {
-    int iqMin, iqMax;
-    char category[50];
-
-    // Map score to IQ range and category with more granular ranges
-    switch(score) {
-        case 10:
-            iqMin = 140;
-            iqMax = 160;
-            sprintf(category, "Exceptional Genius!");
-            break;
-        case 9:
-            iqMin = 130;
-            iqMax = 140;
-            sprintf(category, "Very Superior Intelligence!");
-            break;
-        case 8:
-            iqMin = 120;
-            iqMax = 130;
-            sprintf(category, "Superior Intelligence!");
-            break;
-        case 7:
-            iqMin = 110;
-            iqMax = 120;
-            sprintf(category, "High Average Intelligence!");
-            break;
-        case 6:
-            iqMin = 100;
-            iqMax = 110;
-            sprintf(category, "Average Intelligence!");
-            break;
-        case 5:
-            iqMin = 90;
-            iqMax = 100;
-            sprintf(category, "Low Average Intelligence!");
-            break;
-        case 4:
-            iqMin = 80;
-            iqMax = 90;
-            sprintf(category, "Below Average Intelligence!");
-            break;
-        case 3:
-            iqMin = 70;
-            iqMax = 80;
-            sprintf(category, "Borderline Intelligence!");
-            break;
-        case 2:
-            iqMin = 60;
-            iqMax = 70;
-            sprintf(category, "Mild Intellectual Disability!");
-            break;
-        case 1:
-            iqMin = 50;
-            iqMax = 60;
-            sprintf(category, "Moderate Intellectual Disability!");
-            break;
-        case 0:
-            iqMin = 40;
-            iqMax = 50;
-            sprintf(category, "Severe Intellectual Disability!");
+BankSnapshot *snapshotAcquire(BankSnapshot *snapshot) {
+    snapshot->references++;
+    return snapshot;
+}
+
+void snapshotRelease(BankSnapshot *snapshot) {
+    if (--snapshot->references > 0) {
+        return;
+    }
+    for (int c = 0; c < CATEGORY_COUNT; c++) {
+        freeQuestionView(&snapshot->views[c]);
+    }
+    if (snapshot->ownsBank) {
+        closeQuestionBank(&snapshot->bank);
+    }
+    free(snapshot);
+}
+
+
+// ====================================
+// Function Implementations - Server
+// ====================================
+
+typedef struct Room Room;
+
+// One connected player. Buffers are fixed so every connection costs the same
+// amount of memory however the client behaves; a client that sends an
+// over-long line or stops reading its output is disconnected.
+typedef struct Connection {
+    int fd;
+    Room *room;                 // Room the player joined, or NULL
+    struct Connection *nextInRoom;
+    struct Connection *prevInRoom;
+    char name[NAME_LENGTH];
+    QuizSession session;        // The player's progress through the room's quiz
+    Timer questionDeadline;     // Armed while a question is limited to QUESTION_DURATION
+    int wantsWrite;             // Set while EPOLLOUT is armed
+    int closing;                // Set when the connection is to be dropped
+    struct Connection *nextClosing; // Next connection waiting to be dropped
+    int inputLength;
+    int outputStart;
+    int outputLength;
+    char input[SERVER_INPUT_SIZE];
+    char output[SERVER_OUTPUT_SIZE];
+} Connection;
+
+// A room of players who all take the same quiz at the same time
+struct Room {
+    char name[32];
+    int category;
+    int playing;                // Set while a quiz is running
+    uint32_t quiz[QUIZ_SIZE];
+    int numQuestions;
+    long long startMs;          // When the running quiz started
+    uint64_t seed;              // Seed the running quiz was drawn with
+    BankSnapshot *bank;         // Version of the bank the running quiz was drawn from, or NULL
+    int players;
+    int finishedPlayers;
+    Timer deadline;             // Ends the running quiz after TEST_DURATION
+    Timer scoreboardTimer;      // Armed when scores changed since the last scoreboard
+    Connection *firstPlayer;
+    Room *nextInBucket;
+};
+
+typedef struct {
+    int epollFd;
+    int listenFd;
+    BankSnapshot *bank;         // Newest version of the bank, which new quizzes are drawn from
+    const char *bankPath;       // File the bank is reloaded from, or NULL for a bank built into the program
+    int generated;              // Whether the categories take generated questions
+    int watchFd;                // Reports the bank file being replaced, or -1
+    int signalFd;               // Reports SIGHUP, which reloads the bank
+    Connection **connections;   // Indexed by file descriptor
+    int connectionCapacity;
+    int connectionCount;
+    Room *roomBuckets[SERVER_ROOM_BUCKETS];
+    int roomCount;
+    Random rng;                 // Seeds each quiz a room starts
+    TimerWheel timers;          // Quiz, question and scoreboard deadlines of every room
+    Connection *closingList;    // Connections to drop once the current event is handled
+    Journal *journal;           // Where the sessions are recorded, or NULL
+    Timer journalTimer;         // Armed while journal records wait to be written
+    Norms *norms;               // Norms finished sessions count towards, or NULL
+    Timer normsTimer;           // Armed while sessions wait to be saved to the norms file
+    Timer metricsTimer;         // Armed while a metrics file is being kept up to date
+} Server;
+
+// Marks a connection to be dropped. It stays valid until the server loop
+// closes it, so the caller can keep using it.
+static void markClosing(Server *server, Connection *conn) {
+    if (!conn->closing) {
+        conn->closing = 1;
+        conn->nextClosing = server->closingList;
+        server->closingList = conn;
+    }
+}
+
+// Queues text for a client, dropping the client if its output buffer is full
+static void sendText(Server *server, Connection *conn, const char *text, int length) {
+    if (conn->closing) {
+        return;
+    }
+    if (conn->outputStart > 0 && conn->outputStart + conn->outputLength + length > SERVER_OUTPUT_SIZE) {
+        memmove(conn->output, conn->output + conn->outputStart, conn->outputLength);
+        conn->outputStart = 0;
+    }
+    if (conn->outputLength + length > SERVER_OUTPUT_SIZE) {
+        markClosing(server, conn);
+        return;
+    }
+    memcpy(conn->output + conn->outputStart + conn->outputLength, text, length);
+    conn->outputLength += length;
+
+    // Write straight away; only wait for EPOLLOUT if the socket is full
+    while (conn->outputLength > 0) {
+        ssize_t written = send(conn->fd, conn->output + conn->outputStart, conn->outputLength, MSG_NOSIGNAL);
+        if (written > 0) {
+            conn->outputStart += (int)written;
+            conn->outputLength -= (int)written;
+        } else if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
             break;
-        default:
-            iqMin = 0;
-            iqMax = 0;
-            sprintf(category, "Invalid Score!");
+        } else if (written < 0 && errno == EINTR) {
+            continue;
+        } else {
+            markClosing(server, conn);
+            return;
+        }
+    }
+    if (conn->outputLength == 0) {
+        conn->outputStart = 0;
     }
 
-    // Display the final result
-    printf("\n%s, your Final Score: %d/%d | IQ Range: %d-%d | Category: %s\n",
-           playerName, score, totalQuestions, iqMin, iqMax, category);
+    int wantsWrite = conn->outputLength > 0;
+    if (wantsWrite != conn->wantsWrite) {
+        struct epoll_event event;
+        event.events = EPOLLIN | (wantsWrite ? EPOLLOUT : 0);
+        event.data.fd = conn->fd;
+        epoll_ctl(server->epollFd, EPOLL_CTL_MOD, conn->fd, &event);
+        conn->wantsWrite = wantsWrite;
+    }
 }
 
-// Handles multiplayer gameplay with unlimited players
-void playMultiplayer(int numQuestions, Question questions[], int totalQuestions, char names[][50], int numPlayers, int category) {
-    printf("\nStarting Multiplayer Quiz!\n");
-    
-    // Validate totalQuestions
-    if (totalQuestions < numQuestions) {
-        printf("Warning: Not enough questions available. Using all available questions.\n");
-        numQuestions = totalQuestions;
+static void sendLine(Server *server, Connection *conn, const char *format, ...) {
+    char line[SERVER_OUTPUT_SIZE];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line) - 1, format, args);
+    va_end(args);
+    if (length < 0) {
+        return;
     }
-    
-    // Shuffle questions for each player
-    int indices[MAX_QUESTIONS];
-    for (int i = 0; i < totalQuestions; i++) {
-        indices[i] = i;
+    if (length > (int)sizeof(line) - 2) {
+        length = (int)sizeof(line) - 2;
     }
-    for (int i = totalQuestions - 1; i > 0; i--) {
-        int j = rand() % (i + 1);
-        int temp = indices[i];
-        indices[i] = indices[j];
-        indices[j] = temp;
+    line[length++] = '\n';
+    sendText(server, conn, line, length);
+}
+
+// Sends a line to every player in a room
+static void broadcastLine(Server *server, Room *room, const char *format, ...) {
+    char line[SERVER_OUTPUT_SIZE];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line) - 1, format, args);
+    va_end(args);
+    if (length < 0) {
+        return;
     }
-    
-    int scores[MAX_QUESTIONS] = {0};
-    int timeTaken[MAX_QUESTIONS] = {0};
-    
-    // Each player takes their turn
-    for (int i = 0; i < numPlayers; i++) {
-        printf("\n%s's turn!\n", names[i]);
-        // Use the shuffled questions
-        Question shuffledQuestions[MAX_QUESTIONS];
-        for (int j = 0; j < numQuestions; j++) {
-            shuffledQuestions[j] = questions[indices[j]];
+    if (length > (int)sizeof(line) - 2) {
+        length = (int)sizeof(line) - 2;
+    }
+    line[length++] = '\n';
+    for (Connection *conn = room->firstPlayer; conn != NULL; conn = conn->nextInRoom) {
+        sendText(server, conn, line, length);
+    }
+}
+
+static Room **findRoomSlot(Server *server, const char *name) {
+    Room **slot = &server->roomBuckets[hashBytes(name, strlen(name)) % SERVER_ROOM_BUCKETS];
+    while (*slot != NULL && strcmp((*slot)->name, name) != 0) {
+        slot = &(*slot)->nextInBucket;
+    }
+    return slot;
+}
+
+// Sends the room's current top players as one line
+static void sendScoreboard(Server *server, Room *room) {
+    Connection *top[SCOREBOARD_SIZE];
+    int count = 0;
+    for (Connection *conn = room->firstPlayer; conn != NULL; conn = conn->nextInRoom) {
+        int pos = count < SCOREBOARD_SIZE ? count++ : SCOREBOARD_SIZE;
+        while (pos > 0 && conn->session.score > top[pos - 1]->session.score) {
+            if (pos < SCOREBOARD_SIZE) {
+                top[pos] = top[pos - 1];
+            }
+            pos--;
+        }
+        if (pos < SCOREBOARD_SIZE) {
+            top[pos] = conn;
         }
-        scores[i] = playSolo(numQuestions, shuffledQuestions, numQuestions, names[i], &timeTaken[i], category);
     }
-    
-    // Display results
-    printf("\n=================================\n");
-    printf("        FINAL SCORES\n");
-    printf("=================================\n");
-    
-    // Display scores based on category
-    for (int i = 0; i < numPlayers; i++) {
-        if (category == 1) {
-            printf("%s: %d (Time: %d seconds)\n", names[i], scores[i], timeTaken[i]);
-        } else {
-            printf("%s: %d/%d\n", names[i], scores[i], numQuestions);
+
+    char line[SERVER_OUTPUT_SIZE];
+    int length = snprintf(line, sizeof(line), "SCOREBOARD");
+    for (int i = 0; i < count && length < (int)sizeof(line); i++) {
+        length += snprintf(line + length, sizeof(line) - length, " %s:%d/%d",
+                           top[i]->name, top[i]->session.score, top[i]->session.current);
+    }
+    broadcastLine(server, room, "%s", line);
+    timerCancel(&server->timers, &room->scoreboardTimer);
+}
+
+// Sends a player the question they are on, or their result once they are done
+static void sendNextQuestion(Server *server, Connection *conn) {
+    QuizSession *session = &conn->session;
+    if (session->state != SESSION_ASKING) {
+        timerCancel(&server->timers, &conn->questionDeadline);
+        sendLine(server, conn, "FINISHED %d/%d %lld", session->score, session->numQuestions,
+                 sessionTimeTaken(session));
+        return;
+    }
+    if (QUESTION_DURATION > 0) {
+        timerArm(&server->timers, &conn->questionDeadline, monotonicMs() + QUESTION_DURATION * 1000LL);
+    }
+    // The question and its options go out together in one send
+    long long rendering = METRIC_SAMPLE();
+    QuestionText scratch;
+    Question q = quizQuestion(session->bank, (uint32_t)sessionQuestion(session), &scratch);
+    char text[SERVER_OUTPUT_SIZE];
+    int length = snprintf(text, sizeof(text), "QUESTION %d/%d %s\nOPTION 1 %s\nOPTION 2 %s\nOPTION 3 %s\nOPTION 4 %s\n",
+                          session->current + 1, session->numQuestions, q.question,
+                          q.options[0], q.options[1], q.options[2], q.options[3]);
+    METRIC_SAMPLED(HISTOGRAM_QUESTION_RENDER, rendering);
+    sendText(server, conn, text, length < (int)sizeof(text) ? length : (int)sizeof(text) - 1);
+}
+
+// Ends the room's quiz and announces the final ranking and winner. Only the
+// players that are listed get sorted, however big the room is.
+static void finishRoom(Server *server, Room *room) {
+    Connection **players = malloc(room->players * sizeof(Connection *));
+    RankEntry *ranked = malloc(room->players * sizeof(RankEntry));
+    int count = 0;
+    long long now = monotonicMs();
+    for (Connection *conn = room->firstPlayer; conn != NULL; conn = conn->nextInRoom) {
+        if (conn->session.state == SESSION_ASKING) {
+            sessionEnd(&conn->session, now);
+            sendLine(server, conn, "TIMEUP");
+        }
+        timerCancel(&server->timers, &conn->questionDeadline);
+        if (players != NULL && ranked != NULL) {
+            ranked[count].score = conn->session.score;
+            ranked[count].timeMs = (int)sessionTimeTaken(&conn->session);
+            ranked[count].player = count;
+            players[count++] = conn;
         }
     }
-    
-    // Find winner(s)
-    int maxScore = scores[0];
-    int fastestTime = timeTaken[0];
-    int winnerIndex = 0;
-    int isTie = 0;
-    
-    for (int i = 1; i < numPlayers; i++) {
-        if (scores[i] > maxScore) {
-            maxScore = scores[i];
-            winnerIndex = i;
-            fastestTime = timeTaken[i];
-            isTie = 0;
-        } else if (scores[i] == maxScore) {
-            // In case of tie, use time as tiebreaker
-            if (timeTaken[i] < fastestTime) {
-                fastestTime = timeTaken[i];
-                winnerIndex = i;
+    timerCancel(&server->timers, &room->deadline);
+    timerCancel(&server->timers, &room->scoreboardTimer);
+    if (room->bank != NULL) {
+        snapshotRelease(room->bank);
+        room->bank = NULL;
+    }
+    room->playing = 0;
+    room->finishedPlayers = 0;
+    if (count == 0) {
+        broadcastLine(server, room, "GAMEOVER");
+        free(players);
+        free(ranked);
+        return;
+    }
+
+    int listed = rankTop(ranked, count, SCOREBOARD_SIZE);
+    broadcastLine(server, room, "GAMEOVER");
+    for (int i = 0; i < listed; i++) {
+        broadcastLine(server, room, "RANK %d %s %d %d", i + 1, players[ranked[i].player]->name,
+                      ranked[i].score, ranked[i].timeMs);
+    }
+    if (rankedWinner(ranked, listed, room->category == 1) == 0) {
+        broadcastLine(server, room, "WINNER %s", players[ranked[0].player]->name);
+    } else {
+        broadcastLine(server, room, "TIE");
+    }
+    free(players);
+    free(ranked);
+}
+
+static void leaveRoom(Server *server, Connection *conn) {
+    Room *room = conn->room;
+    if (room == NULL) {
+        return;
+    }
+    // A player leaving mid-quiz ends their session, so it is counted and
+    // journaled as abandoned; they were never among the finished players
+    int asking = room->playing && conn->session.state == SESSION_ASKING;
+    if (asking) {
+        sessionEnd(&conn->session, monotonicMs());
+    }
+    if (conn->prevInRoom != NULL) {
+        conn->prevInRoom->nextInRoom = conn->nextInRoom;
+    } else {
+        room->firstPlayer = conn->nextInRoom;
+    }
+    if (conn->nextInRoom != NULL) {
+        conn->nextInRoom->prevInRoom = conn->prevInRoom;
+    }
+    conn->room = NULL;
+    conn->nextInRoom = conn->prevInRoom = NULL;
+    timerCancel(&server->timers, &conn->questionDeadline);
+    room->players--;
+    if (room->playing && !asking) {
+        room->finishedPlayers--;
+    }
+
+    if (room->players == 0) {
+        timerCancel(&server->timers, &room->deadline);
+        timerCancel(&server->timers, &room->scoreboardTimer);
+        if (room->bank != NULL) {
+            snapshotRelease(room->bank);
+        }
+        Room **slot = findRoomSlot(server, room->name);
+        *slot = room->nextInBucket;
+        server->roomCount--;
+        free(room);
+        return;
+    }
+    broadcastLine(server, room, "LEFT %s", conn->name);
+    if (room->playing && room->finishedPlayers == room->players) {
+        finishRoom(server, room);
+    }
+}
+
+static void handleJoin(Server *server, Connection *conn, char *args) {
+    char *roomName = strtok(args, " ");
+    char *name = strtok(NULL, " ");
+    char *categoryText = strtok(NULL, " ");
+    if (roomName == NULL || name == NULL || strlen(roomName) >= sizeof(((Room *)0)->name)
+        || strlen(name) >= sizeof(conn->name)) {
+        sendLine(server, conn, "ERROR usage: JOIN <room> <name> [category 1-3]");
+        return;
+    }
+    if (conn->room != NULL) {
+        sendLine(server, conn, "ERROR already in room %s", conn->room->name);
+        return;
+    }
+
+    Room **slot = findRoomSlot(server, roomName);
+    Room *room = *slot;
+    if (room == NULL) {
+        room = calloc(1, sizeof(Room));
+        if (room == NULL) {
+            sendLine(server, conn, "ERROR server is full");
+            return;
+        }
+        strcpy(room->name, roomName);
+        room->deadline.owner = room->scoreboardTimer.owner = room;
+        room->deadline.kind = TIMER_QUIZ_DEADLINE;
+        room->scoreboardTimer.kind = TIMER_SCOREBOARD;
+        room->category = categoryText ? atoi(categoryText) : 1;
+        if (room->category < 1 || room->category > CATEGORY_COUNT) {
+            room->category = 1;
+        }
+        *slot = room;
+        server->roomCount++;
+    } else if (room->playing) {
+        sendLine(server, conn, "ERROR room %s is playing, wait for the next game", roomName);
+        return;
+    }
+
+    strcpy(conn->name, name);
+    conn->room = room;
+    conn->prevInRoom = NULL;
+    conn->nextInRoom = room->firstPlayer;
+    if (room->firstPlayer != NULL) {
+        room->firstPlayer->prevInRoom = conn;
+    }
+    room->firstPlayer = conn;
+    room->players++;
+    sendLine(server, conn, "JOINED %s %d %d", room->name, room->category, room->players);
+    broadcastLine(server, room, "PLAYER %s", conn->name);
+}
+
+static void handleStart(Server *server, Connection *conn) {
+    Room *room = conn->room;
+    if (room == NULL || room->playing) {
+        sendLine(server, conn, "ERROR %s", room ? "quiz already running" : "join a room first");
+        return;
+    }
+    // Each quiz gets its own seed, sent to the players so it can be replayed
+    Random rng;
+    room->seed = (uint64_t)randomNext(&server->rng) << 32 | randomNext(&server->rng);
+    randomSeed(&rng, room->seed, 0);
+    room->bank = snapshotAcquire(server->bank);
+    room->numQuestions = drawQuiz(&room->bank->views[room->category - 1], room->quiz, QUIZ_SIZE, &rng);
+    room->playing = 1;
+    room->startMs = monotonicMs();
+    room->finishedPlayers = 0;
+    timerArm(&server->timers, &room->deadline, room->startMs + TEST_DURATION * 1000LL);
+    broadcastLine(server, room, "START %d %d %llu", room->numQuestions, TEST_DURATION,
+                  (unsigned long long)room->seed);
+    for (Connection *player = room->firstPlayer; player != NULL; player = player->nextInRoom) {
+        sessionStart(&player->session, &room->bank->bank, room->quiz, room->numQuestions,
+                     room->startMs, TEST_DURATION * 1000LL);
+        sessionRecord(&player->session, server->journal, room->category);
+        sessionNorms(&player->session, server->norms, room->category);
+        sendNextQuestion(server, player);
+    }
+}
+
+// Grades a player's answer (0 when their question ran out of time) and
+// moves them on, ending the room's quiz once everyone is done
+static void gradeAnswer(Server *server, Connection *conn, int answer, long long now) {
+    Room *room = conn->room;
+    QuestionText scratch;
+    Question q = quizQuestion(conn->session.bank, (uint32_t)sessionQuestion(&conn->session), &scratch);
+    int result = sessionAnswer(&conn->session, answer, now);
+    if (result == 1) {
+        sendLine(server, conn, "CORRECT");
+    } else if (result == 0) {
+        sendLine(server, conn, "WRONG %d %s", q.correctOption, correctOptionText(&q));
+    }
+    if (room->scoreboardTimer.list == NULL) {
+        timerArm(&server->timers, &room->scoreboardTimer, now + SCOREBOARD_INTERVAL_MS);
+    }
+    if (conn->session.state != SESSION_ASKING) {
+        room->finishedPlayers++;
+        if (conn->session.state == SESSION_TIMED_OUT) {
+            sendLine(server, conn, "TIMEUP");
+        }
+    }
+    sendNextQuestion(server, conn);
+    if (room->finishedPlayers == room->players) {
+        sendScoreboard(server, room);
+        finishRoom(server, room);
+    }
+}
+
+static void handleAnswer(Server *server, Connection *conn, const char *args) {
+    Room *room = conn->room;
+    if (room == NULL || !room->playing || conn->session.state != SESSION_ASKING) {
+        sendLine(server, conn, "ERROR no question to answer");
+        return;
+    }
+    if (args[0] < '1' || args[0] > '4' || args[1] != '\0') {
+        sendLine(server, conn, "ERROR answer with 1-4");
+        return;
+    }
+    gradeAnswer(server, conn, args[0] - '0', monotonicMs());
+}
+
+// Acts on a room or player deadline that has passed
+static void handleTimer(Server *server, Timer *timer, long long now) {
+    if (timer->kind == TIMER_QUESTION_DEADLINE) {
+        Connection *conn = timer->owner;
+        if (conn->room != NULL && conn->room->playing && conn->session.state == SESSION_ASKING) {
+            gradeAnswer(server, conn, 0, now);
+        }
+        return;
+    }
+    if (timer->kind == TIMER_JOURNAL_FLUSH) {
+        journalFlush(server->journal);
+        return;
+    }
+    if (timer->kind == TIMER_NORMS_SAVE) {
+        normsSave(server->norms);
+        return;
+    }
+    if (timer->kind == TIMER_METRICS_SAVE) {
+        writeMetrics(gameMetricsPath);
+        return;
+    }
+    Room *room = timer->owner;
+    if (timer->kind == TIMER_SCOREBOARD) {
+        sendScoreboard(server, room);
+    } else {
+        finishRoom(server, room);
+    }
+}
+
+// Runs one command line from a client
+static void handleCommand(Server *server, Connection *conn, char *line) {
+    char *args = strchr(line, ' ');
+    if (args != NULL) {
+        *args++ = '\0';
+    } else {
+        args = line + strlen(line);
+    }
+
+    if (strcmp(line, "JOIN") == 0) {
+        handleJoin(server, conn, args);
+    } else if (strcmp(line, "START") == 0) {
+        handleStart(server, conn);
+    } else if (strcmp(line, "ANSWER") == 0) {
+        handleAnswer(server, conn, args);
+    } else if (strcmp(line, "LEAVE") == 0) {
+        leaveRoom(server, conn);
+        sendLine(server, conn, "OK");
+    } else if (strcmp(line, "QUIT") == 0) {
+        sendLine(server, conn, "BYE");
+        markClosing(server, conn);
+    } else if (line[0] != '\0') {
+        sendLine(server, conn, "ERROR unknown command %s", line);
+    }
+}
+
+static void closeConnection(Server *server, Connection *conn) {
+    leaveRoom(server, conn);
+    epoll_ctl(server->epollFd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    server->connections[conn->fd] = NULL;
+    server->connectionCount--;
+    free(conn);
+}
+
+static void acceptConnections(Server *server) {
+    for (;;) {
+        int fd = accept4(server->listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return; // EAGAIN once the backlog is empty, or out of descriptors
+        }
+        if (fd >= server->connectionCapacity) {
+            int capacity = server->connectionCapacity;
+            while (capacity <= fd) {
+                capacity *= 2;
             }
-            isTie = 1;
+            Connection **grown = realloc(server->connections, capacity * sizeof(Connection *));
+            if (grown == NULL) {
+                close(fd);
+                continue;
+            }
+            memset(grown + server->connectionCapacity, 0,
+                   (capacity - server->connectionCapacity) * sizeof(Connection *));
+            server->connections = grown;
+            server->connectionCapacity = capacity;
+        }
+        Connection *conn = calloc(1, sizeof(Connection));
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (conn == NULL || epoll_ctl(server->epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            free(conn);
+            close(fd);
+            continue;
         }
+        int noDelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        conn->fd = fd;
+        conn->questionDeadline.owner = conn;
+        conn->questionDeadline.kind = TIMER_QUESTION_DEADLINE;
+        server->connections[fd] = conn;
+        server->connectionCount++;
+        METRIC_COUNT(COUNTER_CONNECTIONS);
+        sendLine(server, conn, "WELCOME MindMatch");
     }
-    
-    // Handle ties
-    if (isTie) {
-        printf("\nIt's a tie between: ");
-        for (int i = 0; i < numPlayers; i++) {
-            if (scores[i] == maxScore) {
-                printf("%s ", names[i]);
+}
+
+// Reads what the client sent and runs every complete line
+static void readConnection(Server *server, Connection *conn) {
+    for (;;) {
+        ssize_t received = recv(conn->fd, conn->input + conn->inputLength,
+                                SERVER_INPUT_SIZE - conn->inputLength, 0);
+        if (received == 0) {
+            markClosing(server, conn);
+            return;
+        }
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                markClosing(server, conn);
+            }
+            return;
+        }
+        conn->inputLength += (int)received;
+
+        int start = 0;
+        for (int i = 0; i < conn->inputLength && !conn->closing; i++) {
+            if (conn->input[i] == '\n') {
+                conn->input[i] = '\0';
+                if (i > start && conn->input[i - 1] == '\r') {
+                    conn->input[i - 1] = '\0';
+                }
+                handleCommand(server, conn, conn->input + start);
+                start = i + 1;
+            }
+        }
+        memmove(conn->input, conn->input + start, conn->inputLength - start);
+        conn->inputLength -= start;
+        if (conn->inputLength == SERVER_INPUT_SIZE) {
+            sendLine(server, conn, "ERROR line too long");
+            markClosing(server, conn);
+        }
+        if (conn->closing) {
+            return;
+        }
+    }
+}
+
+// Watches the directory of the bank file, since a new bank is written
+// beside the file and renamed over it. Returns the inotify descriptor, or -1.
+static int watchBankFile(const char *path) {
+    char directory[512];
+    const char *slash = strrchr(path, '/');
+    if (slash == NULL) {
+        strcpy(directory, ".");
+    } else {
+        snprintf(directory, sizeof(directory), "%.*s", slash == path ? 1 : (int)(slash - path), path);
+    }
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd >= 0 && inotify_add_watch(fd, directory, IN_MOVED_TO) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+// Reads everything the bank watch or the signal descriptor has reported and
+// tells whether the bank should be reloaded: on SIGHUP, or once a file of
+// the bank's name was renamed into its directory. A file written in place
+// is only picked up on SIGHUP, since it may be read while half written.
+static int reloadRequested(Server *server, int fd) {
+    _Alignas(struct inotify_event) char buffer[4096];
+    const char *slash = strrchr(server->bankPath, '/');
+    const char *name = slash != NULL ? slash + 1 : server->bankPath;
+    int requested = 0;
+    ssize_t length;
+    while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t at = 0; fd == server->watchFd && at < length; ) {
+            const struct inotify_event *event = (const struct inotify_event *)(buffer + at);
+            requested |= event->len > 0 && strcmp(event->name, name) == 0;
+            at += (ssize_t)(sizeof(struct inotify_event) + event->len);
+        }
+        requested |= fd == server->signalFd;
+    }
+    return requested;
+}
+
+// Reads the bank file again and makes it the version new quizzes are drawn
+// from. Running quizzes keep the version they started with, which is freed
+// when the last of them ends; nothing waits for them. A file that does not
+// load is reported and the current version kept.
+static void reloadBank(Server *server) {
+    long long loading = METRIC_CLOCK();
+    BankSnapshot *snapshot = snapshotOpen(server->bankPath, server->generated);
+    if (snapshot == NULL) {
+        fprintf(stderr, "Cannot reload the question bank '%s'; keeping version %u\n",
+                server->bankPath, server->bank->version);
+        return;
+    }
+    snapshot->version = server->bank->version + 1;
+    snapshotRelease(server->bank);
+    server->bank = snapshot;
+    METRIC_COUNT(COUNTER_BANK_RELOADS);
+    METRIC_RECORD(HISTOGRAM_BANK_LOAD, METRIC_CLOCK() - loading);
+    printf("Question bank version %u loaded from %s (%u questions)\n", snapshot->version, server->bankPath,
+           snapshot->bank.count);
+    fflush(stdout);
+}
+
+// Opens the listening socket: "unix:<path>" for a Unix socket, otherwise a TCP port
+static int openListener(const char *address) {
+    int fd;
+    if (strncmp(address, "unix:", 5) == 0) {
+        struct sockaddr_un local;
+        memset(&local, 0, sizeof(local));
+        local.sun_family = AF_UNIX;
+        if (strlen(address + 5) >= sizeof(local.sun_path)) {
+            return -1;
+        }
+        strcpy(local.sun_path, address + 5);
+        unlink(local.sun_path);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0 || bind(fd, (struct sockaddr *)&local, sizeof(local)) != 0) {
+            if (fd >= 0) close(fd);
+            return -1;
         }
-        printf("\n");
     } else {
-        printf("\n%s wins!\n", names[winnerIndex]);
+        struct sockaddr_in any;
+        memset(&any, 0, sizeof(any));
+        any.sin_family = AF_INET;
+        any.sin_addr.s_addr = htonl(INADDR_ANY);
+        any.sin_port = htons((uint16_t)atoi(address));
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int reuse = 1;
+        if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0
+            || bind(fd, (struct sockaddr *)&any, sizeof(any)) != 0) {
+            if (fd >= 0) close(fd);
+            return -1;
+        }
+    }
+    if (listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Hosts rooms of players over TCP or a Unix socket from one event loop.
+// Players in a room answer the same quiz at the same time, each at their
+// own pace, and see a scoreboard that is refreshed once a second. The bank
+// is reloaded from bankPath whenever that file is replaced or the server
+// gets SIGHUP.
+int runServer(const QuestionBank *bank, const char *bankPath, const char *address, int generated, Journal *journal,
+              Norms *norms, uint64_t seed) {
+    // Allow as many connections as the system lets this process have
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    static Server server;
+    memset(&server, 0, sizeof(server));
+    server.journal = journal;
+    server.journalTimer.kind = TIMER_JOURNAL_FLUSH;
+    server.norms = norms;
+    server.normsTimer.kind = TIMER_NORMS_SAVE;
+    server.metricsTimer.kind = TIMER_METRICS_SAVE;
+    randomSeed(&server.rng, seed, 0);
+    server.bankPath = bankPath;
+    server.generated = generated;
+    // A bank from a file is read again as a copy of the server's own, like every later version
+    server.bank = bankPath != NULL ? snapshotOpen(bankPath, generated) : snapshotCreate(bank, generated);
+    if (server.bank == NULL) {
+        return -1;
+    }
+    server.connectionCapacity = 1024;
+    server.connections = calloc(server.connectionCapacity, sizeof(Connection *));
+    server.listenFd = openListener(address);
+    server.epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (server.connections == NULL || server.listenFd < 0 || server.epollFd < 0) {
+        fprintf(stderr, "Cannot listen on '%s'\n", address);
+        return -1;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = server.listenFd;
+    epoll_ctl(server.epollFd, EPOLL_CTL_ADD, server.listenFd, &event);
+
+    // A bank read from a file is reloaded when the file is replaced, or on
+    // SIGHUP where the file system cannot be watched
+    server.watchFd = server.signalFd = -1;
+    if (bankPath != NULL) {
+        sigset_t hangup;
+        sigemptyset(&hangup);
+        sigaddset(&hangup, SIGHUP);
+        sigprocmask(SIG_BLOCK, &hangup, NULL);
+        server.signalFd = signalfd(-1, &hangup, SFD_NONBLOCK | SFD_CLOEXEC);
+        server.watchFd = watchBankFile(bankPath);
+        if (server.watchFd < 0) {
+            fprintf(stderr, "Cannot watch '%s' for changes; send SIGHUP to reload it\n", bankPath);
+        }
+        int reloadFds[2] = {server.signalFd, server.watchFd};
+        for (int i = 0; i < 2; i++) {
+            event.data.fd = reloadFds[i];
+            if (reloadFds[i] >= 0) {
+                epoll_ctl(server.epollFd, EPOLL_CTL_ADD, reloadFds[i], &event);
+            }
+        }
+    }
+    printf("MindMatch server listening on %s\n", address);
+    fflush(stdout);
+
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    timerWheelInit(&server.timers, monotonicMs());
+    for (;;) {
+        // Sleep until a client needs attention or the next deadline is due
+        long long now = monotonicMs();
+        long long due = timerNextExpiry(&server.timers);
+        int timeout = due < 0 ? -1 : due > now ? (int)(due - now) : 0;
+        int ready = epoll_wait(server.epollFd, events, SERVER_MAX_EVENTS, timeout);
+        if (ready < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < ready; i++) {
+            int fd = events[i].data.fd;
+            if (fd == server.listenFd) {
+                acceptConnections(&server);
+                continue;
+            }
+            if (fd == server.watchFd || fd == server.signalFd) {
+                if (reloadRequested(&server, fd)) {
+                    reloadBank(&server);
+                }
+                continue;
+            }
+            Connection *conn = server.connections[fd];
+            if (conn == NULL) {
+                continue;
+            }
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                markClosing(&server, conn);
+            }
+            if (!conn->closing && (events[i].events & EPOLLIN)) {
+                readConnection(&server, conn);
+            }
+            if (!conn->closing && (events[i].events & EPOLLOUT)) {
+                sendText(&server, conn, "", 0);
+            }
+        }
+
+        // Refresh scoreboards and end quizzes and questions that ran out of time
+        now = monotonicMs();
+        Timer *timer;
+        while ((timer = timerExpire(&server.timers, now)) != NULL) {
+            handleTimer(&server, timer, now);
+        }
+
+        // Drop the clients that quit, failed or stopped reading their output
+        while (server.closingList != NULL) {
+            Connection *conn = server.closingList;
+            server.closingList = conn->nextClosing;
+            closeConnection(&server, conn);
+        }
+
+        // Journal records are written in blocks, at the latest JOURNAL_FLUSH_MS after they were made
+        if (server.journal != NULL && server.journal->used > 0 && server.journalTimer.list == NULL) {
+            timerArm(&server.timers, &server.journalTimer, now + JOURNAL_FLUSH_MS);
+        }
+
+        // Finished sessions are merged into the norms file at most NORMS_SAVE_MS after they end
+        if (server.norms != NULL && server.norms->changed && server.normsTimer.list == NULL) {
+            timerArm(&server.timers, &server.normsTimer, now + NORMS_SAVE_MS);
+        }
+
+        // The metrics file given with --metrics is rewritten every METRICS_SAVE_MS
+        if (gameMetricsPath != NULL && server.metricsTimer.list == NULL) {
+            timerArm(&server.timers, &server.metricsTimer, now + METRICS_SAVE_MS);
+        }
     }
-}
\ No newline at end of file
+    return -1;
+}
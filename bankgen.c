@@ -0,0 +1,112 @@
+// ====================================
+// bankgen - bakes the question bank into the program
+// ====================================
+//
+// Reads a question source file (questions.txt), checks every question, lists
+// duplicate questions (and with --collapse-duplicates leaves them out of every
+// category) and writes a C header holding the finished bank image as a static
+// const table.
+// Compiling Game.c with -DMINDMATCH_BAKED_BANK then includes that header, so
+// the bank sits in the program's read-only data with no startup work and is
+// shared between running copies of the game through the page cache.
+//
+//     gcc -O2 -o bankgen bankgen.c
+//     ./bankgen [--collapse-duplicates] questions.txt bank_table.h
+//     gcc -O2 -DMINDMATCH_BAKED_BANK -o MindMatch Game.c
+
+#define MINDMATCH_NO_MAIN
+#include "Game.c"
+
+
+// Checks the finished image the same way the game will when it starts.
+// attachQuestionBank already refuses answer keys and difficulties out of
+// range, and parseQuestionSource held every question and option to
+// MAX_QUESTION_LENGTH and MAX_OPTION_LENGTH (the decoded text cannot show
+// a longer one, since it is cut to those lengths), so what is left is that
+// every category has enough questions for a quiz.
+int checkBankImage(const unsigned char *image, size_t imageSize) {
+    QuestionBank bank;
+    if (attachQuestionBank(&bank, image, imageSize) != 0) {
+        fprintf(stderr, "bankgen: generated image does not attach\n");
+        return -1;
+    }
+    for (int category = 1; category <= CATEGORY_COUNT; category++) {
+        QuestionView view;
+        if (loadQuestions(&bank, category, 0, &view) != 0) {
+            return -1;
+        }
+        int count = view.count;
+        freeQuestionView(&view);
+        if (count < QUIZ_SIZE) {
+            fprintf(stderr, "bankgen: category %d has only %d questions\n", category, count);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Writes the image as a C array, replacing the header only once it is complete
+int writeBankHeader(const char *sourcePath, const char *headerPath,
+                    const unsigned char *image, size_t imageSize, size_t questionCount) {
+    char tempPath[512];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", headerPath);
+    FILE *out = fopen(tempPath, "w");
+    if (out == NULL) {
+        fprintf(stderr, "bankgen: cannot create '%s'\n", tempPath);
+        return -1;
+    }
+
+    fprintf(out, "// Generated by bankgen from %s. Do not edit.\n", sourcePath);
+    fprintf(out, "// %zu questions, bank format version %d\n\n", questionCount, BANK_VERSION);
+    fprintf(out, "_Alignas(8) static const unsigned char bakedBank[%zu] = {", imageSize);
+    for (size_t i = 0; i < imageSize; i++) {
+        fprintf(out, "%s0x%02x,", i % 16 == 0 ? "\n    " : " ", image[i]);
+    }
+    fprintf(out, "\n};\n");
+
+    int failed = ferror(out);
+    if (fclose(out) != 0) {
+        failed = 1;
+    }
+    if (failed || rename(tempPath, headerPath) != 0) {
+        fprintf(stderr, "bankgen: cannot write '%s'\n", headerPath);
+        remove(tempPath);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int collapse = argc == 4 && strcmp(argv[1], "--collapse-duplicates") == 0;
+    if (argc != 3 + collapse) {
+        fprintf(stderr, "Usage: %s [--collapse-duplicates] <questions.txt> <bank_table.h>\n", argv[0]);
+        return 2;
+    }
+    argv += collapse;
+
+    BankBuilder builder;
+    memset(&builder, 0, sizeof(builder));
+    builder.collapseDuplicates = collapse;
+    size_t imageSize = 0;
+    unsigned char *image = NULL;
+
+    int failed = parseQuestionSource(argv[1], &builder) != 0;
+    if (!failed) {
+        long repeats = findDuplicates(&builder);
+        failed = repeats < 0;
+        printDuplicates(&builder, argv[1], repeats);
+    }
+    if (!failed) {
+        image = serializeBank(&builder, &imageSize);
+        failed = image == NULL
+              || checkBankImage(image, imageSize) != 0
+              || writeBankHeader(argv[1], argv[2], image, imageSize, builder.count) != 0;
+    }
+    if (!failed) {
+        printf("bankgen: %zu questions baked into %s (%zu bytes)\n", builder.count, argv[2], imageSize);
+    }
+
+    free(image);
+    freeBankBuilder(&builder);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,1759 @@
+// ====================================
+// bench - timing runs for the game's core structures
+// ====================================
+//
+// Builds on Game.c the same way bankgen does and times the parts of the game
+// that have to keep up with many players at once: the timer wheel, the
+// rankings of big rooms, drawing quizzes from big categories, tag queries
+// over a big bank, the duplicate pass run when a big bank is built, the
+// question generators, recording and replaying the journal, the item
+// analysis of recorded answers, the quantile sketches behind the norms,
+// adaptive quizzes against quizzes drawn at random and the per-player sets
+// that keep returning players from seeing the same questions. It also plays
+// the game itself from questions.txt: loading the categories, drawing
+// quizzes, asking questions and whole solo, 1v1 and multiplayer games, with
+// scripted answers in place of the keyboard, checks that counting and
+// timing those things for --metrics stays cheap, keeps a big multiplayer
+// game in a checkpoint that a crashed copy of bench leaves behind to be
+// picked up again, reloads the bank under running quizzes as a server does
+// and compresses the text of a big bank to decode it a question at a time.
+//
+// Every timed run is reported as ns/op with the allocations it made per op
+// and the peak memory of the process while it ran. --json writes those
+// results to a file, and --baseline compares them with a file written
+// earlier: a run more than --tolerance (25%) slower, or using more
+// allocations or memory, makes bench fail. --repeat does every run several
+// times and keeps the best of each, which takes out most of the noise.
+// Runs can be picked by group.
+//
+//     gcc -O2 -o bench bench.c
+//     ./bench [--json results.json] [--baseline results.json] [--tolerance 0.25] [--repeat n] [group ...]
+
+#define MINDMATCH_NO_MAIN
+#define _GNU_SOURCE
+#include <stdlib.h>
+
+// Every malloc, calloc and realloc made by the game (and by bench) is
+// counted, so runs can report their allocations
+static long long benchAllocations = 0;
+
+static void *benchMalloc(size_t size) {
+    benchAllocations++;
+    return malloc(size);
+}
+
+static void *benchCalloc(size_t count, size_t size) {
+    benchAllocations++;
+    return calloc(count, size);
+}
+
+static void *benchRealloc(void *pointer, size_t size) {
+    benchAllocations++;
+    return realloc(pointer, size);
+}
+
+#define malloc(size) benchMalloc(size)
+#define calloc(count, size) benchCalloc(count, size)
+#define realloc(pointer, size) benchRealloc(pointer, size)
+
+#include "Game.c"
+#include <sys/wait.h>
+
+#define BENCH_TIMERS 1000000       // Outstanding timers in the timer wheel run
+#define BENCH_PLAYERS 1000000      // Players in the ranking run
+#define BENCH_VIEW_SIZE 4000000    // Questions in the category quizzes are drawn from
+#define BENCH_DRAWS 1000000        // Quizzes drawn in the draw run
+#define BENCH_BANK_SIZE 1000000    // Questions in the bank the query run builds
+#define BENCH_QUERIES 100          // Times each query is run
+#define BENCH_DUPLICATE_SIZE 1000000  // Questions in the bank the duplicate run builds
+#define BENCH_GENERATED 3000000    // Questions made up in the generator run
+#define BENCH_JOURNAL_SESSIONS 500000 // Sessions played in the journal run
+#define BENCH_ANALYTICS_SESSIONS 2000000 // Sessions whose answers the analytics run aggregates
+#define BENCH_ANALYTICS_ITEMS 1000  // Questions in the analytics run, every 50th of them keyed wrongly
+#define BENCH_SKETCH_VALUES 10000000 // Performances added to the sketches in the norms run
+#define BENCH_ADAPTIVE_BANK 50000   // Questions in the bank the adaptive run builds
+#define BENCH_ADAPTIVE_PLAYERS 200000 // Simulated players in the adaptive run, each taking both kinds of quiz
+#define BENCH_EXPOSURE_POOL 40      // Questions in the small category of the exposure run
+#define BENCH_EXPOSURE_BANK 1000000 // Questions in the big bank of the exposure run
+#define BENCH_EXPOSURE_PLAYERS 100000 // Returning players in the exposure run
+#define BENCH_EXPOSURE_FILE_PLAYERS 200000 // Players kept in the exposure file
+#define BENCH_LOADS 20000           // Times the game's bank is attached and each category loaded
+#define BENCH_SELECTIONS 1000000    // Quizzes drawn from the game's categories
+#define BENCH_ASKED 200000          // Questions asked through the console with scripted answers
+#define BENCH_SOLO_GAMES 20000      // Whole solo games played
+#define BENCH_1V1_GAMES 10000       // Whole 1v1 games played
+#define BENCH_ROOM_PLAYERS 1000     // Players in each multiplayer game
+#define BENCH_ROOM_GAMES 10         // Whole multiplayer games played
+#define BENCH_METRIC_EVENTS 10000000 // Events counted, recorded, timed and traced in the metrics run
+#define BENCH_METRIC_VALUES (1 << 20) // Different values the metrics run records, a power of two
+#define BENCH_METRIC_NS 50          // Most nanoseconds the instrumentation may add to one event
+#define BENCH_CHECKPOINT_PLAYERS 100000 // Players in the game the checkpoint run keeps
+#define BENCH_CHECKPOINT_TURNS 10000 // Turns played with every answer written to the checkpoint
+#define BENCH_CHECKPOINT_ANSWER_MS 100 // Time between two answers on the checkpoint run's clock
+#define BENCH_RESUME_MS 50          // Most milliseconds picking up the checkpoint run's game may take
+#define BENCH_RELOADS 2000          // Times the reload run opens the bank file as a new version
+#define BENCH_RELOAD_QUIZZES 1000000 // Quizzes the reload run draws, each holding the version it was drawn from
+#define BENCH_COMPRESS_SIZE 1000000 // Questions in the bank the compress run builds
+#define BENCH_MAX_RESULTS 64        // Most results one run of bench reports
+#define BENCH_TOLERANCE 0.25        // Share a result may be worse than its baseline before bench fails
+
+
+// Nanoseconds from the monotonic clock
+static long long benchNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// One timed run: what it did, how long each op took, the allocations per op
+// and the highest memory use of the process while it ran
+typedef struct {
+    char name[48];
+    long long ops;
+    double nsPerOp;
+    double allocationsPerOp;
+    long peakRssKb;
+} BenchResult;
+
+static BenchResult benchResults[BENCH_MAX_RESULTS];
+static int benchResultCount = 0;
+
+// Where a timed run started
+typedef struct {
+    long long ns;
+    long long allocations;
+} BenchMark;
+
+// Highest resident memory of the process, in kB, since it started or since
+// the last benchStart where the kernel lets the peak be reset
+static long benchPeakRssKb() {
+    FILE *status = fopen("/proc/self/status", "r");
+    char line[256];
+    long peak = -1;
+    while (status != NULL && fgets(line, sizeof(line), status) != NULL) {
+        if (sscanf(line, "VmHWM: %ld kB", &peak) == 1) {
+            break;
+        }
+    }
+    if (status != NULL) {
+        fclose(status);
+    }
+    if (peak < 0) {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        peak = usage.ru_maxrss;
+    }
+    return peak;
+}
+
+// Starts a timed run, bringing the peak memory back down to what is in use
+static BenchMark benchStart() {
+    int clear = open("/proc/self/clear_refs", O_WRONLY);
+    if (clear >= 0) {
+        if (write(clear, "5", 1) != 1) {
+            // Older kernels cannot reset the peak; it then covers every run so far
+        }
+        close(clear);
+    }
+    BenchMark mark = {benchNs(), benchAllocations};
+    return mark;
+}
+
+// Keeps the result of a run of ops operations that took ns in all. A run
+// done again with --repeat keeps the best of its results. Returns the
+// nanoseconds each op took, for the run's own report.
+static double benchRecord(const char *name, long long ops, long long ns, long long allocations) {
+    if (ops < 1) {
+        ops = 1;
+    }
+    BenchResult current;
+    snprintf(current.name, sizeof(current.name), "%s", name);
+    current.ops = ops;
+    current.nsPerOp = (double)ns / ops;
+    current.allocationsPerOp = (double)allocations / ops;
+    current.peakRssKb = benchPeakRssKb();
+
+    int i = 0;
+    while (i < benchResultCount && strcmp(benchResults[i].name, name) != 0) {
+        i++;
+    }
+    if (i == benchResultCount && benchResultCount < BENCH_MAX_RESULTS) {
+        benchResults[benchResultCount++] = current;
+    } else if (i < benchResultCount) {
+        BenchResult *best = &benchResults[i];
+        best->nsPerOp = current.nsPerOp < best->nsPerOp ? current.nsPerOp : best->nsPerOp;
+        best->allocationsPerOp = current.allocationsPerOp < best->allocationsPerOp ? current.allocationsPerOp
+                                                                                   : best->allocationsPerOp;
+        best->peakRssKb = current.peakRssKb < best->peakRssKb ? current.peakRssKb : best->peakRssKb;
+    }
+    return current.nsPerOp;
+}
+
+// Ends a timed run of ops operations and keeps its result
+static double benchReport(const char *name, long long ops, BenchMark start) {
+    return benchRecord(name, ops, benchNs() - start.ns, benchAllocations - start.allocations);
+}
+
+// Arms a million timers spread over a quiz's TEST_DURATION, cancels every
+// fourth one, moves every fourth to a new deadline, then runs the wheel one
+// millisecond at a time and checks every timer fires exactly on time.
+int benchTimers() {
+    Timer *timers = calloc(BENCH_TIMERS, sizeof(Timer));
+    if (timers == NULL) {
+        fprintf(stderr, "bench: not enough memory for %d timers\n", BENCH_TIMERS);
+        return -1;
+    }
+    TimerWheel wheel;
+    timerWheelInit(&wheel, 0);
+    long long span = TEST_DURATION * 1000LL;
+    Random rng;
+    randomSeed(&rng, 1, 0);
+
+    BenchMark start = benchStart();
+    for (int i = 0; i < BENCH_TIMERS; i++) {
+        timerArm(&wheel, &timers[i], 1 + randomBelow(&rng, (uint32_t)span));
+    }
+    double armNs = benchReport("timers.arm", BENCH_TIMERS, start);
+    start = benchStart();
+    for (int i = 0; i < BENCH_TIMERS; i += 4) {
+        timerCancel(&wheel, &timers[i]);
+        timerArm(&wheel, &timers[i + 1], 1 + randomBelow(&rng, (uint32_t)span));
+    }
+    double moveNs = benchReport("timers.move", BENCH_TIMERS / 4, start);
+    start = benchStart();
+
+    int fired = 0, late = 0;
+    for (long long now = 1; now <= span; now++) {
+        Timer *timer;
+        while ((timer = timerExpire(&wheel, now)) != NULL) {
+            late += timer->expiresMs != now;
+            fired++;
+        }
+    }
+    double fireNs = benchReport("timers.fire", fired, start);
+
+    int expected = BENCH_TIMERS - BENCH_TIMERS / 4;
+    printf("timers: %d armed        %6.1f ns/op\n", BENCH_TIMERS, armNs);
+    printf("timers: %d cancel+move  %6.1f ns/op\n", BENCH_TIMERS / 4, moveNs);
+    printf("timers: %d fired        %6.1f ns/op (%lld ms of wheel time in %.3f s)\n",
+           fired, fireNs, span, fireNs * fired / 1e9);
+    free(timers);
+
+    if (fired != expected || late != 0 || wheel.count != 0) {
+        fprintf(stderr, "bench: timer wheel fired %d of %d timers, %d off time\n", fired, expected, late);
+        return -1;
+    }
+    return 0;
+}
+
+// Ranks a million players with scores and times like a big room's, once
+// with a full sort and once for just the scoreboard, and checks both agree
+int benchRanking() {
+    RankEntry *all = malloc(BENCH_PLAYERS * sizeof(RankEntry));
+    RankEntry *top = malloc(BENCH_PLAYERS * sizeof(RankEntry));
+    if (all == NULL || top == NULL) {
+        fprintf(stderr, "bench: not enough memory for %d players\n", BENCH_PLAYERS);
+        free(all);
+        free(top);
+        return -1;
+    }
+    Random rng;
+    randomSeed(&rng, 2, 0);
+    for (int i = 0; i < BENCH_PLAYERS; i++) {
+        all[i].score = (int)randomBelow(&rng, QUIZ_SIZE + 1);
+        all[i].timeMs = (int)randomBelow(&rng, TEST_DURATION * 1000);
+        all[i].player = i;
+    }
+    memcpy(top, all, BENCH_PLAYERS * sizeof(RankEntry));
+
+    BenchMark start = benchStart();
+    rankAll(all, BENCH_PLAYERS);
+    double sortNs = benchReport("ranking.sort", BENCH_PLAYERS, start);
+    start = benchStart();
+    int listed = rankTop(top, BENCH_PLAYERS, SCOREBOARD_SIZE);
+    double topNs = benchReport("ranking.top", BENCH_PLAYERS, start);
+
+    printf("ranking: %d players full sort   %8.3f ms\n", BENCH_PLAYERS, sortNs * BENCH_PLAYERS / 1e6);
+    printf("ranking: %d players top %d      %8.3f ms\n", BENCH_PLAYERS, SCOREBOARD_SIZE, topNs * BENCH_PLAYERS / 1e6);
+    int failed = listed != SCOREBOARD_SIZE || memcmp(all, top, listed * sizeof(RankEntry)) != 0;
+    free(all);
+    free(top);
+    if (failed) {
+        fprintf(stderr, "bench: top %d does not match the full ranking\n", SCOREBOARD_SIZE);
+        return -1;
+    }
+    return 0;
+}
+
+// Draws quizzes from a category of four million questions and checks that
+// no quiz repeats a question and that every position is picked evenly
+int benchDraw() {
+    uint32_t *ids = malloc(BENCH_VIEW_SIZE * sizeof(uint32_t));
+    if (ids == NULL) {
+        fprintf(stderr, "bench: not enough memory for %d questions\n", BENCH_VIEW_SIZE);
+        return -1;
+    }
+    for (uint32_t i = 0; i < BENCH_VIEW_SIZE; i++) {
+        ids[i] = i;
+    }
+    QuestionView view = {NULL, ids, BENCH_VIEW_SIZE, NULL, 0, {0}};
+    Random rng;
+    randomSeed(&rng, 3, 0);
+
+    int repeats = 0;
+    long long lowHalf = 0;
+    BenchMark start = benchStart();
+    for (int d = 0; d < BENCH_DRAWS; d++) {
+        uint32_t quiz[QUIZ_SIZE];
+        int n = drawQuiz(&view, quiz, QUIZ_SIZE, &rng);
+        for (int i = 0; i < n; i++) {
+            lowHalf += quiz[i] < BENCH_VIEW_SIZE / 2;
+            for (int j = 0; j < i; j++) {
+                repeats += quiz[i] == quiz[j];
+            }
+        }
+    }
+    double drawNs = benchReport("draw.quiz", BENCH_DRAWS, start);
+    free(ids);
+
+    double share = (double)lowHalf / ((double)BENCH_DRAWS * QUIZ_SIZE);
+    printf("draw: %d quizzes of %d from %d   %6.1f ns/quiz (%.4f picked from the first half)\n",
+           BENCH_DRAWS, QUIZ_SIZE, BENCH_VIEW_SIZE, drawNs, share);
+    if (repeats != 0 || share < 0.499 || share > 0.501) {
+        fprintf(stderr, "bench: draws repeat questions (%d) or are uneven\n", repeats);
+        return -1;
+    }
+    return 0;
+}
+
+// Tells whether a question with these tags and difficulty belongs in the
+// answer to query q of benchQuery, the slow way
+static int benchQueryMatches(int q, uint64_t tags, int difficulty, const uint64_t masks[]) {
+    switch (q) {
+        case 0:  return (tags & masks[6]) && !(tags & masks[9]);
+        case 1:  return (tags & (masks[10] | masks[11])) && difficulty >= 3;
+        default: return (tags & masks[7]) && !(tags & masks[8]);
+    }
+}
+
+// Builds a bank of a million questions tagged like questions.txt, with one
+// in a hundred also tagged "review", then times queries over its tag index
+// and checks each one selects exactly the questions it should
+int benchQuery() {
+    static const char *lists[] = {
+        "vocabulary english", "grammar english", "sequence", "ratio math", "general", "mental_math math"
+    };
+    static const char *queries[] = {
+        "math AND NOT ratio", "grammar OR vocabulary, difficulty >= 3", "review AND NOT english"
+    };
+    static char options[4][MAX_LINE_LENGTH] = {"1", "2", "3", "4"};
+    BankBuilder builder;
+    memset(&builder, 0, sizeof(builder));
+    uint64_t masks[12] = {0};
+    for (int g = 0; g < 6; g++) {
+        parseTagList(&builder, lists[g], &masks[g]);
+    }
+    parseTagList(&builder, "math", &masks[6]);
+    parseTagList(&builder, "review", &masks[7]);
+    parseTagList(&builder, "english", &masks[8]);
+    parseTagList(&builder, "ratio", &masks[9]);
+    parseTagList(&builder, "grammar", &masks[10]);
+    parseTagList(&builder, "vocabulary", &masks[11]);
+
+    Random rng;
+    randomSeed(&rng, 4, 0);
+    int failed = 0;
+    for (uint32_t i = 0; i < BENCH_BANK_SIZE && !failed; i++) {
+        char text[32];
+        snprintf(text, sizeof(text), "Question %u", i);
+        uint64_t tags = masks[randomBelow(&rng, 6)] | (randomBelow(&rng, 100) == 0 ? masks[7] : 0);
+        failed = addBuiltQuestion(&builder, text, options, 1, tags, 1 + (int)randomBelow(&rng, DIFFICULTY_LEVELS)) != 0;
+    }
+    size_t imageSize = 0;
+    unsigned char *image = failed ? NULL : serializeBank(&builder, &imageSize);
+    QuestionBank bank;
+    if (image == NULL || attachQuestionBank(&bank, image, imageSize) != 0) {
+        fprintf(stderr, "bench: cannot build a bank of %d questions\n", BENCH_BANK_SIZE);
+        free(image);
+        freeBankBuilder(&builder);
+        return -1;
+    }
+
+    for (int q = 0; q < 3 && !failed; q++) {
+        QuestionView view;
+        char error[128], name[16];
+        snprintf(name, sizeof(name), "query.%d", q + 1);
+        BenchMark start = benchStart();
+        for (int r = 0; r < BENCH_QUERIES && !failed; r++) {
+            if (r > 0) {
+                freeQuestionView(&view);
+            }
+            failed = queryQuestions(&bank, queries[q], &view, error, sizeof(error)) != 0;
+        }
+        double queryNs = benchReport(name, BENCH_QUERIES, start);
+        if (failed) {
+            fprintf(stderr, "bench: query '%s' failed: %s\n", queries[q], error);
+            break;
+        }
+
+        int expected = 0, next = 0;
+        for (uint32_t i = 0; i < BENCH_BANK_SIZE; i++) {
+            if (benchQueryMatches(q, builder.tags[i], builder.difficulty[i], masks)) {
+                expected++;
+                failed |= next >= view.count || view.ids[next++] != i;
+            }
+        }
+        failed |= expected != view.count;
+        printf("query: %-40s %7d questions %8.1f us/query\n",
+               queries[q], view.count, queryNs / 1000);
+        freeQuestionView(&view);
+        if (failed) {
+            fprintf(stderr, "bench: query '%s' selected the wrong questions\n", queries[q]);
+        }
+    }
+
+    free(image);
+    freeBankBuilder(&builder);
+    return failed ? -1 : 0;
+}
+
+// Builds a bank of a million questions of twelve random words, where one
+// question in a hundred is an exact copy of an earlier one with its options
+// shuffled and another is a near copy with an extra word, then times the
+// duplicate pass and checks it finds exactly those copies
+int benchDuplicates() {
+    static char options[4][MAX_LINE_LENGTH];
+    BankBuilder builder;
+    memset(&builder, 0, sizeof(builder));
+    Random rng;
+    randomSeed(&rng, 5, 0);
+    int failed = 0;
+    for (uint32_t i = 0; i < BENCH_DUPLICATE_SIZE && !failed; i++) {
+        char text[MAX_LINE_LENGTH];
+        uint32_t copyOf = i % 100 == 99 ? i - 60 : i % 100 == 49 ? i - 30 : i;
+        if (copyOf != i) {
+            Question q;
+            q.question = builder.blob.data + builder.text[copyOf];
+            for (int k = 0; k < 4; k++) {
+                q.options[k] = builder.blob.data + builder.optionSets[builder.optionSet[copyOf]][k];
+            }
+            snprintf(text, sizeof(text), i % 100 == 49 ? "%s again" : "%s", q.question);
+            for (int k = 0; k < 4; k++) {
+                snprintf(options[k], sizeof(options[k]), "%s", q.options[(k + (i % 100 == 99)) % 4]);
+            }
+        } else {
+            int length = 0;
+            for (int w = 0; w < 12; w++) {
+                length += snprintf(text + length, sizeof(text) - length, "%sw%u", w ? " " : "", randomBelow(&rng, 5000));
+            }
+            for (int k = 0; k < 4; k++) {
+                snprintf(options[k], sizeof(options[k]), "o%u", randomBelow(&rng, 1000));
+            }
+        }
+        failed = addBuiltQuestion(&builder, text, options, 1, 1, DEFAULT_DIFFICULTY) != 0;
+    }
+
+    BenchMark start = benchStart();
+    long repeats = failed ? -1 : findDuplicates(&builder);
+    double seconds = benchReport("duplicates.question", BENCH_DUPLICATE_SIZE, start) * BENCH_DUPLICATE_SIZE / 1e9;
+    if (repeats < 0) {
+        fprintf(stderr, "bench: not enough memory for %d questions\n", BENCH_DUPLICATE_SIZE);
+        freeBankBuilder(&builder);
+        return -1;
+    }
+
+    long wrong = 0;
+    for (uint32_t i = 0; i < BENCH_DUPLICATE_SIZE; i++) {
+        uint32_t copyOf = i % 100 == 99 ? i - 60 : i % 100 == 49 ? i - 30 : i;
+        wrong += builder.duplicateOf[i] != copyOf || builder.exactDuplicate[i] != (i % 100 == 99);
+    }
+    printf("duplicates: %d questions in %.3f s (%.1f million per minute), %ld repeats found\n",
+           BENCH_DUPLICATE_SIZE, seconds, BENCH_DUPLICATE_SIZE / seconds * 60 / 1e6, repeats);
+    freeBankBuilder(&builder);
+    if (wrong != 0) {
+        fprintf(stderr, "bench: %ld questions put in the wrong duplicate group\n", wrong);
+        return -1;
+    }
+    return 0;
+}
+
+// Checks the shape of a generated question: a correct option from 1 to 4,
+// four different options and text that fits a stored question's limits.
+// Sums and products are worked out again from the text.
+static int benchGeneratedValid(const GeneratedQuestion *g) {
+    const Question *q = &g->question;
+    int valid = q->correctOption >= 1 && q->correctOption <= 4 && q->question[0] != '\0'
+             && strlen(q->question) <= MAX_QUESTION_LENGTH;
+    for (int i = 0; i < 4 && valid; i++) {
+        valid = q->options[i][0] != '\0' && strlen(q->options[i]) <= MAX_OPTION_LENGTH;
+        for (int j = 0; j < i && valid; j++) {
+            valid = strcmp(q->options[i], q->options[j]) != 0;
+        }
+    }
+    long a, b;
+    char operation[16];
+    if (valid && sscanf(q->question, "What is %ld %15[a-z ] %ld?", &a, operation, &b) == 3) {
+        // The operation is read up to the second number, with the space before it
+        size_t length = strlen(operation);
+        while (length > 0 && operation[length - 1] == ' ') {
+            operation[--length] = '\0';
+        }
+        long answer = strcmp(operation, "plus") == 0 ? a + b
+                    : strcmp(operation, "minus") == 0 ? a - b
+                    : strcmp(operation, "multiplied by") == 0 ? a * b : a / b;
+        valid = atol(q->options[q->correctOption - 1]) == answer;
+    }
+    return valid;
+}
+
+// Makes up three million questions, a third from each generator, and checks
+// every one of them and that the same id always gives the same question
+int benchGenerators() {
+    GeneratedQuestion g, again;
+    unsigned long checksum = 0;
+    BenchMark start = benchStart();
+    for (uint32_t i = 0; i < BENCH_GENERATED; i++) {
+        generateQuestion(GENERATED_ID | (i % GENERATOR_COUNT) << GENERATED_SEED_BITS | i / GENERATOR_COUNT, &g);
+        checksum += (unsigned long)g.question.correctOption + (unsigned char)g.options[0][0];
+    }
+    double seconds = benchReport("generators.question", BENCH_GENERATED, start) * BENCH_GENERATED / 1e9;
+
+    long invalid = 0;
+    for (uint32_t i = 0; i < BENCH_GENERATED; i++) {
+        uint32_t id = GENERATED_ID | (i % GENERATOR_COUNT) << GENERATED_SEED_BITS | i / GENERATOR_COUNT;
+        generateQuestion(id, &g);
+        generateQuestion(id, &again);
+        int same = strcmp(g.text, again.text) == 0;
+        for (int j = 0; j < 4; j++) {
+            same &= strcmp(g.options[j], again.options[j]) == 0;
+        }
+        invalid += !benchGeneratedValid(&g) || !same;
+    }
+    printf("generators: %d questions in %.3f s (%.1f million per second, checksum %lu)\n",
+           BENCH_GENERATED, seconds, BENCH_GENERATED / seconds / 1e6, checksum);
+    if (invalid != 0) {
+        fprintf(stderr, "bench: %ld generated questions are not valid\n", invalid);
+        return -1;
+    }
+    return 0;
+}
+
+// Plays the same sessions with and without a journal, so the difference is
+// what recording costs, then replays the journal and checks every session
+static void benchJournalSessions(const QuestionBank *bank, Journal *journal) {
+    Random rng;
+    randomSeed(&rng, 6, 0);
+    uint32_t quiz[QUIZ_SIZE];
+    for (int i = 0; i < QUIZ_SIZE; i++) {
+        quiz[i] = (uint32_t)i;
+    }
+    for (int s = 0; s < BENCH_JOURNAL_SESSIONS; s++) {
+        QuizSession session;
+        sessionStart(&session, bank, quiz, QUIZ_SIZE, 0, TEST_DURATION * 1000LL);
+        sessionRecord(&session, journal, 1 + s % CATEGORY_COUNT);
+        long long now = 0;
+        while (session.state == SESSION_ASKING) {
+            now += 1 + randomBelow(&rng, 60000);
+            sessionAnswer(&session, 1 + (int)randomBelow(&rng, 4), now);
+        }
+    }
+}
+
+int benchJournal() {
+    static const uint8_t correct[QUIZ_SIZE] = {1, 2, 3, 4, 1, 2, 3, 4, 1, 2};
+    QuestionBank bank;
+    memset(&bank, 0, sizeof(bank));
+    bank.count = QUIZ_SIZE;
+    bank.correctOption = correct;
+    char path[] = "/tmp/mindmatch-bench-XXXXXX";
+    int fd = mkstemp(path);
+    static Journal journal;
+    if (fd < 0 || journalOpen(&journal, path) != 0) {
+        fprintf(stderr, "bench: cannot create a journal in /tmp\n");
+        return -1;
+    }
+    close(fd);
+
+    long long answers = (long long)BENCH_JOURNAL_SESSIONS * QUIZ_SIZE;
+    BenchMark start = benchStart();
+    benchJournalSessions(&bank, NULL);
+    double playNs = benchReport("journal.play", answers, start);
+    start = benchStart();
+    benchJournalSessions(&bank, &journal);
+    int failed = journalClose(&journal) != 0;
+    double recordNs = benchReport("journal.record", answers, start);
+
+    FILE *discard = fopen("/dev/null", "w");
+    start = benchStart();
+    failed |= discard == NULL || replayJournal(&bank, path, discard) != 0;
+    double replayNs = benchReport("journal.replay", answers, start);
+    if (discard != NULL) {
+        fclose(discard);
+    }
+    unlink(path);
+
+    printf("journal: %d sessions   %6.1f ns/answer to play, %6.1f ns/answer more to record, replayed in %.3f s\n",
+           BENCH_JOURNAL_SESSIONS, playNs, recordNs - playNs, replayNs * answers / 1e9);
+    if (failed) {
+        fprintf(stderr, "bench: the journal did not replay to the same results\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Makes up the answers of two million sessions of ten questions. Each
+// player has an ability and each question a difficulty, both 0-999; a
+// player who knows the answer picks it, anyone else guesses. On every 50th
+// question the key is wrong, so the players who know the answer are marked
+// wrong. Checks that aggregation finds those questions and only those.
+int benchAnalytics() {
+    AnswerColumns columns;
+    memset(&columns, 0, sizeof(columns));
+    size_t count = (size_t)BENCH_ANALYTICS_SESSIONS * QUIZ_SIZE;
+    columns.item = malloc(count * sizeof(uint32_t));
+    columns.choice = malloc(count);
+    columns.latencyMs = malloc(count * sizeof(uint32_t));
+    columns.session = malloc(count * sizeof(uint32_t));
+    columns.score = malloc(BENCH_ANALYTICS_SESSIONS);
+    ItemStats *stats = malloc(BENCH_ANALYTICS_ITEMS * sizeof(ItemStats));
+    if (!columns.item || !columns.choice || !columns.latencyMs || !columns.session || !columns.score || !stats) {
+        fprintf(stderr, "bench: not enough memory for the analytics run\n");
+        freeAnswerColumns(&columns);
+        free(stats);
+        return -1;
+    }
+
+    Random rng;
+    randomSeed(&rng, 7, 0);
+    for (uint32_t s = 0; s < BENCH_ANALYTICS_SESSIONS; s++) {
+        int ability = (int)randomBelow(&rng, 1000);
+        int score = 0;
+        for (int q = 0; q < QUIZ_SIZE; q++) {
+            uint32_t item = randomBelow(&rng, BENCH_ANALYTICS_ITEMS);
+            int difficulty = (int)(item * 7919 % 1000);
+            int knows = (int)randomBelow(&rng, 1000) < 500 + ability - difficulty;
+            int key = 1 + (int)(item % 4);
+            int pick = knows ? key : 1 + (int)randomBelow(&rng, 4);
+            if (item % 50 == 0) {
+                // The answer players know is the option after the one keyed
+                pick = knows ? 1 + key % 4 : pick;
+            }
+            int correct = pick == key;
+            score += correct;
+            columns.item[columns.count] = item;
+            columns.choice[columns.count] = (uint8_t)(pick | (correct ? JOURNAL_CORRECT : 0));
+            columns.latencyMs[columns.count] = 2000 + randomBelow(&rng, 20000);
+            columns.session[columns.count] = s;
+            columns.count++;
+        }
+        columns.score[s] = (int8_t)score;
+    }
+    columns.sessions = BENCH_ANALYTICS_SESSIONS;
+
+    BenchMark start = benchStart();
+    int failed = aggregateAnswers(&columns, stats, BENCH_ANALYTICS_ITEMS) != 0;
+    double seconds = benchReport("analytics.answer", (long long)columns.count, start) * columns.count / 1e9;
+
+    long wrong = 0;
+    for (uint32_t i = 0; i < BENCH_ANALYTICS_ITEMS; i++) {
+        wrong += (stats[i].discrimination < 0) != (i % 50 == 0);
+    }
+    printf("analytics: %zu answers aggregated in %.3f s (%.0f million per second)\n",
+           columns.count, seconds, columns.count / seconds / 1e6);
+    freeAnswerColumns(&columns);
+    free(stats);
+    if (failed || wrong != 0) {
+        fprintf(stderr, "bench: item analysis got %ld questions wrong\n", wrong);
+        return -1;
+    }
+    return 0;
+}
+
+// Adds ten million performances shaped like quiz scores to two sketches,
+// half to each, merges them and checks the ranks against exact ones, which
+// are easy to count as the values only take a few hundred distinct values
+int benchNorms() {
+    static QuantileSketch halves[2];
+    static long counts[QUIZ_SIZE * 100 + 50];   // Hundredths from 0 up to a full score plus 0.49
+    Random rng;
+    randomSeed(&rng, 8, 0);
+    BenchMark start = benchStart();
+    for (int i = 0; i < BENCH_SKETCH_VALUES; i++) {
+        int score = 0;
+        for (int q = 0; q < QUIZ_SIZE; q++) {
+            score += randomBelow(&rng, 3) != 0;
+        }
+        int hundredths = score * 100 + (int)randomBelow(&rng, 50);
+        counts[hundredths]++;
+        sketchAdd(&halves[i & 1], hundredths / 100.0, 1);
+    }
+    double addNs = benchReport("norms.add", BENCH_SKETCH_VALUES, start);
+    start = benchStart();
+    sketchMerge(&halves[0], &halves[1]);
+    double mergeNs = benchReport("norms.merge", 1, start);
+
+    double worst = 0;
+    long below = 0;
+    for (int x = 0; x < QUIZ_SIZE * 100 + 50; x++) {
+        double exact = (below + counts[x] / 2.0) / BENCH_SKETCH_VALUES;
+        double error = sketchRank(&halves[0], x / 100.0) - exact;
+        worst = error > worst ? error : -error > worst ? -error : worst;
+        below += counts[x];
+    }
+    printf("norms: %d values   %6.1f ns/add, merged in %.1f us, %u centroids, worst rank error %.4f\n",
+           BENCH_SKETCH_VALUES, addNs, mergeNs / 1e3,
+           halves[0].merged, worst);
+    if (worst > 0.01) {
+        fprintf(stderr, "bench: the merged sketch is off by %.4f\n", worst);
+        return -1;
+    }
+    return 0;
+}
+
+// Whether a simulated player of the given ability gets a question right,
+// under the same model adaptive quizzes assume
+static int benchAnswersRight(Random *rng, double ability, const QuestionBank *bank, uint32_t id) {
+    double p = ADAPTIVE_GUESS + (1 - ADAPTIVE_GUESS) * logistic(ability - levelDifficulty(quizDifficulty(bank, id)));
+    return randomNext(rng) < p * 4294967296.0;
+}
+
+// Simulated players, their abilities spread like a standard normal, each
+// take a quiz of ten questions drawn at random and an adaptive quiz. Checks
+// the adaptive quizzes are shorter and measure the ability at least as
+// well as the random ones.
+int benchAdaptive() {
+    static char options[4][MAX_LINE_LENGTH] = {"1", "2", "3", "4"};
+    BankBuilder builder;
+    memset(&builder, 0, sizeof(builder));
+    Random rng;
+    randomSeed(&rng, 9, 0);
+    int failed = 0;
+    for (uint32_t i = 0; i < BENCH_ADAPTIVE_BANK && !failed; i++) {
+        char text[32];
+        snprintf(text, sizeof(text), "Question %u", i);
+        failed = addBuiltQuestion(&builder, text, options, 1, 0, 1 + (int)randomBelow(&rng, DIFFICULTY_LEVELS)) != 0;
+    }
+    size_t imageSize = 0;
+    unsigned char *image = failed ? NULL : serializeBank(&builder, &imageSize);
+    QuestionBank bank;
+    QuestionView view;
+    DifficultyIndex index;
+    if (image == NULL || attachQuestionBank(&bank, image, imageSize) != 0 || queryQuestions(&bank, "all", &view, NULL, 0) != 0
+        || buildDifficultyIndex(&index, &view) != 0) {
+        fprintf(stderr, "bench: cannot build a bank of %d questions\n", BENCH_ADAPTIVE_BANK);
+        free(image);
+        freeBankBuilder(&builder);
+        return -1;
+    }
+
+    double randomSquares = 0, adaptiveSquares = 0;
+    long adaptiveQuestions = 0;
+    long long adaptiveNs = 0;
+    BenchMark run = benchStart();
+    for (int player = 0; player < BENCH_ADAPTIVE_PLAYERS; player++) {
+        // Twelve uniform numbers add up to nearly a standard normal one
+        double ability = -6;
+        for (int i = 0; i < 12; i++) {
+            ability += randomNext(&rng) / 4294967296.0;
+        }
+
+        uint32_t quiz[QUIZ_SIZE];
+        int numQuestions = drawQuiz(&view, quiz, QUIZ_SIZE, &rng);
+        AbilityEstimate estimate;
+        abilityStart(&estimate);
+        for (int q = 0; q < numQuestions; q++) {
+            abilityUpdate(&estimate, levelDifficulty(quizDifficulty(&bank, quiz[q])),
+                          benchAnswersRight(&rng, ability, &bank, quiz[q]));
+        }
+        randomSquares += (estimate.ability - ability) * (estimate.ability - ability);
+
+        long long start = benchNs();
+        AdaptiveQuiz adaptive;
+        QuizSession session;
+        sessionStart(&session, &bank, quiz, adaptiveStart(&adaptive, &index, NULL, quiz, &rng), 0, TEST_DURATION * 1000LL);
+        sessionAdapt(&session, &adaptive);
+        while (session.state == SESSION_ASKING) {
+            uint32_t id = (uint32_t)sessionQuestion(&session);
+            int right = benchAnswersRight(&rng, ability, &bank, id);
+            sessionAnswer(&session, right ? 1 : 2, session.current + 1);
+        }
+        adaptiveNs += benchNs() - start;
+        adaptiveQuestions += session.numQuestions;
+        double error = adaptive.estimate.ability - ability;
+        adaptiveSquares += error * error;
+    }
+
+    double questionNs = benchRecord("adaptive.question", adaptiveQuestions, adaptiveNs,
+                                    benchAllocations - run.allocations);
+    double randomError = squareRoot(randomSquares / BENCH_ADAPTIVE_PLAYERS);
+    double adaptiveError = squareRoot(adaptiveSquares / BENCH_ADAPTIVE_PLAYERS);
+    double meanQuestions = (double)adaptiveQuestions / BENCH_ADAPTIVE_PLAYERS;
+    printf("adaptive: %d players   random quizzes: %d questions, ability off by %.3f   "
+           "adaptive: %.2f questions, off by %.3f, %.0f ns/question\n",
+           BENCH_ADAPTIVE_PLAYERS, QUIZ_SIZE, randomError, meanQuestions, adaptiveError,
+           questionNs);
+    freeDifficultyIndex(&index);
+    freeQuestionView(&view);
+    free(image);
+    freeBankBuilder(&builder);
+    if (meanQuestions >= QUIZ_SIZE || adaptiveError > randomError) {
+        fprintf(stderr, "bench: adaptive quizzes are no better than random ones\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Counts the questions of a player's first four quizzes from a 40-question
+// category that they were asked before, drawing at random and drawing
+// unseen questions; checks the Bloom filter used for big banks against
+// questions it was never given; and saves and loads a set for each of many
+// players in an exposure file under /tmp.
+int benchExposures() {
+    uint32_t *ids = malloc(BENCH_EXPOSURE_BANK * sizeof(uint32_t));
+    if (ids == NULL) {
+        fprintf(stderr, "bench: not enough memory for %d questions\n", BENCH_EXPOSURE_BANK);
+        return -1;
+    }
+    for (uint32_t i = 0; i < BENCH_EXPOSURE_BANK; i++) {
+        ids[i] = i;
+    }
+    Random rng;
+    randomSeed(&rng, 10, 0);
+
+    // A small category, where every question has its own bit
+    QuestionView pool = {NULL, ids, BENCH_EXPOSURE_POOL, NULL, 0, {0}};
+    long randomRepeats = 0, unseenRepeats = 0;
+    long long drawNs = 0;
+    BenchMark run = benchStart();
+    for (int player = 0; player < BENCH_EXPOSURE_PLAYERS; player++) {
+        SeenSet asked, seen;
+        memset(&asked, 0, sizeof(asked));
+        memset(&seen, 0, sizeof(seen));
+        asked.bankCount = seen.bankCount = BENCH_EXPOSURE_POOL;
+        for (int round = 0; round < BENCH_EXPOSURE_POOL / QUIZ_SIZE; round++) {
+            uint32_t quiz[QUIZ_SIZE];
+            int n = drawQuiz(&pool, quiz, QUIZ_SIZE, &rng);
+            for (int i = 0; i < n; i++) {
+                randomRepeats += seenContains(&asked, quiz[i]);
+                seenAdd(&asked, quiz[i]);
+            }
+            long long start = benchNs();
+            n = drawUnseenQuiz(&pool, quiz, QUIZ_SIZE, &seen, &rng);
+            drawNs += benchNs() - start;
+            for (int i = 0; i < n; i++) {
+                unseenRepeats += seenContains(&seen, quiz[i]);
+                seenAdd(&seen, quiz[i]);
+            }
+        }
+    }
+    int quizzes = BENCH_EXPOSURE_PLAYERS * (BENCH_EXPOSURE_POOL / QUIZ_SIZE);
+    double smallNs = benchRecord("exposures.small_draw", quizzes, drawNs, benchAllocations - run.allocations);
+    printf("exposure: %d players x %d quizzes of %d from %d   random: %.2f repeats/player   "
+           "unseen: %.2f repeats/player, %.0f ns/quiz\n",
+           BENCH_EXPOSURE_PLAYERS, BENCH_EXPOSURE_POOL / QUIZ_SIZE, QUIZ_SIZE, BENCH_EXPOSURE_POOL,
+           (double)randomRepeats / BENCH_EXPOSURE_PLAYERS, (double)unseenRepeats / BENCH_EXPOSURE_PLAYERS,
+           smallNs);
+
+    // A big bank, where a set is a Bloom filter holding up to EXPOSURE_CAPACITY questions
+    QuestionView bank = {NULL, ids, BENCH_EXPOSURE_BANK, NULL, 0, {0}};
+    long falsePositives = 0, tests = 0;
+    drawNs = 0;
+    run = benchStart();
+    for (int player = 0; player < BENCH_EXPOSURE_PLAYERS / 10; player++) {
+        SeenSet seen;
+        memset(&seen, 0, sizeof(seen));
+        seen.bankCount = BENCH_EXPOSURE_BANK;
+        uint32_t first = randomBelow(&rng, BENCH_EXPOSURE_BANK - EXPOSURE_CAPACITY);
+        for (uint32_t i = 0; i < EXPOSURE_CAPACITY; i++) {
+            seenAdd(&seen, first + i);
+        }
+        for (int i = 0; i < 100; i++) {
+            uint32_t id = randomBelow(&rng, BENCH_EXPOSURE_BANK);
+            if (id < first || id >= first + EXPOSURE_CAPACITY) {
+                falsePositives += seenContains(&seen, id);
+                tests++;
+            }
+        }
+        uint32_t quiz[QUIZ_SIZE];
+        long long start = benchNs();
+        drawUnseenQuiz(&bank, quiz, QUIZ_SIZE, &seen, &rng);
+        drawNs += benchNs() - start;
+    }
+    double falseRate = (double)falsePositives / tests;
+    double bloomNs = benchRecord("exposures.bloom_draw", BENCH_EXPOSURE_PLAYERS / 10, drawNs,
+                                 benchAllocations - run.allocations);
+    printf("exposure: Bloom filter of %d bits holding %d of %d questions   %.4f false positives, %.0f ns/quiz\n",
+           EXPOSURE_BITS, EXPOSURE_CAPACITY, BENCH_EXPOSURE_BANK, falseRate,
+           bloomNs);
+    free(ids);
+
+    // Every player's set saved to and found in one file
+    const char *path = "/tmp/mindmatch-bench.seen";
+    char lockPath[512];
+    snprintf(lockPath, sizeof(lockPath), "%s.lock", path);
+    remove(path);
+    QuestionBank fakeBank;
+    memset(&fakeBank, 0, sizeof(fakeBank));
+    fakeBank.count = BENCH_EXPOSURE_BANK;
+    int failed = 0, lost = 0;
+    BenchMark start = benchStart();
+    for (int player = 0; player < BENCH_EXPOSURE_FILE_PLAYERS && !failed; player++) {
+        char name[32];
+        SeenSet seen;
+        snprintf(name, sizeof(name), "player%d", player);
+        failed = seenLoad(path, &fakeBank, name, &seen) != 0;
+        seenAdd(&seen, (uint32_t)player);
+        failed = failed || seenSave(path, &seen) != 0;
+    }
+    double saveNs = benchReport("exposures.load_save", BENCH_EXPOSURE_FILE_PLAYERS, start);
+    start = benchStart();
+    for (int player = 0; player < BENCH_EXPOSURE_FILE_PLAYERS && !failed; player++) {
+        char name[32];
+        SeenSet seen;
+        snprintf(name, sizeof(name), "player%d", player);
+        failed = seenLoad(path, &fakeBank, name, &seen) != 0;
+        lost += seen.seen != 1 || !seenContains(&seen, (uint32_t)player);
+    }
+    double loadNs = benchReport("exposures.load", BENCH_EXPOSURE_FILE_PLAYERS, start);
+    struct stat info;
+    failed = failed || stat(path, &info) != 0;
+    remove(path);
+    remove(lockPath);
+    if (failed) {
+        fprintf(stderr, "bench: cannot use exposure file %s\n", path);
+        return -1;
+    }
+    printf("exposure: %d players in one file   load+save %.1f us/player, load %.1f us/player, "
+           "%.0f bytes/player on disk\n",
+           BENCH_EXPOSURE_FILE_PLAYERS, saveNs / 1000, loadNs / 1000,
+           (double)info.st_blocks * 512 / BENCH_EXPOSURE_FILE_PLAYERS);
+    if (unseenRepeats != 0 || falseRate > 0.02 || lost != 0) {
+        fprintf(stderr, "bench: returning players were given seen questions (%ld), the filter is too full, "
+                        "or sets were lost (%d)\n", unseenRepeats, lost);
+        return -1;
+    }
+    return 0;
+}
+
+// Builds the game's own bank from questions.txt in memory, as bankgen does.
+// Returns the image the bank is attached to, or NULL.
+static unsigned char *benchGameBank(QuestionBank *bank, size_t *imageSize) {
+    BankBuilder builder;
+    memset(&builder, 0, sizeof(builder));
+    unsigned char *image = parseQuestionSource(BANK_SOURCE, &builder) == 0 ? serializeBank(&builder, imageSize) : NULL;
+    freeBankBuilder(&builder);
+    if (image == NULL || attachQuestionBank(bank, image, *imageSize) != 0) {
+        fprintf(stderr, "bench: cannot build the bank from %s\n", BANK_SOURCE);
+        free(image);
+        return NULL;
+    }
+    return image;
+}
+
+// Writes lines of scripted answers, each a random option, to a file the
+// console can read in place of the keyboard. Returns the file, or -1.
+static int benchScript(int lines, Random *rng) {
+    char path[] = "/tmp/mindmatch-bench-XXXXXX";
+    int fd = mkstemp(path);
+    char *text = malloc((size_t)lines * 2);
+    if (fd < 0 || text == NULL) {
+        fprintf(stderr, "bench: cannot write scripted answers in /tmp\n");
+        if (fd >= 0) close(fd);
+        free(text);
+        return -1;
+    }
+    unlink(path);
+    for (int i = 0; i < lines; i++) {
+        text[2 * i] = (char)('1' + randomBelow(rng, 4));
+        text[2 * i + 1] = '\n';
+    }
+    int failed = write(fd, text, (size_t)lines * 2) != (ssize_t)lines * 2;
+    free(text);
+    if (failed) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Starts the console over at the first answer of a script
+static void benchRewind(int script) {
+    lseek(script, 0, SEEK_SET);
+    console.fd = script;
+    console.length = 0;
+    console.skipping = 0;
+    console.eof = 0;
+}
+
+// Sends what the game prints to /dev/null while a run plays it. Returns
+// what benchRestoreOutput needs to put the output back.
+static int benchMuteOutput() {
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    if (null >= 0) {
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+    return saved;
+}
+
+static void benchRestoreOutput(int saved) {
+    fflush(stdout);
+    if (saved >= 0) {
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+    }
+    console.fd = STDIN_FILENO;
+}
+
+// Attaches the game's bank and loads each of its categories over and over,
+// as every game does once at the start
+int benchLoad() {
+    QuestionBank bank;
+    size_t imageSize = 0;
+    unsigned char *image = benchGameBank(&bank, &imageSize);
+    if (image == NULL) {
+        return -1;
+    }
+    int failed = 0;
+    BenchMark start = benchStart();
+    for (int i = 0; i < BENCH_LOADS && !failed; i++) {
+        failed = attachQuestionBank(&bank, image, imageSize) != 0;
+    }
+    double attachNs = benchReport("load.attach", BENCH_LOADS, start);
+
+    int counts[CATEGORY_COUNT] = {0};
+    start = benchStart();
+    for (int i = 0; i < BENCH_LOADS && !failed; i++) {
+        for (int category = 1; category <= CATEGORY_COUNT && !failed; category++) {
+            QuestionView view;
+            failed = loadQuestions(&bank, category, 0, &view) != 0;
+            if (!failed) {
+                counts[category - 1] = view.count;
+                freeQuestionView(&view);
+            }
+        }
+    }
+    double categoryNs = benchReport("load.category", (long long)BENCH_LOADS * CATEGORY_COUNT, start);
+
+    printf("load: %u questions from %s   attach %6.1f ns, load a category %6.1f ns (%d, %d and %d questions)\n",
+           bank.count, BANK_SOURCE, attachNs, categoryNs, counts[0], counts[1], counts[2]);
+    free(image);
+    if (failed || counts[0] != (int)bank.count) {
+        fprintf(stderr, "bench: the game's categories did not load\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Draws quizzes from the game's categories as solo play and multiplayer
+// rooms do, then as returning players who take ten quizzes in a row each
+int benchSelect() {
+    QuestionBank bank;
+    size_t imageSize = 0;
+    unsigned char *image = benchGameBank(&bank, &imageSize);
+    if (image == NULL) {
+        return -1;
+    }
+    QuestionView views[CATEGORY_COUNT];
+    int loaded = 0;
+    while (loaded < CATEGORY_COUNT && loadQuestions(&bank, loaded + 1, 0, &views[loaded]) == 0) {
+        loaded++;
+    }
+    Random rng;
+    randomSeed(&rng, 11, 0);
+
+    long repeats = 0;
+    BenchMark start = benchStart();
+    for (int d = 0; d < BENCH_SELECTIONS && loaded == CATEGORY_COUNT; d++) {
+        uint32_t quiz[QUIZ_SIZE];
+        int n = drawQuiz(&views[d % CATEGORY_COUNT], quiz, QUIZ_SIZE, &rng);
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < i; j++) {
+                repeats += quiz[i] == quiz[j];
+            }
+        }
+    }
+    double drawNs = benchReport("select.draw", BENCH_SELECTIONS, start);
+
+    SeenSet seen;
+    start = benchStart();
+    for (int d = 0; d < BENCH_SELECTIONS && loaded == CATEGORY_COUNT; d++) {
+        int player = d / 10;
+        if (d % 10 == 0) {
+            memset(&seen, 0, sizeof(seen));
+            seen.bankCount = bank.count;
+        }
+        uint32_t quiz[QUIZ_SIZE];
+        int n = drawUnseenQuiz(&views[player % CATEGORY_COUNT], quiz, QUIZ_SIZE, &seen, &rng);
+        for (int i = 0; i < n; i++) {
+            seenAdd(&seen, quiz[i]);
+        }
+    }
+    double unseenNs = benchReport("select.unseen", BENCH_SELECTIONS, start);
+
+    printf("select: %d quizzes from the game's categories   %6.1f ns/quiz, %6.1f ns/quiz for returning players\n",
+           BENCH_SELECTIONS, drawNs, unseenNs);
+    for (int i = 0; i < loaded; i++) {
+        freeQuestionView(&views[i]);
+    }
+    free(image);
+    if (loaded != CATEGORY_COUNT || repeats != 0) {
+        fprintf(stderr, "bench: the game's quizzes could not be drawn or repeat questions\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Asks IQ test questions through the console, the way playSolo does, with
+// the answers read from a script
+int benchAsk() {
+    QuestionBank bank;
+    size_t imageSize = 0;
+    unsigned char *image = benchGameBank(&bank, &imageSize);
+    QuestionView view;
+    if (image == NULL || loadQuestions(&bank, 1, 0, &view) != 0) {
+        free(image);
+        return -1;
+    }
+    Random rng;
+    randomSeed(&rng, 12, 0);
+    int script = benchScript(QUIZ_SIZE, &rng);
+    if (script < 0) {
+        freeQuestionView(&view);
+        free(image);
+        return -1;
+    }
+
+    long asked = 0, right = 0, unfinished = 0;
+    int saved = benchMuteOutput();
+    BenchMark start = benchStart();
+    while (asked < BENCH_ASKED) {
+        uint32_t quiz[QUIZ_SIZE];
+        int n = drawQuiz(&view, quiz, QUIZ_SIZE, &rng);
+        benchRewind(script);
+        QuizSession session;
+        sessionStart(&session, &bank, quiz, n, monotonicMs(), TEST_DURATION * 1000LL);
+        TimerWheel timers;
+        Timer deadline = {0};
+        timerWheelInit(&timers, session.startMs);
+        deadline.kind = TIMER_QUIZ_DEADLINE;
+        timerArm(&timers, &deadline, session.startMs + session.timeLimitMs);
+        while (session.state == SESSION_ASKING) {
+            askQuestion(&session, &timers);
+        }
+        asked += session.current;
+        right += session.score;
+        unfinished += session.current != n;
+    }
+    double askNs = benchReport("ask.question", asked, start);
+    benchRestoreOutput(saved);
+    close(script);
+
+    printf("ask: %ld questions shown and graded from scripted answers   %6.0f ns/question (%ld right)\n",
+           asked, askNs, right);
+    freeQuestionView(&view);
+    free(image);
+    if (unfinished != 0 || right == 0 || right == asked) {
+        fprintf(stderr, "bench: %ld scripted quizzes did not finish\n", unfinished);
+        return -1;
+    }
+    return 0;
+}
+
+// Plays whole IQ test games through the console with scripted answers:
+// solo games, 1v1 games and multiplayer games of a thousand players each
+int benchPlay() {
+    QuestionBank bank;
+    size_t imageSize = 0;
+    unsigned char *image = benchGameBank(&bank, &imageSize);
+    QuestionView view;
+    if (image == NULL || loadQuestions(&bank, 1, 0, &view) != 0) {
+        free(image);
+        return -1;
+    }
+    Random rng;
+    randomSeed(&rng, 13, 0);
+    int script = benchScript(BENCH_ROOM_PLAYERS * QUIZ_SIZE, &rng);
+    Roster roster;
+    if (script < 0 || rosterCreate(&roster, BENCH_ROOM_PLAYERS) != 0) {
+        if (script >= 0) close(script);
+        freeQuestionView(&view);
+        free(image);
+        return -1;
+    }
+    for (int i = 0; i < BENCH_ROOM_PLAYERS; i++) {
+        snprintf(roster.players[i].name, NAME_LENGTH, "Player %d", i + 1);
+    }
+
+    char player1[NAME_LENGTH] = "Player 1", player2[NAME_LENGTH] = "Player 2";
+    long soloScores = 0, roomScores = 0;
+    int ranOut = 0;
+    int saved = benchMuteOutput();
+    BenchMark start = benchStart();
+    for (int g = 0; g < BENCH_SOLO_GAMES; g++) {
+        uint32_t quiz[QUIZ_SIZE];
+        int timeTakenMs;
+        benchRewind(script);
+        int n = drawQuiz(&view, quiz, QUIZ_SIZE, &rng);
+        soloScores += playSolo(&bank, quiz, n, NULL, NULL, NULL, player1, &timeTakenMs, 1);
+    }
+    double soloNs = benchReport("play.solo", BENCH_SOLO_GAMES, start);
+    start = benchStart();
+    for (int g = 0; g < BENCH_1V1_GAMES; g++) {
+        benchRewind(script);
+        play1v1(&view, QUIZ_SIZE, player1, player2, 1, &rng);
+        ranOut |= console.eof;
+    }
+    double duelNs = benchReport("play.1v1", BENCH_1V1_GAMES, start);
+    start = benchStart();
+    for (int g = 0; g < BENCH_ROOM_GAMES; g++) {
+        benchRewind(script);
+        playMultiplayer(&view, QUIZ_SIZE, &roster, 1, &rng);
+        ranOut |= console.eof;
+        for (int i = 0; i < BENCH_ROOM_PLAYERS; i++) {
+            roomScores += roster.players[i].score;
+        }
+    }
+    double turnNs = benchReport("play.multiplayer_turn", (long long)BENCH_ROOM_GAMES * BENCH_ROOM_PLAYERS, start);
+    benchRestoreOutput(saved);
+    close(script);
+
+    printf("play: solo %6.1f us/game, 1v1 %6.1f us/game, %d players a game %6.1f us/turn   "
+           "(mean scores %.2f and %.2f)\n",
+           soloNs / 1000, duelNs / 1000, BENCH_ROOM_PLAYERS, turnNs / 1000,
+           (double)soloScores / BENCH_SOLO_GAMES, (double)roomScores / (BENCH_ROOM_GAMES * BENCH_ROOM_PLAYERS));
+    rosterRelease(&roster);
+    freeQuestionView(&view);
+    free(image);
+    if (ranOut || soloScores == 0 || roomScores == 0) {
+        fprintf(stderr, "bench: scripted games ran out of answers or scored nothing\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int benchCompareValues(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Times what the game's instrumentation adds to an event: bumping a
+// counter, recording a value and timing a short piece of work (sampled),
+// each of which must stay under BENCH_METRIC_NS, and tracing a span to a
+// file, which must stay under it on top of the two clock reads a span
+// needs. Also checks the histograms' quantiles against the exact ones of a
+// million values spread over many sizes.
+int benchMetrics() {
+    uint64_t *values = malloc(BENCH_METRIC_VALUES * sizeof(uint64_t));
+    Histogram *histogram = calloc(1, sizeof(Histogram));
+    if (values == NULL || histogram == NULL) {
+        free(values);
+        free(histogram);
+        return -1;
+    }
+    Random rng;
+    randomSeed(&rng, 14, 0);
+    for (int i = 0; i < BENCH_METRIC_VALUES; i++) {
+        values[i] = ((uint64_t)randomNext(&rng) << 32 | randomNext(&rng)) >> randomBelow(&rng, 64);
+    }
+
+    BenchMark start = benchStart();
+    for (long i = 0; i < BENCH_METRIC_EVENTS; i++) {
+        METRIC_COUNT(values[i & (BENCH_METRIC_VALUES - 1)] % COUNTER_COUNT);
+    }
+    double countNs = benchReport("metrics.count", BENCH_METRIC_EVENTS, start);
+    start = benchStart();
+    for (long i = 0; i < BENCH_METRIC_EVENTS; i++) {
+        METRIC_RECORD(HISTOGRAM_ANSWER_TIME + i % CATEGORY_COUNT, values[i & (BENCH_METRIC_VALUES - 1)]);
+    }
+    double recordNs = benchReport("metrics.record", BENCH_METRIC_EVENTS, start);
+    start = benchStart();
+    for (long i = 0; i < BENCH_METRIC_EVENTS; i++) {
+        long long rendering = METRIC_SAMPLE();
+        METRIC_SAMPLED(HISTOGRAM_QUESTION_RENDER, rendering);
+    }
+    double timedNs = benchReport("metrics.timed", BENCH_METRIC_EVENTS, start);
+    start = benchStart();
+    for (long i = 0; i < BENCH_METRIC_EVENTS; i++) {
+        monotonicNs();
+    }
+    double clockNs = benchReport("metrics.clock", BENCH_METRIC_EVENTS, start);
+    int failed = traceOpen("/dev/null") != 0;
+    start = benchStart();
+    for (long i = 0; i < BENCH_METRIC_EVENTS && !failed; i++) {
+        TRACE_SPAN("bench", TRACE_START());
+    }
+    failed |= traceClose() != 0;
+    double spanNs = benchReport("metrics.span", BENCH_METRIC_EVENTS, start);
+
+    // The top of the bucket a quantile falls in is never below the exact
+    // value and at most 12.5% above it
+    double worst = 0;
+    for (int i = 0; i < BENCH_METRIC_VALUES; i++) {
+        histogramRecord(histogram, values[i], 1);
+    }
+    qsort(values, BENCH_METRIC_VALUES, sizeof(uint64_t), benchCompareValues);
+    const double quantiles[] = {0.01, 0.5, 0.9, 0.99, 0.999, 1};
+    for (int q = 0; q < 6; q++) {
+        uint64_t exact = values[(long)(quantiles[q] * BENCH_METRIC_VALUES + 0.999999) - 1];
+        uint64_t kept = histogramQuantile(histogram, quantiles[q]);
+        double error = kept < exact ? 1 : exact > 0 ? (double)(kept - exact) / exact : kept > 0;
+        worst = error > worst ? error : worst;
+    }
+
+    printf("metrics: counter %5.1f ns, histogram %5.1f ns, sampled timing %5.1f ns, traced span %5.1f ns "
+           "with %5.1f ns a clock read   (quantiles within %.1f%%)\n",
+           countNs, recordNs, timedNs, spanNs, clockNs, 100 * worst);
+    free(values);
+    free(histogram);
+    if (failed || worst > 1.0 / HISTOGRAM_SUB_BUCKETS) {
+        fprintf(stderr, "bench: %s\n", failed ? "could not trace to /dev/null" : "histogram quantiles are off");
+        return -1;
+    }
+    if (countNs > BENCH_METRIC_NS || recordNs > BENCH_METRIC_NS || timedNs > BENCH_METRIC_NS
+        || spanNs - 2 * clockNs > BENCH_METRIC_NS) {
+        fprintf(stderr, "bench: instrumentation takes more than %d ns an event\n", BENCH_METRIC_NS);
+        return -1;
+    }
+    return 0;
+}
+
+// Plays one player's turn of the checkpoint run, its answers BENCH_CHECKPOINT_ANSWER_MS
+// apart, stopping after the given number of answers. Returns the score.
+static int benchCheckpointTurn(const QuestionBank *bank, const uint32_t quiz[], Checkpoint *checkpoint,
+                               int player, int answers, long long *nowMs) {
+    QuizSession session;
+    sessionStart(&session, bank, quiz, QUIZ_SIZE, *nowMs, TEST_DURATION * 1000LL);
+    if (checkpoint != NULL) {
+        checkpoint->player = player;
+        checkpoint->progress.state = CHECKPOINT_WAITING;
+        sessionCheckpoint(&session, checkpoint);
+    }
+    for (int q = 0; q < answers && session.state == SESSION_ASKING; q++) {
+        *nowMs += BENCH_CHECKPOINT_ANSWER_MS;
+        sessionAnswer(&session, (player + q) % 4 + 1, *nowMs);
+    }
+    return session.score;
+}
+
+// Keeps a game of BENCH_CHECKPOINT_PLAYERS players in a checkpoint: writing
+// it when the game starts, answering with and without each answer written
+// to it, and picking it up again. The game that is picked up is left by a
+// child that plays half the turns and dies part way through the next one;
+// it has to come back with every result and the unfinished turn intact,
+// within BENCH_RESUME_MS.
+int benchCheckpoint() {
+    const char *path = "/tmp/mindmatch-bench.checkpoint";
+    QuestionBank bank;
+    size_t imageSize = 0;
+    unsigned char *image = benchGameBank(&bank, &imageSize);
+    QuestionView view;
+    if (image == NULL || loadQuestions(&bank, 2, 0, &view) != 0) {
+        free(image);
+        return -1;
+    }
+    Random rng;
+    randomSeed(&rng, 15, 0);
+    uint32_t quiz[QUIZ_SIZE];
+    drawQuiz(&view, quiz, QUIZ_SIZE, &rng);
+    Roster roster;
+    if (rosterCreate(&roster, BENCH_CHECKPOINT_PLAYERS) != 0) {
+        freeQuestionView(&view);
+        free(image);
+        return -1;
+    }
+    for (int i = 0; i < BENCH_CHECKPOINT_PLAYERS; i++) {
+        snprintf(roster.players[i].name, NAME_LENGTH, "Player %d", i + 1);
+    }
+
+    Checkpoint checkpoint;
+    remove(path);
+    BenchMark start = benchStart();
+    int failed = checkpointStart(&checkpoint, path, &bank, &roster, 2, quiz, QUIZ_SIZE, &rng) != 0;
+    double startNs = benchReport("checkpoint.start", 1, start);
+    long long nowMs = 0;
+    start = benchStart();
+    for (int i = 0; i < BENCH_CHECKPOINT_TURNS && !failed; i++) {
+        benchCheckpointTurn(&bank, quiz, NULL, i, QUIZ_SIZE, &nowMs);
+    }
+    double plainNs = benchReport("checkpoint.answer_plain", (long long)BENCH_CHECKPOINT_TURNS * QUIZ_SIZE, start);
+    start = benchStart();
+    for (int i = 0; i < BENCH_CHECKPOINT_TURNS && !failed; i++) {
+        benchCheckpointTurn(&bank, quiz, &checkpoint, i, QUIZ_SIZE, &nowMs);
+    }
+    double keptNs = benchReport("checkpoint.answer", (long long)BENCH_CHECKPOINT_TURNS * QUIZ_SIZE, start);
+    failed |= checkpoint.failed;
+    if (!failed) {
+        checkpointFinish(&checkpoint);
+    }
+
+    // A copy of bench plays half the turns, and part of the next, then dies
+    // without a word
+    int half = BENCH_CHECKPOINT_PLAYERS / 2, answered = QUIZ_SIZE / 2;
+    fflush(stdout);
+    pid_t child = failed ? -1 : fork();
+    if (child == 0) {
+        if (checkpointStart(&checkpoint, path, &bank, &roster, 2, quiz, QUIZ_SIZE, &rng) != 0) {
+            _exit(1);
+        }
+        for (int i = 0; i <= half; i++) {
+            benchCheckpointTurn(&bank, quiz, &checkpoint, i, i < half ? QUIZ_SIZE : answered, &nowMs);
+        }
+        _exit(checkpoint.failed);
+    }
+    int status = 0;
+    failed = failed || child < 0 || waitpid(child, &status, 0) != child || status != 0;
+
+    CheckpointHeader header;
+    Roster resumed;
+    start = benchStart();
+    failed = failed || checkpointResume(&checkpoint, path, &bank, &header, &resumed) != 0;
+    double resumeNs = benchReport("checkpoint.resume", 1, start);
+    int lost = 0;
+    if (!failed) {
+        long long replayMs = 0;
+        for (int i = 0; i < half; i++) {
+            lost += resumed.players[i].score != benchCheckpointTurn(&bank, quiz, NULL, i, QUIZ_SIZE, &replayMs)
+                 || strcmp(resumed.players[i].name, roster.players[i].name) != 0;
+        }
+        lost += checkpoint.player != half || checkpoint.progress.state != CHECKPOINT_PLAYING
+             || checkpoint.progress.answered != answered
+             || checkpoint.progress.score != benchCheckpointTurn(&bank, quiz, NULL, half, answered, &replayMs)
+             || header.numPlayers != BENCH_CHECKPOINT_PLAYERS || memcmp(header.quiz, quiz, sizeof(quiz)) != 0;
+        checkpointFinish(&checkpoint);
+        rosterRelease(&resumed);
+    }
+    remove(path);
+
+    printf("checkpoint: %d players   written in %.1f ms, answer %.0f ns with it and %.0f ns without, "
+           "picked up in %.2f ms\n",
+           BENCH_CHECKPOINT_PLAYERS, startNs / 1e6, keptNs, plainNs, resumeNs / 1e6);
+    rosterRelease(&roster);
+    freeQuestionView(&view);
+    free(image);
+    if (failed || lost != 0) {
+        fprintf(stderr, "bench: the checkpoint %s\n", failed ? "could not be written or read back" : "lost results");
+        return -1;
+    }
+    if (resumeNs > BENCH_RESUME_MS * 1e6) {
+        fprintf(stderr, "bench: picking up a game of %d players takes more than %d ms\n",
+                BENCH_CHECKPOINT_PLAYERS, BENCH_RESUME_MS);
+        return -1;
+    }
+    return 0;
+}
+
+// Mappings the process has whose name holds the text, from /proc/self/maps
+static int benchMappings(const char *name) {
+    FILE *maps = fopen("/proc/self/maps", "r");
+    char line[1024];
+    int count = 0;
+    while (maps != NULL && fgets(line, sizeof(line), maps) != NULL) {
+        count += strstr(line, name) != NULL;
+    }
+    if (maps != NULL) fclose(maps);
+    return count;
+}
+
+// Reloads the game's bank from a file over and over as a server does when
+// the file is replaced, while one quiz keeps the first version, and times
+// what a quiz pays to hold the version it was drawn from. The held version
+// has to stay readable through every reload and through the file being
+// cut short in place, which must not load, and every other version has to
+// be unmapped as soon as nothing holds it.
+int benchReload() {
+    const char *path = "/tmp/mindmatch-bench.bank";
+    QuestionBank bank;
+    size_t imageSize = 0;
+    unsigned char *image = benchGameBank(&bank, &imageSize);
+    if (image == NULL) {
+        return -1;
+    }
+    FILE *out = fopen(path, "wb");
+    int failed = out == NULL || fwrite(image, 1, imageSize, out) != imageSize;
+    failed |= out != NULL && fclose(out) != 0;
+    free(image);
+    BankSnapshot *current = failed ? NULL : snapshotOpen(path, 0);
+    if (current == NULL) {
+        fprintf(stderr, "bench: cannot open the bank written to %s\n", path);
+        remove(path);
+        return -1;
+    }
+
+    // A running quiz holds the first version through every reload
+    BankSnapshot *held = snapshotAcquire(current);
+    char firstQuestion[MAX_QUESTION_LENGTH + 1];
+    QuestionText scratch;
+    snprintf(firstQuestion, sizeof(firstQuestion), "%s", bankQuestion(&held->bank, 0, &scratch).question);
+    BenchMark start = benchStart();
+    for (int i = 0; i < BENCH_RELOADS && !failed; i++) {
+        BankSnapshot *snapshot = snapshotOpen(path, 0);
+        failed = snapshot == NULL;
+        if (!failed) {
+            snapshot->version = current->version + 1;
+            snapshotRelease(current);
+            current = snapshot;
+        }
+    }
+    double reloadNs = benchReport("reload.swap", BENCH_RELOADS, start);
+    int mappedWhileHeld = benchMappings(BANK_COPY_NAME);
+    failed |= truncate(path, (off_t)(imageSize / 2)) != 0;
+    BankSnapshot *cut = failed ? NULL : snapshotOpen(path, 0);
+    if (cut != NULL) {
+        snapshotRelease(cut);
+        failed = 1;
+    }
+
+    Random rng;
+    randomSeed(&rng, 16, 0);
+    long long drawn = 0;
+    start = benchStart();
+    for (int i = 0; i < BENCH_RELOAD_QUIZZES; i++) {
+        uint32_t quiz[QUIZ_SIZE];
+        BankSnapshot *snapshot = snapshotAcquire(current);
+        drawn += drawQuiz(&snapshot->views[i % CATEGORY_COUNT], quiz, QUIZ_SIZE, &rng);
+        snapshotRelease(snapshot);
+    }
+    double quizNs = benchReport("reload.quiz", BENCH_RELOAD_QUIZZES, start);
+
+    int intact = strcmp(bankQuestion(&held->bank, 0, &scratch).question, firstQuestion) == 0;
+    uint32_t version = current->version;
+    snapshotRelease(held);
+    int mappedAfter = benchMappings(BANK_COPY_NAME);
+    snapshotRelease(current);
+    int mappedAtEnd = benchMappings(BANK_COPY_NAME);
+    remove(path);
+
+    printf("reload: %d versions of %u questions   swap %5.1f us, draw a quiz holding its version %5.1f ns   "
+           "(%d, %d and %d mappings)\n",
+           version, bank.count, reloadNs / 1000, quizNs, mappedWhileHeld, mappedAfter, mappedAtEnd);
+    if (failed || !intact || drawn != (long long)BENCH_RELOAD_QUIZZES * QUIZ_SIZE) {
+        fprintf(stderr, "bench: a reload failed, a cut short file loaded or the held version changed under its quiz\n");
+        return -1;
+    }
+    if (mappedWhileHeld != 2 || mappedAfter != 1 || mappedAtEnd != 0) {
+        fprintf(stderr, "bench: versions of the bank were not unmapped once nothing held them\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Builds a bank of a million questions made up by the generators, the kind
+// of templated text a big bank is full of, then times compressing its text
+// and decoding questions one at a time in random order, and checks every
+// decoded question against the text it was built from
+int benchCompress() {
+    static char options[4][MAX_LINE_LENGTH];
+    BankBuilder builder;
+    memset(&builder, 0, sizeof(builder));
+    int failed = 0;
+    for (uint32_t i = 0; i < BENCH_COMPRESS_SIZE && !failed; i++) {
+        GeneratedQuestion g;
+        generateQuestion(GENERATED_ID | (i % GENERATOR_COUNT) << GENERATED_SEED_BITS | i / GENERATOR_COUNT, &g);
+        for (int k = 0; k < 4; k++) {
+            snprintf(options[k], sizeof(options[k]), "%s", g.options[k]);
+        }
+        failed = addBuiltQuestion(&builder, g.text, options, g.question.correctOption, 1, g.difficulty) != 0;
+    }
+
+    BenchMark start = benchStart();
+    size_t imageSize = 0;
+    unsigned char *image = failed ? NULL : serializeBank(&builder, &imageSize);
+    double buildNs = benchReport("compress.build", BENCH_COMPRESS_SIZE, start);
+    QuestionBank bank;
+    uint32_t *order = malloc(BENCH_COMPRESS_SIZE * sizeof(uint32_t));
+    if (image == NULL || order == NULL || attachQuestionBank(&bank, image, imageSize) != 0) {
+        fprintf(stderr, "bench: cannot build a bank of %d questions\n", BENCH_COMPRESS_SIZE);
+        free(image);
+        free(order);
+        freeBankBuilder(&builder);
+        return -1;
+    }
+
+    // Random order, so each question's strings are decoded from cold memory as a quiz would
+    Random rng;
+    randomSeed(&rng, 17, 0);
+    for (uint32_t i = 0; i < BENCH_COMPRESS_SIZE; i++) {
+        uint32_t j = randomBelow(&rng, i + 1);
+        order[i] = order[j];
+        order[j] = i;
+    }
+    QuestionText scratch;
+    unsigned long checksum = 0;
+    start = benchStart();
+    for (uint32_t i = 0; i < BENCH_COMPRESS_SIZE; i++) {
+        Question q = bankQuestion(&bank, order[i], &scratch);
+        checksum += (unsigned char)q.question[0] + (unsigned char)q.options[3][0];
+    }
+    double decodeNs = benchReport("compress.decode", BENCH_COMPRESS_SIZE, start);
+
+    long wrong = 0;
+    for (uint32_t i = 0; i < BENCH_COMPRESS_SIZE; i++) {
+        Question q = bankQuestion(&bank, i, &scratch);
+        int same = strcmp(q.question, builder.blob.data + builder.text[i]) == 0;
+        for (int k = 0; k < 4; k++) {
+            same &= strcmp(q.options[k], builder.blob.data + builder.optionSets[builder.optionSet[i]][k]) == 0;
+        }
+        wrong += !same;
+    }
+    size_t packed = bank.stringsSize + 8 + 4 * (size_t)bank.phraseCount + bank.phraseOffsets[bank.phraseCount];
+    printf("compress: %d questions, text %zu -> %zu bytes (%.2fx with %u phrases), image %.1f bytes per question   "
+           "build %.2f us, decode %.0f ns per question (checksum %lu)\n",
+           BENCH_COMPRESS_SIZE, builder.blob.size, packed, (double)builder.blob.size / packed, bank.phraseCount,
+           (double)imageSize / BENCH_COMPRESS_SIZE, buildNs / 1000, decodeNs, checksum);
+    free(image);
+    free(order);
+    freeBankBuilder(&builder);
+    if (wrong != 0) {
+        fprintf(stderr, "bench: %ld questions decoded differently from the text they were built from\n", wrong);
+        return -1;
+    }
+    return 0;
+}
+
+// Writes every result as JSON, one benchmark a line
+static int writeBenchResults(const char *path) {
+    FILE *out = fopen(path, "w");
+    if (out == NULL) {
+        fprintf(stderr, "bench: cannot create '%s'\n", path);
+        return -1;
+    }
+    fprintf(out, "{\"benchmarks\": [\n");
+    for (int i = 0; i < benchResultCount; i++) {
+        const BenchResult *result = &benchResults[i];
+        fprintf(out, "  {\"name\": \"%s\", \"ops\": %lld, \"ns_per_op\": %.3f, \"allocations_per_op\": %.6f, "
+                     "\"peak_rss_kb\": %ld}%s\n",
+                result->name, result->ops, result->nsPerOp, result->allocationsPerOp, result->peakRssKb,
+                i + 1 < benchResultCount ? "," : "");
+    }
+    fprintf(out, "]}\n");
+    if (fclose(out) != 0) {
+        fprintf(stderr, "bench: cannot write '%s'\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// Whether a result is more than the tolerance worse than its baseline, once
+// differences below slack, which noise alone can make, are let through
+static int benchWorse(double current, double baseline, double tolerance, double slack) {
+    return current > baseline * (1 + tolerance) + slack;
+}
+
+// Compares every result with the one of the same name in a file written
+// with --json, and reports those that got worse
+static int compareBaseline(const char *path, double tolerance) {
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        fprintf(stderr, "bench: cannot open baseline '%s'\n", path);
+        return -1;
+    }
+    char line[512];
+    int compared = 0, worse = 0;
+    while (fgets(line, sizeof(line), in) != NULL) {
+        BenchResult base;
+        if (sscanf(line, " {\"name\": \"%47[^\"]\", \"ops\": %lld, \"ns_per_op\": %lf, \"allocations_per_op\": %lf, "
+                         "\"peak_rss_kb\": %ld", base.name, &base.ops, &base.nsPerOp, &base.allocationsPerOp,
+                   &base.peakRssKb) != 5) {
+            continue;
+        }
+        for (int i = 0; i < benchResultCount; i++) {
+            const BenchResult *result = &benchResults[i];
+            if (strcmp(result->name, base.name) != 0) {
+                continue;
+            }
+            compared++;
+            if (benchWorse(result->nsPerOp, base.nsPerOp, tolerance, 1)) {
+                printf("slower: %-24s %10.1f ns/op, baseline %10.1f (%+.0f%%)\n", result->name,
+                       result->nsPerOp, base.nsPerOp, (result->nsPerOp / base.nsPerOp - 1) * 100);
+                worse++;
+            }
+            if (benchWorse(result->allocationsPerOp, base.allocationsPerOp, tolerance, 0.001)) {
+                printf("more allocations: %-14s %10.3f /op, baseline %10.3f\n", result->name,
+                       result->allocationsPerOp, base.allocationsPerOp);
+                worse++;
+            }
+            if (benchWorse((double)result->peakRssKb, (double)base.peakRssKb, tolerance, 1024)) {
+                printf("more memory: %-19s %10ld kB, baseline %10ld kB\n", result->name,
+                       result->peakRssKb, base.peakRssKb);
+                worse++;
+            }
+        }
+    }
+    fclose(in);
+    printf("baseline: %d results compared with %s, %d worse by more than %.0f%%\n",
+           compared, path, worse, tolerance * 100);
+    return worse == 0 ? 0 : -1;
+}
+
+// The runs bench can do, by the names they are picked with
+typedef struct {
+    const char *name;
+    int (*run)();
+} BenchGroup;
+
+static const BenchGroup benchGroups[] = {
+    {"timers", benchTimers}, {"ranking", benchRanking}, {"draw", benchDraw}, {"query", benchQuery},
+    {"duplicates", benchDuplicates}, {"generators", benchGenerators}, {"journal", benchJournal},
+    {"analytics", benchAnalytics}, {"norms", benchNorms}, {"adaptive", benchAdaptive},
+    {"exposures", benchExposures}, {"load", benchLoad}, {"select", benchSelect}, {"ask", benchAsk},
+    {"play", benchPlay}, {"metrics", benchMetrics}, {"checkpoint", benchCheckpoint}, {"reload", benchReload},
+    {"compress", benchCompress}
+};
+#define BENCH_GROUPS (int)(sizeof(benchGroups) / sizeof(benchGroups[0]))
+
+int main(int argc, char *argv[]) {
+    const char *jsonPath = NULL;
+    const char *baselinePath = NULL;
+    double tolerance = BENCH_TOLERANCE;
+    int repeats = 1;
+    int picked[BENCH_GROUPS] = {0};
+    int pickedAny = 0;
+    for (int i = 1; i < argc; i++) {
+        int group = -1;
+        for (int g = 0; g < BENCH_GROUPS && argv[i][0] != '-'; g++) {
+            if (strcmp(argv[i], benchGroups[g].name) == 0) {
+                group = g;
+            }
+        }
+        if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baselinePath = argv[++i];
+        } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+            tolerance = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            repeats = atoi(argv[++i]);
+        } else if (group >= 0) {
+            picked[group] = 1;
+            pickedAny = 1;
+        } else {
+            fprintf(stderr, "Usage: %s [--json file] [--baseline file] [--tolerance share] [--repeat n]\n"
+                            "             [group ...]\n"
+                            "Groups:", argv[0]);
+            for (int g = 0; g < BENCH_GROUPS; g++) {
+                fprintf(stderr, " %s", benchGroups[g].name);
+            }
+            fprintf(stderr, "\n");
+            return 2;
+        }
+    }
+
+    int failed = 0;
+    for (int r = 0; r < repeats; r++) {
+        for (int g = 0; g < BENCH_GROUPS; g++) {
+            if (!pickedAny || picked[g]) {
+                failed |= benchGroups[g].run() != 0;
+            }
+        }
+    }
+    if (jsonPath != NULL) {
+        failed |= writeBenchResults(jsonPath) != 0;
+    }
+    if (baselinePath != NULL) {
+        failed |= compareBaseline(baselinePath, tolerance) != 0;
+    }
+    return failed ? 1 : 0;
+}